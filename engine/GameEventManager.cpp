@@ -14,6 +14,7 @@
 #include "server.h"
 #include "client.h"
 #include "tier0/vprof.h"
+#include "tier1/memstack.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -41,66 +42,345 @@ static ConVar net_showevents( "net_showevents", "0", FCVAR_CHEAT, "Dump game eve
 
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR( CGameEventManager, IGameEventManager2, INTERFACEVERSION_GAMEEVENTSMANAGER2, s_GameEventManager );
 
+//-----------------------------------------------------------------------------
+// CGameEventDescriptor
+//-----------------------------------------------------------------------------
+void CGameEventDescriptor::CompileFields()
+{
+	fields.RemoveAll();
+
+	if ( !keys )
+		return;
+
+	for ( KeyValues *key = keys->GetFirstSubKey(); key; key = key->GetNextKey() )
+	{
+		GameEventField_t &field = fields[ fields.AddToTail() ];
+		field.name = key->GetName();
+		field.type = key->GetInt();
+	}
+}
+
+int CGameEventDescriptor::FindField( const char *keyName, int nHint ) const
+{
+	if ( !keyName )
+		return -1;
+
+	// key names are case insensitive, like KeyValues
+	if ( nHint >= 0 && nHint < fields.Count() && !Q_stricmp( fields[nHint].name, keyName ) )
+		return nHint;
+
+	for ( int i = 0; i < fields.Count(); i++ )
+	{
+		if ( !Q_stricmp( fields[i].name, keyName ) )
+			return i;
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// CGameEvent
+//-----------------------------------------------------------------------------
+DEFINE_FIXEDSIZE_ALLOCATOR_MT( CGameEvent, 64, CUtlMemoryPool::GROW_SLOW );
+
 CGameEvent::CGameEvent( CGameEventDescriptor *descriptor )
 {
 	Assert( descriptor );
 	m_pDescriptor = descriptor;
-	m_pDataKeys = new KeyValues( descriptor->name );
+	m_nFields = descriptor->fields.Count();
+	m_nLastField = -1;
+	m_pExtraKeys = NULL;
+	m_pDataKeys = NULL;
+	m_pSerialized = NULL;
+	m_nSerializedBits = 0;
+	m_nSerializedGeneration = 0;
+	m_nStringBytes = 0;
+
+	m_pValues = ( m_nFields <= INLINE_FIELDS ) ? m_InlineValues : new GameEventValue_t[m_nFields];
+	for ( int i = 0; i < m_nFields; i++ )
+	{
+		m_pValues[i].type = GameEventValue_t::TYPE_EMPTY;
+		m_pValues[i].pszFormatted = NULL;
+	}
 }
 
 CGameEvent::~CGameEvent()
 {
-	m_pDataKeys->deleteThis();
+	if ( m_pValues != m_InlineValues )
+	{
+		delete [] m_pValues;
+	}
+
+	for ( int i = 0; i < m_HeapStrings.Count(); i++ )
+	{
+		delete [] m_HeapStrings[i];
+	}
+
+	if ( m_pExtraKeys )
+	{
+		m_pExtraKeys->deleteThis();
+	}
+
+	InvalidateDataKeys();
+}
+
+int CGameEvent::FindField( const char *keyName )
+{
+	// the descriptor may have been reloaded since this event was created
+	int nField = m_pDescriptor->FindField( keyName, m_nLastField + 1 );
+	if ( nField < 0 || nField >= m_nFields )
+		return -1;
+
+	m_nLastField = nField;
+	return nField;
+}
+
+KeyValues *CGameEvent::GetExtraKeys()
+{
+	if ( !m_pExtraKeys )
+	{
+		m_pExtraKeys = new KeyValues( m_pDescriptor->name );
+	}
+	return m_pExtraKeys;
+}
+
+const char *CGameEvent::StoreString( const char *value )
+{
+	int len = Q_strlen( value ) + 1;
+
+	char *pDest;
+	if ( m_nStringBytes + len <= INLINE_STRING_BYTES )
+	{
+		pDest = m_StringData + m_nStringBytes;
+		m_nStringBytes += len;
+	}
+	else
+	{
+		pDest = new char[len];
+		m_HeapStrings.AddToTail( pDest );
+	}
+
+	Q_memcpy( pDest, value, len );
+	return pDest;
+}
+
+void CGameEvent::InvalidateDataKeys()
+{
+	if ( m_pDataKeys )
+	{
+		m_pDataKeys->deleteThis();
+		m_pDataKeys = NULL;
+	}
+
+	m_pSerialized = NULL;
+}
+
+bool CGameEvent::WriteSerializedBits( bf_write *buf )
+{
+	// The arena block goes away at the end of the tick it was made in
+	if ( !m_pSerialized || m_nSerializedGeneration != FrameArenaGeneration( FRAME_ARENA_SERVER_TICK ) )
+		return false;
+
+	buf->WriteBits( m_pSerialized, m_nSerializedBits );
+	return true;
+}
+
+void CGameEvent::SetSerializedBits( const void *pData, int nBits )
+{
+	m_nSerializedGeneration = FrameArenaGeneration( FRAME_ARENA_SERVER_TICK );
+	m_pSerialized = FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, ( nBits + 7 ) >> 3 );
+	if ( m_pSerialized )
+	{
+		Q_memcpy( m_pSerialized, pData, ( nBits + 7 ) >> 3 );
+		m_nSerializedBits = nBits;
+	}
+}
+
+int CGameEvent::GetFieldInt( int nField, int defaultValue )
+{
+	if ( nField >= m_nFields )
+		return defaultValue;
+
+	const GameEventValue_t &value = m_pValues[nField];
+	switch ( value.type )
+	{
+	case GameEventValue_t::TYPE_INT:	return value.iValue;
+	case GameEventValue_t::TYPE_FLOAT:	return (int)value.flValue;
+	case GameEventValue_t::TYPE_STRING:	return atoi( value.pszValue );
+	default:							return defaultValue;
+	}
+}
+
+float CGameEvent::GetFieldFloat( int nField, float defaultValue )
+{
+	if ( nField >= m_nFields )
+		return defaultValue;
+
+	const GameEventValue_t &value = m_pValues[nField];
+	switch ( value.type )
+	{
+	case GameEventValue_t::TYPE_INT:	return (float)value.iValue;
+	case GameEventValue_t::TYPE_FLOAT:	return value.flValue;
+	case GameEventValue_t::TYPE_STRING:	return (float)atof( value.pszValue );
+	default:							return defaultValue;
+	}
+}
+
+const char *CGameEvent::GetFieldString( int nField, const char *defaultValue )
+{
+	if ( nField >= m_nFields )
+		return defaultValue;
+
+	// Numbers are formatted once per value set, later reads return the same string
+	GameEventValue_t &value = m_pValues[nField];
+	char buf[64];
+	switch ( value.type )
+	{
+	case GameEventValue_t::TYPE_INT:
+		if ( !value.pszFormatted )
+		{
+			Q_snprintf( buf, sizeof( buf ), "%d", value.iValue );
+			value.pszFormatted = StoreString( buf );
+		}
+		return value.pszFormatted;
+	case GameEventValue_t::TYPE_FLOAT:
+		if ( !value.pszFormatted )
+		{
+			Q_snprintf( buf, sizeof( buf ), "%f", value.flValue );
+			value.pszFormatted = StoreString( buf );
+		}
+		return value.pszFormatted;
+	case GameEventValue_t::TYPE_STRING:
+		return value.pszValue;
+	default:
+		return defaultValue;
+	}
+}
+
+void CGameEvent::SetFieldInt( int nField, int value )
+{
+	InvalidateDataKeys();
+	m_pValues[nField].type = GameEventValue_t::TYPE_INT;
+	m_pValues[nField].iValue = value;
+	m_pValues[nField].pszFormatted = NULL;
+}
+
+void CGameEvent::SetFieldFloat( int nField, float value )
+{
+	InvalidateDataKeys();
+	m_pValues[nField].type = GameEventValue_t::TYPE_FLOAT;
+	m_pValues[nField].flValue = value;
+	m_pValues[nField].pszFormatted = NULL;
+}
+
+void CGameEvent::SetFieldString( int nField, const char *value )
+{
+	InvalidateDataKeys();
+	m_pValues[nField].type = GameEventValue_t::TYPE_STRING;
+	m_pValues[nField].pszValue = StoreString( value ? value : "" );
+	m_pValues[nField].pszFormatted = NULL;
 }
 
 bool CGameEvent::GetBool( const char *keyName, bool defaultValue)
 {
-	return m_pDataKeys->GetInt( keyName, defaultValue ) != 0;
+	return GetInt( keyName, defaultValue ) != 0;
 }
 
 int CGameEvent::GetInt( const char *keyName, int defaultValue)
 {
-	return m_pDataKeys->GetInt( keyName, defaultValue );
+	int nField = FindField( keyName );
+	if ( nField < 0 )
+		return m_pExtraKeys ? m_pExtraKeys->GetInt( keyName, defaultValue ) : defaultValue;
+
+	return GetFieldInt( nField, defaultValue );
 }
 
 float CGameEvent::GetFloat( const char *keyName, float defaultValue )
 {
-	return m_pDataKeys->GetFloat( keyName, defaultValue );
+	int nField = FindField( keyName );
+	if ( nField < 0 )
+		return m_pExtraKeys ? m_pExtraKeys->GetFloat( keyName, defaultValue ) : defaultValue;
+
+	return GetFieldFloat( nField, defaultValue );
 }
 
 const char *CGameEvent::GetString( const char *keyName, const char *defaultValue )
 {
-	return m_pDataKeys->GetString( keyName, defaultValue );
+	int nField = FindField( keyName );
+	if ( nField < 0 )
+		return m_pExtraKeys ? m_pExtraKeys->GetString( keyName, defaultValue ) : defaultValue;
+
+	return GetFieldString( nField, defaultValue );
 }
 
 void CGameEvent::SetBool( const char *keyName, bool value )
 {
-	m_pDataKeys->SetInt( keyName, value?1:0 );
+	SetInt( keyName, value?1:0 );
 }
 
 void CGameEvent::SetInt( const char *keyName, int value )
 {
-	m_pDataKeys->SetInt( keyName, value );
+	int nField = FindField( keyName );
+	if ( nField < 0 )
+	{
+		InvalidateDataKeys();
+		GetExtraKeys()->SetInt( keyName, value );
+		return;
+	}
+
+	SetFieldInt( nField, value );
 }
 
 void CGameEvent::SetFloat( const char *keyName, float value )
 {
-	m_pDataKeys->SetFloat( keyName, value );
+	int nField = FindField( keyName );
+	if ( nField < 0 )
+	{
+		InvalidateDataKeys();
+		GetExtraKeys()->SetFloat( keyName, value );
+		return;
+	}
+
+	SetFieldFloat( nField, value );
 }
 
 void CGameEvent::SetString( const char *keyName, const char *value )
 {
-	m_pDataKeys->SetString( keyName, value );
+	int nField = FindField( keyName );
+	if ( nField < 0 )
+	{
+		InvalidateDataKeys();
+		GetExtraKeys()->SetString( keyName, value );
+		return;
+	}
+
+	SetFieldString( nField, value );
 }
 
 bool CGameEvent::IsEmpty( const char *keyName )
 {
-	return m_pDataKeys->IsEmpty( keyName );
+	if ( !keyName )
+	{
+		// the event itself, empty if nothing was set
+		for ( int i = 0; i < m_nFields; i++ )
+		{
+			if ( m_pValues[i].type != GameEventValue_t::TYPE_EMPTY )
+				return false;
+		}
+
+		return !m_pExtraKeys || m_pExtraKeys->IsEmpty();
+	}
+
+	int nField = FindField( keyName );
+	if ( nField < 0 )
+		return !m_pExtraKeys || m_pExtraKeys->IsEmpty( keyName );
+
+	return m_pValues[nField].type == GameEventValue_t::TYPE_EMPTY;
 }
 
 const char *CGameEvent::GetName() const
 {
-	return m_pDataKeys->GetName();
+	return m_pDescriptor->name;
 }
 
 bool CGameEvent::IsLocal() const
@@ -113,6 +393,98 @@ bool CGameEvent::IsReliable() const
 	return m_pDescriptor->reliable;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Copies all values of another event of the same type
+//-----------------------------------------------------------------------------
+void CGameEvent::CopyFrom( CGameEvent *pOther )
+{
+	Assert( pOther->m_pDescriptor == m_pDescriptor );
+
+	InvalidateDataKeys();
+
+	int nFields = MIN( m_nFields, pOther->m_nFields );
+	for ( int i = 0; i < nFields; i++ )
+	{
+		const GameEventValue_t &value = pOther->m_pValues[i];
+		if ( value.type == GameEventValue_t::TYPE_STRING )
+		{
+			// strings point into the other event's storage
+			SetFieldString( i, value.pszValue );
+		}
+		else
+		{
+			m_pValues[i] = value;
+			m_pValues[i].pszFormatted = NULL;	// points into the other event's storage
+		}
+	}
+
+	if ( m_pExtraKeys )
+	{
+		m_pExtraKeys->deleteThis();
+		m_pExtraKeys = NULL;
+	}
+
+	if ( pOther->m_pExtraKeys )
+	{
+		m_pExtraKeys = pOther->m_pExtraKeys->MakeCopy();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets values from a KeyValues event of the old interface
+//-----------------------------------------------------------------------------
+void CGameEvent::SetFromKeyValues( KeyValues *keys )
+{
+	for ( KeyValues *key = keys->GetFirstSubKey(); key; key = key->GetNextKey() )
+	{
+		switch ( key->GetDataType() )
+		{
+		case KeyValues::TYPE_INT:		SetInt( key->GetName(), key->GetInt() ); break;
+		case KeyValues::TYPE_FLOAT:		SetFloat( key->GetName(), key->GetFloat() ); break;
+		case KeyValues::TYPE_STRING:	SetString( key->GetName(), key->GetString() ); break;
+		default:
+			// nothing the descriptor can hold, keep it as is
+			InvalidateDataKeys();
+			GetExtraKeys()->AddSubKey( key->MakeCopy() );
+			break;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds a KeyValues copy of the event for legacy listeners. It stays
+//  valid until the event is changed or freed.
+//-----------------------------------------------------------------------------
+KeyValues *CGameEvent::GetDataKeys()
+{
+	if ( m_pDataKeys )
+		return m_pDataKeys;
+
+	m_pDataKeys = new KeyValues( m_pDescriptor->name );
+
+	for ( int i = 0; i < m_nFields; i++ )
+	{
+		const char *keyName = m_pDescriptor->fields[i].name;
+		const GameEventValue_t &value = m_pValues[i];
+		switch ( value.type )
+		{
+		case GameEventValue_t::TYPE_INT:	m_pDataKeys->SetInt( keyName, value.iValue ); break;
+		case GameEventValue_t::TYPE_FLOAT:	m_pDataKeys->SetFloat( keyName, value.flValue ); break;
+		case GameEventValue_t::TYPE_STRING:	m_pDataKeys->SetString( keyName, value.pszValue ); break;
+		}
+	}
+
+	if ( m_pExtraKeys )
+	{
+		for ( KeyValues *key = m_pExtraKeys->GetFirstSubKey(); key; key = key->GetNextKey() )
+		{
+			m_pDataKeys->AddSubKey( key->MakeCopy() );
+		}
+	}
+
+	return m_pDataKeys;
+}
+
 CGameEventManager::CGameEventManager()
 {
 	Reset();
@@ -258,6 +630,8 @@ bool CGameEventManager::ParseEventList(SVC_GameEventList *msg)
 			datatype = msg->m_DataIn.ReadUBitLong( 3 );
 		}
 
+		descriptor->CompileFields();
+
 		descriptor->eventid = id;
 	}
 
@@ -350,14 +724,9 @@ IGameEvent *CGameEventManager::DuplicateEvent( IGameEvent *event )
 	if ( !gameEvent )
 		return NULL;
 
-	// create new instance
+	// create new instance and make copy
 	CGameEvent *newEvent = new CGameEvent ( gameEvent->m_pDescriptor );
-
-	// free keys
-	newEvent->m_pDataKeys->deleteThis();
-
-	// and make copy
-	newEvent->m_pDataKeys = gameEvent->m_pDataKeys->MakeCopy();
+	newEvent->CopyFrom( gameEvent );
 
 	return newEvent;
 }
@@ -369,13 +738,11 @@ void CGameEventManager::ConPrintEvent( IGameEvent *event)
 	if ( !descriptor )
 		return;
 
-	KeyValues *key = descriptor->keys->GetFirstSubKey(); 
-
-	while ( key )
+	for ( int i = 0; i < descriptor->fields.Count(); i++ )
 	{
-		const char * keyName = key->GetName();
+		const char * keyName = descriptor->fields[i].name;
 
-		int type = key->GetInt();
+		int type = descriptor->fields[i].type;
 
 		switch ( type )
 		{
@@ -384,7 +751,6 @@ void CGameEventManager::ConPrintEvent( IGameEvent *event)
 		case TYPE_FLOAT : ConMsg( "- \"%s\" = \"%.2f\"\n", keyName, event->GetFloat(keyName) ); break;
 		default: ConMsg( "- \"%s\" = \"%i\"\n", keyName, event->GetInt(keyName) ); break;
 		}
-		key = key->GetNextKey();
 	}
 }
 
@@ -446,8 +812,6 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 		if ( listener->m_nListenerType == CLIENTSTUB && (bServerOnly || bClientOnly) )
 			continue;
 
-		// TODO optimized the serialize event for clients, call only once and not per client
-
 		// fire event in this listener module
 		if ( listener->m_nListenerType == CLIENTSIDE_OLD ||
 			 listener->m_nListenerType == SERVERSIDE_OLD )
@@ -458,7 +822,7 @@ bool CGameEventManager::FireEventIntern( IGameEvent *event, bool bServerOnly, bo
 			IGameEventListener *pCallback = static_cast<IGameEventListener*>(listener->m_pCallback);
 			CGameEvent *pEvent = static_cast<CGameEvent*>(event);
 
-			pCallback->FireGameEvent( pEvent->m_pDataKeys );
+			pCallback->FireGameEvent( pEvent->GetDataKeys() );
 		}
 		else
 		{
@@ -483,22 +847,30 @@ bool CGameEventManager::SerializeEvent( IGameEvent *event, bf_write* buf )
 
 	Assert( descriptor );
 
-	buf->WriteUBitLong( descriptor->eventid, MAX_EVENT_BITS );
+	CGameEvent *gameEvent = static_cast<CGameEvent*>( event );
 
-	// now iterate trough all fields described in gameevents.res and put them in the buffer
+	// Every client stub listener serializes the same event, only the first one
+	// has to walk the fields
+	if ( gameEvent->WriteSerializedBits( buf ) )
+		return !buf->IsOverflowed();
+
+	char eventData[MAX_EVENT_BYTES];
+	bf_write eventBuf( "CGameEventManager::SerializeEvent", eventData, sizeof( eventData ) );
 
-	KeyValues * key = descriptor->keys->GetFirstSubKey();
+	eventBuf.WriteUBitLong( descriptor->eventid, MAX_EVENT_BITS );
+
+	// now iterate trough all fields described in gameevents.res and put them in the buffer
 
 	if ( net_showevents.GetInt() > 2 )
 	{
 		DevMsg("Serializing event '%s' (%i):\n", descriptor->name, descriptor->eventid );
 	}
 	
-	while ( key )
+	for ( int i = 0; i < descriptor->fields.Count(); i++ )
 	{
-		const char * keyName = key->GetName();
+		const char * keyName = descriptor->fields[i].name;
 
-		int type = key->GetInt();
+		int type = descriptor->fields[i].type;
 
 		if ( net_showevents.GetInt() > 2 )
 		{
@@ -512,18 +884,22 @@ bool CGameEventManager::SerializeEvent( IGameEvent *event, bf_write* buf )
 		switch ( type )
 		{
 			case TYPE_LOCAL : break; // don't network this guy
-			case TYPE_STRING: buf->WriteString( event->GetString( keyName, "") ); break;
-			case TYPE_FLOAT : buf->WriteFloat( event->GetFloat( keyName, 0.0f) ); break;
-			case TYPE_LONG	: buf->WriteLong( event->GetInt( keyName, 0) ); break;
-			case TYPE_SHORT	: buf->WriteShort( event->GetInt( keyName, 0) ); break;
-			case TYPE_BYTE	: buf->WriteByte( event->GetInt( keyName, 0) ); break;
-			case TYPE_BOOL	: buf->WriteOneBit( event->GetInt( keyName, 0) ); break;
-			default: DevMsg(1, "CGameEventManager: unkown type %i for key '%s'.\n", type, key->GetName() ); break;
+			case TYPE_STRING: eventBuf.WriteString( gameEvent->GetFieldString( i, "") ); break;
+			case TYPE_FLOAT : eventBuf.WriteFloat( gameEvent->GetFieldFloat( i, 0.0f) ); break;
+			case TYPE_LONG	: eventBuf.WriteLong( gameEvent->GetFieldInt( i, 0) ); break;
+			case TYPE_SHORT	: eventBuf.WriteShort( gameEvent->GetFieldInt( i, 0) ); break;
+			case TYPE_BYTE	: eventBuf.WriteByte( gameEvent->GetFieldInt( i, 0) ); break;
+			case TYPE_BOOL	: eventBuf.WriteOneBit( gameEvent->GetFieldInt( i, 0) ); break;
+			default: DevMsg(1, "CGameEventManager: unkown type %i for key '%s'.\n", type, keyName ); break;
 		}
-
-		key = key->GetNextKey();
 	}
 
+	if ( eventBuf.IsOverflowed() )
+		return false;
+
+	gameEvent->SetSerializedBits( eventData, eventBuf.GetNumBitsWritten() );
+
+	buf->WriteBits( eventData, eventBuf.GetNumBitsWritten() );
 	return !buf->IsOverflowed();
 }
 
@@ -545,7 +921,7 @@ IGameEvent *CGameEventManager::UnserializeEvent( bf_read *buf)
 	}
 
 	// create new event
-	IGameEvent *event = CreateEvent( descriptor );
+	CGameEvent *event = static_cast<CGameEvent*>( CreateEvent( descriptor ) );
 
 	if ( !event )
 	{
@@ -553,29 +929,23 @@ IGameEvent *CGameEventManager::UnserializeEvent( bf_read *buf)
 		return NULL;
 	}
 
-	KeyValues * key = descriptor->keys->GetFirstSubKey(); 
-
-	while ( key )
+	for ( int i = 0; i < descriptor->fields.Count(); i++ )
 	{
-		const char * keyName = key->GetName();
-
-		int type = key->GetInt();
+		int type = descriptor->fields[i].type;
 
 		switch ( type )
 		{
 			case TYPE_LOCAL		: break; // ignore 
 			case TYPE_STRING	: if ( buf->ReadString( databuf, sizeof(databuf) ) )
-									event->SetString( keyName, databuf );
+									event->SetFieldString( i, databuf );
 								  break;
-			case TYPE_FLOAT		: event->SetFloat( keyName, buf->ReadFloat() ); break;
-			case TYPE_LONG		: event->SetInt( keyName, buf->ReadLong() ); break;
-			case TYPE_SHORT		: event->SetInt( keyName, buf->ReadShort() ); break;
-			case TYPE_BYTE		: event->SetInt( keyName, buf->ReadByte() ); break;
-			case TYPE_BOOL		: event->SetInt( keyName, buf->ReadOneBit() ); break;
-			default: DevMsg(1, "CGameEventManager: unknown type %i for key '%s'.\n", type, key->GetName() ); break;
+			case TYPE_FLOAT		: event->SetFieldFloat( i, buf->ReadFloat() ); break;
+			case TYPE_LONG		: event->SetFieldInt( i, buf->ReadLong() ); break;
+			case TYPE_SHORT		: event->SetFieldInt( i, buf->ReadShort() ); break;
+			case TYPE_BYTE		: event->SetFieldInt( i, buf->ReadByte() ); break;
+			case TYPE_BOOL		: event->SetFieldInt( i, buf->ReadOneBit() ); break;
+			default: DevMsg(1, "CGameEventManager: unknown type %i for key '%s'.\n", type, descriptor->fields[i].name ); break;
 		}
-
-		key = key->GetNextKey();
 	}
 
 	return event;
@@ -821,6 +1191,8 @@ bool CGameEventManager::RegisterEvent( KeyValues * event)
 		
 		subkey = subkey->GetNextKey();
 	}
+
+	descriptor->CompileFields();
 	
 	return true;
 }
@@ -18,6 +18,7 @@
 #include <KeyValues.h>
 #include <networkstringtabledefs.h>
 #include <utlsymbol.h>
+#include <mempool.h>
 
 class SVC_GameEventList;
 class CLC_ListenEvents;
@@ -29,6 +30,13 @@ public:
 	int					m_nListenerType;	// client or server side ?
 };
 
+// One data field of an event, compiled from the descriptor keys
+struct GameEventField_t
+{
+	const char	*name;		// key name, owned by the KeyValues symbol table
+	int			type;		// CGameEventManager::TYPE_*
+};
+
 class CGameEventDescriptor
 {
 public:
@@ -41,15 +49,46 @@ public:
 		reliable = true;
 	}
 
+	void		CompileFields();
+	int			FindField( const char *keyName, int nHint ) const;
+
 public:
 	char		name[MAX_EVENT_NAME_LENGTH];	// name of this event
 	int			eventid;	// network index number, -1 = not networked
 	KeyValues	*keys;		// KeyValue describing data types, if NULL only name 
+	CUtlVector<GameEventField_t>	fields;	// keys in order, event values are stored by field index
 	bool		local;		// local event, never tell clients about that
 	bool		reliable;	// send this event as reliable message
     CUtlVector<CGameEventCallback*>	listeners;	// registered listeners
 };
 
+// A value set on an event. Keeps the type it was set with and converts on read
+// the same way KeyValues does.
+struct GameEventValue_t
+{
+	enum
+	{
+		TYPE_EMPTY = 0,
+		TYPE_INT,
+		TYPE_FLOAT,
+		TYPE_STRING,
+	};
+
+	int		type;
+	union
+	{
+		int			iValue;
+		float		flValue;
+		const char	*pszValue;
+	};
+	const char	*pszFormatted;	// int or float read as a string, made on the first read
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Event data is stored in a value array laid out like the descriptor
+//  fields, so accessors don't build or search a KeyValues tree. Keys that aren't
+//  in the descriptor still work, they go to a KeyValues overflow.
+//-----------------------------------------------------------------------------
 class CGameEvent : public IGameEvent
 {
 public:
@@ -57,6 +96,24 @@ public:
 	CGameEvent( CGameEventDescriptor *descriptor );
 	virtual ~CGameEvent();
 
+	// by descriptor field index, for (un)serializing
+	int   GetFieldInt( int nField, int defaultValue = 0 );
+	float GetFieldFloat( int nField, float defaultValue = 0.0f );
+	const char *GetFieldString( int nField, const char *defaultValue = "" );
+	void  SetFieldInt( int nField, int value );
+	void  SetFieldFloat( int nField, float value );
+	void  SetFieldString( int nField, const char *value );
+
+	void  CopyFrom( CGameEvent *pOther );
+	void  SetFromKeyValues( KeyValues *keys );
+
+	// KeyValues copy of all the data, for legacy listeners. Owned by the event.
+	KeyValues *GetDataKeys();
+
+	// Networked fields as last serialized, kept in the server tick's frame arena
+	bool  WriteSerializedBits( bf_write *buf );
+	void  SetSerializedBits( const void *pData, int nBits );
+
 	const char *GetName() const;
 	bool  IsEmpty(const char *keyName = NULL);
 	bool  IsLocal() const;
@@ -73,7 +130,33 @@ public:
 	void SetString( const char *keyName, const char *value );
 	
 	CGameEventDescriptor	*m_pDescriptor;
-	KeyValues				*m_pDataKeys;
+
+private:
+	enum
+	{
+		INLINE_FIELDS = 16,			// more than any stock event
+		INLINE_STRING_BYTES = 256,
+	};
+
+	int		FindField( const char *keyName );
+	KeyValues *GetExtraKeys();
+	const char *StoreString( const char *value );
+	void	InvalidateDataKeys();
+
+	GameEventValue_t	*m_pValues;			// one per descriptor field
+	int					m_nFields;
+	int					m_nLastField;		// fields are usually set in descriptor order
+	KeyValues			*m_pExtraKeys;		// keys that aren't in the descriptor, NULL if none
+	KeyValues			*m_pDataKeys;		// built by GetDataKeys
+	void				*m_pSerialized;		// set by SetSerializedBits, NULL if stale
+	int					m_nSerializedBits;
+	unsigned			m_nSerializedGeneration;
+	CUtlVector<char *>	m_HeapStrings;		// strings that didn't fit m_StringData
+	int					m_nStringBytes;
+	GameEventValue_t	m_InlineValues[INLINE_FIELDS];
+	char				m_StringData[INLINE_STRING_BYTES];
+
+	DECLARE_FIXEDSIZE_ALLOCATOR_MT( CGameEvent );
 };
 
 class CGameEventManager : public IGameEventManager2
@@ -115,8 +115,8 @@ bool CGameEventManagerOld::FireEventIntern( KeyValues *keys, bool bServerSideOnl
 	if ( !event )
 		return false;
 
-	event->m_pDataKeys->deleteThis();
-	event->m_pDataKeys = keys;
+	event->SetFromKeyValues( keys );
+	keys->deleteThis();
 
 	if ( bClientSideOnly )
 	{
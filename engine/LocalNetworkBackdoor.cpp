@@ -10,6 +10,7 @@
 #include "eiface.h"
 #include "cdll_engine_int.h"
 #include "dt_localtransfer.h"
+#include "sv_main.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -24,25 +25,7 @@ void CLocalNetworkBackdoor::InitFastCopy()
 		return;
 
 
-	const CStandardSendProxies *pSendProxies = NULL;
-
-	// If the game server is greater than v4, then it is using the new proxy format.
-	if ( g_iServerGameDLLVersion >= 5 ) // check server version
-	{
-		pSendProxies = serverGameDLL->GetStandardSendProxies();
-	}
-	else
-	{
-		// If the game server is older than v4, it is using the old proxy; we set the new proxy members to the 
-		// engine's copy.
-		static CStandardSendProxies compatSendProxy = *serverGameDLL->GetStandardSendProxies();
-
-		compatSendProxy.m_DataTableToDataTable = g_StandardSendProxies.m_DataTableToDataTable;
-		compatSendProxy.m_SendLocalDataTable = g_StandardSendProxies.m_SendLocalDataTable;
-		compatSendProxy.m_ppNonModifiedPointerProxies = g_StandardSendProxies.m_ppNonModifiedPointerProxies;
-
-		pSendProxies = &compatSendProxy;
-	} 
+	const CStandardSendProxies *pSendProxies = SV_GetStandardSendProxies();
 
 	const CStandardRecvProxies *pRecvProxies = g_ClientDLL->GetStandardRecvProxies();
 
@@ -66,6 +66,8 @@ CBaseClient::CBaseClient()
 	m_bReportFakeClient = true;
 	m_iTracing = 0;
 	m_bPlayerNameLocked = false;
+	m_bDeferDisconnect = false;
+	m_pszDeferredDisconnect = NULL;
 }
 
 CBaseClient::~CBaseClient()
@@ -254,6 +256,7 @@ void CBaseClient::Clear()
 	m_nForceWaitForTick = -1;
 	m_bFakePlayer = false;
 	m_bIsHLTV = false;
+	m_EntityStaleness.Clear();
 #if defined( REPLAY_ENABLED )
 	m_bIsReplay = false;
 #endif
@@ -1166,6 +1169,8 @@ void CBaseClient::SendSnapshot( CClientFrame *pFrame )
 write_again:
 	bf_write msg( "CBaseClient::SendSnapshot", m_SnapshotScratchBuffer, sizeof( m_SnapshotScratchBuffer ) );
 
+	m_EntityStaleness.BeginSnapshot();
+
 	TRACE_PACKET( ( "SendSnapshot(%d)\n", pFrame->tick_count ) );
 
 	// now create client snapshot packet
@@ -1227,6 +1232,9 @@ write_again:
 	// write message to packet and check for overflow
 	if ( msg.IsOverflowed() )
 	{
+		// nothing in this snapshot reaches the client, so nothing was sent or deferred
+		m_EntityStaleness.Revert();
+
 		bool bWasTracing = IsTracing();
 		if ( bWasTracing )
 		{
@@ -1255,7 +1263,7 @@ write_again:
 			}
 
 			// if this is a reliable snapshot, drop the client
-			Disconnect( "ERROR! Reliable snapshot overflow." );
+			DisconnectFromSnapshot( "ERROR! Reliable snapshot overflow." );
 			return;
 		}
 		else
@@ -1310,7 +1318,34 @@ write_again:
 	}
 	else
 	{
-		Disconnect( "ERROR! Couldn't send snapshot." );
+		DisconnectFromSnapshot( "ERROR! Couldn't send snapshot." );
+	}
+}
+
+void CBaseClient::DisconnectFromSnapshot( const char *pszReason )
+{
+	if ( m_bDeferDisconnect )
+	{
+		// keep the first reason, the client is dropped once the parallel send is done
+		if ( !m_pszDeferredDisconnect )
+		{
+			m_pszDeferredDisconnect = pszReason;
+		}
+		return;
+	}
+
+	Disconnect( "%s", pszReason );
+}
+
+void CBaseClient::ApplyDeferredDisconnect()
+{
+	m_bDeferDisconnect = false;
+
+	if ( m_pszDeferredDisconnect )
+	{
+		const char *pszReason = m_pszDeferredDisconnect;
+		m_pszDeferredDisconnect = NULL;
+		Disconnect( "%s", pszReason );
 	}
 }
 
@@ -22,6 +22,7 @@
 #include "smartptr.h"
 #include "userid.h"
 #include "tier1/bitbuf.h"
+#include "sv_snapshotpriority.h"
 #include "steam/steamclientpublic.h"
 
 // class CClientFrame;
@@ -58,6 +59,8 @@ public:
 };
 
 
+
+
 class CBaseClient : public IGameEventListener2, public IClient, public IClientMessageHandler
 {
 	typedef struct CustomFile_s
@@ -93,6 +96,11 @@ public:
 	virtual	void	Reconnect( void );
 	virtual	void	Disconnect( PRINTF_FORMAT_STRING const char *reason, ... );
 
+	// While snapshots are sent from job threads a failed send can't drop the client
+	// right away; the disconnect is applied later from the main thread.
+	void			SetDeferDisconnect( bool bDefer ) { m_bDeferDisconnect = bDefer; }
+	void			ApplyDeferredDisconnect();
+
 	virtual	void	SetRate( int nRate, bool bForce );
 	virtual	int		GetRate( void ) const;
 	
@@ -188,6 +196,7 @@ public:
 private:	
 
 	void			OnRequestFullUpdate();
+	void			DisconnectFromSnapshot( const char *pszReason );
 
 
 public:
@@ -256,6 +265,9 @@ public:
 
 	bool			m_bFullyAuthenticated;
 
+	bool			m_bDeferDisconnect;			// see SetDeferDisconnect
+	const char		*m_pszDeferredDisconnect;	// reason of a disconnect waiting for ApplyDeferredDisconnect
+
 	// Time when last name change was applied
 	double			m_fTimeLastNameChange;
 	bool			m_bPlayerNameLocked;
@@ -279,6 +291,9 @@ public:
 
 	unsigned int		m_SnapshotScratchBuffer[ SNAPSHOT_SCRATCH_BUFFER_SIZE / 4 ];
 
+	// Number of snapshots each entity's update has been held back for, see SV_ScheduleEntityUpdates
+	CEntityStaleness	m_EntityStaleness;
+
 private:
 	void				StartTrace( bf_write &msg );
 	void				EndTrace( bf_write &msg );
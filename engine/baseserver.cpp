@@ -2261,9 +2261,9 @@ void CBaseServer::WriteTempEntities( CBaseClient *client, CFrameSnapshot *pCurre
 {
 	VPROF_BUDGET( "CBaseServer::WriteTempEntities", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 
-	ALIGN4 char data[NET_MAX_PAYLOAD] ALIGN4_POST;
+	CNetScratchBuffer data;
 	SVC_TempEntities msg;
-	msg.m_DataOut.StartWriting( data, sizeof(data) );
+	msg.m_DataOut.StartWriting( data.Base(), NET_MAX_PAYLOAD );
 	bf_write &buffer = msg.m_DataOut; // shortcut
 	
 	CFrameSnapshot *pSnapshot;
@@ -56,6 +56,7 @@ void CClientFrame::Init( CFrameSnapshot *pSnapshot )
 
 CClientFrame::~CClientFrame()
 {
+	ClearDeferredEntities();
 	SetSnapshot( NULL );	// Release our reference to the snapshot.
 
 	if ( transmit_always != NULL )
@@ -79,6 +80,51 @@ void CClientFrame::SetSnapshot( CFrameSnapshot *pSnapshot )
 	m_pSnapshot = pSnapshot;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Entities must be added in increasing index order, which is the
+//  order WriteDeltaEntities walks them in.
+//-----------------------------------------------------------------------------
+void CClientFrame::AddDeferredEntity( int nEntity, int nTick, PackedEntity *pPackedEntity )
+{
+	Assert( !m_DeferredEntities.Count() || m_DeferredEntities.Tail().nEntity < nEntity );
+
+	framesnapshotmanager->AddEntityReference( reinterpret_cast< PackedEntityHandle_t >( pPackedEntity ) );
+
+	DeferredEntity_t &entry = m_DeferredEntities[ m_DeferredEntities.AddToTail() ];
+	entry.nEntity = nEntity;
+	entry.nTick = nTick;
+	entry.pPackedEntity = pPackedEntity;
+}
+
+const CClientFrame::DeferredEntity_t *CClientFrame::FindDeferredEntity( int nEntity ) const
+{
+	int nLow = 0;
+	int nHigh = m_DeferredEntities.Count() - 1;
+	while ( nLow <= nHigh )
+	{
+		int nMid = ( nLow + nHigh ) / 2;
+		const DeferredEntity_t &entry = m_DeferredEntities[nMid];
+		if ( entry.nEntity == nEntity )
+			return &entry;
+
+		if ( entry.nEntity < nEntity )
+			nLow = nMid + 1;
+		else
+			nHigh = nMid - 1;
+	}
+
+	return NULL;
+}
+
+void CClientFrame::ClearDeferredEntities()
+{
+	FOR_EACH_VEC( m_DeferredEntities, i )
+	{
+		framesnapshotmanager->RemoveEntityReference( reinterpret_cast< PackedEntityHandle_t >( m_DeferredEntities[i].pPackedEntity ) );
+	}
+	m_DeferredEntities.RemoveAll();
+}
+
 void CClientFrame::CopyFrame( CClientFrame &frame )
 {
 	tick_count = frame.tick_count;	
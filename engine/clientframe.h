@@ -13,8 +13,10 @@
 #include <bitvec.h>
 #include <const.h>
 #include <tier1/mempool.h>
+#include <tier1/utlvector.h>
 
 class CFrameSnapshot;
+class PackedEntity;
 
 #define MAX_CLIENT_FRAMES	128
 
@@ -46,6 +48,20 @@ public:
 	CBitVec<MAX_EDICTS>	*from_baseline;	// if bit n is set, this entity was send as update from baseline
 	CBitVec<MAX_EDICTS>	*transmit_always; // if bit is set, don't do PVS checks before sending (HLTV only)
 
+	// Entities in transmit_entity whose update was held back to fit the client's bandwidth.
+	// The client still has pPackedEntity, the state from tick nTick, so the next delta
+	// for these must be taken from there rather than from this frame's snapshot.
+	struct DeferredEntity_t
+	{
+		int				nEntity;
+		int				nTick;
+		PackedEntity	*pPackedEntity;
+	};
+
+	void					AddDeferredEntity( int nEntity, int nTick, PackedEntity *pPackedEntity );
+	const DeferredEntity_t	*FindDeferredEntity( int nEntity ) const;
+	void					ClearDeferredEntities();
+
 	CClientFrame*		m_pNext;
 
 private:
@@ -54,6 +70,8 @@ private:
 	// for the frame number this packed entity corresponds to
 	// m_pSnapshot MUST be private to force using SetSnapshot(), see reference counters
 	CFrameSnapshot		*m_pSnapshot;
+
+	CUtlVector<DeferredEntity_t>	m_DeferredEntities;	// sorted by nEntity, holds a reference to each packed entity
 };
 
 // TODO substitute CClientFrameManager with an intelligent structure (Tree, hash, cache, etc)
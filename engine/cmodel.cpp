@@ -26,8 +26,10 @@
 #include "enginethreads.h"
 #include "sys_dll.h"
 #include "collisionutils.h"
+#include "enginetrace.h"
 #include "tier0/tslist.h"
 #include "tier0/vprof.h"
+#include "vstdlib/random.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -297,6 +299,9 @@ void CM_FreeMap(void)
 	// get the current collision bsp -- there is only one!
 	CCollisionBSPData *pBSPData = GetCollisionBSPData();
 
+	// Nothing may keep pointing at the old surfaces
+	EngineTraceClearCaches();
+
 	// free the collision bsp data
 	CollisionBSPData_Destroy( pBSPData );
 }
@@ -2179,6 +2184,25 @@ void CM_BoxTraceAgainstLeafList( const Ray_t &ray, int *pLeafList, int nLeafCoun
 	Assert( !ray.m_IsRay || trace.allsolid || ( trace.fraction >= trace.fractionleftsolid ) );
 }
 
+//-----------------------------------------------------------------------------
+// Fills in the ray part of the trace info for CM_BoxTrace
+//-----------------------------------------------------------------------------
+static inline void CM_SetupBoxTrace( TraceInfo_t *pTraceInfo, const Ray_t &ray, int brushmask )
+{
+	pTraceInfo->m_bDispHit = false;
+	pTraceInfo->m_DispStabDir.Init();
+	pTraceInfo->m_contents = brushmask;
+	VectorCopy (ray.m_Start, pTraceInfo->m_start);
+	VectorAdd  (ray.m_Start, ray.m_Delta, pTraceInfo->m_end);
+	VectorMultiply (ray.m_Extents, -1.0f, pTraceInfo->m_mins);
+	VectorCopy (ray.m_Extents, pTraceInfo->m_maxs);
+	VectorCopy (ray.m_Extents, pTraceInfo->m_extents);
+	pTraceInfo->m_delta = ray.m_Delta;
+	pTraceInfo->m_invDelta = ray.InvDelta();
+	pTraceInfo->m_ispoint = ray.m_IsRay;
+	pTraceInfo->m_isswept = ray.m_IsSwept;
+}
+
 void CM_BoxTrace( const Ray_t& ray, int headnode, int brushmask, bool computeEndpt, trace_t& tr )
 {
 	VPROF("BoxTrace");
@@ -2203,18 +2227,7 @@ void CM_BoxTrace( const Ray_t& ray, int headnode, int brushmask, bool computeEnd
 		return;
 	}
 
-	pTraceInfo->m_bDispHit = false;
-	pTraceInfo->m_DispStabDir.Init();
-	pTraceInfo->m_contents = brushmask;
-	VectorCopy (ray.m_Start, pTraceInfo->m_start);
-	VectorAdd  (ray.m_Start, ray.m_Delta, pTraceInfo->m_end);
-	VectorMultiply (ray.m_Extents, -1.0f, pTraceInfo->m_mins);
-	VectorCopy (ray.m_Extents, pTraceInfo->m_maxs);
-	VectorCopy (ray.m_Extents, pTraceInfo->m_extents);
-	pTraceInfo->m_delta = ray.m_Delta;
-	pTraceInfo->m_invDelta = ray.InvDelta();
-	pTraceInfo->m_ispoint = ray.m_IsRay;
-	pTraceInfo->m_isswept = ray.m_IsSwept;
+	CM_SetupBoxTrace( pTraceInfo, ray, brushmask );
 
 	if (!ray.m_IsSwept)
 	{
@@ -2239,6 +2252,343 @@ void CM_BoxTrace( const Ray_t& ray, int headnode, int brushmask, bool computeEnd
 }
 
 
+//-----------------------------------------------------------------------------
+// Packet version of CM_RecursiveHullCheck. Up to four swept rays walk the tree
+// together, with the plane tests done 4-wide. Each ray keeps its own interval
+// and drops out of a subtree once the interval is empty or starts past its
+// nearest hit. Leaves are still clipped per ray by CM_TraceToLeaf.
+//
+// The planes are bloated by more than the scalar walk's DIST_EPSILON, so each
+// ray visits every leaf the scalar walk would. CM_TraceToLeaf clips the whole
+// ray whatever the leaf, so the results match CM_BoxTrace. The one exception is
+// which surface is reported when two brushes are hit at exactly the same
+// fraction.
+//-----------------------------------------------------------------------------
+#define CM_PACKET_SIZE			4
+#define CM_PACKET_PLANE_BLOAT	( 4.0f * DIST_EPSILON )
+
+struct TracePacketNode_t
+{
+	int		m_nNode;
+	fltx4	m_fl4Min;		// Each ray's interval in this subtree, empty if min > max
+	fltx4	m_fl4Max;
+};
+
+template <bool IS_POINT>
+static void FASTCALL CM_RecursiveHullCheckPacket( TraceInfo_t **ppTraceInfo, int nRays, int headnode )
+{
+	CCollisionBSPData *pBSPData = ppTraceInfo[0]->m_pBSPData;
+
+	// Unused lanes repeat the first ray with an empty interval
+	const TraceInfo_t *pLane[CM_PACKET_SIZE];
+	for ( int i = 0; i < CM_PACKET_SIZE; i++ )
+	{
+		pLane[i] = ppTraceInfo[ i < nRays ? i : 0 ];
+	}
+
+	FourVectors start, delta, extents;
+	start.LoadAndSwizzle( pLane[0]->m_start, pLane[1]->m_start, pLane[2]->m_start, pLane[3]->m_start );
+	delta.LoadAndSwizzle( pLane[0]->m_delta, pLane[1]->m_delta, pLane[2]->m_delta, pLane[3]->m_delta );
+	if ( !IS_POINT )
+	{
+		extents.LoadAndSwizzle( pLane[0]->m_extents, pLane[1]->m_extents, pLane[2]->m_extents, pLane[3]->m_extents );
+	}
+
+	const fltx4 fl4Bloat = ReplicateX4( CM_PACKET_PLANE_BLOAT );
+	fltx4 fl4Fraction = Four_Ones;		// Each ray's nearest hit so far
+
+	CUtlVectorFixedGrowable< TracePacketNode_t, 64 > stack;
+	TracePacketNode_t &root = stack[ stack.AddToTail() ];
+	root.m_nNode = headnode;
+	root.m_fl4Min = Four_Zeros;
+	root.m_fl4Max = Four_Ones;
+	for ( int i = nRays; i < CM_PACKET_SIZE; i++ )
+	{
+		SubFloat( root.m_fl4Max, i ) = -1.0f;
+	}
+
+	while ( stack.Count() )
+	{
+		TracePacketNode_t entry = stack.Tail();
+		stack.RemoveMultipleFromTail( 1 );
+
+		// Rays with something left to look at in this subtree
+		fltx4 fl4Active = AndSIMD( CmpLeSIMD( entry.m_fl4Min, entry.m_fl4Max ), CmpLtSIMD( entry.m_fl4Min, fl4Fraction ) );
+		int nActive = TestSignSIMD( fl4Active );
+		if ( !nActive )
+			continue;
+
+		if ( entry.m_nNode < 0 )
+		{
+			int ndxLeaf = -1 - entry.m_nNode;
+			for ( int i = 0; i < nRays; i++ )
+			{
+				if ( !( nActive & ( 1 << i ) ) )
+					continue;
+
+				CM_TraceToLeaf<IS_POINT>( ppTraceInfo[i], ndxLeaf, SubFloat( entry.m_fl4Min, i ), SubFloat( entry.m_fl4Max, i ) );
+				SubFloat( fl4Fraction, i ) = ppTraceInfo[i]->m_trace.fraction;
+			}
+			continue;
+		}
+
+		cnode_t *node = pBSPData->map_rootnode + entry.m_nNode;
+		cplane_t *plane = node->plane;
+
+		// Distance to the plane at each ray's start, its change along the ray, and the box's reach
+		fltx4 fl4Dist = ReplicateX4( plane->dist );
+		fltx4 fl4Start, fl4Delta, fl4Offset;
+		if ( plane->type < 3 )
+		{
+			fl4Start = SubSIMD( start[plane->type], fl4Dist );
+			fl4Delta = delta[plane->type];
+			fl4Offset = IS_POINT ? fl4Bloat : AddSIMD( extents[plane->type], fl4Bloat );
+		}
+		else
+		{
+			FourVectors normal;
+			normal.DuplicateVector( plane->normal );
+			fl4Start = SubSIMD( start * normal, fl4Dist );
+			fl4Delta = delta * normal;
+			if ( IS_POINT )
+			{
+				fl4Offset = fl4Bloat;
+			}
+			else
+			{
+				fl4Offset = MaddSIMD( extents.x, ReplicateX4( fabsf( plane->normal.x ) ), fl4Bloat );
+				fl4Offset = MaddSIMD( extents.y, ReplicateX4( fabsf( plane->normal.y ) ), fl4Offset );
+				fl4Offset = MaddSIMD( extents.z, ReplicateX4( fabsf( plane->normal.z ) ), fl4Offset );
+			}
+		}
+		fltx4 fl4NegOffset = NegSIMD( fl4Offset );
+
+		// Which sides each interval reaches
+		fltx4 fl4DistMin = MaddSIMD( entry.m_fl4Min, fl4Delta, fl4Start );
+		fltx4 fl4DistMax = MaddSIMD( entry.m_fl4Max, fl4Delta, fl4Start );
+		fltx4 fl4Front = AndSIMD( fl4Active, OrSIMD( CmpGeSIMD( fl4DistMin, fl4NegOffset ), CmpGeSIMD( fl4DistMax, fl4NegOffset ) ) );
+		fltx4 fl4Back = AndSIMD( fl4Active, OrSIMD( CmpLeSIMD( fl4DistMin, fl4Offset ), CmpLeSIMD( fl4DistMax, fl4Offset ) ) );
+
+		// Clip the intervals where they leave each side, rays parallel to the plane keep theirs
+		fltx4 fl4Increasing = CmpGtSIMD( fl4Delta, Four_Zeros );
+		fltx4 fl4Decreasing = CmpLtSIMD( fl4Delta, Four_Zeros );
+		fltx4 fl4FrontEdge = DivSIMD( SubSIMD( fl4NegOffset, fl4Start ), fl4Delta );
+		fltx4 fl4BackEdge = DivSIMD( SubSIMD( fl4Offset, fl4Start ), fl4Delta );
+
+		TracePacketNode_t front, back;
+		front.m_nNode = node->children[0];
+		front.m_fl4Min = MaskedAssign( fl4Increasing, MaxSIMD( entry.m_fl4Min, fl4FrontEdge ), entry.m_fl4Min );
+		front.m_fl4Max = MaskedAssign( fl4Decreasing, MinSIMD( entry.m_fl4Max, fl4FrontEdge ), entry.m_fl4Max );
+		front.m_fl4Min = MaskedAssign( fl4Front, front.m_fl4Min, Four_Twos );
+
+		back.m_nNode = node->children[1];
+		back.m_fl4Min = MaskedAssign( fl4Decreasing, MaxSIMD( entry.m_fl4Min, fl4BackEdge ), entry.m_fl4Min );
+		back.m_fl4Max = MaskedAssign( fl4Increasing, MinSIMD( entry.m_fl4Max, fl4BackEdge ), entry.m_fl4Max );
+		back.m_fl4Min = MaskedAssign( fl4Back, back.m_fl4Min, Four_Twos );
+
+		int nFront = TestSignSIMD( fl4Front );
+		int nBack = TestSignSIMD( fl4Back );
+
+		// Near side last so it's visited first, going by the first ray that's still active
+		int nLane = 0;
+		while ( !( nActive & ( 1 << nLane ) ) )
+		{
+			++nLane;
+		}
+		bool bFrontFirst = SubFloat( fl4DistMin, nLane ) >= 0.0f;
+
+		if ( bFrontFirst )
+		{
+			if ( nBack )
+				stack.AddToTail( back );
+			if ( nFront )
+				stack.AddToTail( front );
+		}
+		else
+		{
+			if ( nFront )
+				stack.AddToTail( front );
+			if ( nBack )
+				stack.AddToTail( back );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Traces a packet of swept rays of the same kind, see CM_RecursiveHullCheckPacket
+//-----------------------------------------------------------------------------
+static void CM_BoxTracePacket( const Ray_t *pRays, const int *pRayIndices, int nRays, int headnode, int brushmask, bool computeEndpt, trace_t *pTraces )
+{
+	TraceInfo_t *pTraceInfo[CM_PACKET_SIZE];
+	for ( int i = 0; i < nRays; i++ )
+	{
+#ifdef COUNT_COLLISIONS
+		g_CollisionCounts.m_Traces++;
+#endif
+		pTraceInfo[i] = BeginTrace();
+		CM_ClearTrace( &pTraceInfo[i]->m_trace );
+		pTraceInfo[i]->m_pBSPData = GetCollisionBSPData();
+		CM_SetupBoxTrace( pTraceInfo[i], pRays[ pRayIndices[i] ], brushmask );
+	}
+
+	if ( pRays[ pRayIndices[0] ].m_IsRay )
+	{
+		CM_RecursiveHullCheckPacket<true>( pTraceInfo, nRays, headnode );
+	}
+	else
+	{
+		CM_RecursiveHullCheckPacket<false>( pTraceInfo, nRays, headnode );
+	}
+
+	for ( int i = 0; i < nRays; i++ )
+	{
+		const Ray_t &ray = pRays[ pRayIndices[i] ];
+		if ( computeEndpt )
+		{
+			CM_ComputeTraceEndpoints( ray, pTraceInfo[i]->m_trace );
+		}
+
+		trace_t &tr = pTraces[ pRayIndices[i] ];
+		tr = pTraceInfo[i]->m_trace;
+		EndTrace( pTraceInfo[i] );
+		Assert( !ray.m_IsRay || tr.allsolid || (tr.fraction >= tr.fractionleftsolid) );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CM_BoxTrace for a batch of rays. Swept rays go through the tree in packets of
+// four, lines and boxes separately, so it pays off when the rays of a batch are
+// close together and point the same way. Unswept boxes are traced one by one.
+//-----------------------------------------------------------------------------
+void CM_BoxTraces( const Ray_t *pRays, int nRays, int headnode, int brushmask, bool computeEndpt, trace_t *pTraces )
+{
+	VPROF("BoxTraces");
+
+	if ( !GetCollisionBSPData()->numnodes )
+	{
+		for ( int i = 0; i < nRays; i++ )
+		{
+			CM_BoxTrace( pRays[i], headnode, brushmask, computeEndpt, pTraces[i] );
+		}
+		return;
+	}
+
+	// Pending packets of swept boxes and swept lines
+	int pPacket[2][CM_PACKET_SIZE];
+	int nPacket[2] = { 0, 0 };
+
+	for ( int i = 0; i < nRays; i++ )
+	{
+		if ( !pRays[i].m_IsSwept )
+		{
+			CM_BoxTrace( pRays[i], headnode, brushmask, computeEndpt, pTraces[i] );
+			continue;
+		}
+
+		int nKind = pRays[i].m_IsRay ? 1 : 0;
+		pPacket[nKind][ nPacket[nKind]++ ] = i;
+		if ( nPacket[nKind] == CM_PACKET_SIZE )
+		{
+			CM_BoxTracePacket( pRays, pPacket[nKind], CM_PACKET_SIZE, headnode, brushmask, computeEndpt, pTraces );
+			nPacket[nKind] = 0;
+		}
+	}
+
+	for ( int nKind = 0; nKind < 2; nKind++ )
+	{
+		if ( nPacket[nKind] == 1 )
+		{
+			int i = pPacket[nKind][0];
+			CM_BoxTrace( pRays[i], headnode, brushmask, computeEndpt, pTraces[i] );
+		}
+		else if ( nPacket[nKind] > 1 )
+		{
+			CM_BoxTracePacket( pRays, pPacket[nKind], nPacket[nKind], headnode, brushmask, computeEndpt, pTraces );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Times CM_BoxTraces against one CM_BoxTrace per ray over fans of four rays
+// from random points in the map, like shotgun pellets or a sight check, and
+// checks that both agree.
+//-----------------------------------------------------------------------------
+CON_COMMAND( cm_packettrace_bench, "Time packet world traces against single ones. Usage: cm_packettrace_bench [fans] [spread degrees] [hull]" )
+{
+	CCollisionBSPData *pBSPData = GetCollisionBSPData();
+	if ( !pBSPData->numnodes )
+	{
+		ConMsg( "cm_packettrace_bench: no map loaded\n" );
+		return;
+	}
+
+	int nFans = ( args.ArgC() > 1 ) ? MAX( 1, Q_atoi( args[1] ) ) : 10000;
+	float flSpread = ( args.ArgC() > 2 ) ? Q_atof( args[2] ) : 5.0f;
+	bool bHull = ( args.ArgC() > 3 ) && !Q_stricmp( args[3], "hull" );
+
+	const cmodel_t *pWorld = &pBSPData->map_cmodels[0];
+	Vector vecHull = bHull ? Vector( 16, 16, 36 ) : vec3_origin;
+
+	CUniformRandomStream random;
+	random.SetSeed( 0x5eed );
+
+	int nRays = nFans * CM_PACKET_SIZE;
+	CUtlVector< Ray_t > rays;
+	rays.SetCount( nRays );
+	for ( int i = 0; i < nFans; i++ )
+	{
+		Vector vecStart( random.RandomFloat( pWorld->mins.x, pWorld->maxs.x ),
+			random.RandomFloat( pWorld->mins.y, pWorld->maxs.y ),
+			random.RandomFloat( pWorld->mins.z, pWorld->maxs.z ) );
+		QAngle angAim( random.RandomFloat( -45.0f, 45.0f ), random.RandomFloat( -180.0f, 180.0f ), 0.0f );
+
+		for ( int j = 0; j < CM_PACKET_SIZE; j++ )
+		{
+			QAngle angRay( angAim.x + random.RandomFloat( -flSpread, flSpread ), angAim.y + random.RandomFloat( -flSpread, flSpread ), 0.0f );
+			Vector vecDir;
+			AngleVectors( angRay, &vecDir );
+
+			Vector vecEnd;
+			VectorMA( vecStart, 4096.0f, vecDir, vecEnd );
+			rays[ i * CM_PACKET_SIZE + j ].Init( vecStart, vecEnd, -vecHull, vecHull );
+		}
+	}
+
+	CUtlVector< trace_t > scalarTraces, packetTraces;
+	scalarTraces.SetCount( nRays );
+	packetTraces.SetCount( nRays );
+
+	double flStart = Plat_FloatTime();
+	for ( int i = 0; i < nRays; i++ )
+	{
+		CM_BoxTrace( rays[i], 0, MASK_SOLID, true, scalarTraces[i] );
+	}
+	double flScalar = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int i = 0; i < nFans; i++ )
+	{
+		CM_BoxTraces( &rays[ i * CM_PACKET_SIZE ], CM_PACKET_SIZE, 0, MASK_SOLID, true, &packetTraces[ i * CM_PACKET_SIZE ] );
+	}
+	double flPacket = Plat_FloatTime() - flStart;
+
+	int nMismatches = 0;
+	for ( int i = 0; i < nRays; i++ )
+	{
+		const trace_t &a = scalarTraces[i];
+		const trace_t &b = packetTraces[i];
+		if ( fabsf( a.fraction - b.fraction ) > 1e-4f || a.startsolid != b.startsolid || a.allsolid != b.allsolid )
+		{
+			++nMismatches;
+		}
+	}
+
+	ConMsg( "%d %s: single %.3f us/ray, packets %.3f us/ray (%.2fx), %d mismatches\n",
+		nRays, bHull ? "hulls" : "lines", flScalar * 1e6 / nRays, flPacket * 1e6 / nRays,
+		flPacket > 0 ? flScalar / flPacket : 0.0, nMismatches );
+}
+
+
 void CM_TransformedBoxTrace( const Ray_t& ray, int headnode, int brushmask,
 							const Vector& origin, QAngle const& angles, trace_t& tr )
 {
@@ -15,6 +15,7 @@
 #include "tier1/strtools.h"
 #include "tier0/dbg.h"
 #include "dt_stack.h"
+#include "coordsize.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -94,6 +95,7 @@ CSendTablePrecalc::CSendTablePrecalc() :
 	m_pDTITable = NULL;
 	m_pSendTable = 0;
 	m_nDataTableProxies = 0;
+	m_nUnmappedProps = -1;
 }
 
 
@@ -446,6 +448,143 @@ bool CSendTablePrecalc::SetupFlatPropertyArray()
 }
 
 
+static int GetSendPropLoad( const SendProp *pProp, const CStandardSendProxies *pSendProxies )
+{
+	if ( !pSendProxies )
+		return SENDPROP_LOAD_PROXY;
+
+	SendVarProxyFn fn = pProp->GetProxyFn();
+	switch ( pProp->GetType() )
+	{
+		case DPT_Int:
+			if ( fn == pSendProxies->m_Int8ToInt32 )
+				return SENDPROP_LOAD_INT8;
+			if ( fn == pSendProxies->m_Int16ToInt32 )
+				return SENDPROP_LOAD_INT16;
+			if ( fn == pSendProxies->m_Int32ToInt32 || fn == pSendProxies->m_UInt32ToInt32 )
+				return SENDPROP_LOAD_INT32;
+			if ( fn == pSendProxies->m_UInt8ToInt32 )
+				return SENDPROP_LOAD_UINT8;
+			if ( fn == pSendProxies->m_UInt16ToInt32 )
+				return SENDPROP_LOAD_UINT16;
+			break;
+
+		case DPT_Float:
+			if ( fn == pSendProxies->m_FloatToFloat )
+				return SENDPROP_LOAD_FLOAT;
+			break;
+
+		case DPT_Vector:
+			if ( fn == pSendProxies->m_VectorToVector )
+				return SENDPROP_LOAD_VECTOR;
+			break;
+	}
+
+	return SENDPROP_LOAD_PROXY;
+}
+
+
+// Figures out which op encodes a float the same way EncodeFloat would, and how
+// many bits it takes if that doesn't depend on the value.
+static int GetFloatEncodeOp( const SendProp *pProp, int &nParam, int &nFixedBits )
+{
+	int flags = pProp->GetFlags();
+	nParam = 0;
+	nFixedBits = 0;
+
+	if ( flags & SPROP_COORD )
+	{
+		return SENDPROP_OP_FLOAT_COORD;
+	}
+	else if ( flags & SPROP_COORD_MP )
+	{
+		return SENDPROP_OP_FLOAT_COORD_MP;
+	}
+	else if ( flags & SPROP_COORD_MP_LOWPRECISION )
+	{
+		nParam = SENDPROP_COORDMP_LOWPRECISION;
+		return SENDPROP_OP_FLOAT_COORD_MP;
+	}
+	else if ( flags & SPROP_COORD_MP_INTEGRAL )
+	{
+		nParam = SENDPROP_COORDMP_INTEGRAL;
+		return SENDPROP_OP_FLOAT_COORD_MP;
+	}
+	else if ( flags & SPROP_NOSCALE )
+	{
+		nFixedBits = 32;
+		return SENDPROP_OP_FLOAT_NOSCALE;
+	}
+	else if ( flags & SPROP_NORMAL )
+	{
+		nFixedBits = NORMAL_FRACTIONAL_BITS + 1;
+		return SENDPROP_OP_FLOAT_NORMAL;
+	}
+
+	nFixedBits = pProp->m_nBits;
+	return SENDPROP_OP_FLOAT_SCALED;
+}
+
+
+void CSendTablePrecalc::CompileEncodeOps( const CStandardSendProxies *pSendProxies )
+{
+	MEM_ALLOC_CREDIT();
+	m_EncodeOps.SetCount( m_Props.Count() );
+
+	for ( int i=0; i < m_Props.Count(); i++ )
+	{
+		const SendProp *pProp = m_Props[i];
+		CSendPropEncodeOp &op = m_EncodeOps[i];
+
+		int nOp = SENDPROP_OP_GENERIC;
+		int nParam = 0;
+		int nFixedBits = 0;
+
+		switch ( pProp->GetType() )
+		{
+			case DPT_Int:
+				if ( !( pProp->GetFlags() & SPROP_VARINT ) && pProp->m_nBits > 0 && pProp->m_nBits <= 32 )
+				{
+					nOp = SENDPROP_OP_INT_BITS;
+					nParam = ( pProp->GetFlags() & SPROP_UNSIGNED ) ? 0 : SENDPROP_INTBITS_SIGNED;
+					nFixedBits = pProp->m_nBits;
+				}
+				break;
+
+			case DPT_Float:
+				nOp = GetFloatEncodeOp( pProp, nParam, nFixedBits );
+				break;
+
+			case DPT_Vector:
+				{
+					int nFloatOp = GetFloatEncodeOp( pProp, nParam, nFixedBits );
+					if ( nFloatOp == SENDPROP_OP_FLOAT_COORD )
+					{
+						nOp = SENDPROP_OP_VECTOR_COORD;
+					}
+					else if ( nFloatOp == SENDPROP_OP_FLOAT_NOSCALE )
+					{
+						nOp = SENDPROP_OP_VECTOR_NOSCALE;
+					}
+
+					// Normals send a sign bit instead of the third component.
+					if ( nFloatOp == SENDPROP_OP_FLOAT_NORMAL )
+						nFixedBits = nFixedBits * 2 + 1;
+					else
+						nFixedBits *= 3;
+				}
+				break;
+		}
+
+		op.m_Op = (unsigned char)nOp;
+		op.m_Load = (unsigned char)( nOp == SENDPROP_OP_GENERIC ? SENDPROP_LOAD_PROXY : GetSendPropLoad( pProp, pSendProxies ) );
+		op.m_nBits = (unsigned char)( ( nOp == SENDPROP_OP_INT_BITS || nOp == SENDPROP_OP_FLOAT_SCALED ) ? pProp->m_nBits : 0 );
+		op.m_nParam = (unsigned char)nParam;
+		op.m_nFixedBits = (unsigned short)nFixedBits;
+	}
+}
+
+
 // ---------------------------------------------------------------------------------------- //
 // Helpers.
 // ---------------------------------------------------------------------------------------- //
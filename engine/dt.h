@@ -24,6 +24,7 @@
 class SendTable;
 class RecvTable;
 class CDTISendTable;
+class CStandardSendProxies;
 
 
 
@@ -67,6 +68,12 @@ public:
 	int		ComparePropData( CDeltaBitsReader* pOut, const SendProp *pProp );
 	void	CopyPropData( bf_write* pOut, const SendProp *pProp );
 
+	// Same as above, but if nFixedBits is nonzero (see CSendPropEncodeOp::m_nFixedBits),
+	// the property is handled as that many raw bits instead of being decoded.
+	void	SkipPropData( const SendProp *pProp, int nFixedBits );
+	int		ComparePropData( CDeltaBitsReader* pOut, const SendProp *pProp, int nFixedBits );
+	void	CopyPropData( bf_write* pOut, const SendProp *pProp, int nFixedBits );
+
 	// If you know you're done but you're not at the end (you haven't called until
 	// ReadNextPropIndex returns -1), call this so it won't assert in its destructor.
 	void		ForceFinished();
@@ -155,6 +162,46 @@ FORCEINLINE int CDeltaBitsReader::ComparePropData( CDeltaBitsReader *pInReader,
 	return g_PropTypeFns[pProp->m_Type].CompareDeltas( pProp, m_pBuf, pIn );
 }
 
+FORCEINLINE void CDeltaBitsReader::SkipPropData( const SendProp *pProp, int nFixedBits )
+{
+	if ( nFixedBits )
+	{
+		m_pBuf->SeekRelative( nFixedBits );
+	}
+	else
+	{
+		SkipPropData( pProp );
+	}
+}
+
+FORCEINLINE void CDeltaBitsReader::CopyPropData( bf_write* pOut, const SendProp *pProp, int nFixedBits )
+{
+	if ( nFixedBits )
+	{
+		pOut->WriteBitsFromBuffer( m_pBuf, nFixedBits );
+	}
+	else
+	{
+		CopyPropData( pOut, pProp );
+	}
+}
+
+FORCEINLINE int CDeltaBitsReader::ComparePropData( CDeltaBitsReader *pInReader, const SendProp *pProp, int nFixedBits )
+{
+	if ( !nFixedBits )
+		return ComparePropData( pInReader, pProp );
+
+	// Fixed-width encodings compare equal exactly when their bits do.
+	bf_read *pIn = pInReader->m_pBuf;
+	if ( nFixedBits <= 32 )
+		return m_pBuf->CompareBits( pIn, nFixedBits );
+
+	int nDiff = m_pBuf->CompareBitsAt( m_pBuf->GetNumBitsRead(), pIn, pIn->GetNumBitsRead(), nFixedBits );
+	m_pBuf->SeekRelative( nFixedBits );
+	pIn->SeekRelative( nFixedBits );
+	return nDiff;
+}
+
 
 // ------------------------------------------------------------------------------------ //
 // CDeltaBitsWriter.
@@ -337,6 +384,58 @@ public:
 };
 
 
+// ----------------------------------------------------------------------------- //
+// CSendPropEncodeOp
+//
+// Each CSendTablePrecalc is compiled into one of these per flat property when
+// the SendTables are initialized. SendTable_Encode switches on them instead of
+// going through the prop's proxy and g_PropTypeFns for the common cases, and the
+// delta code uses m_nFixedBits to skip, copy and compare props without decoding.
+// ----------------------------------------------------------------------------- //
+
+enum
+{
+	SENDPROP_OP_GENERIC = 0,		// Call g_PropTypeFns[type].Encode.
+	SENDPROP_OP_INT_BITS,			// Fixed-width int (signed, unsigned, ehandles). m_nParam holds SENDPROP_INTBITS_ flags.
+	SENDPROP_OP_FLOAT_COORD,
+	SENDPROP_OP_FLOAT_COORD_MP,		// m_nParam holds SENDPROP_COORDMP_ flags.
+	SENDPROP_OP_FLOAT_NOSCALE,
+	SENDPROP_OP_FLOAT_NORMAL,
+	SENDPROP_OP_FLOAT_SCALED,		// Out of range values take the generic path so they still warn.
+	SENDPROP_OP_VECTOR_COORD,
+	SENDPROP_OP_VECTOR_NOSCALE
+};
+
+enum
+{
+	SENDPROP_LOAD_PROXY = 0,		// Call the prop's proxy.
+
+	// The prop uses one of the standard proxies, so read the field directly.
+	SENDPROP_LOAD_INT8,
+	SENDPROP_LOAD_INT16,
+	SENDPROP_LOAD_INT32,
+	SENDPROP_LOAD_UINT8,
+	SENDPROP_LOAD_UINT16,
+	SENDPROP_LOAD_FLOAT,
+	SENDPROP_LOAD_VECTOR
+};
+
+#define SENDPROP_COORDMP_INTEGRAL		(1<<0)
+#define SENDPROP_COORDMP_LOWPRECISION	(1<<1)
+
+#define SENDPROP_INTBITS_SIGNED			(1<<0)	// Keep m_nBits-1 bits and sign-extend, like Int_Encode.
+
+class CSendPropEncodeOp
+{
+public:
+	unsigned char	m_Op;			// SENDPROP_OP_ value.
+	unsigned char	m_Load;			// SENDPROP_LOAD_ value. Always SENDPROP_LOAD_PROXY for generic ops.
+	unsigned char	m_nBits;		// For SENDPROP_OP_INT_BITS and SENDPROP_OP_FLOAT_SCALED.
+	unsigned char	m_nParam;
+	unsigned short	m_nFixedBits;	// Encoded size if it doesn't depend on the value, otherwise 0.
+};
+
+
 // ----------------------------------------------------------------------------- //
 // CSendTablePrecalc
 // ----------------------------------------------------------------------------- //
@@ -349,6 +448,10 @@ public:
 	// This function builds the flat property array given a SendTable.
 	bool				SetupFlatPropertyArray();
 
+	// Builds m_EncodeOps from m_Props. pSendProxies can be NULL, in which case
+	// every prop's proxy is called.
+	void				CompileEncodeOps( const CStandardSendProxies *pSendProxies );
+
 	int					GetNumProps() const;
 	const SendProp*		GetProp( int i ) const;
 
@@ -386,6 +489,9 @@ public:
 
 	// Each datatable in a SendTable's tree gets a proxy index, and its properties reference that.
 	CUtlVector<unsigned char> m_PropProxyIndices;
+
+	// Parallel to m_Props. See CSendPropEncodeOp.
+	CUtlVector<CSendPropEncodeOp> m_EncodeOps;
 	
 	// CSendNode::m_iDatatableProp indexes this.
 	// These are the datatable properties (SendPropDataTable).
@@ -410,6 +516,10 @@ public:
 	
 	// Map prop offsets to indices for properties that can use it.
 	CUtlMap<unsigned short, unsigned short> m_PropOffsetToIndexMap;
+
+	// How many props m_PropOffsetToIndexMap can't cover because they're reached through a pointer.
+	// -1 until BuildPropOffsetToIndexMap has run.
+	int						m_nUnmappedProps;
 };
 
 
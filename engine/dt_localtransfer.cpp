@@ -167,11 +167,18 @@ void BuildPropOffsetToIndexMap( CSendTablePrecalc *pPrecalc, const CStandardSend
 {
 	CPropMapStack pmStack( pPrecalc, pSendProxies );
 	pmStack.Init();
+
+	pPrecalc->m_PropOffsetToIndexMap.RemoveAll();
+	pPrecalc->m_nUnmappedProps = 0;
 	
 	for ( int i=0; i < pPrecalc->m_Props.Count(); i++ )
 	{
 		pmStack.SeekToProp( i );
-		if ( pmStack.GetCurStructBase() != 0 )
+		if ( pmStack.GetCurStructBase() == 0 )
+		{
+			++pPrecalc->m_nUnmappedProps;
+		}
+		else
 		{
 			const SendProp *pProp = pPrecalc->m_Props[i];
 			
@@ -217,7 +224,6 @@ void LocalTransfer_InitFastCopy(
 	CSendTablePrecalc *pPrecalc = pSendTable->m_pPrecalc;
 
 	// Setup the offset-to-index map.
-	pPrecalc->m_PropOffsetToIndexMap.RemoveAll();
 	BuildPropOffsetToIndexMap( pPrecalc, pSendProxies );
 
 	// Clear the old lists.
@@ -296,7 +302,8 @@ inline int MapPropOffsetsToIndices(
 	CSendTablePrecalc *pPrecalc, 
 	const unsigned short *pOffsets,
 	unsigned short nOffsets,
-	unsigned short *pOut )
+	unsigned short *pOut,
+	int *pnMisses = NULL )
 {
 	int iOut = 0;
 	
@@ -305,6 +312,9 @@ inline int MapPropOffsetsToIndices(
 		unsigned short index = pPrecalc->m_PropOffsetToIndexMap.Find( pOffsets[i] );
 		if ( index == pPrecalc->m_PropOffsetToIndexMap.InvalidIndex() )
 		{
+			if ( pnMisses )
+				++(*pnMisses);
+
 			// Note: this SHOULD be fine. In all known cases, when NetworkStateChanged is called with
 			// an offset, there should be a corresponding SendProp in order for that NetworkStateChanged
 			// call to mean anything. 
@@ -320,6 +330,10 @@ inline int MapPropOffsetsToIndices(
 
 			if ( dt_ShowPartialChangeEnts.GetInt() )
 			{
+				// The server packs entities from several threads.
+				static CThreadFastMutex testDictMutex;
+				AUTO_LOCK( testDictMutex );
+
 				static CUtlDict<int,int> testDict;
 				char str[512];
 				Q_snprintf( str, sizeof( str ), "LocalTransfer offset miss - class: %s, DT: %s, offset: %d", pEdict->GetClassName(), pPrecalc->m_pSendTable->m_pNetTableName, pOffsets[i] );
@@ -393,6 +407,35 @@ inline void FastSortList( unsigned short *pList, unsigned short nEntries )
 }
 
 
+int GetChangedPropIndices( const CBaseEdict *pEdict, const SendTable *pSendTable, unsigned short *pOut )
+{
+	if ( pEdict->m_fStateFlags & FL_FULL_EDICT_CHANGED )
+		return -1;
+
+	if ( pEdict->GetChangeInfoSerialNumber() != g_pSharedChangeInfo->m_iSerialNumber )
+		return -1;
+
+	CSendTablePrecalc *pPrecalc = pSendTable->m_pPrecalc;
+	if ( pPrecalc->m_nUnmappedProps < 0 )
+		return -1;
+
+	const CEdictChangeInfo *pCI = &g_pSharedChangeInfo->m_ChangeInfos[pEdict->GetChangeInfo()];
+
+	// An offset that isn't in the map is only harmless if every prop has an offset,
+	// otherwise it may belong to one of the props we couldn't map.
+	int nMisses = 0;
+	int nProps = MapPropOffsetsToIndices( pEdict, pPrecalc, pCI->m_ChangeOffsets, pCI->m_nChangeOffsets, pOut, &nMisses );
+	if ( nMisses && pPrecalc->m_nUnmappedProps )
+		return -1;
+
+	if ( nProps > 0 )
+	{
+		FastSortList( pOut, nProps );
+	}
+	return nProps;
+}
+
+
 inline void AddToPartialChangeEntsList( int iEnt, bool bPartial )
 {
 	if ( !dt_ShowPartialChangeEnts.GetInt() )
@@ -17,6 +17,7 @@
 
 
 class CBaseEdict;
+class CSendTablePrecalc;
 
 
 // This sets up the ability to copy an entity with the specified SendTable directly
@@ -41,6 +42,14 @@ void LocalTransfer_TransferEntity(
 	bool bJustEnteredPVS,
 	int objectID );
 
+// Fills in pPrecalc->m_PropOffsetToIndexMap so CNetworkVar change offsets can be mapped to props.
+void BuildPropOffsetToIndexMap( CSendTablePrecalc *pPrecalc, const CStandardSendProxies *pSendProxies );
+
+// Maps the offsets in pEdict's CEdictChangeInfo to a sorted list of prop indices.
+// pOut must hold MAX_CHANGE_OFFSETS*3 entries. The list may contain duplicates.
+// Returns -1 if the edict's changes this frame can't be narrowed down to a list of props.
+int GetChangedPropIndices( const CBaseEdict *pEdict, const SendTable *pSendTable, unsigned short *pOut );
+
 // Call this after packing all the entities in a frame.
 void PrintPartialChangeEntsList();
 
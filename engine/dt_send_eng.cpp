@@ -17,6 +17,8 @@
 #include "dt_stack.h"
 #include "common.h"
 #include "packed_entity.h"
+#include "dt_localtransfer.h"
+#include "convar.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include <tier0/memdbgon.h>
@@ -29,6 +31,8 @@ class CSendNode;
 
 extern bool Sendprop_UsingDebugWatch();
 
+static ConVar dt_encodeops( "dt_encodeops", "1", 0, "Encode props with the per-SendTable ops built at init instead of the generic proxy and g_PropTypeFns path." );
+
 
 // This stack doesn't actually call any proxies. It uses the CSendProxyRecipients to tell
 // what can be sent to the specified client.
@@ -239,11 +243,8 @@ CRC32_t	g_SendTableCRC = 0;
 // SendTable functions.
 // ------------------------------------------------------------------------ //
 
-static bool s_debug_info_shown = false;
-static int  s_debug_bits_start = 0;
-
-
-static inline void ShowEncodeDeltaWatchInfo( 
+// Returns true if info was printed for this prop
+static inline bool ShowEncodeDeltaWatchInfo( 
 	const SendTable *pTable,
 	const SendProp *pProp, 
 	bf_read &buffer,
@@ -251,7 +252,7 @@ static inline void ShowEncodeDeltaWatchInfo(
 	const int index )
 {
 	if ( !ShouldWatchThisProp( pTable, objectID, pProp->GetName()) )
-		return;
+		return false;
 	
 	static int lastframe = -1;
 	if ( host_framecount != lastframe )
@@ -263,8 +264,6 @@ static inline void ShowEncodeDeltaWatchInfo(
 	// work on copy of bitbuffer
 	bf_read copy = buffer;
 
-	s_debug_info_shown = true;
-
 	DecodeInfo info;
 	info.m_pStruct = NULL;
 	info.m_pData = NULL;
@@ -283,9 +282,11 @@ static inline void ShowEncodeDeltaWatchInfo(
 	const char *value = info.m_Value.ToString();
 
 	ConDMsg( "+ %s %s, %s, index %i, bits %i, value %s\n", pTable->GetName(), pProp->GetName(), type, index, bits, value );
+	return true;
 }
 
 
+// Writes the current prop's data. The caller writes its index first.
 static FORCEINLINE void SendTable_EncodeProp( CEncodeInfo * pInfo, unsigned long iProp )
 {
 	// Call their proxy to get the property's value.
@@ -303,9 +304,6 @@ static FORCEINLINE void SendTable_EncodeProp( CEncodeInfo * pInfo, unsigned long
 		pInfo->GetObjectID()
 		);
 
-	// Write the index.
-	pInfo->m_DeltaBitsWriter.WritePropIndex( iProp );
-
 	g_PropTypeFns[pProp->m_Type].Encode( 
 		pStructBase, 
 		&var, 
@@ -316,6 +314,100 @@ static FORCEINLINE void SendTable_EncodeProp( CEncodeInfo * pInfo, unsigned long
 }
 
 
+// Same output as SendTable_EncodeProp, but uses the prop's compiled op to skip the
+// proxy call when it's a standard one and the g_PropTypeFns dispatch.
+static FORCEINLINE void SendTable_EncodePropOp( CEncodeInfo * pInfo, unsigned long iProp, const CSendPropEncodeOp &op )
+{
+	if ( op.m_Op == SENDPROP_OP_GENERIC )
+	{
+		SendTable_EncodeProp( pInfo, iProp );
+		return;
+	}
+
+	const SendProp *pProp = pInfo->GetCurProp();
+	unsigned char *pStructBase = pInfo->GetCurStructBase();
+	const unsigned char *pData = pStructBase + pProp->GetOffset();
+
+	DVariant var;
+	switch ( op.m_Load )
+	{
+		case SENDPROP_LOAD_INT8:	var.m_Int = *(const char*)pData;			break;
+		case SENDPROP_LOAD_INT16:	var.m_Int = *(const short*)pData;			break;
+		case SENDPROP_LOAD_INT32:	memcpy( &var.m_Int, pData, sizeof(int) );	break;
+		case SENDPROP_LOAD_UINT8:	var.m_Int = *(const unsigned char*)pData;	break;
+		case SENDPROP_LOAD_UINT16:	var.m_Int = *(const unsigned short*)pData;	break;
+		case SENDPROP_LOAD_FLOAT:	var.m_Float = *(const float*)pData;			break;
+		case SENDPROP_LOAD_VECTOR:	memcpy( var.m_Vector, pData, sizeof(float) * 3 );	break;
+		default:
+			pProp->GetProxyFn()( pProp, pStructBase, pData, &var, 0, pInfo->GetObjectID() );
+			break;
+	}
+
+	bf_write *pOut = pInfo->m_DeltaBitsWriter.GetBitBuf();
+
+	switch ( op.m_Op )
+	{
+		case SENDPROP_OP_INT_BITS:
+			{
+				// Same as Int_Encode: signed props keep the low m_nBits-1 bits and take
+				// the top bit from the real sign, so out of range values encode identically.
+				int nValue = var.m_Int;
+				if ( op.m_nParam & SENDPROP_INTBITS_SIGNED )
+				{
+					int nPreserveBits = ( 0x7FFFFFFF >> ( 32 - op.m_nBits ) );
+					nValue = ( nValue & nPreserveBits ) | ( ( nValue >> 31 ) & ~nPreserveBits );
+				}
+				pOut->WriteUBitLong( (unsigned int)nValue, op.m_nBits, false );
+			}
+			break;
+
+		case SENDPROP_OP_FLOAT_COORD:
+			pOut->WriteBitCoord( var.m_Float );
+			break;
+
+		case SENDPROP_OP_FLOAT_COORD_MP:
+			pOut->WriteBitCoordMP( var.m_Float, ( op.m_nParam & SENDPROP_COORDMP_INTEGRAL ) != 0, ( op.m_nParam & SENDPROP_COORDMP_LOWPRECISION ) != 0 );
+			break;
+
+		case SENDPROP_OP_FLOAT_NOSCALE:
+			pOut->WriteBitFloat( var.m_Float );
+			break;
+
+		case SENDPROP_OP_FLOAT_NORMAL:
+			pOut->WriteBitNormal( var.m_Float );
+			break;
+
+		case SENDPROP_OP_FLOAT_SCALED:
+			if ( var.m_Float >= pProp->m_fLowValue && var.m_Float <= pProp->m_fHighValue )
+			{
+				float fRangeVal = ( var.m_Float - pProp->m_fLowValue ) * pProp->m_fHighLowMul;
+				pOut->WriteUBitLong( RoundFloatToUnsignedLong( fRangeVal ), op.m_nBits );
+			}
+			else
+			{
+				g_PropTypeFns[DPT_Float].Encode( pStructBase, &var, pProp, pOut, pInfo->GetObjectID() );
+			}
+			break;
+
+		case SENDPROP_OP_VECTOR_COORD:
+			pOut->WriteBitCoord( var.m_Vector[0] );
+			pOut->WriteBitCoord( var.m_Vector[1] );
+			pOut->WriteBitCoord( var.m_Vector[2] );
+			break;
+
+		case SENDPROP_OP_VECTOR_NOSCALE:
+			pOut->WriteBitFloat( var.m_Vector[0] );
+			pOut->WriteBitFloat( var.m_Vector[1] );
+			pOut->WriteBitFloat( var.m_Vector[2] );
+			break;
+
+		default:
+			Assert( false );
+			break;
+	}
+}
+
+
 static bool SendTable_IsPropZero( CEncodeInfo *pInfo, unsigned long iProp )
 {
 	const SendProp *pProp = pInfo->GetCurProp();
@@ -430,6 +522,7 @@ bool SendTable_Encode(
 	info.Init();
 	
 	int iNumProps = pPrecalc->GetNumProps();
+	const CSendPropEncodeOp *pOps = dt_encodeops.GetBool() ? pPrecalc->m_EncodeOps.Base() : NULL;
 
 	for ( int iProp=0; iProp < iNumProps; iProp++ )
 	{
@@ -443,13 +536,143 @@ bool SendTable_Encode(
 		if ( bNonZeroOnly && SendTable_IsPropZero(&info, iProp) )
 			continue;
 
-		SendTable_EncodeProp( &info, iProp );
+		info.m_DeltaBitsWriter.WritePropIndex( iProp );
+		if ( pOps )
+		{
+			SendTable_EncodePropOp( &info, iProp, pOps[iProp] );
+		}
+		else
+		{
+			SendTable_EncodeProp( &info, iProp );
+		}
 	}
 
 	return !pOut->IsOverflowed();
 }
 
 
+int SendTable_EncodeChangedProps(
+	const SendTable *pTable,
+	const void *pStruct,
+	const void *pPrevState,
+	const int nPrevBits,
+	const unsigned short *pChangedProps,
+	const int nChangedProps,
+	bf_write *pOut,
+	int objectID,
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	int *pDeltaProps,
+	int nMaxDeltaProps
+	)
+{
+	CSendTablePrecalc *pPrecalc = pTable->m_pPrecalc;
+	ErrorIfNot( pPrecalc, ("SendTable_EncodeChangedProps: Missing m_pPrecalc for SendTable %s.", pTable->m_pNetTableName) );
+	if ( pRecipients )
+	{
+		ErrorIfNot(	pRecipients->NumAllocated() >= pPrecalc->GetNumDataTableProxies(), ("SendTable_EncodeChangedProps: pRecipients array too small.") );
+	}
+
+	VPROF( "SendTable_EncodeChangedProps" );
+
+	CServerDTITimer timer( pTable, SERVERDTI_ENCODE );
+
+	// The datatable proxies still all get called, so recipients and which props
+	// are present come out the same as a full encode.
+	CEncodeInfo info( pPrecalc, (unsigned char*)pStruct, objectID, pOut );
+	info.m_pRecipients = pRecipients;
+	info.Init();
+
+	bf_read prevBits( "SendTable_EncodeChangedProps->prevBits", pPrevState, BitByte( nPrevBits ), nPrevBits );
+	CDeltaBitsReader prevBitsReader( &prevBits );
+	unsigned int iPrevProp = prevBitsReader.ReadNextPropIndex();
+
+	// Lets us compare what we just wrote with the previous state.
+	bf_read outBits( "SendTable_EncodeChangedProps->outBits", pOut->GetBasePointer(), pOut->GetMaxNumBits() >> 3 );
+
+	const CSendPropEncodeOp *pOps = pPrecalc->m_EncodeOps.Base();
+	const bool bUseOps = dt_encodeops.GetBool();
+	int iChanged = 0;
+	int nDeltaProps = 0;
+
+	int iNumProps = pPrecalc->GetNumProps();
+	for ( int iProp=0; iProp < iNumProps; iProp++ )
+	{
+		if ( !info.IsPropProxyValid( iProp ) )
+			continue;
+
+		// Drop props the previous state had that aren't there anymore.
+		while ( iPrevProp < (unsigned int)iProp )
+		{
+			prevBitsReader.SkipPropData( pPrecalc->GetProp( iPrevProp ), pOps[iPrevProp].m_nFixedBits );
+			iPrevProp = prevBitsReader.ReadNextPropIndex();
+		}
+
+		bool bChanged = false;
+		while ( iChanged < nChangedProps && pChangedProps[iChanged] <= iProp )
+		{
+			bChanged |= ( pChangedProps[iChanged] == iProp );
+			++iChanged;
+		}
+
+		const SendProp *pProp = pPrecalc->GetProp( iProp );
+		const bool bInPrev = ( iPrevProp == (unsigned int)iProp );
+
+		info.m_DeltaBitsWriter.WritePropIndex( iProp );
+
+		// Props encoded against the tickcount change even when their field doesn't.
+		if ( bInPrev && !bChanged && !( pProp->GetFlags() & SPROP_ENCODED_AGAINST_TICKCOUNT ) )
+		{
+			prevBitsReader.CopyPropData( pOut, pProp, pOps[iProp].m_nFixedBits );
+			iPrevProp = prevBitsReader.ReadNextPropIndex();
+			continue;
+		}
+
+		info.SeekToProp( iProp );
+
+		int iStartBit = pOut->GetNumBitsWritten();
+		if ( bUseOps )
+		{
+			SendTable_EncodePropOp( &info, iProp, pOps[iProp] );
+		}
+		else
+		{
+			SendTable_EncodeProp( &info, iProp );
+		}
+
+		bool bDelta = true;
+		if ( bInPrev )
+		{
+			int iPrevStartBit = prevBits.GetNumBitsRead();
+			prevBitsReader.SkipPropData( pProp, pOps[iProp].m_nFixedBits );
+			int nPrevPropBits = prevBits.GetNumBitsRead() - iPrevStartBit;
+			int nPropBits = pOut->GetNumBitsWritten() - iStartBit;
+
+			bDelta = ( nPropBits != nPrevPropBits ) || 
+				prevBits.CompareBitsAt( iPrevStartBit, &outBits, iStartBit, nPropBits );
+
+			iPrevProp = prevBitsReader.ReadNextPropIndex();
+		}
+
+		if ( bDelta )
+		{
+			if ( nDeltaProps >= nMaxDeltaProps )
+			{
+				prevBitsReader.ForceFinished();
+				return -1;
+			}
+			pDeltaProps[nDeltaProps++] = iProp;
+		}
+	}
+
+	prevBitsReader.ForceFinished();
+
+	if ( pOut->IsOverflowed() )
+		return -1;
+
+	return nDeltaProps;
+}
+
+
 void SendTable_WritePropList(
 	const SendTable *pTable,
 	const void *pState,
@@ -469,8 +692,9 @@ void SendTable_WritePropList(
 
 	bool bDebugWatch = Sendprop_UsingDebugWatch();
 
-	s_debug_info_shown = false;
-	s_debug_bits_start = pOut->GetNumBitsWritten();
+	// kept local so prop lists can be written from several threads at once
+	bool bDebugInfoShown = false;
+	int nDebugBitsStart = pOut->GetNumBitsWritten();
 	
 	CSendTablePrecalc *pPrecalc = pTable->m_pPrecalc;
 	CDeltaBitsWriter deltaBitsWriter( pOut );
@@ -486,7 +710,7 @@ void SendTable_WritePropList(
 		// Seek the 'to' state to the current property we want to check.
 		while ( iToProp < (unsigned int) pCheckProps[i] )
 		{
-			inputBitsReader.SkipPropData( pPrecalc->GetProp( iToProp ) );
+			inputBitsReader.SkipPropData( pPrecalc->GetProp( iToProp ), pPrecalc->m_EncodeOps[iToProp].m_nFixedBits );
 			iToProp = inputBitsReader.ReadNextPropIndex();
 		}
 
@@ -502,7 +726,7 @@ void SendTable_WritePropList(
 			// Show debug stuff.
 			if ( bDebugWatch )
 			{
-				ShowEncodeDeltaWatchInfo( pTable, pProp, inputBuffer, objectID, iToProp );
+				bDebugInfoShown |= ShowEncodeDeltaWatchInfo( pTable, pProp, inputBuffer, objectID, iToProp );
 			}
 
 			// See how many bits the data for this property takes up.
@@ -510,7 +734,7 @@ void SendTable_WritePropList(
 			int iStartBit = pOut->GetNumBitsWritten();
 
 			deltaBitsWriter.WritePropIndex( iToProp );
-			inputBitsReader.CopyPropData( deltaBitsWriter.GetBitBuf(), pProp ); 
+			inputBitsReader.CopyPropData( deltaBitsWriter.GetBitBuf(), pProp, pPrecalc->m_EncodeOps[iToProp].m_nFixedBits ); 
 
 			nToStateBits = pOut->GetNumBitsWritten() - iStartBit;
 
@@ -523,9 +747,9 @@ void SendTable_WritePropList(
 		++i;
 	}
 
-	if ( s_debug_info_shown )
+	if ( bDebugInfoShown )
 	{
-		int  bits = pOut->GetNumBitsWritten() - s_debug_bits_start;
+		int  bits = pOut->GetNumBitsWritten() - nDebugBitsStart;
 		ConDMsg( "= %i bits (%i bytes)\n", bits, Bits2Bytes(bits) );
 	}
 
@@ -580,7 +804,7 @@ int SendTable_CalcDelta(
 			// Skip any properties in the from state that aren't in the to state.
 			while ( iFromProp < iToProp )
 			{
-				fromBitsReader.SkipPropData( pPrecalc->GetProp( iFromProp ) );
+				fromBitsReader.SkipPropData( pPrecalc->GetProp( iFromProp ), pPrecalc->m_EncodeOps[iFromProp].m_nFixedBits );
 				iFromProp = fromBitsReader.ReadNextPropIndex();
 			}
 
@@ -588,7 +812,7 @@ int SendTable_CalcDelta(
 			{
 				// The property is in both states, so compare them and write the index 
 				// if the states are different.
-				if ( fromBitsReader.ComparePropData( &toBitsReader, pPrecalc->GetProp( iToProp ) ) )
+				if ( fromBitsReader.ComparePropData( &toBitsReader, pPrecalc->GetProp( iToProp ), pPrecalc->m_EncodeOps[iToProp].m_nFixedBits ) )
 				{
 					*pDeltaProps++ = iToProp;
 					if ( pDeltaProps >= pDeltaPropsEnd )
@@ -603,7 +827,7 @@ int SendTable_CalcDelta(
 			else
 			{
 				// Only the 'to' state has this property, so just skip its data and register a change.
-				toBitsReader.SkipPropData( pPrecalc->GetProp( iToProp ) );
+				toBitsReader.SkipPropData( pPrecalc->GetProp( iToProp ), pPrecalc->m_EncodeOps[iToProp].m_nFixedBits );
 				*pDeltaProps++ = iToProp;
 				if ( pDeltaProps >= pDeltaPropsEnd )
 				{
@@ -742,7 +966,7 @@ static void SendTable_CalcNextVectorElems( SendTable *pTable )
 }
 
 
-static bool SendTable_InitTable( SendTable *pTable )
+static bool SendTable_InitTable( SendTable *pTable, const CStandardSendProxies *pSendProxies )
 {
 	if( pTable->m_pPrecalc )
 		return true;
@@ -763,6 +987,13 @@ static bool SendTable_InitTable( SendTable *pTable )
 	if ( !pPrecalc->SetupFlatPropertyArray() )
 		return false;
 
+	pPrecalc->CompileEncodeOps( pSendProxies );
+
+	if ( pSendProxies )
+	{
+		BuildPropOffsetToIndexMap( pPrecalc, pSendProxies );
+	}
+
 	SendTable_Validate( pPrecalc );
 	return true;
 }
@@ -904,7 +1135,7 @@ void SendTable_PrintStats( void )
 
 
 
-bool SendTable_Init( SendTable **pTables, int nTables )
+bool SendTable_Init( SendTable **pTables, int nTables, const CStandardSendProxies *pSendProxies )
 {
 	ErrorIfNot( g_SendTables.Count() == 0,
 		("SendTable_Init: called twice.")
@@ -913,7 +1144,7 @@ bool SendTable_Init( SendTable **pTables, int nTables )
 	// Initialize them all.
 	for ( int i=0; i < nTables; i++ )
 	{
-		if ( !SendTable_InitTable( pTables[i] ) )
+		if ( !SendTable_InitTable( pTables[i], pSendProxies ) )
 			return false;
 	}
 
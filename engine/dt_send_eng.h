@@ -28,7 +28,9 @@ class CStandardSendProxies;
 // ------------------------------------------------------------------------ //
 
 // Precalculate data that enables the SendTable to be used to encode data.
-bool		SendTable_Init( SendTable **pTables, int nTables );
+// pSendProxies lets props using the standard proxies be encoded without calling them,
+// and lets CNetworkVar change offsets be mapped to props.
+bool		SendTable_Init( SendTable **pTables, int nTables, const CStandardSendProxies *pSendProxies = NULL );
 void		SendTable_Term();
 CRC32_t		SendTable_GetCRC();
 int			SendTable_GetNum();
@@ -117,6 +119,27 @@ bool SendTable_Encode(
 	);
 
 
+// Produces the same output as SendTable_Encode, but only calls the proxies and encoders
+// for the props in pChangedProps (sorted, duplicates allowed) and copies the rest out of
+// pPrevState, which must be this object's previous SendTable_Encode output.
+//
+// pDeltaProps receives the props whose encoding differs from pPrevState, like
+// SendTable_CalcDelta, and the return value is how many there are or -1 on overflow.
+int SendTable_EncodeChangedProps(
+	const SendTable *pTable,
+	const void *pStruct,
+	const void *pPrevState,
+	const int nPrevBits,
+	const unsigned short *pChangedProps,
+	const int nChangedProps,
+	bf_write *pOut,
+	int objectID,
+	CUtlMemory<CSendProxyRecipients> *pRecipients,
+	int *pDeltaProps,
+	int nMaxDeltaProps
+	);
+
+
 // In order to receive a table, you must send it from the server and receive its info
 // on the client so the client knows how to unpack it.
 bool SendTable_WriteInfos( SendTable *pTable, bf_write *pBuf );
@@ -253,6 +253,30 @@ BEGIN_SEND_TABLE_NOBASE(DTTestServer, DT_DTTest)
 END_SEND_TABLE()
 
 
+// ------------------------------------------------------------------------------------------- //
+// DTIntTestServer and its DataTable. Fixed-width ints that get fed negative and out of range
+// values to check the compiled int encoder against Int_Encode.
+// ------------------------------------------------------------------------------------------- //
+class DTIntTestServer
+{
+public:
+	int		m_Signed8;
+	int		m_Signed5;
+	int		m_Signed32;
+	int		m_Unsigned8;
+	int		m_Unsigned32;
+};
+
+
+BEGIN_SEND_TABLE_NOBASE(DTIntTestServer, DT_DTIntTest)
+	SendPropInt( SENDINFO_NOCHECK( m_Signed8 ),		8 ),
+	SendPropInt( SENDINFO_NOCHECK( m_Signed5 ),		5 ),
+	SendPropInt( SENDINFO_NOCHECK( m_Signed32 ),	32 ),
+	SendPropInt( SENDINFO_NOCHECK( m_Unsigned8 ),	8, SPROP_UNSIGNED ),
+	SendPropInt( SENDINFO_NOCHECK( m_Unsigned32 ),	32, SPROP_UNSIGNED )
+END_SEND_TABLE()
+
+
 
 // ------------------------------------------------------------------------------------------- //
 // DTTestClientSub and its DataTable.
@@ -831,10 +855,55 @@ bool WriteSendTable_R( SendTable *pTable, bf_write &bfWrite, bool bNeedsDecoder
 }
 
 
+// Encodes DT_DTIntTest with the compiled ops and with the generic encoders and makes
+// sure they write the same bytes, including for values that don't fit in the prop.
+static void RunIntEncodeTest( SendTable *pIntTable )
+{
+	static const int s_TestValues[] =
+	{
+		0, 1, -1, 15, -16, 16, -17, 127, -128, 128, -129, 200, -200, 255, 256, 1000, -1000,
+		0x12345678, (int)0x87654321, 0x7FFFFFFF, (int)0x80000000
+	};
+
+	ConVarRef dt_encodeops( "dt_encodeops" );
+
+	for ( int i=0; i < (int)ARRAYSIZE( s_TestValues ); i++ )
+	{
+		DTIntTestServer dtIntServer;
+		dtIntServer.m_Signed8 = dtIntServer.m_Signed5 = dtIntServer.m_Signed32 = s_TestValues[i];
+		dtIntServer.m_Unsigned8 = dtIntServer.m_Unsigned32 = s_TestValues[i];
+
+		ALIGN4 unsigned char opsEncoded[256] ALIGN4_POST;
+		ALIGN4 unsigned char genericEncoded[256] ALIGN4_POST;
+		memset( opsEncoded, 0, sizeof( opsEncoded ) );
+		memset( genericEncoded, 0, sizeof( genericEncoded ) );
+		bf_write bfOpsEncoded( "RunIntEncodeTest->bfOpsEncoded", opsEncoded, sizeof( opsEncoded ) );
+		bf_write bfGenericEncoded( "RunIntEncodeTest->bfGenericEncoded", genericEncoded, sizeof( genericEncoded ) );
+
+		// Int_Encode asserts on values that need more bits, which is the point here.
+		bool bAssertsDisabled = AreAllAssertsDisabled();
+		SetAllAssertsDisabled( true );
+
+		dt_encodeops.SetValue( 1 );
+		bool bOpsOk = SendTable_Encode( pIntTable, &dtIntServer, &bfOpsEncoded, -1, NULL );
+		dt_encodeops.SetValue( 0 );
+		bool bGenericOk = SendTable_Encode( pIntTable, &dtIntServer, &bfGenericEncoded, -1, NULL );
+		dt_encodeops.SetValue( 1 );
+
+		SetAllAssertsDisabled( bAssertsDisabled );
+
+		Verify( bOpsOk && bGenericOk );
+		Verify( bfOpsEncoded.GetNumBitsWritten() == bfGenericEncoded.GetNumBitsWritten() );
+		Verify( memcmp( opsEncoded, genericEncoded, sizeof( opsEncoded ) ) == 0 );
+	}
+}
+
+
 void RunDataTableTest()
 {
 	RecvTable *pRecvTable = &REFERENCE_RECV_TABLE(DT_DTTest);
 	SendTable *pSendTable = &REFERENCE_SEND_TABLE(DT_DTTest);
+	SendTable *pIntSendTable = &REFERENCE_SEND_TABLE(DT_DTIntTest);
 
 
 	ALIGN4 unsigned char buf[4096] ALIGN4_POST;
@@ -850,9 +919,12 @@ void RunDataTableTest()
 
 
 	// Initialize the send and receive modules.
-	SendTable_Init( &pSendTable, 1 );
+	SendTable *pSendTables[] = { pSendTable, pIntSendTable };
+	SendTable_Init( pSendTables, ARRAYSIZE( pSendTables ), &g_StandardSendProxies );
 	RecvTable_Init( &pRecvTable, 1 );
 
+	RunIntEncodeTest( pIntSendTable );
+
 	pSendTable->SetWriteFlag( false );
 	
 	// Send DataTable info to the client.
@@ -895,6 +967,7 @@ void RunDataTableTest()
 	memset(&dtServer, 0, sizeof(dtServer));
 	memset(&dtClient, 0, sizeof(dtClient));
 	memset(prevEncoded, 0, sizeof(prevEncoded));
+	int nPrevEncodedBits = 1; // Just the terminating zero bit of an empty state
 
 	SetGuardBytes( &dtClient );
 
@@ -932,6 +1005,47 @@ void RunDataTableTest()
 			Assert(false);
 		}
 
+		// The compiled encode ops must write exactly what the generic proxy path does.
+		ALIGN4 unsigned char genericEncoded[4096] ALIGN4_POST;
+		bf_write bfGenericEncoded( "RunDataTableTest->bfGenericEncoded", genericEncoded, sizeof(genericEncoded) );
+		ConVarRef dt_encodeops( "dt_encodeops" );
+		dt_encodeops.SetValue( 0 );
+		if( !SendTable_Encode( pSendTable, &dtServer, &bfGenericEncoded, -1, NULL ) )
+		{
+			Assert(false);
+		}
+		dt_encodeops.SetValue( 1 );
+
+		bf_read fullEncodedBits( "RunDataTableTest->fullEncodedBits", fullEncoded, sizeof( fullEncoded ), bfFullEncoded.GetNumBitsWritten() );
+		bf_read genericEncodedBits( "RunDataTableTest->genericEncodedBits", genericEncoded, sizeof( genericEncoded ), bfGenericEncoded.GetNumBitsWritten() );
+		Verify( bfGenericEncoded.GetNumBitsWritten() == bfFullEncoded.GetNumBitsWritten() );
+		Verify( !fullEncodedBits.CompareBitsAt( 0, &genericEncodedBits, 0, bfFullEncoded.GetNumBitsWritten() ) );
+
+		// Re-encoding every prop on top of the previous state must match a full encode too,
+		// and with nothing changed SendTable_EncodeChangedProps must just copy the state it's given.
+		unsigned short allProps[MAX_DATATABLE_PROPS];
+		int nAllProps = SendTable_GetNumFlatProps( pSendTable );
+		for ( int iProp=0; iProp < nAllProps; iProp++ )
+			allProps[iProp] = iProp;
+
+		ALIGN4 int splicedDeltaProps[MAX_DATATABLE_PROPS] ALIGN4_POST;
+		ALIGN4 unsigned char splicedEncoded[4096] ALIGN4_POST;
+		bf_write bfSplicedEncoded( "RunDataTableTest->bfSplicedEncoded", splicedEncoded, sizeof(splicedEncoded) );
+		int nSplicedDeltaProps = SendTable_EncodeChangedProps( pSendTable, &dtServer, prevEncoded, nPrevEncodedBits, 
+			allProps, nAllProps, &bfSplicedEncoded, -1, NULL, splicedDeltaProps, ARRAYSIZE( splicedDeltaProps ) );
+		
+		bf_read splicedEncodedBits( "RunDataTableTest->splicedEncodedBits", splicedEncoded, sizeof( splicedEncoded ), bfSplicedEncoded.GetNumBitsWritten() );
+		Verify( nSplicedDeltaProps >= 0 );
+		Verify( bfSplicedEncoded.GetNumBitsWritten() == bfFullEncoded.GetNumBitsWritten() );
+		Verify( !fullEncodedBits.CompareBitsAt( 0, &splicedEncodedBits, 0, bfFullEncoded.GetNumBitsWritten() ) );
+
+		bfSplicedEncoded.Reset();
+		nSplicedDeltaProps = SendTable_EncodeChangedProps( pSendTable, &dtServer, fullEncoded, bfFullEncoded.GetNumBitsWritten(), 
+			NULL, 0, &bfSplicedEncoded, -1, NULL, splicedDeltaProps, ARRAYSIZE( splicedDeltaProps ) );
+		Verify( nSplicedDeltaProps == 0 );
+		Verify( bfSplicedEncoded.GetNumBitsWritten() == bfFullEncoded.GetNumBitsWritten() );
+		Verify( !fullEncodedBits.CompareBitsAt( 0, &splicedEncodedBits, 0, bfFullEncoded.GetNumBitsWritten() ) );
+
 
 		ALIGN4 unsigned char deltaEncoded[4096] ALIGN4_POST;
 		bf_write bfDeltaEncoded( "RunDataTableTest->bfDeltaEncoded", deltaEncoded, sizeof(deltaEncoded) );
@@ -950,11 +1064,11 @@ void RunDataTableTest()
 			ALIGN4 int deltaProps[MAX_DATATABLE_PROPS] ALIGN4_POST;
 
 			bf_read fullEncodedRead( "RunDataTableTest->fullEncodedRead", fullEncoded, sizeof( fullEncoded ), bfFullEncoded.GetNumBitsWritten() );
-			bf_read prevEncodedRead( "RunDataTableTest->prevEncodedRead", prevEncoded, sizeof( prevEncoded ) );
+			bf_read prevEncodedRead( "RunDataTableTest->prevEncodedRead", prevEncoded, sizeof( prevEncoded ), nPrevEncodedBits );
 
 			int nDeltaProps = SendTable_CalcDelta( 
 				pSendTable, 
-				prevEncoded, sizeof( prevEncoded ) * 8, 
+				prevEncoded, nPrevEncodedBits, 
 				fullEncoded, bfFullEncoded.GetNumBitsWritten(),
 				deltaProps,
 				ARRAYSIZE( deltaProps ),
@@ -975,6 +1089,7 @@ void RunDataTableTest()
 		}
 
 		memcpy( prevEncoded, fullEncoded, sizeof( prevEncoded ) );
+		nPrevEncodedBits = bfFullEncoded.GetNumBitsWritten();
 
 
 		// This step isn't necessary to have the client decode the data but it's here to test
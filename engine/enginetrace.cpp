@@ -8,6 +8,7 @@
 //=============================================================================//
 
 #include "engine/IEngineTrace.h"
+#include "enginetrace.h"
 #include "icliententitylist.h"
 #include "ispatialpartitioninternal.h"
 #include "icliententity.h"
@@ -28,6 +29,8 @@
 #include "mathlib/polyhedron.h"
 #include "sys_dll.h"
 #include "vphysics/virtualmesh.h"
+#include "host.h"
+#include "tier1/generichash.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -41,6 +44,8 @@ enum
 	TRACE_STAT_COUNTER_TRACERAY = 0,
 	TRACE_STAT_COUNTER_POINTCONTENTS,
 	TRACE_STAT_COUNTER_ENUMERATE,
+	TRACE_STAT_COUNTER_WORLDCACHE_HIT,
+	TRACE_STAT_COUNTER_WORLDCACHE_MISS,
 	NUM_TRACE_STAT_COUNTER
 };
 
@@ -62,6 +67,105 @@ static CUtlVector<Ray_t> s_FrameRays;
 static CUtlVector<Ray_t> s_BenchmarkRays;
 #endif
 
+ConVar trace_worldcache( "trace_worldcache", "0", 0, "Reuse the world collision of identical traces within a tick." );
+
+// Batched traces share one entity query unless their bounds are this much bigger than the rays'
+#define TRACE_BATCH_MAX_VOLUME_RATIO	2.0f
+#define TRACE_BATCH_RAY_BLOAT			16.0f
+
+
+//-----------------------------------------------------------------------------
+// Remembers world traces for the current tick. The world can't move, so two
+// identical rays with the same mask hit it the same way whatever the filter.
+// Direct mapped, a colliding ray just replaces the older entry.
+//-----------------------------------------------------------------------------
+class CWorldTraceCache
+{
+public:
+	CWorldTraceCache();
+
+	bool	Lookup( const Ray_t &ray, unsigned int fMask, trace_t *pTrace );
+	void	Store( const Ray_t &ray, unsigned int fMask, const trace_t &trace );
+	void	Clear();
+
+private:
+	enum { CACHE_SIZE = 512 };	// Power of two
+
+	// No padding, compared and hashed as a block
+	struct Key_t
+	{
+		Vector			m_vecStart;
+		Vector			m_vecDelta;
+		Vector			m_vecStartOffset;
+		Vector			m_vecExtents;
+		unsigned int	m_fMask;
+		int				m_nFlags;
+	};
+
+	struct Entry_t
+	{
+		Key_t			m_Key;
+		int				m_nTick;	// host_tickcount the entry was made, -1 if empty
+		trace_t			m_Trace;
+	};
+
+	static void BuildKey( const Ray_t &ray, unsigned int fMask, Key_t *pKey );
+	Entry_t &EntryForKey( const Key_t &key )	{ return m_Entries[ HashBlock( &key, sizeof( key ) ) & ( CACHE_SIZE - 1 ) ]; }
+
+	Entry_t				m_Entries[CACHE_SIZE];
+	CThreadFastMutex	m_Mutex;
+};
+
+CWorldTraceCache::CWorldTraceCache()
+{
+	Clear();
+}
+
+void CWorldTraceCache::BuildKey( const Ray_t &ray, unsigned int fMask, Key_t *pKey )
+{
+	pKey->m_vecStart = ray.m_Start;
+	pKey->m_vecDelta = ray.m_Delta;
+	pKey->m_vecStartOffset = ray.m_StartOffset;
+	pKey->m_vecExtents = ray.m_Extents;
+	pKey->m_fMask = fMask;
+	pKey->m_nFlags = ( ray.m_IsRay ? 1 : 0 ) | ( ray.m_IsSwept ? 2 : 0 );
+}
+
+bool CWorldTraceCache::Lookup( const Ray_t &ray, unsigned int fMask, trace_t *pTrace )
+{
+	Key_t key;
+	BuildKey( ray, fMask, &key );
+
+	AUTO_LOCK( m_Mutex );
+	Entry_t &entry = EntryForKey( key );
+	if ( entry.m_nTick != host_tickcount || V_memcmp( &entry.m_Key, &key, sizeof( key ) ) )
+		return false;
+
+	*pTrace = entry.m_Trace;
+	return true;
+}
+
+void CWorldTraceCache::Store( const Ray_t &ray, unsigned int fMask, const trace_t &trace )
+{
+	Key_t key;
+	BuildKey( ray, fMask, &key );
+
+	AUTO_LOCK( m_Mutex );
+	Entry_t &entry = EntryForKey( key );
+	entry.m_Key = key;
+	entry.m_nTick = host_tickcount;
+	entry.m_Trace = trace;
+}
+
+void CWorldTraceCache::Clear()
+{
+	AUTO_LOCK( m_Mutex );
+	for ( int i = 0; i < CACHE_SIZE; i++ )
+	{
+		m_Entries[i].m_nTick = -1;
+	}
+}
+
 
 
 //-----------------------------------------------------------------------------
@@ -125,6 +229,12 @@ public:
 	// Walks bsp to find the leaf containing the specified point
 	virtual int GetLeafContainingPoint( const Vector &ptTest );
 
+	// Traces a batch of rays, sharing the entity query if they're close together
+	virtual void	TraceRays( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces );
+
+	// Forget cached world traces, the world is going away
+	void ClearWorldTraceCache() { m_WorldTraceCache.Clear(); }
+
 private:
 	// FIXME: Different versions for client + server. Eventually we need to make these go away
 	virtual void SetTraceEntity( ICollideable *pCollideable, trace_t *pTrace ) = 0;
@@ -158,9 +268,18 @@ private:
 
 	// Clips a trace to another trace
 	bool ClipTraceToTrace( trace_t &clipTrace, trace_t *pFinalTrace );
+
+	// The parts of TraceRay that TraceRays shares
+	bool TraceRayAgainstWorld( const Ray_t &ray, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTrace,
+		Ray_t *pEntityRay, float *pWorldFraction, float *pWorldFractionLeftSolidScale, bool bWorldTraced = false );
+	void WorldBoxTrace( const Ray_t &ray, unsigned int fMask, trace_t *pTrace );
+	void WorldBoxTraces( const Ray_t *pRays, int nRays, unsigned int fMask, trace_t *pTraces );
+	bool ShouldTraceAgainstEntity( IHandleEntity *pHandleEntity, unsigned int fMask, ITraceFilter *pTraceFilter, ICollideable **ppCollideable );
+	void FinishTraceRay( const Ray_t &ray, float flWorldFraction, float flWorldFractionLeftSolidScale, trace_t *pTrace );
 private:
-	int m_traceStatCounters[NUM_TRACE_STAT_COUNTER];
+	int32 volatile m_traceStatCounters[NUM_TRACE_STAT_COUNTER];	// bumped from worker threads too
 	const matrix3x4_t *m_pRootMoveParent;
+	CWorldTraceCache m_WorldTraceCache;
 	friend void RayBench( const CCommand &args );
 
 };
@@ -213,6 +332,34 @@ IEngineTrace *g_pEngineTraceServer = &s_EngineTraceServer;
 IEngineTrace *g_pEngineTraceClient = &s_EngineTraceClient;
 #endif
 
+//-----------------------------------------------------------------------------
+// Cached world traces point into the collision BSP
+//-----------------------------------------------------------------------------
+void EngineTraceClearCaches()
+{
+	s_EngineTraceServer.ClearWorldTraceCache();
+#ifndef SWDS
+	s_EngineTraceClient.ClearWorldTraceCache();
+#endif
+}
+
+static void PrintWorldTraceCacheStats( const char *pName, IEngineTrace *pEngineTrace, bool bClear )
+{
+	int nHits = pEngineTrace->GetStatByIndex( TRACE_STAT_COUNTER_WORLDCACHE_HIT, bClear );
+	int nMisses = pEngineTrace->GetStatByIndex( TRACE_STAT_COUNTER_WORLDCACHE_MISS, bClear );
+	int nTotal = nHits + nMisses;
+	ConMsg( "%s: %d hits, %d misses (%.1f%% hit rate)\n", pName, nHits, nMisses, nTotal ? 100.0f * nHits / nTotal : 0.0f );
+}
+
+CON_COMMAND( trace_worldcache_stats, "Print trace_worldcache hits and misses. Use 'trace_worldcache_stats clear' to reset them." )
+{
+	bool bClear = ( args.ArgC() > 1 ) && !Q_stricmp( args[1], "clear" );
+	PrintWorldTraceCacheStats( "server", g_pEngineTraceServer, bClear );
+#ifndef SWDS
+	PrintWorldTraceCacheStats( "client", g_pEngineTraceClient, bClear );
+#endif
+}
+
 //-----------------------------------------------------------------------------
 // Client-server neutral method of getting at collideables
 //-----------------------------------------------------------------------------
@@ -384,7 +531,7 @@ int	CEngineTrace::GetPointContents( const Vector &vecAbsPosition, IHandleEntity*
 	VPROF( "CEngineTrace_GetPointContents" );
 //	VPROF_BUDGET( "CEngineTrace_GetPointContents", "CEngineTrace_GetPointContents" );
 	
-	m_traceStatCounters[TRACE_STAT_COUNTER_POINTCONTENTS]++;
+	ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_POINTCONTENTS] );
 	// First check the collision model
 	int nContents = CM_PointContents( vecAbsPosition, 0 );
 	if ( nContents & MASK_CURRENT )
@@ -521,12 +668,11 @@ int CEngineTrace::GetStatByIndex( int index, bool bClear )
 {
 	if ( index >= NUM_TRACE_STAT_COUNTER )
 		return 0;
-	int out = m_traceStatCounters[index];
 	if ( bClear )
 	{
-		m_traceStatCounters[index] = 0;
+		return ThreadInterlockedExchange( &m_traceStatCounters[index], 0 );
 	}
-	return out;
+	return m_traceStatCounters[index];
 }
 
 
@@ -1677,7 +1823,7 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 
 	tmZone( TELEMETRY_LEVEL1, TMZF_NONE, "%s:%d", __FUNCTION__, __LINE__ );
 	VPROF_INCREMENT_COUNTER( "TraceRay", 1 );
-	m_traceStatCounters[TRACE_STAT_COUNTER_TRACERAY]++;
+	ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_TRACERAY] );
 //	VPROF_BUDGET( "CEngineTrace::TraceRay", "Ray/Hull Trace" );
 	
 	CTraceFilterHitAll traceFilter;
@@ -1686,7 +1832,53 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 		pTraceFilter = &traceFilter;
 	}
 
-	CM_ClearTrace( pTrace );
+	Ray_t entityRay;
+	float flWorldFraction, flWorldFractionLeftSolidScale;
+	if ( !TraceRayAgainstWorld( ray, fMask, pTraceFilter, pTrace, &entityRay, &flWorldFraction, &flWorldFractionLeftSolidScale ) )
+		return;
+
+	// Collide with entities along the ray
+	// FIXME: Hitbox code causes this to be re-entrant for the IK stuff.
+	// If we could eliminate that, this could be static and therefore
+	// not have to reallocate memory all the time
+	CEntityListAlongRay enumerator;
+	enumerator.Reset();
+	SpatialPartition()->EnumerateElementsAlongRay( SpatialPartitionMask(), entityRay, false, &enumerator );
+
+	trace_t tr;
+	ICollideable *pCollideable;
+	int nCount = enumerator.Count();
+	for ( int i = 0; i < nCount; ++i )
+	{
+		if ( !ShouldTraceAgainstEntity( enumerator.m_EntityHandles[i], fMask, pTraceFilter, &pCollideable ) )
+			continue;
+
+		ClipRayToCollideable( entityRay, fMask, pCollideable, &tr );
+
+		// Make sure the ray is always shorter than it currently is
+		ClipTraceToTrace( tr, pTrace );
+
+		// Stop if we're in allsolid
+		if (pTrace->allsolid)
+			break;
+	}
+
+	FinishTraceRay( ray, flWorldFraction, flWorldFractionLeftSolidScale, pTrace );
+}
+
+
+//-----------------------------------------------------------------------------
+// TraceRay against the world. Sets up the ray that entities need to be clipped
+// against, returns false if there's no need to look at entities.
+// bWorldTraced means pTrace already holds the WorldBoxTrace result.
+//-----------------------------------------------------------------------------
+bool CEngineTrace::TraceRayAgainstWorld( const Ray_t &ray, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTrace,
+	Ray_t *pEntityRay, float *pWorldFraction, float *pWorldFractionLeftSolidScale, bool bWorldTraced )
+{
+	if ( !bWorldTraced )
+	{
+		CM_ClearTrace( pTrace );
+	}
 
 	// Collide with the world.
 	if ( pTraceFilter->GetTraceType() != TRACE_ENTITIES_ONLY )
@@ -1701,16 +1893,19 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 		Assert(!pCollide || pCollide->GetCollisionOrigin() == vec3_origin );
 		Assert(!pCollide || pCollide->GetCollisionAngles() == vec3_angle );
 
-		CM_BoxTrace( ray, 0, fMask, true, *pTrace );
+		if ( !bWorldTraced )
+		{
+			WorldBoxTrace( ray, fMask, pTrace );
+		}
 		SetTraceEntity( pCollide, pTrace );
 
 		// inside world, no need to check being inside anything else
 		if ( pTrace->startsolid )
-			return;
+			return false;
 
 		// Early out if we only trace against the world
 		if ( pTraceFilter->GetTraceType() == TRACE_WORLD_ONLY )
-			return;
+			return false;
 	}
 	else
 	{
@@ -1721,17 +1916,18 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 	}
 
 	// Save the world collision fraction.
-	float flWorldFraction = pTrace->fraction;
-	float flWorldFractionLeftSolidScale = flWorldFraction;
+	*pWorldFraction = pTrace->fraction;
+	*pWorldFractionLeftSolidScale = pTrace->fraction;
 
 	// Create a ray that extends only until we hit the world
 	// and adjust the trace accordingly
-	Ray_t entityRay = ray;
+	Ray_t &entityRay = *pEntityRay;
+	entityRay = ray;
 
 	if ( pTrace->fraction == 0 )
 	{
 		entityRay.m_Delta.Init();
-		flWorldFractionLeftSolidScale = pTrace->fractionleftsolid;
+		*pWorldFractionLeftSolidScale = pTrace->fractionleftsolid;
 		pTrace->fractionleftsolid = 1.0f;
 		pTrace->fraction = 1.0f;
 	}
@@ -1750,67 +1946,113 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 		pTrace->fraction = 1.0;
 	}
 
-	// Collide with entities along the ray
-	// FIXME: Hitbox code causes this to be re-entrant for the IK stuff.
-	// If we could eliminate that, this could be static and therefore
-	// not have to reallocate memory all the time
-	CEntityListAlongRay enumerator;
-	enumerator.Reset();
-	SpatialPartition()->EnumerateElementsAlongRay( SpatialPartitionMask(), entityRay, false, &enumerator );
+	return true;
+}
 
-	bool bNoStaticProps = pTraceFilter->GetTraceType() == TRACE_ENTITIES_ONLY;
-	bool bFilterStaticProps = pTraceFilter->GetTraceType() == TRACE_EVERYTHING_FILTER_PROPS;
 
-	trace_t tr;
-	ICollideable *pCollideable;
-	const char *pDebugName;
-	int nCount = enumerator.Count();
-	for ( int i = 0; i < nCount; ++i )
+//-----------------------------------------------------------------------------
+// CM_BoxTrace against the world, through the per-tick cache if it's enabled
+//-----------------------------------------------------------------------------
+void CEngineTrace::WorldBoxTrace( const Ray_t &ray, unsigned int fMask, trace_t *pTrace )
+{
+	if ( !trace_worldcache.GetBool() )
 	{
-		// Generate a collideable
-		IHandleEntity *pHandleEntity = enumerator.m_EntityHandles[i];
-		HandleEntityToCollideable( pHandleEntity, &pCollideable, &pDebugName );
+		CM_BoxTrace( ray, 0, fMask, true, *pTrace );
+		return;
+	}
+
+	if ( m_WorldTraceCache.Lookup( ray, fMask, pTrace ) )
+	{
+		ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_WORLDCACHE_HIT] );
+		return;
+	}
+
+	ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_WORLDCACHE_MISS] );
+	CM_BoxTrace( ray, 0, fMask, true, *pTrace );
+	m_WorldTraceCache.Store( ray, fMask, *pTrace );
+}
+
+
+//-----------------------------------------------------------------------------
+// WorldBoxTrace for a batch of rays, what isn't cached goes through the tree in packets
+//-----------------------------------------------------------------------------
+void CEngineTrace::WorldBoxTraces( const Ray_t *pRays, int nRays, unsigned int fMask, trace_t *pTraces )
+{
+	if ( !trace_worldcache.GetBool() )
+	{
+		CM_BoxTraces( pRays, nRays, 0, fMask, true, pTraces );
+		return;
+	}
 
-		// Check for error condition
-		if ( IsPC() && IsDebug() && !IsSolid( pCollideable->GetSolid(), pCollideable->GetSolidFlags() ) )
+	CUtlVector< Ray_t > missedRays;
+	CUtlVectorFixedGrowable< int, 16 > missedIndices;
+	for ( int i = 0; i < nRays; i++ )
+	{
+		if ( m_WorldTraceCache.Lookup( pRays[i], fMask, &pTraces[i] ) )
 		{
-			Assert( 0 );
-			Msg( "%s in solid list (not solid)\n", pDebugName );
+			ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_WORLDCACHE_HIT] );
 			continue;
 		}
 
-		if ( !StaticPropMgr()->IsStaticProp( pHandleEntity ) )
-		{
-			if ( !pTraceFilter->ShouldHitEntity( pHandleEntity, fMask ) )
-				continue;
-		}
-		else
-		{
-			// FIXME: Could remove this check here by
-			// using a different spatial partition mask. Look into it
-			// if we want more speedups here.
-			if ( bNoStaticProps )
-				continue;
+		ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_WORLDCACHE_MISS] );
+		missedRays.AddToTail( pRays[i] );
+		missedIndices.AddToTail( i );
+	}
 
-			if ( bFilterStaticProps )
-			{
-				if ( !pTraceFilter->ShouldHitEntity( pHandleEntity, fMask ) )
-					continue;
-			}
-		}
+	if ( !missedRays.Count() )
+		return;
 
-		ClipRayToCollideable( entityRay, fMask, pCollideable, &tr );
+	CUtlVector< trace_t > missedTraces;
+	missedTraces.SetCount( missedRays.Count() );
+	CM_BoxTraces( missedRays.Base(), missedRays.Count(), 0, fMask, true, missedTraces.Base() );
 
-		// Make sure the ray is always shorter than it currently is
-		ClipTraceToTrace( tr, pTrace );
+	for ( int i = 0; i < missedRays.Count(); i++ )
+	{
+		m_WorldTraceCache.Store( missedRays[i], fMask, missedTraces[i] );
+		pTraces[ missedIndices[i] ] = missedTraces[i];
+	}
+}
 
-		// Stop if we're in allsolid
-		if (pTrace->allsolid)
-			break;
+
+//-----------------------------------------------------------------------------
+// Runs an entity from the spatial partition through the trace filter
+//-----------------------------------------------------------------------------
+bool CEngineTrace::ShouldTraceAgainstEntity( IHandleEntity *pHandleEntity, unsigned int fMask, ITraceFilter *pTraceFilter, ICollideable **ppCollideable )
+{
+	// Generate a collideable
+	const char *pDebugName;
+	HandleEntityToCollideable( pHandleEntity, ppCollideable, &pDebugName );
+
+	// Check for error condition
+	if ( IsPC() && IsDebug() && !IsSolid( (*ppCollideable)->GetSolid(), (*ppCollideable)->GetSolidFlags() ) )
+	{
+		Assert( 0 );
+		Msg( "%s in solid list (not solid)\n", pDebugName );
+		return false;
 	}
 
-	// Fix up the fractions so they are appropriate given the original
-	// unclipped-to-world ray
+	if ( !StaticPropMgr()->IsStaticProp( pHandleEntity ) )
+		return pTraceFilter->ShouldHitEntity( pHandleEntity, fMask );
+
+	// FIXME: Could remove this check here by
+	// using a different spatial partition mask. Look into it
+	// if we want more speedups here.
+	if ( pTraceFilter->GetTraceType() == TRACE_ENTITIES_ONLY )
+		return false;
+
+	if ( pTraceFilter->GetTraceType() == TRACE_EVERYTHING_FILTER_PROPS )
+		return pTraceFilter->ShouldHitEntity( pHandleEntity, fMask );
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Fix up the fractions so they are appropriate given the original
+// unclipped-to-world ray
+//-----------------------------------------------------------------------------
+void CEngineTrace::FinishTraceRay( const Ray_t &ray, float flWorldFraction, float flWorldFractionLeftSolidScale, trace_t *pTrace )
+{
 	pTrace->fraction *= flWorldFraction;
 	pTrace->fractionleftsolid *= flWorldFractionLeftSolidScale;
 
@@ -1837,6 +2079,258 @@ void CEngineTrace::TraceRay( const Ray_t &ray, unsigned int fMask, ITraceFilter
 }
 
 
+//-----------------------------------------------------------------------------
+// Bounds of the volume a ray sweeps through
+//-----------------------------------------------------------------------------
+static void RaySweptBounds( const Ray_t &ray, float flBloat, Vector *pMins, Vector *pMaxs )
+{
+	Vector vecEnd;
+	VectorAdd( ray.m_Start, ray.m_Delta, vecEnd );
+	VectorMin( ray.m_Start, vecEnd, *pMins );
+	VectorMax( ray.m_Start, vecEnd, *pMaxs );
+
+	Vector vecBloat( ray.m_Extents.x + flBloat, ray.m_Extents.y + flBloat, ray.m_Extents.z + flBloat );
+	*pMins -= vecBloat;
+	*pMaxs += vecBloat;
+}
+
+//-----------------------------------------------------------------------------
+// An entity TraceRays clips its rays against
+//-----------------------------------------------------------------------------
+struct TraceBatchEntity_t
+{
+	ICollideable	*m_pCollideable;
+	Vector			m_vecMins;
+	Vector			m_vecMaxs;
+};
+
+//-----------------------------------------------------------------------------
+// TraceRay for a batch of rays. Rays that lie close together go through the
+// world in packets and get their entities from one box query instead of a walk
+// along each ray, and the filter is asked about each entity once. Far apart
+// rays just run one by one.
+//-----------------------------------------------------------------------------
+void CEngineTrace::TraceRays( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces )
+{
+	VPROF_INCREMENT_COUNTER( "TraceRays", 1 );
+
+	CTraceFilterHitAll traceFilter;
+	if ( !pTraceFilter )
+	{
+		pTraceFilter = &traceFilter;
+	}
+
+	bool bCoherent = ( nRays > 1 );
+
+	Vector vecBatchMins, vecBatchMaxs;
+	if ( bCoherent )
+	{
+		// Only worth it if the batch doesn't cover much more space than the rays themselves
+		float flRayVolume = 0.0f;
+		for ( int i = 0; i < nRays; i++ )
+		{
+			Vector vecMins, vecMaxs;
+			RaySweptBounds( pRays[i], TRACE_BATCH_RAY_BLOAT, &vecMins, &vecMaxs );
+			flRayVolume += ( vecMaxs.x - vecMins.x ) * ( vecMaxs.y - vecMins.y ) * ( vecMaxs.z - vecMins.z );
+
+			RaySweptBounds( pRays[i], 0.0f, &vecMins, &vecMaxs );
+			if ( i == 0 )
+			{
+				vecBatchMins = vecMins;
+				vecBatchMaxs = vecMaxs;
+			}
+			else
+			{
+				VectorMin( vecBatchMins, vecMins, vecBatchMins );
+				VectorMax( vecBatchMaxs, vecMaxs, vecBatchMaxs );
+			}
+		}
+
+		Vector vecBatchSize = vecBatchMaxs - vecBatchMins;
+		bCoherent = ( vecBatchSize.x * vecBatchSize.y * vecBatchSize.z <= flRayVolume * TRACE_BATCH_MAX_VOLUME_RATIO );
+	}
+
+	if ( !bCoherent )
+	{
+		for ( int i = 0; i < nRays; i++ )
+		{
+			TraceRay( pRays[i], fMask, pTraceFilter, &pTraces[i] );
+		}
+		return;
+	}
+
+	bool bWorldTraced = ( pTraceFilter->GetTraceType() != TRACE_ENTITIES_ONLY );
+	if ( bWorldTraced )
+	{
+		WorldBoxTraces( pRays, nRays, fMask, pTraces );
+	}
+
+	CEntityListAlongRay enumerator;
+	enumerator.Reset();
+	if ( pTraceFilter->GetTraceType() != TRACE_WORLD_ONLY )
+	{
+		SpatialPartition()->EnumerateElementsInBox( SpatialPartitionMask(), vecBatchMins, vecBatchMaxs, false, &enumerator );
+	}
+
+	// Filter once for the batch, keep the bounds to cull entities per ray like the partition would
+	CUtlVector< TraceBatchEntity_t > entities;
+	for ( int i = 0; i < enumerator.Count(); ++i )
+	{
+		ICollideable *pCollideable;
+		if ( !ShouldTraceAgainstEntity( enumerator.m_EntityHandles[i], fMask, pTraceFilter, &pCollideable ) )
+			continue;
+
+		TraceBatchEntity_t &entity = entities[ entities.AddToTail() ];
+		entity.m_pCollideable = pCollideable;
+		pCollideable->WorldSpaceSurroundingBounds( &entity.m_vecMins, &entity.m_vecMaxs );
+	}
+
+	trace_t tr;
+	for ( int i = 0; i < nRays; i++ )
+	{
+		const Ray_t &ray = pRays[i];
+		trace_t *pTrace = &pTraces[i];
+
+		VPROF_INCREMENT_COUNTER( "TraceRay", 1 );
+		ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_TRACERAY] );
+
+		Ray_t entityRay;
+		float flWorldFraction, flWorldFractionLeftSolidScale;
+		if ( !TraceRayAgainstWorld( ray, fMask, pTraceFilter, pTrace, &entityRay, &flWorldFraction, &flWorldFractionLeftSolidScale, bWorldTraced ) )
+			continue;
+
+		for ( int j = 0; j < entities.Count(); ++j )
+		{
+			const TraceBatchEntity_t &entity = entities[j];
+			if ( !IsBoxIntersectingRay( entity.m_vecMins, entity.m_vecMaxs, entityRay, 1.0f ) )
+				continue;
+
+			ClipRayToCollideable( entityRay, fMask, entity.m_pCollideable, &tr );
+
+			// Make sure the ray is always shorter than it currently is
+			ClipTraceToTrace( tr, pTrace );
+
+			// Stop if we're in allsolid
+			if ( pTrace->allsolid )
+				break;
+		}
+
+		FinishTraceRay( ray, flWorldFraction, flWorldFractionLeftSolidScale, pTrace );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Traces fans of rays at solid server entities with TraceRays, then each ray
+// again with TraceRay, and reports every ray where the two disagree.
+//-----------------------------------------------------------------------------
+static bool TraceBatchCheckMatches( const trace_t &single, const trace_t &batch )
+{
+	if ( fabsf( single.fraction - batch.fraction ) > 1e-4f )
+		return false;
+	if ( single.startsolid != batch.startsolid || single.allsolid != batch.allsolid )
+		return false;
+	if ( single.m_pEnt != batch.m_pEnt )
+		return false;
+	if ( !VectorsAreEqual( single.endpos, batch.endpos, 0.01f ) )
+		return false;
+	if ( single.DidHit() && ( !VectorsAreEqual( single.plane.normal, batch.plane.normal, 1e-3f ) || fabsf( single.plane.dist - batch.plane.dist ) > 0.01f ) )
+		return false;
+	return true;
+}
+
+CON_COMMAND( trace_batch_check, "Check that TraceRays gives the same results as TraceRay. Usage: trace_batch_check [fans] [spread degrees] [hull]" )
+{
+	if ( !sv.IsActive() )
+	{
+		ConMsg( "trace_batch_check: no server running\n" );
+		return;
+	}
+
+	int nFans = ( args.ArgC() > 1 ) ? MAX( 1, Q_atoi( args[1] ) ) : 1000;
+	float flSpread = ( args.ArgC() > 2 ) ? Q_atof( args[2] ) : 2.0f;
+	bool bHull = ( args.ArgC() > 3 ) && !Q_stricmp( args[3], "hull" );
+	Vector vecHull = bHull ? Vector( 16, 16, 36 ) : vec3_origin;
+
+	CUtlVector< Vector > targets;
+	for ( int i = 1; i < sv.num_edicts; i++ )
+	{
+		edict_t *pEdict = &sv.edicts[i];
+		ICollideable *pCollide = pEdict->IsFree() ? NULL : pEdict->GetCollideable();
+		if ( !pCollide || pCollide->GetSolid() == SOLID_NONE )
+			continue;
+
+		Vector vecMins, vecMaxs;
+		pCollide->WorldSpaceSurroundingBounds( &vecMins, &vecMaxs );
+		targets.AddToTail( ( vecMins + vecMaxs ) * 0.5f );
+	}
+
+	if ( !targets.Count() )
+	{
+		ConMsg( "trace_batch_check: no solid entities\n" );
+		return;
+	}
+
+	CUniformRandomStream random;
+	random.SetSeed( 0x5eed );
+
+	const int nFanRays = 4;
+	Ray_t rays[nFanRays];
+	trace_t batchTraces[nFanRays];
+	int nMismatches = 0;
+	int nEntityHits = 0;
+
+	for ( int i = 0; i < nFans; i++ )
+	{
+		// From somewhere near a solid entity, towards it and past it
+		const Vector &vecTarget = targets[ random.RandomInt( 0, targets.Count() - 1 ) ];
+		Vector vecStart( vecTarget.x + random.RandomFloat( -256.0f, 256.0f ),
+			vecTarget.y + random.RandomFloat( -256.0f, 256.0f ),
+			vecTarget.z + random.RandomFloat( -256.0f, 256.0f ) );
+
+		QAngle angAim;
+		VectorAngles( vecTarget - vecStart, angAim );
+
+		for ( int j = 0; j < nFanRays; j++ )
+		{
+			QAngle angRay( angAim.x + random.RandomFloat( -flSpread, flSpread ), angAim.y + random.RandomFloat( -flSpread, flSpread ), 0.0f );
+			Vector vecDir;
+			AngleVectors( angRay, &vecDir );
+
+			Vector vecEnd;
+			VectorMA( vecStart, 512.0f, vecDir, vecEnd );
+			rays[j].Init( vecStart, vecEnd, -vecHull, vecHull );
+		}
+
+		s_EngineTraceServer.TraceRays( rays, nFanRays, MASK_SOLID, NULL, batchTraces );
+
+		for ( int j = 0; j < nFanRays; j++ )
+		{
+			trace_t single;
+			s_EngineTraceServer.TraceRay( rays[j], MASK_SOLID, NULL, &single );
+
+			if ( single.m_pEnt && single.m_pEnt != (CBaseEntity *)sv.edicts->GetIServerEntity() )
+			{
+				++nEntityHits;
+			}
+
+			if ( !TraceBatchCheckMatches( single, batchTraces[j] ) )
+			{
+				++nMismatches;
+				ConMsg( "  ray %d: fraction %.4f / %.4f, endpos (%.2f %.2f %.2f) / (%.2f %.2f %.2f), entity %p / %p\n",
+					i * nFanRays + j, single.fraction, batchTraces[j].fraction,
+					single.endpos.x, single.endpos.y, single.endpos.z,
+					batchTraces[j].endpos.x, batchTraces[j].endpos.y, batchTraces[j].endpos.z,
+					single.m_pEnt, batchTraces[j].m_pEnt );
+			}
+		}
+	}
+
+	ConMsg( "trace_batch_check: %d %s, %d entity hits, %d mismatches\n",
+		nFans * nFanRays, bHull ? "hulls" : "lines", nEntityHits, nMismatches );
+	Assert( nMismatches == 0 );
+}
+
+
 //-----------------------------------------------------------------------------
 // A version that sweeps a collideable through the world
 //-----------------------------------------------------------------------------
@@ -1892,7 +2386,7 @@ private:
 //-----------------------------------------------------------------------------
 void CEngineTrace::EnumerateEntities( const Ray_t &ray, bool bTriggers, IEntityEnumerator *pEnumerator )
 {
-	m_traceStatCounters[TRACE_STAT_COUNTER_ENUMERATE]++;
+	ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_ENUMERATE] );
 	// FIXME: If we store CBaseHandles directly in the spatial partition, this method
 	// basically becomes obsolete. The spatial partition can be queried directly.
 	CEnumerationFilter enumerator( this, pEnumerator );
@@ -1912,7 +2406,7 @@ void CEngineTrace::EnumerateEntities( const Ray_t &ray, bool bTriggers, IEntityE
 //-----------------------------------------------------------------------------
 void CEngineTrace::EnumerateEntities( const Vector &vecAbsMins, const Vector &vecAbsMaxs, IEntityEnumerator *pEnumerator )
 {
-	m_traceStatCounters[TRACE_STAT_COUNTER_ENUMERATE]++;
+	ThreadInterlockedIncrement( &m_traceStatCounters[TRACE_STAT_COUNTER_ENUMERATE] );
 	// FIXME: If we store CBaseHandles directly in the spatial partition, this method
 	// basically becomes obsolete. The spatial partition can be queried directly.
 	CEnumerationFilter enumerator( this, pEnumerator );
@@ -26,5 +26,10 @@ extern IEngineTrace *g_pEngineTraceClient;
 //-----------------------------------------------------------------------------
 void EngineTraceRenderRayCasts();
 
+//-----------------------------------------------------------------------------
+// Drops anything cached about the world, called when the collision BSP is freed
+//-----------------------------------------------------------------------------
+void EngineTraceClearCaches();
+
 
 #endif // ENGINETRACE_H
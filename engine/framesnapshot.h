@@ -12,6 +12,7 @@
 
 #include <mempool.h>
 #include <utllinkedlist.h>
+#include <tier0/threadtools.h>
 
 
 class PackedEntity;
@@ -54,11 +55,37 @@ public:
 typedef struct
 {
 	PackedEntity	*pEntity;	// original packed entity
+	unsigned int	serial;		// pEntity->m_nCacheSerial when this entry was filled
 	int				counter;	// increaseing counter to find LRU entries
 	int				bits;		// uncompressed data length in bits
 	char			data[MAX_PACKEDENTITY_DATA]; // uncompressed data cache
 } UnpackedDataCache_t;
 
+//-----------------------------------------------------------------------------
+// Purpose: Per-thread state for CFrameSnapshotManager, so packing and sending
+//  threads don't contend on its mutex: a stash of free PackedEntity blocks that
+//  is refilled from and returned to the pool in batches, and the thread's own
+//  uncompressed packed entity cache.
+//-----------------------------------------------------------------------------
+class CPackedEntityThreadCache
+{
+public:
+	enum
+	{
+		MAX_FREE_BLOCKS = 64,
+		BLOCK_BATCH = 32,				// Blocks moved between the stash and the pool at a time.
+		NUM_UNPACKED_ENTRIES = 64,
+	};
+
+	void					*m_pFreeBlocks[MAX_FREE_BLOCKS];	// Unconstructed PackedEntity memory.
+	int						m_nFreeBlocks;
+
+	int						m_nUnpackedCounter;		// increase with every cache access
+	UnpackedDataCache_t		*m_pUnpacked;			// NUM_UNPACKED_ENTRIES, allocated on first use.
+
+	CPackedEntityThreadCache *m_pNext;				// All thread caches, so they can be flushed.
+};
+
 
 
 //-----------------------------------------------------------------------------
@@ -163,14 +190,32 @@ public:
 	// List of entities to explicitly delete
 	void			AddExplicitDelete( int iSlot );
 
+	// While snapshots are sent from job threads, snapshots whose last reference
+	// goes away are kept alive until EndDeferredDeletes so other threads can
+	// still walk the snapshot list (WriteTempEntities).
+	void			BeginDeferredDeletes();
+	void			EndDeferredDeletes();
+
 private:
 	void	DeleteFrameSnapshot( CFrameSnapshot* pSnapshot );
 
 	CUtlLinkedList<CFrameSnapshot*, unsigned short>		m_FrameSnapshots;
-	CClassMemoryPool< PackedEntity >					m_PackedEntitiesPool;
-
-	int								m_nPackedEntityCacheCounter;  // increase with every cache access
-	CUtlVector<UnpackedDataCache_t>	m_PackedEntityCache;	// cache for uncompressed packed entities
+	CThreadFastMutex									m_FrameSnapshotsMutex;	// guards m_FrameSnapshots and m_DeferredDeletes
+	CUtlVector<CFrameSnapshot*>							m_DeferredDeletes;
+	bool												m_bDeferDeletes;
+	CClassMemoryPool< PackedEntity >					m_PackedEntitiesPool;	// guarded by m_WriteMutex
+
+	CPackedEntityThreadCache	*GetThreadCache();
+	PackedEntity				*AllocPackedEntity();
+	void						FreePackedEntity( PackedEntity *pPackedEntity );
+
+	// Returns every thread's free blocks to the pool and empties their uncompressed caches.
+	// Only safe when no other thread is packing or sending.
+	void						FlushThreadCaches();
+
+	CTHREADLOCALPTR( CPackedEntityThreadCache )	m_pThreadCache;
+	CPackedEntityThreadCache	*m_pThreadCaches;		// guarded by m_WriteMutex
+	CInterlockedUInt			m_nPackedEntitySerial;
 
 	// The most recently sent packets for each entity
 	PackedEntityHandle_t	m_pPackedData[ MAX_EDICTS ];
@@ -1372,6 +1372,8 @@ CClientFrame *CHLTVServer::AddNewFrame( CClientFrame *clientFrame )
 
 void CHLTVServer::SendClientMessages ( bool bSendSnapshots )
 {
+	NET_BeginBatchedSend();
+
 	// build individual updates
 	for ( int i=0; i< m_Clients.Count(); i++ )
 	{
@@ -1398,6 +1400,8 @@ void CHLTVServer::SendClientMessages ( bool bSendSnapshots )
 		client->UpdateSendState();
 		client->m_fLastSendTime = net_time;
 	}
+
+	NET_FlushBatchedSend();
 }
 
 void CHLTVServer::UpdateStats( void )
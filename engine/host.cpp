@@ -102,6 +102,7 @@
 #endif
 #include "sys_mainwind.h"
 #include "host_phonehome.h"
+#include "host_tickstats.h"
 #ifndef SWDS
 #include "vgui_baseui_interface.h"
 #include "cl_steamauth.h"
@@ -548,6 +549,11 @@ CON_COMMAND( threadpool_run_tests, "" )
 		RunThreadPoolTests();
 	}
 }
+
+CON_COMMAND( threadpool_run_scaling, "Reports thread pool jobs/sec across thread counts" )
+{
+	RunThreadPoolScalingBenchmark();
+}
 #endif
 
 //-----------------------------------------------------------------------------
@@ -2669,7 +2675,9 @@ void _Host_RunFrame_Server( bool finaltick )
 
 	// Run the Server frame ( read, run physics, respond )
 	g_HostTimes.StartFrameSegment( FRAME_SEGMENT_SERVER );
+	g_TickStats.BeginTick();
 	SV_Frame ( finaltick );
+	g_TickStats.EndTick( sv.m_nTickCount, host_state.interval_per_tick, finaltick, sv.m_bSimulatingTicks );
 	g_HostTimes.EndFrameSegment( FRAME_SEGMENT_SERVER );
 
 	// Look for connectionless rcon packets on dedicated servers
@@ -4959,6 +4967,8 @@ void Host_Shutdown(void)
 
 	TRACESHUTDOWN( sv.Shutdown() );
 
+	TRACESHUTDOWN( g_TickStats.Stop() );
+
 	TRACESHUTDOWN( NET_Shutdown() );
 
 #ifndef SWDS
@@ -0,0 +1,322 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-tick server timing recorder, see host_tickstats.h
+//
+//=============================================================================
+
+#include "net_ws_headers.h"
+#include "host_tickstats.h"
+#include "tier1/netadr.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+CTickStatsRecorder g_TickStats;
+
+//-----------------------------------------------------------------------------
+// Purpose: Owns the ring buffer the server thread writes records into and the
+//  thread that drains it to the output. There is exactly one producer (the
+//  server thread) and one consumer (the writer thread), so the ring only needs
+//  a pair of monotonically increasing indices.
+//-----------------------------------------------------------------------------
+class CTickStatsWriter : public CThread
+{
+public:
+	enum
+	{
+		RING_SIZE = 1024,					// Power of two, 16 seconds at 64 ticks/s
+		RECORDS_PER_DATAGRAM = 24,			// Keeps datagrams well under a typical MTU
+	};
+
+	CTickStatsWriter();
+
+	bool	Open( const char *pTarget );
+	void	Close();
+
+	// Server thread
+	void	Push( const TickStatsRecord_t &record );
+
+private:
+	virtual int Run();
+
+	void	Drain();
+	void	Output( const TickStatsRecord_t *pRecords, int nRecords );
+	void	FillHeader( TickStatsHeader_t *pHeader, int nRecords ) const;
+
+	TickStatsRecord_t	m_Ring[RING_SIZE];
+	CInterlockedInt		m_nWriteIndex;		// Next slot the server thread fills
+	CInterlockedInt		m_nReadIndex;		// Next slot the writer thread drains
+	uint32				m_nDropped;			// Server thread only
+
+	FileHandle_t		m_hFile;
+	SOCKET				m_Socket;
+	netadr_t			m_Address;
+
+	CThreadEvent		m_hThreadEvent;
+	volatile bool		m_bThreadShouldExit;
+};
+
+static CTickStatsWriter g_TickStatsWriter;
+
+CTickStatsWriter::CTickStatsWriter()
+{
+	SetName( "TickStatsWriter" );
+	m_nDropped = 0;
+	m_hFile = FILESYSTEM_INVALID_HANDLE;
+	m_Socket = (SOCKET)-1;
+	m_bThreadShouldExit = false;
+}
+
+bool CTickStatsWriter::Open( const char *pTarget )
+{
+	Close();
+
+	m_nWriteIndex = 0;
+	m_nReadIndex = 0;
+	m_nDropped = 0;
+
+	if ( !Q_strnicmp( pTarget, "udp:", 4 ) )
+	{
+		if ( !NET_StringToAdr( pTarget + 4, &m_Address ) || !m_Address.GetPort() )
+		{
+			Warning( "host_tickstats: bad address '%s', expected udp:addr:port\n", pTarget + 4 );
+			return false;
+		}
+
+		m_Socket = socket( PF_INET, SOCK_DGRAM, IPPROTO_UDP );
+		if ( m_Socket == (SOCKET)-1 )
+		{
+			Warning( "host_tickstats: unable to create socket\n" );
+			return false;
+		}
+	}
+	else
+	{
+		m_hFile = g_pFileSystem->Open( pTarget, "wb" );
+		if ( m_hFile == FILESYSTEM_INVALID_HANDLE )
+		{
+			Warning( "host_tickstats: unable to open '%s' for writing\n", pTarget );
+			return false;
+		}
+
+		TickStatsHeader_t header;
+		FillHeader( &header, 0 );
+		g_pFileSystem->Write( &header, sizeof( header ), m_hFile );
+	}
+
+	m_bThreadShouldExit = false;
+	if ( !Start() )
+	{
+		Warning( "host_tickstats: unable to start writer thread\n" );
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void CTickStatsWriter::Close()
+{
+	if ( IsAlive() )
+	{
+		m_bThreadShouldExit = true;
+		m_hThreadEvent.Set();
+		Join();
+	}
+
+	if ( m_hFile != FILESYSTEM_INVALID_HANDLE )
+	{
+		g_pFileSystem->Close( m_hFile );
+		m_hFile = FILESYSTEM_INVALID_HANDLE;
+	}
+
+	if ( m_Socket != (SOCKET)-1 )
+	{
+		closesocket( m_Socket );
+		m_Socket = (SOCKET)-1;
+	}
+}
+
+void CTickStatsWriter::Push( const TickStatsRecord_t &record )
+{
+	int nWrite = m_nWriteIndex;
+	if ( nWrite - m_nReadIndex >= RING_SIZE )
+	{
+		// Writer fell behind, don't stall the server for it
+		++m_nDropped;
+		return;
+	}
+
+	TickStatsRecord_t &slot = m_Ring[nWrite & ( RING_SIZE - 1 )];
+	slot = record;
+	slot.m_nDropped = m_nDropped;
+	m_nDropped = 0;
+
+	// Publishing the index is an interlocked exchange, so the record is visible first
+	m_nWriteIndex = nWrite + 1;
+}
+
+int CTickStatsWriter::Run()
+{
+	while ( !m_bThreadShouldExit )
+	{
+		m_hThreadEvent.Wait( 100 );
+		Drain();
+	}
+
+	return 0;
+}
+
+void CTickStatsWriter::Drain()
+{
+	int nRead = m_nReadIndex;
+	int nWrite = m_nWriteIndex;
+
+	while ( nRead != nWrite )
+	{
+		// Hand out contiguous runs so the ring wrap needs no copy
+		int nSlot = nRead & ( RING_SIZE - 1 );
+		int nCount = MIN( nWrite - nRead, RING_SIZE - nSlot );
+		nCount = MIN( nCount, (int)RECORDS_PER_DATAGRAM );
+
+		Output( &m_Ring[nSlot], nCount );
+
+		nRead += nCount;
+		m_nReadIndex = nRead;
+	}
+}
+
+void CTickStatsWriter::Output( const TickStatsRecord_t *pRecords, int nRecords )
+{
+	if ( m_hFile != FILESYSTEM_INVALID_HANDLE )
+	{
+		g_pFileSystem->Write( pRecords, nRecords * sizeof( TickStatsRecord_t ), m_hFile );
+		return;
+	}
+
+	if ( m_Socket != (SOCKET)-1 )
+	{
+		char buf[ sizeof( TickStatsHeader_t ) + RECORDS_PER_DATAGRAM * sizeof( TickStatsRecord_t ) ];
+		FillHeader( (TickStatsHeader_t *)buf, nRecords );
+		Q_memcpy( buf + sizeof( TickStatsHeader_t ), pRecords, nRecords * sizeof( TickStatsRecord_t ) );
+
+		struct sockaddr addr;
+		m_Address.ToSockadr( &addr );
+
+		// Unreliable by design, a lost datagram just leaves a gap in the tick numbers
+		sendto( m_Socket, buf, sizeof( TickStatsHeader_t ) + nRecords * sizeof( TickStatsRecord_t ), 0, &addr, sizeof( addr ) );
+	}
+}
+
+void CTickStatsWriter::FillHeader( TickStatsHeader_t *pHeader, int nRecords ) const
+{
+	pHeader->m_nMagic = TICKSTATS_MAGIC;
+	pHeader->m_nVersion = TICKSTATS_VERSION;
+	pHeader->m_nPhaseCount = TICKSTATS_PHASE_COUNT;
+	pHeader->m_nRecordSize = sizeof( TickStatsRecord_t );
+	pHeader->m_nRecordCount = nRecords;
+	pHeader->m_nReserved = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// CTickStatsRecorder
+//-----------------------------------------------------------------------------
+CTickStatsRecorder::CTickStatsRecorder()
+{
+	COMPILE_TIME_ASSERT( sizeof( TickStatsHeader_t ) == 16 );
+	COMPILE_TIME_ASSERT( sizeof( TickStatsRecord_t ) == 28 + TICKSTATS_PHASE_COUNT * sizeof( uint32 ) );
+
+	m_bRecording = false;
+	m_bInTick = false;
+	m_flTickStart = 0.0;
+}
+
+bool CTickStatsRecorder::Start( const char *pTarget )
+{
+	Stop();
+
+	if ( !g_TickStatsWriter.Open( pTarget ) )
+		return false;
+
+	m_bRecording = true;
+	return true;
+}
+
+void CTickStatsRecorder::Stop()
+{
+	m_bRecording = false;
+	g_TickStatsWriter.Close();
+}
+
+void CTickStatsRecorder::BeginTick()
+{
+	m_bInTick = m_bRecording;
+	if ( !m_bInTick )
+		return;
+
+	for ( int i = 0; i < TICKSTATS_PHASE_COUNT; i++ )
+	{
+		m_flPhaseTime[i] = 0.0;
+	}
+	m_flTickStart = Plat_FloatTime();
+}
+
+void CTickStatsRecorder::EndTick( int nTick, float flInterval, bool bFinalTick, bool bSimulated )
+{
+	if ( !m_bInTick )
+		return;
+
+	m_bInTick = false;
+
+	double flTotal = Plat_FloatTime() - m_flTickStart;
+
+	TickStatsRecord_t record;
+	record.m_nStartUs = (uint64)( m_flTickStart * 1000000.0 );
+	record.m_nTick = nTick;
+	record.m_nDropped = 0;
+	record.m_nBudgetUs = (uint32)( flInterval * 1000000.0f );
+	record.m_nTotalUs = (uint32)( flTotal * 1000000.0 );
+	for ( int i = 0; i < TICKSTATS_PHASE_COUNT; i++ )
+	{
+		record.m_nPhaseUs[i] = (uint32)( m_flPhaseTime[i] * 1000000.0 );
+	}
+
+	record.m_nFlags = 0;
+	if ( bFinalTick )
+		record.m_nFlags |= TICKSTATS_FINAL_TICK;
+	if ( bSimulated )
+		record.m_nFlags |= TICKSTATS_SIMULATED;
+	if ( record.m_nTotalUs > record.m_nBudgetUs )
+		record.m_nFlags |= TICKSTATS_OVERRUN;
+
+	// Stop() may have closed the writer while this tick ran
+	if ( m_bRecording )
+	{
+		g_TickStatsWriter.Push( record );
+	}
+}
+
+CON_COMMAND( host_tickstats_record, "Stream per-tick server timings to a file or a UDP listener. Usage: host_tickstats_record <filename | udp:addr:port>" )
+{
+	// ArgS keeps "udp:addr:port" in one piece, the tokenizer breaks on ':'
+	if ( args.ArgC() < 2 )
+	{
+		ConMsg( "Usage: host_tickstats_record <filename | udp:addr:port>\n" );
+		return;
+	}
+
+	if ( g_TickStats.Start( args.ArgS() ) )
+	{
+		ConMsg( "Recording tick stats to %s\n", args.ArgS() );
+	}
+}
+
+CON_COMMAND( host_tickstats_stop, "Stop recording per-tick server timings." )
+{
+	if ( !g_TickStats.IsRecording() )
+		return;
+
+	g_TickStats.Stop();
+	ConMsg( "Stopped recording tick stats\n" );
+}
@@ -0,0 +1,118 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Per-tick server timing recorder. Phase durations for every server
+//			tick are pushed into a lock-free ring buffer on the server thread
+//			and streamed by a writer thread to a file or a UDP listener, so
+//			headless servers can be watched for tick overruns without a profiler.
+//
+//			Started with "host_tickstats_record <filename | udp:addr:port>" and
+//			stopped with "host_tickstats_stop".
+//
+//			Stream format (version 1, little endian):
+//
+//			A file starts with one TickStatsHeader_t (m_nRecordCount == 0) followed
+//			by TickStatsRecord_t entries until the end of the file.
+//
+//			Every UDP datagram is one TickStatsHeader_t followed by m_nRecordCount
+//			TickStatsRecord_t entries.
+//
+//			Readers must use m_nRecordSize and m_nPhaseCount from the header to step
+//			through records, so phases can be appended in later versions.
+//
+//=============================================================================
+
+#ifndef HOST_TICKSTATS_H
+#define HOST_TICKSTATS_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/platform.h"
+
+#define TICKSTATS_MAGIC		0x54534B54		// "TKST"
+#define TICKSTATS_VERSION	1
+
+// Phases of a server tick, in the order they run. Time not covered by a phase
+// is m_nTotalUs minus the sum of the phases.
+enum TickStatsPhase_t
+{
+	TICKSTATS_PHASE_SERVER_THINK = 0,	// IServerGameDLL::Think
+	TICKSTATS_PHASE_NET_RECEIVE,		// Reading packets and running usercmds (CBaseServer::RunFrame)
+	TICKSTATS_PHASE_GAME_FRAME,			// IServerGameDLL::GameFrame
+	TICKSTATS_PHASE_PACK_ENTITIES,		// Taking the snapshot and packing entities
+	TICKSTATS_PHASE_SEND_SNAPSHOTS,		// Building and sending client snapshots
+
+	TICKSTATS_PHASE_COUNT,
+};
+
+// Record flags
+#define TICKSTATS_FINAL_TICK	(1<<0)	// Last server tick of this host frame (snapshots are only sent then)
+#define TICKSTATS_SIMULATED		(1<<1)	// The game simulated this tick
+#define TICKSTATS_OVERRUN		(1<<2)	// m_nTotalUs exceeded m_nBudgetUs
+
+#pragma pack( push, 1 )
+struct TickStatsHeader_t
+{
+	uint32	m_nMagic;			// TICKSTATS_MAGIC
+	uint16	m_nVersion;			// TICKSTATS_VERSION
+	uint16	m_nPhaseCount;		// Entries in TickStatsRecord_t::m_nPhaseUs
+	uint16	m_nRecordSize;		// sizeof( TickStatsRecord_t )
+	uint16	m_nRecordCount;		// Records following this header in a datagram, 0 for files
+	uint32	m_nReserved;
+};
+
+struct TickStatsRecord_t
+{
+	uint64	m_nStartUs;			// Tick start, in microseconds of Plat_FloatTime
+	uint32	m_nTick;			// Server tick count after the tick ran
+	uint32	m_nFlags;			// TICKSTATS_ flags
+	uint32	m_nDropped;			// Records lost to a full ring buffer right before this one
+	uint32	m_nBudgetUs;		// Tick interval
+	uint32	m_nTotalUs;			// Whole server tick
+	uint32	m_nPhaseUs[TICKSTATS_PHASE_COUNT];
+};
+#pragma pack( pop )
+
+//-----------------------------------------------------------------------------
+// Purpose: Collects phase times for the current tick on the server thread.
+//  Everything is a no-op unless a recording is running.
+//-----------------------------------------------------------------------------
+class CTickStatsRecorder
+{
+public:
+	CTickStatsRecorder();
+
+	bool	Start( const char *pTarget );
+	void	Stop();
+	bool	IsRecording() const { return m_bRecording; }
+
+	void	BeginTick();
+	void	EndTick( int nTick, float flInterval, bool bFinalTick, bool bSimulated );
+
+	void	BeginPhase( TickStatsPhase_t phase )
+	{
+		if ( m_bInTick )
+		{
+			m_flPhaseStart[phase] = Plat_FloatTime();
+		}
+	}
+
+	void	EndPhase( TickStatsPhase_t phase )
+	{
+		if ( m_bInTick )
+		{
+			m_flPhaseTime[phase] += Plat_FloatTime() - m_flPhaseStart[phase];
+		}
+	}
+
+private:
+	volatile bool	m_bRecording;
+	bool			m_bInTick;
+	double			m_flTickStart;
+	double			m_flPhaseStart[TICKSTATS_PHASE_COUNT];
+	double			m_flPhaseTime[TICKSTATS_PHASE_COUNT];
+};
+
+extern CTickStatsRecorder g_TickStats;
+
+#endif // HOST_TICKSTATS_H
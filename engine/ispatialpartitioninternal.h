@@ -37,6 +37,10 @@ ISpatialPartitionInternal* SpatialPartition();
 ISpatialPartition *CreateSpatialPartition( const Vector& worldmin, const Vector& worldmax );
 void DestroySpatialPartition( ISpatialPartition * );
 
+#ifdef _DEBUG
+void RunSpatialPartitionTest();
+#endif
+
 
 //-----------------------------------------------------------------------------
 // Method to get at the singleton implementation of the spatial partition mgr
@@ -137,6 +137,9 @@ void		NET_OutOfBandPrintf(int sock, const netadr_t &adr, PRINTF_FORMAT_STRING co
 int			NET_SendPacket ( INetChannel *chan, int sock,  const netadr_t &to, const  unsigned char *data, int length, bf_write *pVoicePayload = NULL, bool bUseCompression = false );
 // Called periodically to maybe send any queued packets (up to 4 per frame)
 void		NET_SendQueuedPackets();
+// Collect outgoing datagrams and send them in as few syscalls as possible (net_batchudp)
+void		NET_BeginBatchedSend();
+void		NET_FlushBatchedSend();
 // Start set current network configuration
 void		NET_SetMutiplayer(bool multiplayer);
 // Set net_time
@@ -174,6 +177,25 @@ void NET_RemoveAllExtraSockets();
 
 const char *NET_ErrorString (int code); // translate a socket error into a friendly string
 
+// Pooled NET_MAX_MESSAGE sized buffers, so code that runs on job threads (parallel
+// snapshot send) doesn't need a full message on its stack
+struct NetScratchBuffer_t;
+NetScratchBuffer_t *NET_AllocScratchBuffer();
+void		NET_FreeScratchBuffer( NetScratchBuffer_t *pBuffer );
+byte		*NET_GetScratchBufferData( NetScratchBuffer_t *pBuffer );
+
+class CNetScratchBuffer
+{
+public:
+	CNetScratchBuffer() : m_pBuffer( NET_AllocScratchBuffer() ) {}
+	~CNetScratchBuffer() { NET_FreeScratchBuffer( m_pBuffer ); }
+
+	byte *Base() { return NET_GetScratchBufferData( m_pBuffer ); }
+
+private:
+	NetScratchBuffer_t *m_pBuffer;
+};
+
 //============================================================================
 
 // Message data
@@ -1574,7 +1574,7 @@ A 0 length will still generate a packet and deal with the reliable messages.
 */
 int CNetChan::SendDatagram(bf_write *datagram)
 {
-	ALIGN4 byte		send_buf[ NET_MAX_MESSAGE ] ALIGN4_POST;
+	CNetScratchBuffer send_buf;
 
 #ifndef NO_VCR
 	if ( vcr_verbose.GetInt() && datagram && datagram->GetNumBytesWritten() > 0 )
@@ -1618,7 +1618,7 @@ int CNetChan::SendDatagram(bf_write *datagram)
 		m_StreamReliable.Reset();
 	}
 
-	bf_write send( "CNetChan_TransmitBits->send", send_buf, sizeof(send_buf) );
+	bf_write send( "CNetChan_TransmitBits->send", send_buf.Base(), NET_MAX_MESSAGE );
 
 	// Prepare the packet header
 	// build packet flags
@@ -3070,10 +3070,11 @@ void CNetChan::IncrementQueuedPackets()
 
 void CNetChan::DecrementQueuedPackets()
 {
-	--m_nQueuedPackets;
-	Assert( m_nQueuedPackets >= 0 );
-	if ( m_nQueuedPackets < 0 )
+	if ( --m_nQueuedPackets < 0 )
+	{
+		Assert( 0 );
 		m_nQueuedPackets = 0;
+	}
 }
 
 bool CNetChan::HasQueuedPackets() const
@@ -3086,6 +3087,25 @@ bool CNetChan::HasQueuedPackets() const
 	return m_nQueuedPackets > 0;
 }
 
+void CNetChan::AccountBatchedSend( int nBytes )
+{
+	// SendDatagram only counted the UDP header, this is the rest of the last packet
+	netflow_t *pflow = &m_DataFlow[ FLOW_OUTGOING ];
+	if ( pflow->currentframe )
+	{
+		pflow->currentframe->size += nBytes;
+	}
+
+	FlowUpdate( FLOW_OUTGOING, nBytes );
+
+	m_fClearTime += (float)nBytes / (float)m_Rate;
+
+	if ( net_maxcleartime.GetFloat() > 0.0f )
+	{
+		m_fClearTime = min( m_fClearTime, net_time + net_maxcleartime.GetFloat() );
+	}
+}
+
 void CNetChan::SetInterpolationAmount( float flInterpolationAmount )
 {
 	m_flInterpolationAmount = flInterpolationAmount;
@@ -211,6 +211,8 @@ public:
 	void		IncrementQueuedPackets();
 	void		DecrementQueuedPackets();
 	bool		HasQueuedPackets() const;
+	// Counts a datagram that sat in the batched send queue once it has gone out
+	void		AccountBatchedSend( int nBytes );
 
 private:
 	
@@ -337,7 +339,7 @@ public:
 	INetChannelHandler			*m_MessageHandler;	// who registers and processes messages
 	CUtlVector<INetMessage*>	m_NetMessages;		// list of registered message
 	IDemoRecorder				*m_DemoRecorder;			// if != NULL points to a recording/playback demo object
-	int							m_nQueuedPackets;
+	CInterlockedInt				m_nQueuedPackets;	// decremented by the queued packet sender thread
 
 	float						m_flInterpolationAmount;
 	float						m_flRemoteFrameTime;
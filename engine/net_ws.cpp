@@ -191,6 +191,245 @@ static	int  net_error = 0;			// global error code updated with NET_GetLastError(
 static CUtlVectorMT< CUtlVector< CNetChan* > >			s_NetChannels;
 static CUtlVectorMT< CUtlVector< pendingsocket_t > >	s_PendingSockets;
 
+//-----------------------------------------------------------------------------
+// Address-keyed index over s_NetChannels so NET_FindNetChannel doesn't have to
+// walk every channel for each incoming datagram. Lookups only take a read lock,
+// which the packet processing threads can share; s_NetChannels stays the
+// authoritative list and is what the index is rebuilt from on collisions.
+//-----------------------------------------------------------------------------
+class CNetChannelIndex
+{
+public:
+	enum
+	{
+		NUM_BUCKETS = 256,	// must be a power of two
+	};
+
+	CNetChannelIndex()
+	{
+		ResetStats();
+	}
+
+	// Returns the first channel registered for this socket/address, or NULL
+	CNetChan *Find( int socket, const netadr_t &adr )
+	{
+		++m_nLookups;
+
+		if ( !IsIndexable( adr ) )
+		{
+			++m_nMisses;
+			return NULL;
+		}
+
+		Key_t key;
+		MakeKey( key, socket, adr );
+
+		CNetChan *pFound = NULL;
+		int nProbes = 0;
+
+		m_Lock.LockForRead();
+		const CUtlVector< Entry_t > &bucket = m_Buckets[ HashKey( key ) ];
+		for ( int i = 0; i < bucket.Count(); i++ )
+		{
+			++nProbes;
+			if ( bucket[i].m_Key == key )
+			{
+				pFound = bucket[i].m_pChan;
+				break;
+			}
+		}
+		m_Lock.UnlockRead();
+
+		m_nProbes += nProbes;
+		if ( pFound )
+		{
+			++m_nHits;
+		}
+		else
+		{
+			++m_nMisses;
+		}
+
+		return pFound;
+	}
+
+	// (Re)registers a channel under its current socket and remote address
+	void Insert( CNetChan *pChan )
+	{
+		m_Lock.LockForWrite();
+		RemoveInternal( pChan );
+
+		const netadr_t &adr = pChan->GetRemoteAddress();
+		if ( IsIndexable( adr ) )
+		{
+			Entry_t entry;
+			MakeKey( entry.m_Key, pChan->GetSocket(), adr );
+			entry.m_pChan = pChan;
+
+			// Keep the linear-scan semantics: the oldest channel for a given address wins,
+			// a forced duplicate only becomes visible once the older one is removed
+			CUtlVector< Entry_t > &bucket = m_Buckets[ HashKey( entry.m_Key ) ];
+			bool bDuplicate = false;
+			for ( int i = 0; i < bucket.Count(); i++ )
+			{
+				if ( bucket[i].m_Key == entry.m_Key )
+				{
+					bDuplicate = true;
+					break;
+				}
+			}
+
+			if ( !bDuplicate )
+			{
+				bucket.AddToTail( entry );
+			}
+		}
+		m_Lock.UnlockWrite();
+	}
+
+	// Removes a channel, promoting any other channel in pChannels that shares its key.
+	// Caller must hold the s_NetChannels lock and have already removed pChan from it.
+	void Remove( CNetChan *pChan, const CUtlVector< CNetChan* > &channels )
+	{
+		m_Lock.LockForWrite();
+		Key_t removedKey;
+		if ( RemoveInternal( pChan, &removedKey ) )
+		{
+			for ( int i = 0; i < channels.Count(); i++ )
+			{
+				CNetChan *pOther = channels[i];
+				if ( !IsIndexable( pOther->GetRemoteAddress() ) )
+					continue;
+
+				Entry_t entry;
+				MakeKey( entry.m_Key, pOther->GetSocket(), pOther->GetRemoteAddress() );
+				if ( entry.m_Key == removedKey )
+				{
+					entry.m_pChan = pOther;
+					m_Buckets[ HashKey( entry.m_Key ) ].AddToTail( entry );
+					break;
+				}
+			}
+		}
+		m_Lock.UnlockWrite();
+	}
+
+	void ResetStats()
+	{
+		m_nLookups = 0;
+		m_nHits = 0;
+		m_nMisses = 0;
+		m_nProbes = 0;
+	}
+
+	void PrintStats()
+	{
+		int nEntries = 0;
+		int nUsedBuckets = 0;
+		int nLongestChain = 0;
+
+		m_Lock.LockForRead();
+		for ( int i = 0; i < NUM_BUCKETS; i++ )
+		{
+			int nCount = m_Buckets[i].Count();
+			nEntries += nCount;
+			if ( nCount )
+			{
+				++nUsedBuckets;
+			}
+			nLongestChain = MAX( nLongestChain, nCount );
+		}
+		m_Lock.UnlockRead();
+
+		int nLookups = m_nLookups;
+		ConMsg( "Channel index: %d entries in %d/%d buckets, longest chain %d\n", nEntries, nUsedBuckets, NUM_BUCKETS, nLongestChain );
+		ConMsg( "- lookups: %d (hits %d, misses %d), avg compares per lookup %.2f\n\n",
+			nLookups, (int)m_nHits, (int)m_nMisses, nLookups ? (float)(int)m_nProbes / (float)nLookups : 0.0f );
+	}
+
+private:
+	struct Key_t
+	{
+		int				m_nSocket;
+		netadrtype_t	m_Type;
+		unsigned int	m_nIP;
+		unsigned short	m_nPort;
+
+		bool operator==( const Key_t &other ) const
+		{
+			return m_nSocket == other.m_nSocket && m_Type == other.m_Type && m_nIP == other.m_nIP && m_nPort == other.m_nPort;
+		}
+	};
+
+	struct Entry_t
+	{
+		Key_t		m_Key;
+		CNetChan	*m_pChan;
+	};
+
+	// Only address types that netadr_t::CompareAdr can match are indexed
+	static bool IsIndexable( const netadr_t &adr )
+	{
+		netadrtype_t type = adr.GetType();
+		return type == NA_IP || type == NA_LOOPBACK || type == NA_BROADCAST;
+	}
+
+	// Mirrors netadr_t::CompareAdr: loopback and broadcast addresses compare on type alone
+	static void MakeKey( Key_t &key, int socket, const netadr_t &adr )
+	{
+		key.m_nSocket = socket;
+		key.m_Type = adr.GetType();
+		if ( key.m_Type == NA_IP )
+		{
+			key.m_nIP = adr.GetIPNetworkByteOrder();
+			key.m_nPort = adr.GetPort();
+		}
+		else
+		{
+			key.m_nIP = 0;
+			key.m_nPort = 0;
+		}
+	}
+
+	static int HashKey( const Key_t &key )
+	{
+		unsigned nHash = HashIntConventional( (int)key.m_nIP );
+		nHash ^= HashIntConventional( ( (int)key.m_nPort << 8 ) ^ ( key.m_nSocket << 4 ) ^ (int)key.m_Type );
+		return nHash & ( NUM_BUCKETS - 1 );
+	}
+
+	bool RemoveInternal( CNetChan *pChan, Key_t *pRemovedKey = NULL )
+	{
+		for ( int i = 0; i < NUM_BUCKETS; i++ )
+		{
+			CUtlVector< Entry_t > &bucket = m_Buckets[i];
+			for ( int j = 0; j < bucket.Count(); j++ )
+			{
+				if ( bucket[j].m_pChan == pChan )
+				{
+					if ( pRemovedKey )
+					{
+						*pRemovedKey = bucket[j].m_Key;
+					}
+					bucket.FastRemove( j );
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	CThreadSpinRWLock		m_Lock;
+	CUtlVector< Entry_t >	m_Buckets[NUM_BUCKETS];
+
+	CInterlockedInt			m_nLookups;
+	CInterlockedInt			m_nHits;
+	CInterlockedInt			m_nMisses;
+	CInterlockedInt			m_nProbes;
+};
+
+static CNetChannelIndex s_NetChannelIndex;
+
 CTSQueue<loopback_t *> s_LoopBacks[LOOPBACK_SOCKETS];
 static netpacket_t*	s_pLagData[MAX_SOCKETS];  // List of lag structures, if fakelag is set.
 
@@ -418,33 +657,20 @@ bool NET_StringToAdr ( const char *s, netadr_t *a)
 
 CNetChan *NET_FindNetChannel(int socket, netadr_t &adr)
 {
-	AUTO_LOCK_FM( s_NetChannels );
-
-	int numChannels = s_NetChannels.Count();
-
-	for ( int i = 0; i < numChannels; i++ )
-	{
-		CNetChan * chan = s_NetChannels[i];
-
-		// sockets must match
-		if ( socket != chan->GetSocket() )
-			continue;
-
-		// and the IP:Port address 
-		if ( adr.CompareAdr( chan->GetRemoteAddress() )  )
-		{
-			return chan;	// found it
-		}
-	}
-
-	return NULL;	// no channel found
+	return s_NetChannelIndex.Find( socket, adr );
 }
 
+static void NET_FlushBatchedSendForSocket( int hSocket );
+static void NET_ClearBatchedSendsForChannel( INetChannel *netchan );
+
 void NET_CloseSocket( int hSocket, int sock = -1)
 {
 	if ( !hSocket )
 		return;
 
+	// datagrams still in the send batch for this socket go out before it closes
+	NET_FlushBatchedSendForSocket( hSocket );
+
 	// close socket handle
 	int ret;
 	VCR_NONPLAYBACKFN( closesocket( hSocket ), ret, "closesocket" );
@@ -808,6 +1034,12 @@ INetChannel *NET_CreateNetChannel(int socket, netadr_t *adr, const char * name,
 	// just reset and return
 	chan->Setup( socket, adr, name, handler, nProtocolVersion );
 
+	// index the channel under its (possibly new) address once Setup has assigned it
+	{
+		AUTO_LOCK_FM( s_NetChannels );
+		s_NetChannelIndex.Insert( chan );
+	}
+
 	return chan;
 }
 
@@ -826,8 +1058,10 @@ void NET_RemoveNetChannel(INetChannel *netchan, bool bDeleteNetChan)
 	}
 
 	s_NetChannels.FindAndRemove( static_cast<CNetChan*>(netchan) );
+	s_NetChannelIndex.Remove( static_cast<CNetChan*>(netchan), s_NetChannels );
 
 	NET_ClearQueuedPacketsForChannel( netchan );
+	NET_ClearBatchedSendsForChannel( netchan );
 	
 	if ( bDeleteNetChan )
 		delete netchan;
@@ -1400,6 +1634,318 @@ bool NET_GetLoopPacket ( netpacket_t * packet )
 	return ( NET_LagPacket( true, packet ) );	
 }
 
+//-----------------------------------------------------------------------------
+// Batched UDP I/O. On Linux, recvmmsg/sendmmsg let us move many datagrams per
+// syscall. Received datagrams are drained into a per-socket pool and handed
+// out one at a time to NET_ReceiveDatagram, so split packets, compression and
+// fake lag see exactly what a plain recvfrom would have returned. Outgoing
+// datagrams are only batched between NET_BeginBatchedSend/NET_FlushBatchedSend.
+// A queued datagram hasn't been sent, so its bytes are only counted against
+// the channel's rate and flow once NET_FlushBatchedSend has them on the wire.
+//-----------------------------------------------------------------------------
+#if defined( LINUX )
+#define NET_BATCHED_UDP
+#endif
+
+#ifdef NET_BATCHED_UDP
+
+static ConVar net_batchudp( "net_batchudp", "0", 0, "Use recvmmsg/sendmmsg to receive and send UDP datagrams in batches" );
+
+#define NET_BATCH_MAX_MESSAGES	16
+#define NET_BATCH_MAX_DATAGRAM	65536	// largest possible UDP payload
+
+struct netrecvbatch_t
+{
+	byte					*pBuffers;	// NET_BATCH_MAX_MESSAGES slots of NET_BATCH_MAX_DATAGRAM bytes
+	struct mmsghdr			msgs[NET_BATCH_MAX_MESSAGES];
+	struct iovec			iovs[NET_BATCH_MAX_MESSAGES];
+	struct sockaddr			from[NET_BATCH_MAX_MESSAGES];
+	int						nCount;		// datagrams received by the last recvmmsg
+	int						nNext;		// next datagram to hand out
+};
+
+struct netsentbytes_t
+{
+	CNetChan				*pChannel;
+	int						nBytes;
+};
+
+struct netsendbatch_t
+{
+	CThreadFastMutex		mutex;
+	SOCKET					hSocket;
+	int						nCount;
+	CUtlVector< byte >		data;
+	int						nOffset[NET_BATCH_MAX_MESSAGES];
+	int						nLength[NET_BATCH_MAX_MESSAGES];
+	struct sockaddr			to[NET_BATCH_MAX_MESSAGES];
+	int						nToLen[NET_BATCH_MAX_MESSAGES];
+	CNetChan				*pChannel[NET_BATCH_MAX_MESSAGES];	// NULL for out of band datagrams
+	CUtlVector< netsentbytes_t > sent;	// flushed but not yet counted by the channels
+};
+
+static netrecvbatch_t	*s_pRecvBatches[MAX_SOCKETS];
+static netsendbatch_t	s_SendBatch;
+static volatile bool	s_bSendBatchOpen = false;
+
+static bool NET_UseBatchedIO()
+{
+	// VCR has to see every individual recvfrom/sendto
+	return net_batchudp.GetBool() && VCRGetMode() == VCR_Disabled;
+}
+
+static void NET_DiscardBatchedReceives( int sock )
+{
+	if ( sock >= 0 && sock < MAX_SOCKETS && s_pRecvBatches[sock] )
+	{
+		s_pRecvBatches[sock]->nCount = 0;
+		s_pRecvBatches[sock]->nNext = 0;
+	}
+}
+
+static bool NET_HasBatchedReceives( int sock )
+{
+	netrecvbatch_t *pBatch = s_pRecvBatches[sock];
+	return pBatch && pBatch->nNext < pBatch->nCount;
+}
+
+static int NET_ReceiveBatched( int sock, SOCKET hSocket, char *buf, int len, struct sockaddr *from, int *fromlen )
+{
+	netrecvbatch_t *pBatch = s_pRecvBatches[sock];
+	if ( !pBatch )
+	{
+		pBatch = new netrecvbatch_t;
+		Q_memset( pBatch, 0, sizeof( *pBatch ) );
+		pBatch->pBuffers = new byte[ NET_BATCH_MAX_MESSAGES * NET_BATCH_MAX_DATAGRAM ];
+		s_pRecvBatches[sock] = pBatch;
+	}
+
+	if ( pBatch->nNext >= pBatch->nCount )
+	{
+		pBatch->nCount = 0;
+		pBatch->nNext = 0;
+
+		for ( int i = 0; i < NET_BATCH_MAX_MESSAGES; i++ )
+		{
+			pBatch->iovs[i].iov_base = pBatch->pBuffers + i * NET_BATCH_MAX_DATAGRAM;
+			pBatch->iovs[i].iov_len = NET_BATCH_MAX_DATAGRAM;
+
+			struct msghdr &hdr = pBatch->msgs[i].msg_hdr;
+			Q_memset( &hdr, 0, sizeof( hdr ) );
+			hdr.msg_name = &pBatch->from[i];
+			hdr.msg_namelen = sizeof( pBatch->from[i] );
+			hdr.msg_iov = &pBatch->iovs[i];
+			hdr.msg_iovlen = 1;
+			pBatch->msgs[i].msg_len = 0;
+		}
+
+		int ret;
+		{
+			VPROF_BUDGET( "recvmmsg", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+			ret = recvmmsg( hSocket, pBatch->msgs, NET_BATCH_MAX_MESSAGES, MSG_DONTWAIT, NULL );
+		}
+
+		if ( ret <= 0 )
+		{
+			if ( ret == 0 )
+			{
+				errno = EWOULDBLOCK;
+			}
+			return -1;	// errno is picked up by NET_GetLastError
+		}
+
+		pBatch->nCount = ret;
+	}
+
+	int nMsg = pBatch->nNext++;
+	int nSize = pBatch->msgs[nMsg].msg_len;
+	if ( nSize > len )
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	Q_memcpy( buf, pBatch->iovs[nMsg].iov_base, nSize );
+	Q_memcpy( from, &pBatch->from[nMsg], MIN( (int)sizeof( struct sockaddr ), *fromlen ) );
+	*fromlen = pBatch->msgs[nMsg].msg_hdr.msg_namelen;
+	return nSize;
+}
+
+// Caller must hold s_SendBatch.mutex
+static void NET_FlushSendBatchLocked()
+{
+	netsendbatch_t &batch = s_SendBatch;
+
+	struct mmsghdr msgs[NET_BATCH_MAX_MESSAGES];
+	struct iovec iovs[NET_BATCH_MAX_MESSAGES];
+	Q_memset( msgs, 0, sizeof( msgs ) );
+
+	for ( int i = 0; i < batch.nCount; i++ )
+	{
+		iovs[i].iov_base = batch.data.Base() + batch.nOffset[i];
+		iovs[i].iov_len = batch.nLength[i];
+		msgs[i].msg_hdr.msg_name = &batch.to[i];
+		msgs[i].msg_hdr.msg_namelen = batch.nToLen[i];
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int nSent = 0;
+	while ( nSent < batch.nCount )
+	{
+		int ret;
+		{
+			VPROF_BUDGET( "sendmmsg", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+			ret = sendmmsg( batch.hSocket, &msgs[nSent], batch.nCount - nSent, 0 );
+		}
+
+		if ( ret <= 0 )
+		{
+			// Drop the datagram that failed, like a failed sendto would, and keep going
+			if ( net_showudp.GetBool() )
+			{
+				ConDMsg( "NET_FlushBatchedSend: %s\n", NET_ErrorString( errno ) );
+			}
+			++nSent;
+			continue;
+		}
+
+		// Senders may still be using their channels, NET_FlushBatchedSend does the counting
+		for ( int i = nSent; i < nSent + ret; i++ )
+		{
+			if ( batch.pChannel[i] )
+			{
+				netsentbytes_t &bytes = batch.sent[ batch.sent.AddToTail() ];
+				bytes.pChannel = batch.pChannel[i];
+				bytes.nBytes = batch.nLength[i];
+			}
+		}
+
+		nSent += ret;
+	}
+
+	batch.nCount = 0;
+	batch.data.RemoveAll();
+}
+
+static int NET_SendBatched( SOCKET s, const char *buf, int len, const struct sockaddr *to, int tolen, CNetChan *pChannel )
+{
+	netsendbatch_t &batch = s_SendBatch;
+
+	if ( len > NET_BATCH_MAX_DATAGRAM || tolen > (int)sizeof( struct sockaddr ) )
+	{
+		return sendto( s, buf, len, 0, to, tolen );
+	}
+
+	AUTO_LOCK( batch.mutex );
+
+	// keep the order of datagrams on the wire: anything queued for another socket goes out first
+	if ( batch.nCount && ( batch.hSocket != s || batch.nCount == NET_BATCH_MAX_MESSAGES ) )
+	{
+		NET_FlushSendBatchLocked();
+	}
+
+	batch.hSocket = s;
+	batch.nOffset[batch.nCount] = batch.data.AddMultipleToTail( len, (const byte *)buf );
+	batch.nLength[batch.nCount] = len;
+	Q_memcpy( &batch.to[batch.nCount], to, tolen );
+	batch.nToLen[batch.nCount] = tolen;
+	batch.pChannel[batch.nCount] = pChannel;
+	++batch.nCount;
+
+	// nothing has gone out yet
+	return 0;
+}
+
+#endif // NET_BATCHED_UDP
+
+//-----------------------------------------------------------------------------
+// Purpose: Start collecting outgoing datagrams so they can be sent with one
+//			syscall per socket in NET_FlushBatchedSend. No-op unless net_batchudp is set.
+//-----------------------------------------------------------------------------
+void NET_BeginBatchedSend()
+{
+#ifdef NET_BATCHED_UDP
+	if ( NET_UseBatchedIO() )
+	{
+		s_bSendBatchOpen = true;
+	}
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Send everything collected since NET_BeginBatchedSend
+//-----------------------------------------------------------------------------
+void NET_FlushBatchedSend()
+{
+#ifdef NET_BATCHED_UDP
+	AUTO_LOCK( s_SendBatch.mutex );
+	s_bSendBatchOpen = false;
+	if ( s_SendBatch.nCount )
+	{
+		NET_FlushSendBatchLocked();
+	}
+
+	for ( int i = 0; i < s_SendBatch.sent.Count(); i++ )
+	{
+		s_SendBatch.sent[i].pChannel->AccountBatchedSend( s_SendBatch.sent[i].nBytes );
+	}
+	s_SendBatch.sent.RemoveAll();
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Send anything still batched for a socket that's about to close
+//-----------------------------------------------------------------------------
+static void NET_FlushBatchedSendForSocket( int hSocket )
+{
+#ifdef NET_BATCHED_UDP
+	AUTO_LOCK( s_SendBatch.mutex );
+	if ( s_SendBatch.nCount && s_SendBatch.hSocket == (SOCKET)hSocket )
+	{
+		NET_FlushSendBatchLocked();
+	}
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The channel is going away, its batched datagrams still go out
+//			but nothing will count them
+//-----------------------------------------------------------------------------
+static void NET_ClearBatchedSendsForChannel( INetChannel *netchan )
+{
+#ifdef NET_BATCHED_UDP
+	AUTO_LOCK( s_SendBatch.mutex );
+	for ( int i = 0; i < s_SendBatch.nCount; i++ )
+	{
+		if ( s_SendBatch.pChannel[i] == netchan )
+		{
+			s_SendBatch.pChannel[i] = NULL;
+		}
+	}
+
+	for ( int i = s_SendBatch.sent.Count(); --i >= 0; )
+	{
+		if ( s_SendBatch.sent[i].pChannel == netchan )
+		{
+			s_SendBatch.sent.Remove( i );
+		}
+	}
+#endif
+}
+
+static int NET_ReceiveFrom( int sock, SOCKET hSocket, char *buf, int len, struct sockaddr *from, int *fromlen )
+{
+#ifdef NET_BATCHED_UDP
+	// drain what is already pooled even if batching was just switched off
+	if ( NET_HasBatchedReceives( sock ) || NET_UseBatchedIO() )
+	{
+		return NET_ReceiveBatched( sock, hSocket, buf, len, from, fromlen );
+	}
+#endif
+	return VCRHook_recvfrom( hSocket, buf, len, 0, from, fromlen );
+}
+
 bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 {
 	VPROF_BUDGET( "NET_ReceiveDatagram", VPROF_BUDGETGROUP_OTHER_NETWORKING );
@@ -1414,7 +1960,7 @@ bool NET_ReceiveDatagram ( const int sock, netpacket_t * packet )
 	int ret = 0;
 	{
 		VPROF_BUDGET( "recvfrom", VPROF_BUDGETGROUP_OTHER_NETWORKING );
-		ret = VCRHook_recvfrom(net_socket, (char *)packet->data, NET_MAX_MESSAGE, 0, (struct sockaddr *)&from, (int *)&fromlen );
+		ret = NET_ReceiveFrom( packet->source, net_socket, (char *)packet->data, NET_MAX_MESSAGE, (struct sockaddr *)&from, &fromlen );
 	}
 	if ( ret >= NET_MIN_MESSAGE )
 	{
@@ -1814,6 +2360,26 @@ struct NetScratchBuffer_t : TSLNodeBase_t
 };
 CTSSimpleList<NetScratchBuffer_t> g_NetScratchBuffers;
 
+NetScratchBuffer_t *NET_AllocScratchBuffer()
+{
+	NetScratchBuffer_t *scratch = g_NetScratchBuffers.Pop();
+	if ( !scratch )
+	{
+		scratch = new NetScratchBuffer_t;
+	}
+	return scratch;
+}
+
+void NET_FreeScratchBuffer( NetScratchBuffer_t *pBuffer )
+{
+	g_NetScratchBuffers.Push( pBuffer );
+}
+
+byte *NET_GetScratchBufferData( NetScratchBuffer_t *pBuffer )
+{
+	return pBuffer->data;
+}
+
 void NET_ProcessSocket( int sock, IConnectionlessPacketHandler *handler )
 {
 	VPROF_BUDGET( "NET_ProcessSocket", VPROF_BUDGETGROUP_OTHER_NETWORKING );
@@ -1845,11 +2411,7 @@ void NET_ProcessSocket( int sock, IConnectionlessPacketHandler *handler )
 	}
 
 	// now get datagrams from sockets
-	NetScratchBuffer_t *scratch = g_NetScratchBuffers.Pop();
-	if ( !scratch )
-	{
-		scratch = new NetScratchBuffer_t;
-	}
+	NetScratchBuffer_t *scratch = NET_AllocScratchBuffer();
 	while ( ( packet = NET_GetPacket ( sock, scratch->data ) ) != NULL )
 	{
 		if ( Filter_ShouldDiscard ( packet->from ) )	// filtering is done by network layer
@@ -1885,7 +2447,7 @@ void NET_ProcessSocket( int sock, IConnectionlessPacketHandler *handler )
 			Msg ("Sequenced packet without connection from %s\n" , packet->from.ToString() );
 		}*/
 	}
-	g_NetScratchBuffers.Push( scratch );
+	NET_FreeScratchBuffer( scratch );
 }
 
 void NET_LogBadPacket(netpacket_t * packet)
@@ -1922,7 +2484,11 @@ void NET_LogBadPacket(netpacket_t * packet)
 	}
 }
 
-int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockaddr FAR * to, int tolen, int iGameDataLength )
+//-----------------------------------------------------------------------------
+// Purpose: Returns the bytes sent, 0 if the datagram was only queued in the send
+//			batch. pChannel is credited with queued bytes once they go out.
+//-----------------------------------------------------------------------------
+int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockaddr FAR * to, int tolen, int iGameDataLength, CNetChan *pChannel )
 {
 	int nSend = 0;
 #if defined( _X360 )
@@ -1950,6 +2516,13 @@ int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockad
 	}
 	else
 #endif //defined( _X360 )
+#ifdef NET_BATCHED_UDP
+	if ( s_bSendBatchOpen )
+	{
+		nSend = NET_SendBatched( s, buf, len, to, tolen, pChannel );
+	}
+	else
+#endif
 	{
 		nSend = sendto( s, buf, len, 0, to, tolen );
 	}
@@ -1970,7 +2543,7 @@ int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockad
 //-----------------------------------------------------------------------------
 bool CL_IsHL2Demo();
 bool CL_IsPortalDemo();
-int NET_SendTo( bool verbose, SOCKET s, const char FAR * buf, int len, const struct sockaddr FAR * to, int tolen, int iGameDataLength )
+int NET_SendTo( bool verbose, SOCKET s, const char FAR * buf, int len, const struct sockaddr FAR * to, int tolen, int iGameDataLength, CNetChan *pChannel = NULL )
 {	
 	int nSend = 0;
 
@@ -2016,7 +2589,8 @@ int NET_SendTo( bool verbose, SOCKET s, const char FAR * buf, int len, const str
 			len,
 			to, 
 			tolen, 
-			iGameDataLength 
+			iGameDataLength,
+			pChannel
 		);
 	}
 
@@ -2101,6 +2675,7 @@ struct SendQueue_t
 	}
 	int									m_nHostFrame;
 	CUtlLinkedList< SendQueueItem_t >	m_SendQueue;
+	CThreadFastMutex					m_Mutex;	// split packets may be queued from parallel snapshot sends
 };
 
 static SendQueue_t g_SendQueue;
@@ -2115,6 +2690,7 @@ int NET_QueuePacketForSend( CNetChan *chan, bool verbose, SOCKET s, const char F
 	else
 	{
 		Assert( chan );
+		AUTO_LOCK( g_SendQueue.m_Mutex );
 		// Set up data structure
 		SendQueueItem_t *sq = &g_SendQueue.m_SendQueue[ g_SendQueue.m_SendQueue.AddToTail() ];
 		sq->m_Socket = s;
@@ -2145,6 +2721,7 @@ void NET_SendQueuedPacket( SendQueueItem_t *sq )
 
 void NET_ClearQueuedPacketsForChannel( INetChannel *channel )
 {
+	AUTO_LOCK( g_SendQueue.m_Mutex );
 	CUtlLinkedList< SendQueueItem_t >& list = g_SendQueue.m_SendQueue;
 
 	for ( unsigned short i = list.Head(); i != list.InvalidIndex();  )
@@ -2166,6 +2743,7 @@ void NET_SendQueuedPackets()
 		return;
 	g_SendQueue.m_nHostFrame = host_framecount;
 
+	AUTO_LOCK( g_SendQueue.m_Mutex );
 	CUtlLinkedList< SendQueueItem_t >& list = g_SendQueue.m_SendQueue;
 
 	int nRemaining = net_splitrate.GetInt();
@@ -2287,7 +2865,7 @@ int NET_SendLong( INetChannel *chan, int sock, SOCKET s, const char FAR * buf, i
 			// Also, we send the first packet no matter what
 			// w/o a netchan, if there are too many splits, its possible the packet can't be delivered.  However, this would only apply to out of band stuff like
 			//  server query packets, which should never require splitting anyway.
-			ret = NET_SendTo( false, s, packet, size + sizeof(SPLITPACKET), to, tolen, -1 );
+			ret = NET_SendTo( false, s, packet, size + sizeof(SPLITPACKET), to, tolen, -1, netchan );
 		}
 
 		// First split send
@@ -2484,7 +3062,7 @@ int NET_SendPacket ( INetChannel *chan, int sock,  const netadr_t &to, const uns
 		!(net_queued_packet_thread.GetInt() == NET_QUEUED_PACKET_THREAD_DEBUG_VALUE && chan ) )	
 	{
 		// simple case, small packet, just send it
-		ret = NET_SendTo( true, net_socket, (const char *)data, length, &addr, sizeof(addr), iGameDataLength );
+		ret = NET_SendTo( true, net_socket, (const char *)data, length, &addr, sizeof(addr), iGameDataLength, dynamic_cast< CNetChan * >( chan ) );
 	}
 	else
 	{
@@ -2551,6 +3129,10 @@ void NET_CloseAllSockets (void)
 			net_sockets[i].hUDP = 0;
 			net_sockets[i].hTCP = 0;
 		}
+
+#ifdef NET_BATCHED_UDP
+		NET_DiscardBatchedReceives( i );
+#endif
 	}
 
 	// shut down all pending sockets
@@ -2577,6 +3159,10 @@ void NET_FlushAllSockets( void )
 	
 	for (int i=0 ; i<net_sockets.Count() ; i++)
 	{
+#ifdef NET_BATCHED_UDP
+		NET_DiscardBatchedReceives( i );
+#endif
+
 		if ( net_sockets[i].hUDP )
 		{
 			int bytes = 1;
@@ -3389,6 +3975,13 @@ CON_COMMAND( net_channels, "Shows net channel info" )
 	{
 		NET_PrintChannelStatus( s_NetChannels[i] );
 	}
+
+	s_NetChannelIndex.PrintStats();
+}
+
+CON_COMMAND( net_channels_resetstats, "Resets net channel lookup statistics" )
+{
+	s_NetChannelIndex.ResetStats();
 }
 
 CON_COMMAND( net_start, "Inits multiplayer network sockets" )
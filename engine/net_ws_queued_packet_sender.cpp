@@ -185,7 +185,8 @@ void CQueuedPacketSender::QueuePacket( INetChannel *pChan, SOCKET s, const char
 	m_hThreadEvent.Set();
 }
 
-extern int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockaddr FAR * to, int tolen, int iGameDataLength );
+class CNetChan;
+extern int NET_SendToImpl( SOCKET s, const char FAR * buf, int len, const struct sockaddr FAR * to, int tolen, int iGameDataLength, CNetChan *pChannel );
 
 int CQueuedPacketSender::Run()
 {
@@ -254,7 +255,8 @@ int CQueuedPacketSender::Run()
 						pPacket->buf.Count(), 
 						(sockaddr*)pPacket->to.Base(),
 						pPacket->to.Count(), 
-						-1 
+						-1,
+						NULL
 					);
 				}	
 				
@@ -1515,7 +1515,7 @@ void CNetworkStringTableContainer::WriteUpdateMessage( CBaseClient *client, int
 {
 	VPROF_BUDGET( "CNetworkStringTableContainer::WriteUpdateMessage", VPROF_BUDGETGROUP_OTHER_NETWORKING );
 
-	char buffer[NET_MAX_PAYLOAD];
+	CNetScratchBuffer buffer;
 
 	// Determine if an update is needed
 	for ( int i = 0; i < m_Tables.Count(); i++ )
@@ -1530,7 +1530,7 @@ void CNetworkStringTableContainer::WriteUpdateMessage( CBaseClient *client, int
 
 		SVC_UpdateStringTable msg;
 
-		msg.m_DataOut.StartWriting( buffer, NET_MAX_PAYLOAD );
+		msg.m_DataOut.StartWriting( buffer.Base(), NET_MAX_PAYLOAD );
 		msg.m_nTableID = table->GetTableId();
 		msg.m_nChangedEntries = table->WriteUpdate( client, msg.m_DataOut, tick_ack );
 
@@ -33,6 +33,7 @@ PackedEntity::PackedEntity()
 	m_pChangeFrameList = NULL;
 	m_nSnapshotCreationTick = 0;
 	m_nShouldCheckCreationTick = 0;
+	m_nCacheSerial = 0;
 }
 
 PackedEntity::~PackedEntity()
@@ -17,6 +17,7 @@
 #include <mempool.h>
 #include <utlvector.h>
 #include <tier0/dbg.h>
+#include <tier0/threadtools.h>
 
 #include "common.h"
 
@@ -110,7 +111,8 @@ public:
 	ClientClass	*m_pClientClass;	// Valid on the client
 		
 	int			m_nEntityIndex;		// Entity index.
-	int			m_ReferenceCount;	// reference count;
+	CInterlockedInt	m_ReferenceCount;	// reference count; snapshots are packed and released from several threads
+	unsigned int	m_nCacheSerial;		// Unique per allocation on the server, so stale UnpackedDataCache_t entries can't match a reused PackedEntity.
 
 private:
 
@@ -109,6 +109,7 @@ struct EntityInfo_t
 	char						m_nLevel[NUM_TREES];	// Which level voxel tree is it in?
 	unsigned short				m_nVisitBit[NUM_TREES];
 	intp						m_iLeafList[NUM_TREES];	// Index into the leaf pool - leaf list for entity (m_aLeafList).
+	int							m_iDeferredMove[NUM_TREES];	// Pending move in the tree's deferred list, -1 if none
 };
 
 
@@ -122,6 +123,22 @@ typedef CUtlFixedLinkedList<LeafListData_t>	CLeafList;
 
 typedef CVarBitVec CPartitionVisits;
 
+//-----------------------------------------------------------------------------
+// Enumeration state owned by a single thread. Every query marks visits in its
+// own bit vector, and queries nested inside an enumerator callback push a new
+// one, so concurrent queries never share marks. Only the owning thread touches it.
+//-----------------------------------------------------------------------------
+struct PartitionThreadState_t
+{
+	PartitionThreadState_t() : m_nVisitDepth( 0 ), m_nReadDepth( 0 ), m_nWriteDepth( 0 ) {}
+	~PartitionThreadState_t() { m_VisitStack.PurgeAndDeleteElements(); }
+
+	CUtlVector<CPartitionVisits *>	m_VisitStack;
+	int								m_nVisitDepth;
+	int								m_nReadDepth;		// Read locks held on the tree
+	int								m_nWriteDepth;		// Nested BeginWrite calls
+};
+
 //-----------------------------------------------------------------------------
 // Used when rendering the various levels of the voxel hash
 //-----------------------------------------------------------------------------
@@ -143,6 +160,8 @@ static Color s_pVoxelColor[9] =
 static Vector s_PartitionMin( MIN_COORD_FLOAT, MIN_COORD_FLOAT, MIN_COORD_FLOAT );
 static Vector s_PartitionMax( MAX_COORD_FLOAT, MAX_COORD_FLOAT, MAX_COORD_FLOAT );
 
+static ConVar partition_defer_moves( "partition_defer_moves", "1", 0, "Queue spatial partition moves, merging repeated moves of an element, and apply them in one batch before the next query." );
+
 //-----------------------------------------------------------------------------
 // Divide voxel coordinates by 2
 //-----------------------------------------------------------------------------
@@ -259,7 +278,8 @@ public:
 	// Inherited from ISpatialPartition
 	virtual void Init(  CSpatialPartition *pOwner, int iTree, const Vector& worldmin, const Vector& worldmax );
 
-	virtual void ElementMoved( SpatialPartitionHandle_t handle, const Vector& mins, const Vector& maxs );
+	// Returns false if the element stayed in the same voxels and wasn't re-inserted
+	virtual bool ElementMoved( SpatialPartitionHandle_t handle, const Vector& mins, const Vector& maxs );
 	virtual void EnumerateElementsInBox( SpatialPartitionListMask_t listMask, const Vector& mins, const Vector& maxs, bool coarseTest, IPartitionEnumerator* pIterator );
 	virtual void EnumerateElementsInSphere( SpatialPartitionListMask_t listMask, const Vector& origin, float radius, bool coarseTest, IPartitionEnumerator* pIterator );
 	virtual void EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask, const Ray_t& ray, bool coarseTest, IPartitionEnumerator* pIterator );
@@ -283,8 +303,8 @@ public:
 	// Shut down the allocated memory
 	void Shutdown( void );
 
-	// Insert into the appropriate tree
-	void InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs, bool bReinsert );
+	// Insert into the appropriate tree, returns false if a re-insert was skipped
+	bool InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs, bool bReinsert );
 
 	// Remove from appropriate tree
 	void RemoveFromTree( SpatialPartitionHandle_t hPartition );
@@ -293,8 +313,15 @@ public:
 	void LockForWrite()		{ m_lock.LockForWrite(); }
 	void UnlockWrite()		{ m_lock.UnlockWrite(); }
 
-	void LockForRead()		{ m_lock.LockForRead(); }
-	void UnlockRead()		{ m_lock.UnlockRead(); }
+	void LockForRead();
+	void UnlockRead();
+
+	// Is this thread inside a query on the tree?
+	bool IsQuerying();
+
+	// Write lock that is safe to take from inside a query on this thread, and nests
+	int BeginWrite();
+	void EndWrite( int nReadDepth );
 
 	// Ray casting
 	bool EnumerateElementsAlongRay_Ray( SpatialPartitionListMask_t listMask, const Ray_t &ray, const Vector &vecInvDelta, const Vector &vecEnd, IPartitionEnumerator *pIterator );
@@ -307,16 +334,16 @@ public:
 	void ComputeSweptRayBounds( const Ray_t &ray, const Vector &vecStartMin, const Vector &vecStartMax, Vector *pVecMin, Vector *pVecMax );
 
 private:
+	PartitionThreadState_t *ThreadState();
 
 	int									m_nLevelCount;
 	CVoxelHash*							m_pVoxelHash;
 	CLeafList							m_aLeafList;								// Pool - Linked list(multilist) of leaves per entity.
 	int									m_TreeId;
-	CPartitionVisits *                  m_pVisits[MAX_THREADS_SUPPORTED];
+	PartitionThreadState_t *			m_pThreadState[MAX_THREAD_IDS];	// Indexed by g_nThreadID
 	CSpatialPartition *					m_pOwner;
 	CUtlVector<unsigned short>			m_AvailableVisitBits;
 	unsigned short						m_nNextVisitBit;
-	CTSPool<CPartitionVisits>			m_FreeVisits;
 	CThreadSpinRWLock					m_lock;
 };
 
@@ -388,6 +415,12 @@ public:
 	virtual void InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs );
 	virtual void RemoveFromTree( SpatialPartitionHandle_t hPartition );
 
+	virtual void BeginParallelQueries();
+	virtual void EndParallelQueries();
+
+	// Prints what the deferred moves saved since the last clear, see partition_defer_stats
+	void PrintDeferredMoveStats( bool bClear );
+
 	CVoxelTree * VoxelTree( SpatialPartitionListMask_t listMask );
 	CVoxelTree * VoxelTreeForHandle( SpatialPartitionHandle_t handle );
 
@@ -396,6 +429,12 @@ protected:
 	// Invokes the pre-query callbacks.
 	void InvokeQueryCallbacks( SpatialPartitionListMask_t listMask, bool = false );
 
+	// Moves the element in one tree, or queues the move for FlushDeferredMoves
+	void MoveElementInTree( int iTree, SpatialPartitionHandle_t handle, const Vector& mins, const Vector& maxs, bool bDefer );
+	void CancelDeferredMoves( SpatialPartitionHandle_t handle );
+	void FlushDeferredMoves( int iTree );
+	void FlushDeferredMovesForQuery( CVoxelTree *pTree );
+
 	typedef CUtlLinkedList<EntityInfo_t, SpatialPartitionHandle_t, false, SpatialPartitionHandle_t, CUtlMemoryStack<UtlLinkedListElem_t< EntityInfo_t, SpatialPartitionHandle_t >, SpatialPartitionHandle_t, 0xffff, 1024> > CHandleList;
 
 private:
@@ -404,6 +443,32 @@ private:
 
 	CVoxelTree												m_VoxelTrees[NUM_TREES];
 
+	// Moves waiting to be applied to a tree, at most one per element (see ElementMoved)
+	struct DeferredMove_t
+	{
+		SpatialPartitionHandle_t							m_hPartition;
+		Vector												m_vecMins;
+		Vector												m_vecMaxs;
+	};
+	struct DeferredMoveList_t
+	{
+		DeferredMoveList_t() : m_nMerged( 0 ), m_nApplied( 0 ), m_nReinsertsAvoided( 0 ) {}
+
+		CUtlVector<DeferredMove_t>							m_Moves;
+		CThreadFastMutex									m_Mutex;
+		CUtlVector<DeferredMove_t>							m_Flush;		// Batch being applied, guarded by m_FlushMutex
+		CThreadFastMutex									m_FlushMutex;
+
+		// For partition_defer_stats
+		int													m_nMerged;				// Guarded by m_Mutex
+		int													m_nApplied;				// Guarded by m_FlushMutex
+		int													m_nReinsertsAvoided;	// Guarded by m_FlushMutex
+	};
+	static int __cdecl DeferredMoveLessFunc( const DeferredMove_t *pLeft, const DeferredMove_t *pRight );
+
+	DeferredMoveList_t										m_DeferredMoves[NUM_TREES];
+	CInterlockedInt											m_nParallelQueryDepth;
+
 	IPartitionQueryCallback									*m_pQueryCallback[MAX_QUERY_CALLBACK];		// Query callbacks.
 	int														m_nQueryCallbackCount;						// Number of query callbacks.
 
@@ -435,34 +500,106 @@ inline int CVoxelTree::GetTreeId() const
 	return m_TreeId;
 }
 
-inline CPartitionVisits *CVoxelTree::GetVisits()
+inline PartitionThreadState_t *CVoxelTree::ThreadState()
 {
 	int nThread = g_nThreadID;
-	return m_pVisits[nThread];
+	Assert( nThread >= 0 && nThread < MAX_THREAD_IDS );
+	PartitionThreadState_t *pState = m_pThreadState[nThread];
+	if ( !pState )
+	{
+		// Only the owning thread ever writes its slot
+		pState = new PartitionThreadState_t;
+		m_pThreadState[nThread] = pState;
+	}
+	return pState;
+}
+
+inline CPartitionVisits *CVoxelTree::GetVisits()
+{
+	PartitionThreadState_t *pState = ThreadState();
+	return pState->m_nVisitDepth ? pState->m_VisitStack[pState->m_nVisitDepth - 1] : NULL;
 }
 
 inline CPartitionVisits *CVoxelTree::BeginVisit()
 {
-	int nThread = g_nThreadID;
-	CPartitionVisits *pPrev = m_pVisits[nThread];
-	CPartitionVisits *pVisits = m_FreeVisits.GetObject();
-	if ( pVisits->GetNumBits() < m_nNextVisitBit )
+	PartitionThreadState_t *pState = ThreadState();
+	CPartitionVisits *pPrev = pState->m_nVisitDepth ? pState->m_VisitStack[pState->m_nVisitDepth - 1] : NULL;
+	if ( pState->m_nVisitDepth == pState->m_VisitStack.Count() )
 	{
-		pVisits->Resize( m_nNextVisitBit, true );
+		pState->m_VisitStack.AddToTail( new CPartitionVisits );
+	}
+
+	// Elements inserted after this point are covered by CPartitionVisitor::Visit
+	CPartitionVisits *pVisits = pState->m_VisitStack[pState->m_nVisitDepth++];
+	int nVisitBits = m_nNextVisitBit;
+	if ( pVisits->GetNumBits() < nVisitBits )
+	{
+		pVisits->Resize( nVisitBits, true );
 	}
 	else
 	{
 		pVisits->ClearAll();
 	}
-	m_pVisits[g_nThreadID] = pVisits;
 	return pPrev;
 }
 
 inline void CVoxelTree::EndVisit( CPartitionVisits *pPrev )
 {
-	int nThread = g_nThreadID;
-	m_FreeVisits.PutObject( m_pVisits[nThread] );
-	m_pVisits[nThread] = pPrev;
+	PartitionThreadState_t *pState = ThreadState();
+	Assert( pState->m_nVisitDepth > 0 );
+	--pState->m_nVisitDepth;
+	Assert( GetVisits() == pPrev );
+}
+
+inline void CVoxelTree::LockForRead()
+{
+	m_lock.LockForRead();
+	++ThreadState()->m_nReadDepth;
+}
+
+inline void CVoxelTree::UnlockRead()
+{
+	--ThreadState()->m_nReadDepth;
+	m_lock.UnlockRead();
+}
+
+inline bool CVoxelTree::IsQuerying()
+{
+	return ( ThreadState()->m_nReadDepth > 0 );
+}
+
+//-----------------------------------------------------------------------------
+// If this thread is inside a query (an enumerator callback is inserting or
+// moving something) every read lock it holds is dropped first, otherwise it
+// would wait on itself. Returns the read depth to hand back to EndWrite.
+//-----------------------------------------------------------------------------
+inline int CVoxelTree::BeginWrite()
+{
+	PartitionThreadState_t *pState = ThreadState();
+	if ( pState->m_nWriteDepth++ )
+		return 0;
+
+	int nReadDepth = pState->m_nReadDepth;
+	for ( int i = 0; i < nReadDepth; ++i )
+	{
+		m_lock.UnlockRead();
+	}
+	m_lock.LockForWrite();
+	return nReadDepth;
+}
+
+inline void CVoxelTree::EndWrite( int nReadDepth )
+{
+	PartitionThreadState_t *pState = ThreadState();
+	Assert( pState->m_nWriteDepth > 0 );
+	if ( --pState->m_nWriteDepth )
+		return;
+
+	m_lock.UnlockWrite();
+	for ( int i = 0; i < nReadDepth; ++i )
+	{
+		m_lock.LockForRead();
+	}
 }
 
 inline CVoxelTree *CSpatialPartition::VoxelTree( SpatialPartitionListMask_t listMask )
@@ -973,7 +1110,12 @@ public:
 	bool Visit( SpatialPartitionHandle_t hPartition, EntityInfo_t &hInfo ) const
 	{
 		int nVisitBit = hInfo.m_nVisitBit[m_iTree];
-		if ( m_pVisits->IsBitSet( nVisitBit ) )
+		if ( nVisitBit >= m_pVisits->GetNumBits() )
+		{
+			// Inserted after this query began (by one of its callbacks), so it can't have been visited yet
+			m_pVisits->Resize( nVisitBit + 1, false );
+		}
+		else if ( m_pVisits->IsBitSet( nVisitBit ) )
 		{
 			return false;
 		}
@@ -1921,6 +2063,8 @@ CVoxelTree::CVoxelTree() : m_pVoxelHash( NULL ), m_pOwner( NULL ), m_nNextVisitB
 	m_pVoxelHash = new CVoxelHash[m_nLevelCount]; 
 
 	m_AvailableVisitBits.EnsureCapacity( 2048 );
+
+	memset( m_pThreadState, 0, sizeof( m_pThreadState ) );
 }
 
 //-----------------------------------------------------------------------------
@@ -1928,6 +2072,10 @@ CVoxelTree::CVoxelTree() : m_pVoxelHash( NULL ), m_pOwner( NULL ), m_nNextVisitB
 //-----------------------------------------------------------------------------
 CVoxelTree::~CVoxelTree()
 {
+	for ( int i = 0; i < MAX_THREAD_IDS; ++i )
+	{
+		delete m_pThreadState[i];
+	}
 	delete[] m_pVoxelHash;
 }
 
@@ -1950,9 +2098,6 @@ void CVoxelTree::Init( CSpatialPartition *pOwner, int iTree, const Vector &world
 	m_pOwner = pOwner;
 	m_TreeId = iTree;
 
-	// Reset the enumeration id.
-	memset( m_pVisits, 0, sizeof( m_pVisits ) );
-
 	for ( int i = 0; i < m_nLevelCount; ++i )
 	{
 		m_pVoxelHash[i].Init( this, worldmin, worldmax, i );
@@ -1979,7 +2124,7 @@ void CVoxelTree::Shutdown( void )
 //-----------------------------------------------------------------------------
 // Insert into the appropriate tree
 //-----------------------------------------------------------------------------
-void CVoxelTree::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs, bool bReinsert )
+bool CVoxelTree::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs, bool bReinsert )
 {
 	Assert( hPartition != PARTITION_INVALID_HANDLE );
 
@@ -2028,13 +2173,7 @@ void CVoxelTree::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vect
 
 	if ( bDoInsert )
 	{
-		bool bWasReading = ( m_pVisits[g_nThreadID] != NULL );
-		if ( bWasReading )
-		{
-			// If we're recursing in this thread, need to release our read lock to allow ourselves to write
-			UnlockRead();
-		}
-		m_lock.LockForWrite();
+		int nReadDepth = BeginWrite();
 
 		// if these have changed we need to insert
 		info.m_voxelMin = voxelMin;
@@ -2049,12 +2188,10 @@ void CVoxelTree::InsertIntoTree( SpatialPartitionHandle_t hPartition, const Vect
 			info.m_nVisitBit[m_TreeId] = m_nNextVisitBit++;
 		}
 		m_pVoxelHash[nLevel].InsertIntoTree( hPartition, voxelMin, voxelMax );
-		m_lock.UnlockWrite();
-		if ( bWasReading )
-		{
-			LockForRead();
-		}
+		EndWrite( nReadDepth );
 	}
+
+	return bDoInsert;
 }
 
 
@@ -2068,23 +2205,11 @@ void CVoxelTree::RemoveFromTree( SpatialPartitionHandle_t hPartition )
 	int nLevel = info.m_nLevel[GetTreeId()];
 	if ( nLevel >= 0 )
 	{
-		bool bWasReading = ( m_pVisits[g_nThreadID] != NULL );
-		if ( bWasReading )
-		{
-			// If we're recursing in this thread, need to release our read lock to allow ourselves to write
-			UnlockRead();
-		}
-
-		m_lock.LockForWrite();
+		int nReadDepth = BeginWrite();
 		m_pVoxelHash[nLevel].RemoveFromTree( hPartition );
 		m_AvailableVisitBits.AddToTail( info.m_nVisitBit[m_TreeId] );
 		info.m_nVisitBit[m_TreeId] = (unsigned short)-1;
-		m_lock.UnlockWrite();
-
-		if ( bWasReading )
-		{
-			LockForRead();
-		}
+		EndWrite( nReadDepth );
 	}
 }
 
@@ -2094,9 +2219,9 @@ void CVoxelTree::UpdateListMask( SpatialPartitionHandle_t hPartition )
 	int nLevel = info.m_nLevel[GetTreeId()];
 	if ( nLevel >= 0 )
 	{
-		m_lock.LockForRead();
+		LockForRead();
 		m_pVoxelHash[nLevel].UpdateListMask( hPartition );
-		m_lock.UnlockRead();
+		UnlockRead();
 	}
 }
 
@@ -2104,21 +2229,20 @@ void CVoxelTree::UpdateListMask( SpatialPartitionHandle_t hPartition )
 //-----------------------------------------------------------------------------
 // Called when an element moves
 //-----------------------------------------------------------------------------
-void CVoxelTree::ElementMoved( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs )
+bool CVoxelTree::ElementMoved( SpatialPartitionHandle_t hPartition, const Vector& mins, const Vector& maxs )
 {
-	if ( hPartition != PARTITION_INVALID_HANDLE )
+	if ( hPartition == PARTITION_INVALID_HANDLE )
+		return false;
+
+	// If it doesn't already exist in the tree - add it.
+	EntityInfo_t &info = EntityInfo( hPartition );
+	if ( info.m_iLeafList[GetTreeId()] == CLeafList::InvalidIndex() )
 	{
-		// If it doesn't already exist in the tree - add it.
-		EntityInfo_t &info = EntityInfo( hPartition );
-		if ( info.m_iLeafList[GetTreeId()] == CLeafList::InvalidIndex() )
-		{
-			InsertIntoTree( hPartition, mins, maxs, false );
-			return;
-		} 
+		return InsertIntoTree( hPartition, mins, maxs, false );
+	} 
 
-		// Re-insert entity into voxel hash.
-		InsertIntoTree( hPartition, mins, maxs, true );
-	}
+	// Re-insert entity into voxel hash.
+	return InsertIntoTree( hPartition, mins, maxs, true );
 }
 
 
@@ -2149,12 +2273,12 @@ void CVoxelTree::EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
 	// Callbacks.
 	CPartitionVisits *pPrevVisits = BeginVisit();
 
-	m_lock.LockForRead();
+	LockForRead();
 	Voxel_t vs = m_pVoxelHash[0].VoxelIndexFromPoint( mins );
 	Voxel_t ve = m_pVoxelHash[0].VoxelIndexFromPoint( maxs );
 	if ( !m_pVoxelHash[0].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, pIterator ) )
 	{
-		m_lock.UnlockRead();
+		UnlockRead();
 		EndVisit( pPrevVisits );
 		return;
 	}
@@ -2163,7 +2287,7 @@ void CVoxelTree::EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
 	ve = ConvertToNextLevel( ve );
 	if ( !m_pVoxelHash[1].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, pIterator ) )
 	{
-		m_lock.UnlockRead();
+		UnlockRead();
 		EndVisit( pPrevVisits );
 		return;
 	}
@@ -2172,7 +2296,7 @@ void CVoxelTree::EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
 	ve = ConvertToNextLevel( ve );
 	if ( !m_pVoxelHash[2].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, pIterator ) )
 	{
-		m_lock.UnlockRead();
+		UnlockRead();
 		EndVisit( pPrevVisits );
 		return;
 	}
@@ -2181,7 +2305,7 @@ void CVoxelTree::EnumerateElementsInBox( SpatialPartitionListMask_t listMask,
 	ve = ConvertToNextLevel( ve );
 	m_pVoxelHash[3].EnumerateElementsInBox( listMask, vs, ve, mins, maxs, pIterator );
 
-	m_lock.UnlockRead();
+	UnlockRead();
 	EndVisit( pPrevVisits );
 }
 
@@ -2594,7 +2718,7 @@ void CVoxelTree::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask,
 
 	CPartitionVisits *pPrevVisits = BeginVisit();
 
-	m_lock.LockForRead();
+	LockForRead();
 	if ( ray.m_IsRay )
 	{
 		EnumerateElementsAlongRay_Ray( listMask, clippedRay, vecInvDelta, vecEnd, pIterator );
@@ -2604,7 +2728,7 @@ void CVoxelTree::EnumerateElementsAlongRay( SpatialPartitionListMask_t listMask,
 		EnumerateElementsAlongRay_ExtrudedRay( listMask, clippedRay, vecInvDelta, vecEnd, pIterator );
 	}
 
-	m_lock.UnlockRead();
+	UnlockRead();
 	EndVisit( pPrevVisits );
 }
 
@@ -2622,32 +2746,32 @@ void CVoxelTree::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask,
 	if ( listMask == 0 )
 		return;
 
-	m_lock.LockForRead();
+	LockForRead();
 	// Callbacks.
 	Voxel_t v = m_pVoxelHash[0].VoxelIndexFromPoint( pt );
 	if ( !m_pVoxelHash[0].EnumerateElementsAtPoint( listMask, v, pt, pIterator ) )
 	{
-		m_lock.UnlockRead();
+		UnlockRead();
 		return;
 	}
 
 	v = ConvertToNextLevel( v );
 	if ( !m_pVoxelHash[1].EnumerateElementsAtPoint( listMask, v, pt, pIterator ) )
 	{
-		m_lock.UnlockRead();
+		UnlockRead();
 		return;
 	}
 
 	v = ConvertToNextLevel( v );
 	if ( !m_pVoxelHash[2].EnumerateElementsAtPoint( listMask, v, pt, pIterator ) )
 	{
-		m_lock.UnlockRead();
+		UnlockRead();
 		return;
 	}
 
 	v = ConvertToNextLevel( v );
 	m_pVoxelHash[3].EnumerateElementsAtPoint( listMask, v, pt, pIterator );
-	m_lock.UnlockRead();
+	UnlockRead();
 }
 
 
@@ -2657,12 +2781,12 @@ void CVoxelTree::EnumerateElementsAtPoint( SpatialPartitionListMask_t listMask,
 void CVoxelTree::RenderAllObjectsInTree( float flTime )
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
-	m_lock.LockForRead();
+	LockForRead();
 	for ( int i = 0; i < m_nLevelCount; ++i )
 	{
 		m_pVoxelHash[i].RenderAllObjectsInTree( flTime );
 	}
-	m_lock.UnlockRead();
+	UnlockRead();
 }
 
 
@@ -2673,12 +2797,12 @@ void CVoxelTree::RenderAllObjectsInTree( float flTime )
 void CVoxelTree::RenderObjectsInPlayerLeafs( const Vector &vecPlayerMin, const Vector &vecPlayerMax, float flTime )
 {
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
-	m_lock.LockForRead();
+	LockForRead();
 	for ( int i = 0; i < m_nLevelCount; ++i )
 	{
 		m_pVoxelHash[i].RenderObjectsInPlayerLeafs( vecPlayerMin, vecPlayerMax, flTime );
 	}
-	m_lock.UnlockRead();
+	UnlockRead();
 }
 
 
@@ -2703,6 +2827,7 @@ ISpatialPartitionInternal *SpatialPartition()
 CSpatialPartition::CSpatialPartition()
 {
 	m_nQueryCallbackCount = 0;
+	m_nParallelQueryDepth = 0;
 }
 
 
@@ -2723,6 +2848,11 @@ void CSpatialPartition::Init( const Vector &worldmin, const Vector &worldmax )
 	m_aHandles.Purge();
 	m_aHandles.EnsureCapacity( SPHASH_HANDLELIST_BLOCK );
 
+	for ( int i = 0; i < NUM_TREES; i++ )
+	{
+		m_DeferredMoves[i].m_Moves.RemoveAll();
+	}
+
 	for ( int i = 0; i < NUM_TREES; i++ )
 	{
 		m_VoxelTrees[i].Init( this, i, worldmin, worldmax );
@@ -2736,6 +2866,8 @@ void CSpatialPartition::Shutdown( void )
 {
 	for ( int i = 0; i < NUM_TREES; i++ )
 	{
+		m_DeferredMoves[i].m_Moves.Purge();
+		m_DeferredMoves[i].m_Flush.Purge();
 		m_VoxelTrees[i].Shutdown();
 	}
 	m_aHandles.Purge();
@@ -2819,6 +2951,7 @@ SpatialPartitionHandle_t CSpatialPartition::CreateHandle( IHandleEntity *pHandle
 		m_aHandles[hPartition].m_nVisitBit[i] = 0xffff;
 		m_aHandles[hPartition].m_nLevel[i] = (uint8)-1;
 		m_aHandles[hPartition].m_iLeafList[i] = CLeafList::InvalidIndex();
+		m_aHandles[hPartition].m_iDeferredMove[i] = -1;
 	}
 	
 	return hPartition;
@@ -2991,25 +3124,180 @@ void CSpatialPartition::ElementMoved( SpatialPartitionHandle_t handle, const Vec
 	EntityInfo_t &entityInfo = EntityInfo( handle );
 	SpatialPartitionListMask_t listMask = entityInfo.m_fList;
 
+	// Queries in a parallel epoch see the trees as they were when it began, re-inserting
+	// now would stall every other reader on the write lock
+	bool bDefer = ( m_nParallelQueryDepth > 0 ) || partition_defer_moves.GetBool();
 
 	if ( CLIENT_TREE != SERVER_TREE )
 	{
 		if ( listMask & PARTITION_ALL_CLIENT_EDICTS )
 		{
-			m_VoxelTrees[CLIENT_TREE].ElementMoved( handle, mins, maxs );
-			entityInfo.m_flags |= IN_CLIENT_TREE;
+			MoveElementInTree( CLIENT_TREE, handle, mins, maxs, bDefer );
 		}
 
 		if ( listMask & ~PARTITION_ALL_CLIENT_EDICTS )
 		{
-			m_VoxelTrees[SERVER_TREE].ElementMoved( handle, mins, maxs );
-			entityInfo.m_flags |= IN_SERVER_TREE;
+			MoveElementInTree( SERVER_TREE, handle, mins, maxs, bDefer );
 		}
 	}
 	else
 	{
-		m_VoxelTrees[CLIENT_TREE].ElementMoved( handle, mins, maxs );
-		entityInfo.m_flags |= IN_CLIENT_TREE;
+		MoveElementInTree( CLIENT_TREE, handle, mins, maxs, bDefer );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves an element in one tree right away, or records the move so it
+//          can be merged with any later ones and applied by FlushDeferredMoves
+//-----------------------------------------------------------------------------
+void CSpatialPartition::MoveElementInTree( int iTree, SpatialPartitionHandle_t handle, const Vector& mins, const Vector& maxs, bool bDefer )
+{
+	EntityInfo_t &entityInfo = EntityInfo( handle );
+	if ( bDefer )
+	{
+		DeferredMoveList_t &list = m_DeferredMoves[iTree];
+		AUTO_LOCK( list.m_Mutex );
+		int iMove = entityInfo.m_iDeferredMove[iTree];
+		if ( iMove < 0 )
+		{
+			iMove = list.m_Moves.AddToTail();
+			list.m_Moves[iMove].m_hPartition = handle;
+			entityInfo.m_iDeferredMove[iTree] = iMove;
+		}
+		else
+		{
+			// Moved again before anyone looked, only the latest bounds matter
+			++list.m_nMerged;
+		}
+		list.m_Moves[iMove].m_vecMins = mins;
+		list.m_Moves[iMove].m_vecMaxs = maxs;
+		return;
+	}
+
+	m_VoxelTrees[iTree].ElementMoved( handle, mins, maxs );
+	entityInfo.m_flags |= ( iTree == CLIENT_TREE ) ? IN_CLIENT_TREE : IN_SERVER_TREE;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops any queued moves, so they can't land on a removed element
+//-----------------------------------------------------------------------------
+void CSpatialPartition::CancelDeferredMoves( SpatialPartitionHandle_t handle )
+{
+	EntityInfo_t &entityInfo = EntityInfo( handle );
+	for ( int i = 0; i < NUM_TREES; i++ )
+	{
+		if ( entityInfo.m_iDeferredMove[i] < 0 )
+			continue;
+
+		DeferredMoveList_t &list = m_DeferredMoves[i];
+		AUTO_LOCK( list.m_Mutex );
+		int iMove = entityInfo.m_iDeferredMove[i];
+		if ( iMove >= 0 )
+		{
+			list.m_Moves[iMove].m_hPartition = PARTITION_INVALID_HANDLE;
+			entityInfo.m_iDeferredMove[i] = -1;
+		}
+	}
+}
+
+int __cdecl CSpatialPartition::DeferredMoveLessFunc( const DeferredMove_t *pLeft, const DeferredMove_t *pRight )
+{
+	return (int)pLeft->m_hPartition - (int)pRight->m_hPartition;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Applies every queued move for a tree in one batch, under a single
+//          write lock and in handle order
+//-----------------------------------------------------------------------------
+void CSpatialPartition::FlushDeferredMoves( int iTree )
+{
+	DeferredMoveList_t &list = m_DeferredMoves[iTree];
+	if ( !list.m_Moves.Count() )
+		return;
+
+	VPROF( "CSpatialPartition::FlushDeferredMoves" );
+
+	AUTO_LOCK( list.m_FlushMutex );
+	CVoxelTree &tree = m_VoxelTrees[iTree];
+	int nReadDepth = tree.BeginWrite();
+
+	// Taken under the write lock, so removing an element that's in the tree waits for the batch
+	list.m_Mutex.Lock();
+	list.m_Flush.Swap( list.m_Moves );
+	for ( int i = 0; i < list.m_Flush.Count(); i++ )
+	{
+		if ( list.m_Flush[i].m_hPartition != PARTITION_INVALID_HANDLE )
+		{
+			EntityInfo( list.m_Flush[i].m_hPartition ).m_iDeferredMove[iTree] = -1;
+		}
+	}
+	list.m_Mutex.Unlock();
+
+	// Handle order walks the entity infos front to back
+	list.m_Flush.Sort( DeferredMoveLessFunc );
+
+	uint16 nTreeFlag = ( iTree == CLIENT_TREE ) ? IN_CLIENT_TREE : IN_SERVER_TREE;
+	for ( int i = 0; i < list.m_Flush.Count(); i++ )
+	{
+		const DeferredMove_t &move = list.m_Flush[i];
+		if ( move.m_hPartition == PARTITION_INVALID_HANDLE )
+			continue;
+
+		++list.m_nApplied;
+		if ( !tree.ElementMoved( move.m_hPartition, move.m_vecMins, move.m_vecMaxs ) )
+		{
+			++list.m_nReinsertsAvoided;
+		}
+		EntityInfo( move.m_hPartition ).m_flags |= nTreeFlag;
+	}
+	list.m_Flush.RemoveAll();
+
+	tree.EndWrite( nReadDepth );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves merged away while queued, and applied moves whose element
+//          stayed in its voxels, per tree
+//-----------------------------------------------------------------------------
+void CSpatialPartition::PrintDeferredMoveStats( bool bClear )
+{
+	static const char *s_pTreeNames[NUM_TREES] = { "client", "server" };
+	for ( int i = 0; i < NUM_TREES; i++ )
+	{
+		DeferredMoveList_t &list = m_DeferredMoves[i];
+		AUTO_LOCK( list.m_FlushMutex );
+		AUTO_LOCK( list.m_Mutex );
+
+		int nMoves = list.m_nApplied + list.m_nMerged;
+		ConMsg( "%s tree: %d moves, %d merged (%.1f%%), %d applied, %d reinserts avoided (%.1f%%)\n",
+			s_pTreeNames[i], nMoves, list.m_nMerged, nMoves ? 100.0f * list.m_nMerged / nMoves : 0.0f,
+			list.m_nApplied, list.m_nReinsertsAvoided, list.m_nApplied ? 100.0f * list.m_nReinsertsAvoided / list.m_nApplied : 0.0f );
+
+		if ( bClear )
+		{
+			list.m_nMerged = 0;
+			list.m_nApplied = 0;
+			list.m_nReinsertsAvoided = 0;
+		}
+	}
+}
+
+CON_COMMAND( partition_defer_stats, "Print how many spatial partition moves partition_defer_moves merged or applied without a reinsert. Use 'partition_defer_stats clear' to reset them." )
+{
+	bool bClear = ( args.ArgC() > 1 ) && !Q_stricmp( args[1], "clear" );
+	g_SpatialPartition.PrintDeferredMoveStats( bClear );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Brings a tree up to date before it's queried. Not inside a parallel
+//          epoch, and not from a query nested in an enumerator callback, where
+//          re-inserting would pull voxels out from under the outer query.
+//-----------------------------------------------------------------------------
+inline void CSpatialPartition::FlushDeferredMovesForQuery( CVoxelTree *pTree )
+{
+	if ( m_nParallelQueryDepth == 0 && !pTree->IsQuerying() )
+	{
+		FlushDeferredMoves( pTree->GetTreeId() );
 	}
 }
 
@@ -3021,6 +3309,7 @@ void CSpatialPartition::EnumerateElementsInBox( SpatialPartitionListMask_t listM
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
 	CVoxelTree *pTree = VoxelTree( listMask );
 	InvokeQueryCallbacks( listMask );
+	FlushDeferredMovesForQuery( pTree );
 	pTree->EnumerateElementsInBox( listMask, mins, maxs, coarseTest, pIterator );
 	InvokeQueryCallbacks( listMask, true );
 }
@@ -3033,6 +3322,7 @@ void CSpatialPartition::EnumerateElementsInSphere( SpatialPartitionListMask_t li
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
 	CVoxelTree *pTree = VoxelTree( listMask );
 	InvokeQueryCallbacks( listMask );
+	FlushDeferredMovesForQuery( pTree );
 	pTree->EnumerateElementsInSphere( listMask, origin, radius, coarseTest, pIterator );
 	InvokeQueryCallbacks( listMask, true );
 }
@@ -3045,6 +3335,7 @@ void CSpatialPartition::EnumerateElementsAlongRay( SpatialPartitionListMask_t li
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
 	CVoxelTree *pTree = VoxelTree( listMask );
 	InvokeQueryCallbacks( listMask );
+	FlushDeferredMovesForQuery( pTree );
 	pTree->EnumerateElementsAlongRay( listMask, ray, coarseTest, pIterator );
 	InvokeQueryCallbacks( listMask, true );
 }
@@ -3057,6 +3348,7 @@ void CSpatialPartition::EnumerateElementsAtPoint( SpatialPartitionListMask_t lis
 	MDLCACHE_CRITICAL_SECTION_(g_pMDLCache);
 	CVoxelTree *pTree = VoxelTree( listMask );
 	InvokeQueryCallbacks( listMask );
+	FlushDeferredMovesForQuery( pTree );
 	pTree->EnumerateElementsAtPoint( listMask, pt, coarseTest, pIterator );
 	InvokeQueryCallbacks( listMask, true );
 }
@@ -3096,6 +3388,8 @@ void CSpatialPartition::InsertIntoTree( SpatialPartitionHandle_t hPartition, con
 //-----------------------------------------------------------------------------
 void CSpatialPartition::RemoveFromTree( SpatialPartitionHandle_t hPartition ) 
 { 
+	CancelDeferredMoves( hPartition );
+
 	EntityInfo_t &entityInfo = EntityInfo( hPartition );
 
 	if ( entityInfo.m_flags & IN_CLIENT_TREE )
@@ -3111,6 +3405,31 @@ void CSpatialPartition::RemoveFromTree( SpatialPartitionHandle_t hPartition )
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Parallel query epochs. Between Begin and End any number of threads
+//          may query the partition at once; ElementMoved calls are queued
+//          whatever partition_defer_moves says, and flushed when the outermost
+//          epoch ends. Inserts and removes still happen right away.
+//          The server opens one around each batch of sv_parallel_usercmds
+//          movement (CPlayerMove::ProcessPendingMovement in player_command.cpp).
+//-----------------------------------------------------------------------------
+void CSpatialPartition::BeginParallelQueries()
+{
+	++m_nParallelQueryDepth;
+}
+
+void CSpatialPartition::EndParallelQueries()
+{
+	Assert( m_nParallelQueryDepth > 0 );
+	if ( --m_nParallelQueryDepth == 0 )
+	{
+		for ( int i = 0; i < NUM_TREES; i++ )
+		{
+			FlushDeferredMoves( i );
+		}
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -3180,7 +3499,7 @@ void CVoxelTree::DrawDebugOverlays()
 	if ( nLevel < 0 )
 		return;
 
-	m_lock.LockForRead();
+	LockForRead();
 	for ( int i = 0; i < m_nLevelCount; ++i )
 	{
 		if ( ( nLevel >= 0 ) && ( nLevel != i ) )
@@ -3189,7 +3508,7 @@ void CVoxelTree::DrawDebugOverlays()
 		m_pVoxelHash[i].RenderGrid();
 		m_pVoxelHash[i].RenderAllObjectsInTree( 0.01f );
 	}
-	m_lock.UnlockRead();
+	UnlockRead();
 }
 
 void CSpatialPartition::DrawDebugOverlays()
@@ -3213,3 +3532,80 @@ void DestroySpatialPartition( ISpatialPartition *pPartition )
 	Assert( pPartition != (ISpatialPartition*)&g_SpatialPartition );
 	delete pPartition;
 }
+
+#ifdef _DEBUG
+//-----------------------------------------------------------------------------
+// Checks the contract of parallel query epochs: moves made inside one are not
+// seen until the outermost epoch ends, and are seen right after.
+//-----------------------------------------------------------------------------
+class CPartitionTestEntity : public IHandleEntity
+{
+public:
+	virtual void SetRefEHandle( const CBaseHandle &handle )	{ m_hRef = handle; }
+	virtual const CBaseHandle& GetRefEHandle() const		{ return m_hRef; }
+
+private:
+	CBaseHandle m_hRef;
+};
+
+class CPartitionTestEnumerator : public IPartitionEnumerator
+{
+public:
+	CPartitionTestEnumerator( IHandleEntity *pFind ) : m_pFind( pFind ), m_bFound( false ) {}
+
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		if ( pHandleEntity == m_pFind )
+		{
+			m_bFound = true;
+		}
+		return ITERATION_CONTINUE;
+	}
+
+	IHandleEntity	*m_pFind;
+	bool			m_bFound;
+};
+
+static bool PartitionTest_IsInBox( ISpatialPartition *pPartition, IHandleEntity *pEntity, const Vector &vecMins, const Vector &vecMaxs )
+{
+	CPartitionTestEnumerator enumerator( pEntity );
+	pPartition->EnumerateElementsInBox( PARTITION_ENGINE_SOLID_EDICTS, vecMins, vecMaxs, false, &enumerator );
+	return enumerator.m_bFound;
+}
+
+void RunSpatialPartitionTest()
+{
+	ISpatialPartition *pPartition = CreateSpatialPartition( Vector( MIN_COORD_FLOAT, MIN_COORD_FLOAT, MIN_COORD_FLOAT ), Vector( MAX_COORD_FLOAT, MAX_COORD_FLOAT, MAX_COORD_FLOAT ) );
+
+	const Vector vecOldMins( 0, 0, 0 ), vecOldMaxs( 32, 32, 32 );
+	const Vector vecNewMins( 4096, 0, 0 ), vecNewMaxs( 4128, 32, 32 );
+
+	CPartitionTestEntity entity;
+	SpatialPartitionHandle_t hPartition = pPartition->CreateHandle( &entity, PARTITION_ENGINE_SOLID_EDICTS, vecOldMins, vecOldMaxs );
+	Verify( PartitionTest_IsInBox( pPartition, &entity, vecOldMins, vecOldMaxs ) );
+
+	// Inside an epoch, nested or not, queries keep seeing the element where it was
+	pPartition->BeginParallelQueries();
+	pPartition->BeginParallelQueries();
+	pPartition->ElementMoved( hPartition, vecNewMins, vecNewMaxs );
+	Verify( PartitionTest_IsInBox( pPartition, &entity, vecOldMins, vecOldMaxs ) );
+	Verify( !PartitionTest_IsInBox( pPartition, &entity, vecNewMins, vecNewMaxs ) );
+	pPartition->EndParallelQueries();
+	Verify( PartitionTest_IsInBox( pPartition, &entity, vecOldMins, vecOldMaxs ) );
+	pPartition->EndParallelQueries();
+
+	// The outermost End applies the move
+	Verify( !PartitionTest_IsInBox( pPartition, &entity, vecOldMins, vecOldMaxs ) );
+	Verify( PartitionTest_IsInBox( pPartition, &entity, vecNewMins, vecNewMaxs ) );
+
+	// A move queued inside an epoch is dropped with its element
+	pPartition->BeginParallelQueries();
+	pPartition->ElementMoved( hPartition, vecOldMins, vecOldMaxs );
+	pPartition->DestroyHandle( hPartition );
+	pPartition->EndParallelQueries();
+	Verify( !PartitionTest_IsInBox( pPartition, &entity, vecOldMins, vecOldMaxs ) );
+	Verify( !PartitionTest_IsInBox( pPartition, &entity, vecNewMins, vecNewMaxs ) );
+
+	DestroySpatialPartition( pPartition );
+}
+#endif
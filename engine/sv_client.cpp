@@ -804,9 +804,9 @@ void CGameClient::WriteGameSounds( bf_write &buf )
 	if ( m_Sounds.Count() <= 0 )
 		return;
 
-	char data[NET_MAX_PAYLOAD];
+	CNetScratchBuffer data;
 	SVC_Sounds msg;
-	msg.m_DataOut.StartWriting( data, sizeof(data) );
+	msg.m_DataOut.StartWriting( data.Base(), NET_MAX_PAYLOAD );
 	
 	int nSoundCount = FillSoundsMessage( msg );
 	msg.WriteToBuffer( buf );
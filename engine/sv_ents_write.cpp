@@ -21,38 +21,23 @@
 #include "replayserver.h"
 #include "tier0/vcrmode.h"
 #include "framesnapshot.h"
+#include "tier1/memstack.h"
 
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
 extern ConVar g_CV_DTWatchEnt;
-
-//-----------------------------------------------------------------------------
-// Delta timing stuff.
-//-----------------------------------------------------------------------------
-
-static ConVar		sv_deltatime( "sv_deltatime", "0", 0, "Enable profiling of CalcDelta calls" );
-static ConVar		sv_deltaprint( "sv_deltaprint", "0", 0, "Print accumulated CalcDelta profiling data (only if sv_deltatime is on)" );
+extern bool Sendprop_UsingDebugWatch();
 
 #if defined( DEBUG_NETWORKING )
 ConVar  sv_packettrace( "sv_packettrace", "1", 0, "For debugging, print entity creation/deletion info to console." );
 #endif
 
-class CChangeTrack
-{
-public:
-	char		*m_pName;
-	int			m_nChanged;
-	int			m_nUnchanged;
-	
-	CCycleCount	m_Count;
-	CCycleCount	m_EncodeCount;
-};
-
-
-static CUtlLinkedList<CChangeTrack*, int> g_Tracks;
-
+static ConVar sv_snapshot_priority( "sv_snapshot_priority", "1", 0, "When a client's entity updates don't fit its rate, send the most relevant ones and defer the rest." );
+static ConVar sv_snapshot_priority_budget( "sv_snapshot_priority_budget", "1.5", 0, "Size of a snapshot, as a multiple of the client's rate per snapshot interval, before entity updates get deferred.", true, 0.1f, false, 0.0f );
+static ConVar sv_snapshot_priority_distance( "sv_snapshot_priority_distance", "1024", 0, "Distance from the client at which an entity's update priority halves.", true, 1.0f, false, 0.0f );
+static ConVar sv_snapshot_priority_maxdefer( "sv_snapshot_priority_maxdefer", "16", 0, "Snapshots an entity update may be deferred for before it is always sent.", true, 1.0f, true, 255.0f );
 
 // These are the main variables used by the SV_CreatePacketEntities function.
 // The function is split up into multiple smaller ones and they pass this structure around.
@@ -77,74 +62,225 @@ public:
 
 	int				m_nFullProps;	// number of properties send as full update (Enter PVS)
 	bool			m_bCullProps;	// filter props by clients in recipient lists
-	
+	bool			m_bSharedCache;	// use the per-tick delta cache shared by all game clients
+
+	int				m_nOldPackTick;	// tick of the state the client has for m_pOldPack, older than m_pFromSnapshot if it was deferred
+
+	// Updates held back this snapshot because they didn't fit the client's bandwidth
+	bool				m_bDeferUpdates;
+	CBitVec<MAX_EDICTS>	m_DeferFlags;
+
 	/* Some profiling data
 	int				m_nTotalGap;
 	int				m_nTotalGapCount; */
 };
 
 
+static ConVar sv_deltacache( "sv_deltacache", "4096", 0, "Size in KB of the per-tick entity delta cache shared by all clients (0=off)." );
 
 //-----------------------------------------------------------------------------
-// Delta timing helpers.
+// Purpose: Encoded entity bits for the current tick, shared by all clients of
+//  the game server. Clients that acknowledged the same frame receive the same
+//  delta for an entity, so it only needs to be encoded once per tick.
+//  Entries are bump allocated from one block and pushed onto per entity lists
+//  without locks, so lookups and inserts are safe from the parallel snapshot send.
+//  Only entities without recipient proxies are cached, since everything else
+//  is culled per client.
 //-----------------------------------------------------------------------------
+class CSharedDeltaEntityCache
+{
+	struct DeltaEntityEntry_s
+	{
+		DeltaEntityEntry_s *pNext;
+		const void *pFromData;	// baseline data for full updates, NULL for deltas
+		int	nDeltaTick;			// tick we delta from, -1 for full updates
+		int nVersion;			// creation tick of the packed entity that was written
+		int nBits;
+		int nProps;
+	};
 
-CChangeTrack* GetChangeTrack( const char *pName )
+public:
+	CSharedDeltaEntityCache();
+	~CSharedDeltaEntityCache();
+
+	void SetTick( int nTick, int nMaxEntities );
+	bool IsActive( int nTick ) const { return m_nMaxEntities > 0 && m_nTick == nTick; }
+	unsigned char* FindDeltaBits( int nEntityIndex, int nDeltaTick, const void *pFromData, int nVersion, int &nBits, int &nProps );
+	void AddDeltaBits( int nEntityIndex, int nDeltaTick, const void *pFromData, int nVersion, int nBits, int nProps, bf_write *pBuffer );
+	void Flush();
+
+	void ResetStats();
+	void PrintStats();
+
+private:
+	int		m_nTick;			// tick of the snapshot the entries were written for
+	int		m_nMaxEntities;		// max entities = length of m_Entries in use
+	int		m_nCacheSize;
+	char	*m_pCache;
+	CInterlockedInt m_nCacheUsed;
+	DeltaEntityEntry_s * volatile m_Entries[MAX_EDICTS];
+
+	CInterlockedInt	m_nLookups;
+	CInterlockedInt	m_nHits;
+	CInterlockedInt	m_nAdds;
+	CInterlockedInt	m_nFull;
+};
+
+static CSharedDeltaEntityCache s_SharedDeltaCache;
+
+CSharedDeltaEntityCache::CSharedDeltaEntityCache()
+{
+	Q_memset( (void*)m_Entries, 0, sizeof(m_Entries) );
+	m_nTick = -1;
+	m_nMaxEntities = 0;
+	m_nCacheSize = 0;
+	m_pCache = NULL;
+	m_nCacheUsed = 0;
+	ResetStats();
+}
+
+CSharedDeltaEntityCache::~CSharedDeltaEntityCache()
 {
-	FOR_EACH_LL( g_Tracks, i )
+	Flush();
+	free( m_pCache );
+	m_pCache = NULL;
+	m_nCacheSize = 0;
+}
+
+void CSharedDeltaEntityCache::Flush()
+{
+	if ( m_nMaxEntities != 0 )
 	{
-		CChangeTrack *pCur = g_Tracks[i];
+		Q_memset( (void*)m_Entries, 0, m_nMaxEntities * sizeof(m_Entries[0]) );
+		m_nMaxEntities = 0;
+	}
+
+	m_nCacheUsed = 0;
+	m_nTick = -1;
+}
+
+// Called from the main thread before any client snapshot of this tick is written.
+// Always starts over, since tick counts and packed entity data can repeat across maps.
+void CSharedDeltaEntityCache::SetTick( int nTick, int nMaxEntities )
+{
+	Flush();
 
-		if ( stricmp( pCur->m_pName, pName ) == 0 )
-			return pCur;
+	int nCacheSize = sv_deltacache.GetInt() * 1024;
+
+	if ( nCacheSize != m_nCacheSize )
+	{
+		free( m_pCache );
+		m_pCache = ( nCacheSize > 0 ) ? (char*)malloc( nCacheSize ) : NULL;
+		m_nCacheSize = m_pCache ? nCacheSize : 0;
 	}
 
-	CChangeTrack *pCur = new CChangeTrack;
-	int len = strlen(pName)+1;
-	pCur->m_pName = new char[len];
-	Q_strncpy( pCur->m_pName, pName, len );
-	pCur->m_nChanged = pCur->m_nUnchanged = 0;
-	
-	g_Tracks.AddToTail( pCur );
-	
-	return pCur;
+	if ( m_nCacheSize <= 0 )
+		return;
+
+	m_nMaxEntities = clamp( nMaxEntities, 0, MAX_EDICTS );
+	m_nTick = nTick;
 }
 
+unsigned char* CSharedDeltaEntityCache::FindDeltaBits( int nEntityIndex, int nDeltaTick, const void *pFromData, int nVersion, int &nBits, int &nProps )
+{
+	nBits = -1;
+	nProps = 0;
+
+	if ( nEntityIndex < 0 || nEntityIndex >= m_nMaxEntities )
+		return NULL;
+
+	++m_nLookups;
+
+	for ( DeltaEntityEntry_s *pEntry = m_Entries[nEntityIndex]; pEntry; pEntry = pEntry->pNext )
+	{
+		if ( pEntry->nDeltaTick == nDeltaTick && pEntry->pFromData == pFromData && pEntry->nVersion == nVersion )
+		{
+			++m_nHits;
+			nBits = pEntry->nBits;
+			nProps = pEntry->nProps;
+			return (unsigned char*)(pEntry) + sizeof(DeltaEntityEntry_s);
+		}
+	}
+
+	return NULL;
+}
 
-void PrintChangeTracks()
+void CSharedDeltaEntityCache::AddDeltaBits( int nEntityIndex, int nDeltaTick, const void *pFromData, int nVersion, int nBits, int nProps, bf_write *pBuffer )
 {
-	ConMsg( "\n\n" );
-	ConMsg( "------------------------------------------------------------------------\n" );
-	ConMsg( "CalcDelta MS / %% time / Encode MS / # Changed / # Unchanged / Class Name\n" );
-	ConMsg( "------------------------------------------------------------------------\n" );
+	if ( nEntityIndex < 0 || nEntityIndex >= m_nMaxEntities )
+		return;
+
+	int nEntrySize = sizeof(DeltaEntityEntry_s) + PAD_NUMBER( Bits2Bytes(nBits), 8 );
+	int nOffset = m_nCacheUsed.AtomicAdd( nEntrySize );
 
-	CCycleCount total, encodeTotal;
-	FOR_EACH_LL( g_Tracks, i )
+	if ( nOffset + nEntrySize > m_nCacheSize )
 	{
-		CChangeTrack *pCur = g_Tracks[i];
-		CCycleCount::Add( pCur->m_Count, total, total );
-		CCycleCount::Add( pCur->m_EncodeCount, encodeTotal, encodeTotal );
+		// cache is full for this tick, just encode the rest
+		++m_nFull;
+		return;
 	}
 
-	FOR_EACH_LL( g_Tracks, j )
+	DeltaEntityEntry_s *pEntry = (DeltaEntityEntry_s*)( m_pCache + nOffset );
+	pEntry->pFromData = pFromData;
+	pEntry->nDeltaTick = nDeltaTick;
+	pEntry->nVersion = nVersion;
+	pEntry->nBits = nBits;
+	pEntry->nProps = nProps;
+
+	if ( nBits > 0 )
 	{
-		CChangeTrack *pCur = g_Tracks[j];
-	
-		ConMsg( "%6.2fms       %5.2f    %6.2fms    %4d        %4d          %s\n", 
-			pCur->m_Count.GetMillisecondsF(),
-			pCur->m_Count.GetMillisecondsF() * 100.0f / total.GetMillisecondsF(),
-			pCur->m_EncodeCount.GetMillisecondsF(),
-			pCur->m_nChanged, 
-			pCur->m_nUnchanged, 
-			pCur->m_pName
-			);
+		bf_read  inBuffer;
+		inBuffer.StartReading( pBuffer->GetData(), pBuffer->m_nDataBytes, pBuffer->GetNumBitsWritten() );
+		bf_write outBuffer( (char*)(pEntry) + sizeof(DeltaEntityEntry_s), PAD_NUMBER( Bits2Bytes(nBits), 8 ) );
+		outBuffer.WriteBitsFromBuffer( &inBuffer, nBits );
+	}
+
+	// publish the entry, other threads may be walking or pushing onto this list
+	DeltaEntityEntry_s *pHead;
+	do
+	{
+		pHead = m_Entries[nEntityIndex];
+		pEntry->pNext = pHead;
 	}
+	while ( !ThreadInterlockedAssignPointerIf( (void * volatile *)&m_Entries[nEntityIndex], pEntry, pHead ) );
 
-	ConMsg( "\n\n" );
-	ConMsg( "Total CalcDelta MS: %.2f\n\n", total.GetMillisecondsF() );
-	ConMsg( "Total Encode    MS: %.2f\n\n", encodeTotal.GetMillisecondsF() );
+	++m_nAdds;
 }
 
+void CSharedDeltaEntityCache::ResetStats()
+{
+	m_nLookups = 0;
+	m_nHits = 0;
+	m_nAdds = 0;
+	m_nFull = 0;
+}
+
+void CSharedDeltaEntityCache::PrintStats()
+{
+	int nLookups = m_nLookups;
+	int nHits = m_nHits;
+
+	ConMsg( "Delta cache: %d KB, %d/%d bytes used this tick\n", m_nCacheSize / 1024, MIN( (int)m_nCacheUsed, m_nCacheSize ), m_nCacheSize );
+	ConMsg( "  lookups %d, hits %d (%.1f%%), adds %d, cache full %d\n",
+		nLookups, nHits, nLookups ? ( 100.0f * nHits / nLookups ) : 0.0f, (int)m_nAdds, (int)m_nFull );
+}
+
+CON_COMMAND( sv_deltacache_stats, "Prints hit rate of the shared entity delta cache." )
+{
+	s_SharedDeltaCache.PrintStats();
+}
+
+CON_COMMAND( sv_deltacache_resetstats, "Resets the shared entity delta cache counters." )
+{
+	s_SharedDeltaCache.ResetStats();
+}
+
+void SV_SetDeltaCacheTick( int nTick, int nMaxEntities )
+{
+	s_SharedDeltaCache.SetTick( nTick, nMaxEntities );
+}
+
+
 
 //-----------------------------------------------------------------------------
 // Purpose: Entity wasn't dealt with in packet, but it has been deleted, we'll flag
@@ -358,7 +494,7 @@ static inline void SV_WritePropsFromPackedEntity(
 	int pSendProps[MAX_DATATABLE_PROPS];
 	const int *sendProps = pCheckProps;
 	int nSendProps = nCheckProps;
-	bf_write bufStart;
+	bf_write bufStart = *u.m_pBuf;
 
 
 	// cull properties that are removed by SendProxies for this client.
@@ -383,11 +519,6 @@ static inline void SV_WritePropsFromPackedEntity(
 		ARRAYSIZE( pSendProps )
 		);
 	}
-	else
-	{
-		// this is a HLTV relay proxy
-		bufStart = *u.m_pBuf;
-	}
 		
 	SendTable_WritePropList(
 		pSendTable, 
@@ -406,6 +537,12 @@ static inline void SV_WritePropsFromPackedEntity(
 		int nBits = u.m_pBuf->GetNumBitsWritten() - bufStart.GetNumBitsWritten();
 		hltv->m_DeltaCache.AddDeltaBits( pTo->m_nEntityIndex, u.m_pFromSnapshot->m_nTickCount, nBits, &bufStart );
 	}
+	else if ( u.m_bSharedCache && pTo->GetNumRecipients() == 0 && !u.m_pBuf->IsOverflowed() )
+	{
+		// nothing was culled for this client, the delta is the same for everyone at this from tick
+		int nBits = u.m_pBuf->GetNumBitsWritten() - bufStart.GetNumBitsWritten();
+		s_SharedDeltaCache.AddDeltaBits( pTo->m_nEntityIndex, u.m_nOldPackTick, NULL, pTo->GetSnapshotCreationTick(), nBits, nSendProps, &bufStart );
+	}
 }
 
 
@@ -443,7 +580,7 @@ static bool SV_NeedsExplicitCreate( CEntityWriteInfo &u )
 	{
 		// If it doesn't need explicit create, then the classnames should match.
 		// This assert is analagous to the "Server / Client mismatch" one on the client.
-		static int nWhines = 0;
+		static CInterlockedInt nWhines = 0;	// snapshots may be written from several threads
 		if ( pFromEnt->m_pClass->GetName() != pToEnt->m_pClass->GetName() )
 		{
 			if ( ++nWhines < 4 )
@@ -533,8 +670,31 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 	}
 #endif
 
+	if ( u.m_bSharedCache && u.m_pNewPack->GetNumRecipients() == 0 )
+	{
+		int nCachedBits, nCachedProps;
+		unsigned char *pBuffer = s_SharedDeltaCache.FindDeltaBits( u.m_nNewEntity, u.m_nOldPackTick, NULL, 
+			u.m_pNewPack->GetSnapshotCreationTick(), nCachedBits, nCachedProps );
+
+		if ( pBuffer )
+		{
+			if ( nCachedBits > 0 )
+			{
+				SV_WriteDeltaHeader( u, u.m_nNewEntity, FHDR_ZERO );
+				u.m_pBuf->WriteBits( pBuffer, nCachedBits );
+				u.m_UpdateType = DeltaEnt;
+			}
+			else
+			{
+				u.m_UpdateType = PreserveEnt;
+			}
+
+			return;
+		}
+	}
+
 	int checkProps[MAX_DATATABLE_PROPS];
-	int nCheckProps = u.m_pNewPack->GetPropsChangedAfterTick( u.m_pFromSnapshot->m_nTickCount, checkProps, ARRAYSIZE( checkProps ) );
+	int nCheckProps = u.m_pNewPack->GetPropsChangedAfterTick( u.m_nOldPackTick, checkProps, ARRAYSIZE( checkProps ) );
 	
 	if ( nCheckProps == -1 )
 	{
@@ -619,6 +779,12 @@ static inline void SV_DetermineUpdateType( CEntityWriteInfo &u )
 #endif
 		}
 #endif
+		if ( u.m_bSharedCache && u.m_pNewPack->GetNumRecipients() == 0 )
+		{
+			// no bits changed, PreserveEnt
+			s_SharedDeltaCache.AddDeltaBits( u.m_nNewEntity, u.m_nOldPackTick, NULL, u.m_pNewPack->GetSnapshotCreationTick(), 0, 0, NULL );
+		}
+
 		u.m_UpdateType = PreserveEnt;
 	}
 }
@@ -712,8 +878,31 @@ static inline void SV_WriteEnterPVS( CEntityWriteInfo &u )
 	/*if ( server->IsHLTV() || server->IsReplay() )
 	{*/
 	// send all changed properties when entering PVS (no SendProxy culling since we may use it as baseline
-	u.m_nFullProps +=  SendTable_WriteAllDeltaProps( pClass->m_pTable, pFromData, nFromBits,
-		pToData, nToBits, u.m_pNewPack->m_nEntityIndex, u.m_pBuf );
+	// the result only depends on the baseline data, so clients sharing a baseline can reuse it
+	int nCachedBits, nCachedProps;
+	unsigned char *pCachedBits = u.m_bSharedCache ? s_SharedDeltaCache.FindDeltaBits( u.m_nNewEntity, -1, pFromData, 
+		u.m_pNewPack->GetSnapshotCreationTick(), nCachedBits, nCachedProps ) : NULL;
+
+	if ( pCachedBits )
+	{
+		u.m_pBuf->WriteBits( pCachedBits, nCachedBits );
+		u.m_nFullProps += nCachedProps;
+	}
+	else
+	{
+		bf_write bufStart = *u.m_pBuf;
+
+		int nProps = SendTable_WriteAllDeltaProps( pClass->m_pTable, pFromData, nFromBits,
+			pToData, nToBits, u.m_pNewPack->m_nEntityIndex, u.m_pBuf );
+
+		u.m_nFullProps += nProps;
+
+		if ( u.m_bSharedCache && !u.m_pBuf->IsOverflowed() )
+		{
+			int nBits = u.m_pBuf->GetNumBitsWritten() - bufStart.GetNumBitsWritten();
+			s_SharedDeltaCache.AddDeltaBits( u.m_nNewEntity, -1, pFromData, u.m_pNewPack->GetSnapshotCreationTick(), nBits, nProps, &bufStart );
+		}
+	}
 	/*}
 	else
 	{
@@ -858,6 +1047,181 @@ static inline int SV_WriteDeletions( CEntityWriteInfo &u )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns the packed entity the client has for nEntity as of the from
+//  frame, which is older than the from snapshot if its update was deferred.
+//-----------------------------------------------------------------------------
+static inline PackedEntity *SV_GetClientPackedEntity( CEntityWriteInfo &u, int nEntity, int &nTick )
+{
+	const CClientFrame::DeferredEntity_t *pDeferred = u.m_pFrom->FindDeferredEntity( nEntity );
+	if ( pDeferred )
+	{
+		nTick = pDeferred->nTick;
+		return pDeferred->pPackedEntity;
+	}
+
+	nTick = u.m_pFromSnapshot->m_nTickCount;
+	return framesnapshotmanager->GetPackedEntity( u.m_pFromSnapshot, nEntity );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: When the entity updates for this snapshot won't fit the client's
+//  bandwidth, picks which ones to send. Updates are ranked by distance to the
+//  client and by how many snapshots they've already been held back for; the
+//  rest are flagged in m_DeferFlags and go out in a later snapshot.
+//-----------------------------------------------------------------------------
+static void SV_ScheduleEntityUpdates( CEntityWriteInfo &u, CBaseClient *client )
+{
+	// Full updates must be complete, and proxies and local clients get everything
+	if ( !sv_snapshot_priority.GetBool() || !u.m_bAsDelta || !u.m_bCullProps ||
+		u.m_pServer->IsHLTV() || u.m_pServer->IsReplay() || client->IsHLTV() || client->IsReplay() ||
+		!client->m_NetChannel || client->m_NetChannel->IsLoopback() )
+		return;
+
+	// The client's rate per snapshot, less what choke says it's already short of
+	float flRate = client->m_NetChannel->GetDataRate() * client->m_fSnapshotInterval * sv_snapshot_priority_budget.GetFloat();
+	float flHeadroom = 1.0f - clamp( client->m_NetChannel->GetAvgChoke( FLOW_OUTGOING ), 0.0f, 0.9f );
+	int nBudgetBits = (int)( flRate * flHeadroom * 8.0f ) - u.m_pBuf->GetNumBitsWritten();
+
+	// Leave room in the buffer for deletions, temp entities and sounds
+	nBudgetBits = MIN( nBudgetBits, u.m_pBuf->GetNumBitsLeft() * 3 / 4 );
+
+	// Put back by SendSnapshot if this snapshot overflows
+	client->m_EntityStaleness.Save();
+
+	unsigned char *pStaleness = client->m_EntityStaleness.Base();
+	int nMaxDefer = sv_snapshot_priority_maxdefer.GetInt();
+	int nRequiredBits = 0;
+	int nTotalBits = 0;
+	int checkProps[MAX_DATATABLE_PROPS];
+
+	// Snapshots run on worker threads, each one takes this from its own tick arena
+	CUtlVector< EntityUpdatePriority_t, CUtlMemoryFrameArena< EntityUpdatePriority_t, FRAME_ARENA_SERVER_TICK > > updates;
+	updates.EnsureCapacity( u.m_pToSnapshot->m_nValidEntities );
+
+	for ( int i = u.m_pTo->transmit_entity.FindNextSetBit( 0 ); i >= 0; i = u.m_pTo->transmit_entity.FindNextSetBit( i + 1 ) )
+	{
+		PackedEntity *pNewPack = framesnapshotmanager->GetPackedEntity( u.m_pToSnapshot, i );
+		if ( !pNewPack )
+			continue;
+
+		bool bRequired = ( i == u.m_nClientEntity || pStaleness[i] >= nMaxDefer );
+		int nBits;
+
+		if ( u.m_pFrom->transmit_entity.Get( i ) )
+		{
+			const CFrameSnapshotEntry *pFromEnt = ( i < u.m_pFromSnapshot->m_nNumEntities ) ? &u.m_pFromSnapshot->m_pEntities[i] : NULL;
+			if ( !pFromEnt || !pFromEnt->m_pClass || pFromEnt->m_nSerialNumber != u.m_pToSnapshot->m_pEntities[i].m_nSerialNumber )
+			{
+				// Recreated in the same slot, the client's old entity has to be replaced now
+				nRequiredBits += pNewPack->GetNumBits();
+				pStaleness[i] = 0;
+				continue;
+			}
+
+			int nTick;
+			PackedEntity *pOldPack = SV_GetClientPackedEntity( u, i, nTick );
+			if ( pOldPack == pNewPack )
+			{
+				pStaleness[i] = 0;
+				continue;
+			}
+
+			int nChanged = pNewPack->GetPropsChangedAfterTick( nTick, checkProps, ARRAYSIZE( checkProps ) );
+			if ( nChanged == 0 )
+			{
+				pStaleness[i] = 0;
+				continue;
+			}
+
+			// Assume the changed props are average sized, plus a few bits each for the index
+			int nProps = MAX( pNewPack->m_pServerClass->m_pTable->m_pPrecalc->GetNumProps(), 1 );
+			nBits = ( nChanged < 0 ) ? pNewPack->GetNumBits() : pNewPack->GetNumBits() * nChanged / nProps + nChanged * 4;
+			nBits += 16;
+		}
+		else
+		{
+			// Entering, sent from the baseline plus class and serial
+			nBits = pNewPack->GetNumBits() + 32;
+		}
+
+		if ( bRequired )
+		{
+			nRequiredBits += nBits;
+			pStaleness[i] = 0;
+			continue;
+		}
+
+		EntityUpdatePriority_t &update = updates[ updates.AddToTail() ];
+		update.nEntity = i;
+		update.nBits = nBits;
+		update.flPriority = 0.0f;
+		nTotalBits += nBits;
+	}
+
+	if ( nRequiredBits + nTotalBits <= nBudgetBits )
+	{
+		// Everything fits
+		FOR_EACH_VEC( updates, i )
+		{
+			pStaleness[ updates[i].nEntity ] = 0;
+		}
+		return;
+	}
+
+	ICollideable *pClientEnt = sv.edicts[u.m_nClientEntity].GetCollideable();
+	float flHalfDistance = sv_snapshot_priority_distance.GetFloat();
+
+	FOR_EACH_VEC( updates, i )
+	{
+		EntityUpdatePriority_t &update = updates[i];
+
+		update.flPriority = 1.0f;
+		ICollideable *pEnt = sv.edicts[update.nEntity].GetCollideable();
+		if ( pEnt && pClientEnt )
+		{
+			float flDist = ( pEnt->GetCollisionOrigin() - pClientEnt->GetCollisionOrigin() ).Length();
+			update.flPriority = SV_EntityUpdateRelevance( flDist, flHalfDistance );
+		}
+	}
+
+	u.m_bDeferUpdates = true;
+	SV_PrioritizeEntityUpdates( updates.Base(), updates.Count(), nBudgetBits - nRequiredBits, pStaleness, u.m_DeferFlags );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Skips the current entity if SV_ScheduleEntityUpdates deferred it.
+//  An entering entity is left out of the frame, so it enters in a later one. An
+//  updated entity stays in the frame, recording the state the client still has.
+//-----------------------------------------------------------------------------
+static inline bool SV_DeferEntityUpdate( CEntityWriteInfo &u )
+{
+	if ( !u.m_bDeferUpdates || u.m_nNewEntity == ENTITY_SENTINEL || !u.m_DeferFlags.Get( u.m_nNewEntity ) )
+		return false;
+
+	if ( u.m_nNewEntity < u.m_nOldEntity )
+	{
+		TRACE_PACKET( ( "  SV Defer Enter PVS (%d)\n", u.m_nNewEntity ) );
+
+		u.m_pTo->transmit_entity.Clear( u.m_nNewEntity );
+		u.NextNewEntity();
+		return true;
+	}
+
+	if ( u.m_nNewEntity == u.m_nOldEntity )
+	{
+		TRACE_PACKET( ( "  SV Defer Delta PVS (%d)\n", u.m_nNewEntity ) );
+
+		u.m_pTo->AddDeferredEntity( u.m_nNewEntity, u.m_nOldPackTick, u.m_pOldPack );
+		u.NextOldEntity();
+		u.NextNewEntity();
+		return true;
+	}
+
+	return false;
+}
+
+
 /*
 =============
 WritePacketEntities
@@ -890,6 +1254,11 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 	{
 		u.m_bCullProps = true;	// always cull props for players
 	}
+
+	// the shared cache only holds bits for the game server's current snapshot, and is
+	// bypassed while instrumenting or watching props so every write is still reported
+	u.m_bSharedCache = !IsHLTV() && !IsReplay() && s_SharedDeltaCache.IsActive( u.m_pToSnapshot->m_nTickCount ) &&
+		!g_bServerDTIEnabled && !Sendprop_UsingDebugWatch();
 	
 	if ( from != NULL )
 	{
@@ -906,9 +1275,14 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 	}
 
 	u.m_nHeaderCount = 0;
+	u.m_nOldPackTick = -1;
+	u.m_bDeferUpdates = false;
 //	u.m_nTotalGap = 0;
 //	u.m_nTotalGapCount = 0;
 
+	// a retry after an overflow starts over
+	to->ClearDeferredEntities();
+
 	// set from_baseline pointer if this snapshot may become a baseline update
 	if ( client->m_nBaselineUpdateTick == -1 )
 	{
@@ -954,6 +1328,8 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 	// Don't work too hard if we're using the optimized single-player mode.
 	if ( !g_pLocalNetworkBackdoor )
 	{
+		SV_ScheduleEntityUpdates( u, client );
+
 		// Iterate through the in PVS bitfields until we find an entity 
 		// that was either in the old pack or the new pack
 		u.NextOldEntity();
@@ -962,9 +1338,12 @@ void CBaseServer::WriteDeltaEntities( CBaseClient *client, CClientFrame *to, CCl
 		while ( (u.m_nOldEntity != ENTITY_SENTINEL) || (u.m_nNewEntity != ENTITY_SENTINEL) )
 		{
 			u.m_pNewPack = (u.m_nNewEntity != ENTITY_SENTINEL) ? framesnapshotmanager->GetPackedEntity( u.m_pToSnapshot, u.m_nNewEntity ) : NULL;
-			u.m_pOldPack = (u.m_nOldEntity != ENTITY_SENTINEL) ? framesnapshotmanager->GetPackedEntity( u.m_pFromSnapshot, u.m_nOldEntity ) : NULL;
+			u.m_pOldPack = (u.m_nOldEntity != ENTITY_SENTINEL) ? SV_GetClientPackedEntity( u, u.m_nOldEntity, u.m_nOldPackTick ) : NULL;
 			int nEntityStartBit = pBuf.GetNumBitsWritten();
 
+			if ( SV_DeferEntityUpdate( u ) )
+				continue;
+
 			// Figure out how we want to write this entity.
 			SV_DetermineUpdateType( u  );
 			SV_WriteEntityUpdate( u );
@@ -32,6 +32,9 @@ CFrameSnapshotManager *framesnapshotmanager = &g_FrameSnapshotManager;
 //-----------------------------------------------------------------------------
 CFrameSnapshotManager::CFrameSnapshotManager( void ) : m_PackedEntitiesPool( MAX_EDICTS / 16, CUtlMemoryPool::GROW_SLOW )
 {
+	m_bDeferDeletes = false;
+	m_pThreadCaches = NULL;
+	m_nPackedEntitySerial = 0;
 	COMPILE_TIME_ASSERT( INVALID_PACKED_ENTITY_HANDLE == 0 );
 	Q_memset( m_pPackedData, 0x00, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
 
@@ -44,6 +47,15 @@ CFrameSnapshotManager::~CFrameSnapshotManager( void )
 {
 	AssertMsg1( m_FrameSnapshots.Count() == 0 || IsInErrorExit(), "Expected m_FrameSnapshots to be empty. It had %i items.", m_FrameSnapshots.Count() );
 
+	FlushThreadCaches();
+	while ( m_pThreadCaches )
+	{
+		CPackedEntityThreadCache *pNext = m_pThreadCaches->m_pNext;
+		delete [] m_pThreadCaches->m_pUnpacked;
+		delete m_pThreadCaches;
+		m_pThreadCaches = pNext;
+	}
+
 	// TODO: This assert has been failing. HenryG says it's a valid assert and that we're probably leaking memory.
 	AssertMsg1( m_PackedEntitiesPool.Count() == 0 || IsInErrorExit(), "Expected m_PackedEntitiesPool to be empty. It had %i items.", m_PackedEntitiesPool.Count() );
 }
@@ -58,13 +70,15 @@ void CFrameSnapshotManager::LevelChanged()
 	Assert( m_FrameSnapshots.Count() == 0 );
 
 	// Release the most recent snapshot...
-	m_PackedEntityCache.RemoveAll();
+	FlushThreadCaches();
 	COMPILE_TIME_ASSERT( INVALID_PACKED_ENTITY_HANDLE == 0 );
 	Q_memset( m_pPackedData, 0x00, MAX_EDICTS * sizeof(PackedEntityHandle_t) );
 }
 
 CFrameSnapshot*	CFrameSnapshotManager::NextSnapshot( const CFrameSnapshot *pSnapshot )
 {
+	AUTO_LOCK( m_FrameSnapshotsMutex );
+
 	if ( !pSnapshot || ((unsigned short)pSnapshot->m_ListIndex == m_FrameSnapshots.InvalidIndex()) )
 		return NULL;
 
@@ -100,7 +114,10 @@ CFrameSnapshot*	CFrameSnapshotManager::CreateEmptySnapshot( int tickcount, int m
 		entry++;
 	}
 
-	snap->m_ListIndex = m_FrameSnapshots.AddToTail( snap );
+	{
+		AUTO_LOCK( m_FrameSnapshotsMutex );
+		snap->m_ListIndex = m_FrameSnapshots.AddToTail( snap );
+	}
 	return snap;
 }
 
@@ -181,6 +198,15 @@ CFrameSnapshot* CFrameSnapshotManager::TakeTickSnapshot( int tickcount )
 
 void CFrameSnapshotManager::DeleteFrameSnapshot( CFrameSnapshot* pSnapshot )
 {
+	{
+		AUTO_LOCK( m_FrameSnapshotsMutex );
+		if ( m_bDeferDeletes )
+		{
+			m_DeferredDeletes.AddToTail( pSnapshot );
+			return;
+		}
+	}
+
 	// Decrement reference counts of all packed entities
 	for (int i = 0; i < pSnapshot->m_nNumEntities; ++i)
 	{
@@ -190,33 +216,46 @@ void CFrameSnapshotManager::DeleteFrameSnapshot( CFrameSnapshot* pSnapshot )
 		}
 	}
 
-	m_FrameSnapshots.Remove( pSnapshot->m_ListIndex );
+	{
+		AUTO_LOCK( m_FrameSnapshotsMutex );
+		m_FrameSnapshots.Remove( pSnapshot->m_ListIndex );
+	}
 	delete pSnapshot;
 }
 
+void CFrameSnapshotManager::BeginDeferredDeletes()
+{
+	AUTO_LOCK( m_FrameSnapshotsMutex );
+	Assert( !m_bDeferDeletes );
+	m_bDeferDeletes = true;
+}
+
+void CFrameSnapshotManager::EndDeferredDeletes()
+{
+	CUtlVector<CFrameSnapshot*> deletes;
+	{
+		AUTO_LOCK( m_FrameSnapshotsMutex );
+		m_bDeferDeletes = false;
+		deletes.Swap( m_DeferredDeletes );
+	}
+
+	FOR_EACH_VEC( deletes, i )
+	{
+		DeleteFrameSnapshot( deletes[i] );
+	}
+}
+
 void CFrameSnapshotManager::RemoveEntityReference( PackedEntityHandle_t handle )
 {
 	Assert( handle != INVALID_PACKED_ENTITY_HANDLE );
 
 	PackedEntity *packedEntity = reinterpret_cast< PackedEntity * >( handle );
 
-	if ( --packedEntity->m_ReferenceCount <= 0)
+	// Uncompressed cache entries for this entity are left alone; they're keyed
+	// on m_nCacheSerial as well, so they can't match whatever reuses the memory.
+	if ( --packedEntity->m_ReferenceCount <= 0 )
 	{
-		AUTO_LOCK( m_WriteMutex );
-
-		m_PackedEntitiesPool.Free( packedEntity );
-
-		// if we have a uncompression cache, remove reference too
-		FOR_EACH_VEC( m_PackedEntityCache, i )
-		{
-			UnpackedDataCache_t &pdc = m_PackedEntityCache[i];
-			if ( pdc.pEntity == packedEntity )
-			{
-				pdc.pEntity = NULL;
-				pdc.counter = 0;
-				break;
-			}
-		}
+		FreePackedEntity( packedEntity );
 	}
 }
 
@@ -322,10 +361,8 @@ CThreadFastMutex &CFrameSnapshotManager::GetMutex()
 
 PackedEntity* CFrameSnapshotManager::CreatePackedEntity( CFrameSnapshot* pSnapshot, int entity )
 {
-	m_WriteMutex.Lock();
-	PackedEntity *packedEntity = m_PackedEntitiesPool.Alloc();
+	PackedEntity *packedEntity = AllocPackedEntity();
 	PackedEntityHandle_t handle = reinterpret_cast< PackedEntityHandle_t >( packedEntity );
-	m_WriteMutex.Unlock();
 	
 	Assert( entity < pSnapshot->m_nNumEntities );
 
@@ -377,34 +414,38 @@ PackedEntity* CFrameSnapshotManager::GetPackedEntity( CFrameSnapshot* pSnapshot,
 // ------------------------------------------------------------------------------------------------ //
 UnpackedDataCache_t *CFrameSnapshotManager::GetCachedUncompressedEntity( PackedEntity *packedEntity )
 {
-	if ( m_PackedEntityCache.Count() == 0 )
+	// Each thread has its own cache, so this needs no locking
+	CPackedEntityThreadCache *pCache = GetThreadCache();
+
+	if ( !pCache->m_pUnpacked )
 	{
 		// ops, we have no cache yet, create one and reset counter
-		m_nPackedEntityCacheCounter = 0;
-		m_PackedEntityCache.SetCount( 128 );
+		pCache->m_nUnpackedCounter = 0;
+		pCache->m_pUnpacked = new UnpackedDataCache_t[ CPackedEntityThreadCache::NUM_UNPACKED_ENTRIES ];
 
-		FOR_EACH_VEC( m_PackedEntityCache, i )
+		for ( int i = 0; i < CPackedEntityThreadCache::NUM_UNPACKED_ENTRIES; i++ )
 		{
-			m_PackedEntityCache[i].pEntity = NULL;
-			m_PackedEntityCache[i].counter = 0;
+			pCache->m_pUnpacked[i].pEntity = NULL;
+			pCache->m_pUnpacked[i].serial = 0;
+			pCache->m_pUnpacked[i].counter = 0;
 		}
 	}
 
-	m_nPackedEntityCacheCounter++;
+	pCache->m_nUnpackedCounter++;
 
 	// remember oldest cache entry
 	UnpackedDataCache_t *pdcOldest = NULL;
-	int oldestValue = m_nPackedEntityCacheCounter;
+	int oldestValue = pCache->m_nUnpackedCounter;
 
 
-	FOR_EACH_VEC( m_PackedEntityCache, i )
+	for ( int i = 0; i < CPackedEntityThreadCache::NUM_UNPACKED_ENTRIES; i++ )
 	{
-		UnpackedDataCache_t *pdc = &m_PackedEntityCache[i];
+		UnpackedDataCache_t *pdc = &pCache->m_pUnpacked[i];
 
-		if ( pdc->pEntity == packedEntity )
+		if ( pdc->pEntity == packedEntity && pdc->serial == packedEntity->m_nCacheSerial )
 		{
 			// hit, found it, update counter
-			pdc->counter = m_nPackedEntityCacheCounter;
+			pdc->counter = pCache->m_nUnpackedCounter;
 			return pdc;
 		}
 
@@ -418,12 +459,105 @@ UnpackedDataCache_t *CFrameSnapshotManager::GetCachedUncompressedEntity( PackedE
 	Assert ( pdcOldest );
 
 	// hmm, not in cache, clear & return oldest one
-	pdcOldest->counter = m_nPackedEntityCacheCounter;
+	pdcOldest->counter = pCache->m_nUnpackedCounter;
 	pdcOldest->bits = -1;	// important, this is the signal for the caller to fill this structure
 	pdcOldest->pEntity = packedEntity;
+	pdcOldest->serial = packedEntity->m_nCacheSerial;
 	return pdcOldest;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns the calling thread's cache, creating it on first use
+//-----------------------------------------------------------------------------
+CPackedEntityThreadCache *CFrameSnapshotManager::GetThreadCache()
+{
+	CPackedEntityThreadCache *pCache = m_pThreadCache;
+	if ( pCache )
+		return pCache;
+
+	pCache = new CPackedEntityThreadCache;
+	pCache->m_nFreeBlocks = 0;
+	pCache->m_nUnpackedCounter = 0;
+	pCache->m_pUnpacked = NULL;
+
+	{
+		AUTO_LOCK( m_WriteMutex );
+		pCache->m_pNext = m_pThreadCaches;
+		m_pThreadCaches = pCache;
+	}
+
+	m_pThreadCache = pCache;
+	return pCache;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Takes a block from the thread's stash, refilling it from the
+//  shared pool a batch at a time so the mutex is rarely touched
+//-----------------------------------------------------------------------------
+PackedEntity *CFrameSnapshotManager::AllocPackedEntity()
+{
+	CPackedEntityThreadCache *pCache = GetThreadCache();
+
+	if ( pCache->m_nFreeBlocks == 0 )
+	{
+		AUTO_LOCK( m_WriteMutex );
+		for ( int i = 0; i < CPackedEntityThreadCache::BLOCK_BATCH; i++ )
+		{
+			pCache->m_pFreeBlocks[pCache->m_nFreeBlocks++] = m_PackedEntitiesPool.CUtlMemoryPool::Alloc();
+		}
+	}
+
+	void *pBlock = pCache->m_pFreeBlocks[--pCache->m_nFreeBlocks];
+	PackedEntity *packedEntity = Construct( (PackedEntity *)pBlock );
+	packedEntity->m_nCacheSerial = ++m_nPackedEntitySerial;
+	return packedEntity;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns a block to the thread's stash, handing a batch back to the
+//  shared pool once the stash fills up
+//-----------------------------------------------------------------------------
+void CFrameSnapshotManager::FreePackedEntity( PackedEntity *packedEntity )
+{
+	Destruct( packedEntity );
+
+	CPackedEntityThreadCache *pCache = GetThreadCache();
+
+	if ( pCache->m_nFreeBlocks == CPackedEntityThreadCache::MAX_FREE_BLOCKS )
+	{
+		AUTO_LOCK( m_WriteMutex );
+		for ( int i = 0; i < CPackedEntityThreadCache::BLOCK_BATCH; i++ )
+		{
+			m_PackedEntitiesPool.CUtlMemoryPool::Free( pCache->m_pFreeBlocks[--pCache->m_nFreeBlocks] );
+		}
+	}
+
+	pCache->m_pFreeBlocks[pCache->m_nFreeBlocks++] = packedEntity;
+}
+
+void CFrameSnapshotManager::FlushThreadCaches()
+{
+	AUTO_LOCK( m_WriteMutex );
+
+	for ( CPackedEntityThreadCache *pCache = m_pThreadCaches; pCache; pCache = pCache->m_pNext )
+	{
+		while ( pCache->m_nFreeBlocks > 0 )
+		{
+			m_PackedEntitiesPool.CUtlMemoryPool::Free( pCache->m_pFreeBlocks[--pCache->m_nFreeBlocks] );
+		}
+
+		if ( pCache->m_pUnpacked )
+		{
+			for ( int i = 0; i < CPackedEntityThreadCache::NUM_UNPACKED_ENTRIES; i++ )
+			{
+				pCache->m_pUnpacked[i].pEntity = NULL;
+				pCache->m_pUnpacked[i].serial = 0;
+				pCache->m_pUnpacked[i].counter = 0;
+			}
+		}
+	}
+}
+
 
 
 
@@ -493,8 +627,7 @@ void CFrameSnapshot::ReleaseReference()
 {
 	Assert( m_nReferences > 0 );
 
-	--m_nReferences;
-	if ( m_nReferences == 0 )
+	if ( --m_nReferences == 0 )
 	{
 		g_FrameSnapshotManager.DeleteFrameSnapshot( this );
 	}
@@ -33,6 +33,8 @@
 #include "networkstringtable.h"
 #include "dt_send_eng.h"
 #include "sv_packedentities.h"
+#include "dt_instrumentation_server.h"
+#include "framesnapshot.h"
 #include "testscriptmgr.h"
 #include "PlayerState.h"
 #include "saverestoretypes.h"
@@ -48,6 +50,7 @@
 #include "vgui_baseui_interface.h"
 #endif
 #include "cbenchmark.h"
+#include "host_tickstats.h"
 #include "client.h"
 #include "hltvserver.h"
 #include "replay_internal.h"
@@ -73,6 +76,7 @@
 #include "host_state.h"
 #include "voice.h"
 #include "cbenchmark.h"
+#include "tier1/memstack.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -780,13 +784,34 @@ int SV_BuildSendTablesArray( ServerClass *pClasses, SendTable **pTables, int nMa
 }
 
 
+const CStandardSendProxies *SV_GetStandardSendProxies()
+{
+	if ( !serverGameDLL )
+		return NULL;
+
+	// If the game server is greater than v4, then it is using the new proxy format.
+	if ( g_iServerGameDLLVersion >= 5 )
+		return serverGameDLL->GetStandardSendProxies();
+
+	// If the game server is older than v4, it is using the old proxy; we set the new proxy members to the 
+	// engine's copy.
+	static CStandardSendProxies compatSendProxy = *serverGameDLL->GetStandardSendProxies();
+
+	compatSendProxy.m_DataTableToDataTable = g_StandardSendProxies.m_DataTableToDataTable;
+	compatSendProxy.m_SendLocalDataTable = g_StandardSendProxies.m_SendLocalDataTable;
+	compatSendProxy.m_ppNonModifiedPointerProxies = g_StandardSendProxies.m_ppNonModifiedPointerProxies;
+
+	return &compatSendProxy;
+}
+
+
 // Builds an alternate copy of the datatable for any classes that have datatables with props excluded.
 void SV_InitSendTables( ServerClass *pClasses )
 {
 	SendTable *pTables[MAX_DATATABLES];
 	int nTables = SV_BuildSendTablesArray( pClasses, pTables, ARRAYSIZE( pTables ) );
 
-	SendTable_Init( pTables, nTables );
+	SendTable_Init( pTables, nTables, SV_GetStandardSendProxies() );
 }
 
 
@@ -1818,16 +1843,11 @@ void CGameServer::CopyTempEntities( CFrameSnapshot* pSnapshot )
 	}
 }
 
-// If enabled, random crashes start to appear in WriteTempEntities, etc. It looks like
-// one thread can be in WriteDeltaEntities while another is in WriteTempEntities, and both are
-// partying on g_FrameSnapshotManager.m_FrameSnapshots. Bruce sent e-mail from a customer
-// that stated these crashes don't occur when parallel_sendsnapshot is disabled. Zoid said:
-//
-//   Easiest is just turn off parallel snapshots, it's not much of a win on servers where we
-//   are running many instances anyway. It's off in Dota and CSGO dedicated servers.
-//
-// Bruce also had a patch to disable this in //ValveGames/staging/game/tf/cfg/unencrypted/print_instance_config.py
-static ConVar sv_parallel_sendsnapshot( "sv_parallel_sendsnapshot", "0" );
+// Snapshot build and transmit is reentrant per client: scratch buffers are pooled per call
+// (CNetScratchBuffer), the snapshot list is guarded and snapshot deletes are deferred until
+// all workers are done (so WriteTempEntities can walk it), queued split packets are locked,
+// and failed sends only flag the client for a disconnect that is applied on the main thread.
+static ConVar sv_parallel_sendsnapshot( "sv_parallel_sendsnapshot", "1", 0, "Build and send client snapshots in parallel on the job threads" );
 
 static void SV_ParallelSendSnapshot( CGameClient *& pClient )
 {
@@ -1853,6 +1873,8 @@ static void SV_ParallelSendSnapshot( CGameClient *& pClient )
 void CGameServer::SendClientMessages ( bool bSendSnapshots )
 {
 	VPROF_BUDGET( "SendClientMessages", VPROF_BUDGETGROUP_OTHER_NETWORKING );
+
+	NET_BeginBatchedSend();
 	
 	// build individual updates
 	int receivingClientCount = 0;
@@ -1896,6 +1918,8 @@ void CGameServer::SendClientMessages ( bool bSendSnapshots )
 
 	if ( receivingClientCount )
 	{
+		g_TickStats.BeginPhase( TICKSTATS_PHASE_PACK_ENTITIES );
+
 		// if any client wants an update, take new snapshot now
 		CFrameSnapshot* pSnapshot = framesnapshotmanager->TakeTickSnapshot( m_nTickCount );
 
@@ -1905,12 +1929,36 @@ void CGameServer::SendClientMessages ( bool bSendSnapshots )
 		// Compute the client packs
 		SV_ComputeClientPacks( receivingClientCount, pReceivingClients, pSnapshot );
 
-		if ( receivingClientCount > 1 && sv_parallel_sendsnapshot.GetBool() )
+		g_TickStats.EndPhase( TICKSTATS_PHASE_PACK_ENTITIES );
+		g_TickStats.BeginPhase( TICKSTATS_PHASE_SEND_SNAPSHOTS );
+
+		// clients acking the same frame share encoded deltas for this snapshot
+		SV_SetDeltaCacheTick( pSnapshot->m_nTickCount, pSnapshot->m_nNumEntities );
+
+		// the datatable instrumentation accumulates into shared tables, keep it serial
+		if ( receivingClientCount > 1 && sv_parallel_sendsnapshot.GetBool() && !g_bServerDTIEnabled )
 		{
+			CGameClient *pParallelClients[ABSOLUTE_PLAYER_LIMIT];
+			Q_memcpy( pParallelClients, pReceivingClients, receivingClientCount * sizeof( CGameClient* ) );
+
+			for ( int i = 0; i < receivingClientCount; ++i )
+			{
+				pParallelClients[i]->SetDeferDisconnect( true );
+			}
+
+			framesnapshotmanager->BeginDeferredDeletes();
+
 			// SV_ParallelSendSnapshot will not process HLTV or Replay clients as they
 			// must be run on the main thread due to un-threadsafe global state access.
 			// It will replace anything that it does process with a NULL pointer.
 			ParallelProcess( "SV_ParallelSendSnapshot", pReceivingClients, receivingClientCount, &SV_ParallelSendSnapshot );
+
+			framesnapshotmanager->EndDeferredDeletes();
+
+			for ( int i = 0; i < receivingClientCount; ++i )
+			{
+				pParallelClients[i]->ApplyDeferredDisconnect();
+			}
 		}
 		
 		for (int i = 0; i < receivingClientCount; ++i)
@@ -1927,6 +1975,13 @@ void CGameServer::SendClientMessages ( bool bSendSnapshots )
 	
 		pSnapshot->ReleaseReference();
 	}
+
+	NET_FlushBatchedSend();
+
+	if ( receivingClientCount )
+	{
+		g_TickStats.EndPhase( TICKSTATS_PHASE_SEND_SNAPSHOTS );
+	}
 }
 
 void CGameServer::SetMaxClients( int number )
@@ -2852,7 +2907,9 @@ void SV_Think( bool bIsSimulating )
 	// in singleplayer only run think/simulation if localplayer is connected
 	bIsSimulating =  bIsSimulating && ( sv.IsMultiplayer() || cl.IsActive() );
 
+	g_TickStats.BeginPhase( TICKSTATS_PHASE_GAME_FRAME );
 	g_pServerPluginHandler->GameFrame( bIsSimulating );
+	g_TickStats.EndPhase( TICKSTATS_PHASE_GAME_FRAME );
 
 	if( bIsSimulating )
 		GetBenchResultsMgr()->Frame();
@@ -2913,9 +2970,15 @@ void SV_Frame( bool finalTick )
 {
 	VPROF( "SV_Frame" );
 
+	// Anything the last tick put in the per-tick arenas is dead now, including
+	// the deferred client updates which have run by the time we get here
+	FrameArenaEndFrame( FRAME_ARENA_SERVER_TICK );
+
 	if ( serverGameDLL && finalTick )
 	{
+		g_TickStats.BeginPhase( TICKSTATS_PHASE_SERVER_THINK );
 		serverGameDLL->Think( finalTick );
+		g_TickStats.EndPhase( TICKSTATS_PHASE_SERVER_THINK );
 	}
 
 	if ( !sv.IsActive() || !Host_ShouldRun() )
@@ -2933,7 +2996,9 @@ void SV_Frame( bool finalTick )
 	
 
 	// Run any commands from client and play client Think functions if it is time.
+	g_TickStats.BeginPhase( TICKSTATS_PHASE_NET_RECEIVE );
 	sv.RunFrame(); // read network input etc
+	g_TickStats.EndPhase( TICKSTATS_PHASE_NET_RECEIVE );
 
 	bool simulated = false;
 	if ( SV_HasPlayers() )
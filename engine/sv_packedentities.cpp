@@ -33,6 +33,7 @@
 #include "tier0/vcrmode.h"
 #include "vstdlib/jobthread.h"
 #include "enginethreads.h"
+#include "dt_localtransfer.h"
 
 #ifdef SWDS
 IClientEntityList *entitylist = NULL;
@@ -42,6 +43,19 @@ IClientEntityList *entitylist = NULL;
 #include "tier0/memdbgon.h"
 
 ConVar sv_debugmanualmode( "sv_debugmanualmode", "0", 0, "Make sure entities correctly report whether or not their network data has changed." );
+static ConVar sv_packentities_partial( "sv_packentities_partial", "1", 0, "When an entity reports which network vars changed, only re-encode those props and copy the rest from its previous packed data." );
+
+// Counts PackEntities passes (each of which invalidates the shared edict change infos), and
+// the pass each edict was last packed in. An edict's change info only covers everything since
+// its previous packed data if it was packed in the pass right before this one. 0 means never.
+static int s_nPackEntitiesPass = 1;
+static int s_EdictPackPass[MAX_EDICTS];
+
+static void SV_EndPackEntitiesPass()
+{
+	InvalidateSharedEdictChangeInfos();
+	++s_nPackEntitiesPass;
+}
 
 // Returns false and calls Host_Error if the edict's pvPrivateData is NULL.
 static inline bool SV_EnsurePrivateData(edict_t *pEdict)
@@ -117,6 +131,9 @@ static inline void SV_PackEntity(
 
 	int iSerialNum = pSnapshot->m_pEntities[ edictIdx ].m_nSerialNumber;
 
+	int nLastPackPass = s_EdictPackPass[ edictIdx ];
+	s_EdictPackPass[ edictIdx ] = s_nPackEntitiesPass;
+
 	// Check to see if this entity specifies its changes.
 	// If so, then try to early out making the fullpack
 	bool bUsedPrev = false;
@@ -144,7 +161,49 @@ static inline void SV_PackEntity(
 	unsigned char tempData[ sizeof( CSendProxyRecipients ) * MAX_DATATABLE_PROXIES ];
 	CUtlMemory< CSendProxyRecipients > recip( (CSendProxyRecipients*)tempData, pSendTable->m_pPrecalc->GetNumDataTableProxies() );
 
-	if( !SendTable_Encode( pSendTable, edict->GetUnknown(), &writeBuf, edictIdx, &recip, false ) )
+	// If this entity was previously in there, then it should have a valid IChangeFrameList 
+	// which we can delta against to figure out which properties have changed.
+	//
+	// If not, then we want to setup a new IChangeFrameList.
+
+	PackedEntity *pPrevFrame = framesnapshotmanager->GetPreviouslySentPacket( edictIdx, pSnapshot->m_pEntities[ edictIdx ].m_nSerialNumber );
+
+	int deltaProps[MAX_DATATABLE_PROPS];
+	int nChanges = -1;
+
+	// If the entity told us which network vars changed since the previous packed data,
+	// only re-encode those props and splice them into the previous data.
+	if ( pPrevFrame && 
+		nLastPackPass != 0 && nLastPackPass + 1 == s_nPackEntitiesPass &&
+		sv_packentities_partial.GetBool() && 
+		!sv_debugmanualmode.GetInt() )
+	{
+		unsigned short changedProps[MAX_CHANGE_OFFSETS*3];
+		int nChangedProps = GetChangedPropIndices( edict, pSendTable, changedProps );
+		if ( nChangedProps >= 0 )
+		{
+			Assert( !pPrevFrame->IsCompressed() );
+
+			nChanges = SendTable_EncodeChangedProps(
+				pSendTable,
+				edict->GetUnknown(),
+				pPrevFrame->GetData(), pPrevFrame->GetNumBits(),
+				changedProps, nChangedProps,
+				&writeBuf,
+				edictIdx,
+				&recip,
+				deltaProps,
+				ARRAYSIZE( deltaProps ) );
+
+			if ( nChanges < 0 )
+			{
+				// Let the full encode sort it out.
+				writeBuf.Reset();
+			}
+		}
+	}
+
+	if ( nChanges < 0 && !SendTable_Encode( pSendTable, edict->GetUnknown(), &writeBuf, edictIdx, &recip, false ) )
 	{							 
 		Host_Error( "SV_PackEntity: SendTable_Encode returned false (ent %d).\n", edictIdx );
 	}
@@ -160,29 +219,24 @@ static inline void SV_PackEntity(
 	int nFlatProps = SendTable_GetNumFlatProps( pSendTable );
 	IChangeFrameList *pChangeFrame = NULL;
 
-	// If this entity was previously in there, then it should have a valid IChangeFrameList 
-	// which we can delta against to figure out which properties have changed.
-	//
-	// If not, then we want to setup a new IChangeFrameList.
-
-	PackedEntity *pPrevFrame = framesnapshotmanager->GetPreviouslySentPacket( edictIdx, pSnapshot->m_pEntities[ edictIdx ].m_nSerialNumber );
 	if ( pPrevFrame )
 	{
-		// Calculate a delta.
+		// Calculate a delta, unless SendTable_EncodeChangedProps already did.
 		Assert( !pPrevFrame->IsCompressed() );
 		
-		int deltaProps[MAX_DATATABLE_PROPS];
-
-		int nChanges = SendTable_CalcDelta(
-			pSendTable, 
-			pPrevFrame->GetData(), pPrevFrame->GetNumBits(),
-			packedData,	writeBuf.GetNumBitsWritten(),
-			
-			deltaProps,
-			ARRAYSIZE( deltaProps ),
+		if ( nChanges < 0 )
+		{
+			nChanges = SendTable_CalcDelta(
+				pSendTable, 
+				pPrevFrame->GetData(), pPrevFrame->GetNumBits(),
+				packedData,	writeBuf.GetNumBitsWritten(),
+				
+				deltaProps,
+				ARRAYSIZE( deltaProps ),
 
-			edictIdx
-			);
+				edictIdx
+				);
+		}
 
 #ifndef NO_VCR
 		if ( vcr_verbose.GetInt() )
@@ -383,7 +437,7 @@ void PackEntities_NetworkBackDoor(
 	
 	// Tell the client about any entities that are now dormant.
 	g_pLocalNetworkBackdoor->ProcessDormantEntities();
-	InvalidateSharedEdictChangeInfos();
+	SV_EndPackEntitiesPass();
 }
 
 static ConVar sv_parallel_packentities( "sv_parallel_packentities", "1" );
@@ -463,7 +517,7 @@ void PackEntities_Normal(
 		}
 	}
 
-	InvalidateSharedEdictChangeInfos();
+	SV_EndPackEntitiesPass();
 }
 
 
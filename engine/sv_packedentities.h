@@ -30,5 +30,8 @@ void SV_EnsureInstanceBaseline( ServerClass *pServerClass, int iEdict, const voi
 
 void SV_EnableChangeFrames( bool state );
 
+// Starts a new tick for the entity delta cache shared by all clients in WriteDeltaEntities.
+void SV_SetDeltaCacheTick( int nTick, int nMaxEntities );
+
 
 #endif // SV_PACKEDENTITIES_H
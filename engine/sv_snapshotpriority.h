@@ -0,0 +1,135 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Picks which entity updates go out in a snapshot that won't fit the
+//			client's bandwidth. Kept free of server state so the unit tests
+//			can drive it directly.
+//
+//=============================================================================//
+
+#ifndef SV_SNAPSHOTPRIORITY_H
+#define SV_SNAPSHOTPRIORITY_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <stdlib.h>
+#include "const.h"
+#include "bitvec.h"
+#include "tier1/strtools.h"
+
+
+//-----------------------------------------------------------------------------
+// Number of snapshots each entity's update has been held back for, see
+// SV_ScheduleEntityUpdates. The scheduler saves the counts before it ages them,
+// so a snapshot that overflows and gets rewritten or dropped can put them back.
+//-----------------------------------------------------------------------------
+class CEntityStaleness
+{
+public:
+	CEntityStaleness() { Clear(); }
+
+	void Clear()
+	{
+		Q_memset( m_Count, 0, sizeof( m_Count ) );
+		m_bSaved = false;
+	}
+
+	// Call before writing each snapshot
+	void BeginSnapshot() { m_bSaved = false; }
+
+	// Call before changing any counts for the snapshot being written
+	void Save()
+	{
+		Q_memcpy( m_Saved, m_Count, sizeof( m_Count ) );
+		m_bSaved = true;
+	}
+
+	// The snapshot wasn't sent, forget what it did to the counts
+	void Revert()
+	{
+		if ( m_bSaved )
+		{
+			Q_memcpy( m_Count, m_Saved, sizeof( m_Count ) );
+			m_bSaved = false;
+		}
+	}
+
+	unsigned char *Base() { return m_Count; }
+	unsigned char operator[]( int nEntity ) const { return m_Count[nEntity]; }
+
+private:
+	unsigned char	m_Count[ MAX_EDICTS ];
+	unsigned char	m_Saved[ MAX_EDICTS ];
+	bool			m_bSaved;
+};
+
+
+struct EntityUpdatePriority_t
+{
+	int		nEntity;
+	int		nBits;			// estimated size of the update
+	float	flPriority;
+};
+
+inline int __cdecl EntityUpdatePriorityCompare( const EntityUpdatePriority_t *pLeft, const EntityUpdatePriority_t *pRight )
+{
+	if ( pLeft->flPriority > pRight->flPriority )
+		return -1;
+	if ( pLeft->flPriority < pRight->flPriority )
+		return 1;
+	return pLeft->nEntity - pRight->nEntity;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: How much an update matters to the client by distance alone, 1 right
+//  next to it and 0.5 at flHalfDistance
+//-----------------------------------------------------------------------------
+inline float SV_EntityUpdateRelevance( float flDistance, float flHalfDistance )
+{
+	return 1.0f / ( 1.0f + flDistance / flHalfDistance );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Sends updates in the given order while they fit in nBitsLeft and
+//  flags the rest in deferFlags, aging their staleness.
+//-----------------------------------------------------------------------------
+inline void SV_FillEntityUpdateBudget( const EntityUpdatePriority_t *pUpdates, int nUpdates, int nBitsLeft,
+	unsigned char *pStaleness, CBitVec<MAX_EDICTS> &deferFlags )
+{
+	deferFlags.ClearAll();
+
+	for ( int i = 0; i < nUpdates; i++ )
+	{
+		const EntityUpdatePriority_t &update = pUpdates[i];
+		if ( update.nBits <= nBitsLeft )
+		{
+			nBitsLeft -= update.nBits;
+			pStaleness[update.nEntity] = 0;
+		}
+		else
+		{
+			deferFlags.Set( update.nEntity );
+			pStaleness[update.nEntity]++;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Takes updates whose flPriority holds their relevance, boosts the ones
+//  that have been held back, sorts them best first and fills the budget.
+//-----------------------------------------------------------------------------
+inline void SV_PrioritizeEntityUpdates( EntityUpdatePriority_t *pUpdates, int nUpdates, int nBitsLeft,
+	unsigned char *pStaleness, CBitVec<MAX_EDICTS> &deferFlags )
+{
+	for ( int i = 0; i < nUpdates; i++ )
+	{
+		pUpdates[i].flPriority *= ( 1 + pStaleness[pUpdates[i].nEntity] );
+	}
+
+	typedef int (__cdecl *QSortCompareFunc_t)( const void *, const void * );
+	qsort( pUpdates, nUpdates, sizeof( EntityUpdatePriority_t ), (QSortCompareFunc_t)EntityUpdatePriorityCompare );
+
+	SV_FillEntityUpdateBudget( pUpdates, nUpdates, nBitsLeft, pStaleness, deferFlags );
+}
+
+#endif // SV_SNAPSHOTPRIORITY_H
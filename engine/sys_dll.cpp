@@ -43,6 +43,7 @@
 #include "sv_main.h"
 #include "traceinit.h"
 #include "dt_test.h"
+#include "ispatialpartitioninternal.h"
 #include "keys.h"
 #include "gl_matsysiface.h"
 #include "tier0/vcrmode.h"
@@ -1066,6 +1067,7 @@ int Sys_InitGame( CreateInterfaceFn appSystemFactory, const char* pBaseDir, void
 		if( !CommandLine()->FindParm( "-nodttest" ) && !CommandLine()->FindParm( "-dti" ) )
 		{
 			RunDataTableTest();	
+			RunSpatialPartitionTest();
 		}
 	}
 #endif
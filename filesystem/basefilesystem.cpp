@@ -124,6 +124,16 @@ CBaseFileSystem *BaseFileSystem()
 
 ConVar filesystem_buffer_size( "filesystem_buffer_size", "0", 0, "Size of per file buffers. 0 for none" );
 
+static void FSResolveCacheChanged( IConVar *var, const char *pOldValue, float flOldValue )
+{
+	if ( g_pBaseFileSystem )
+	{
+		g_pBaseFileSystem->InvalidateResolvedPaths();
+	}
+}
+
+ConVar fs_resolvecache( "fs_resolvecache", "1", 0, "Remember which search path relative file opens resolve to, and which files aren't in any", FSResolveCacheChanged );
+
 #if defined( TRACK_BLOCKING_IO )
 
 // If we hit more than 100 items in a frame, we're probably doing a level load...
@@ -315,6 +325,8 @@ CBaseFileSystem::CBaseFileSystem()
 	// Clear out statistics
 	memset( &m_Stats, 0, sizeof(m_Stats) );
 
+	m_nResolvedPathSerial = 0;
+
 	m_fwLevel    = FILESYSTEM_WARNING_REPORTUNCLOSED;
 	m_pfnWarning = NULL;
 	m_pLogFile   = NULL;
@@ -845,6 +857,8 @@ void CBaseFileSystem::AddVPKFile( char const *pPath, const char *pPathID, Search
 
 	// Check if we're trusted or not
 	SetSearchPathIsTrustedSource( sp );
+
+	InvalidateResolvedPaths();
 #endif // SUPPORT_PACKED_STORE
 }
 
@@ -869,6 +883,7 @@ bool CBaseFileSystem::RemoveVPKFile( const char *pPath, const char *pPathID )
 			if ( m_SearchPaths[i].GetPath() == pathIDSym )
 			{
 				m_SearchPaths.Remove( i );
+				InvalidateResolvedPaths();
 				return true;
 			}
 		}
@@ -939,6 +954,7 @@ bool CBaseFileSystem::AddPackFileFromPath( const char *pPath, const char *pakfil
 	sp->m_pPathIDInfo->SetPathID( pathID );
 	sp->SetPackFile( pf );
 
+	InvalidateResolvedPaths();
 	return true;
 }
 
@@ -1087,6 +1103,8 @@ void CBaseFileSystem::AddPackFiles( const char *pPath, const CUtlSymbol &pathID,
 			}
 		}
 	}
+
+	InvalidateResolvedPaths();
 }
 
 //-----------------------------------------------------------------------------
@@ -1106,6 +1124,8 @@ void CBaseFileSystem::RemoveAllMapSearchPaths( void )
 		
 		m_SearchPaths.Remove( i );
 	}
+
+	InvalidateResolvedPaths();
 }
 
 //-----------------------------------------------------------------------------
@@ -1181,6 +1201,7 @@ void CBaseFileSystem::AddMapPackFile( const char *pPath, const char *pPathID, Se
 				sp->m_bIsRemotePath = true;
 			}
 			SetSearchPathIsTrustedSource( sp );
+			InvalidateResolvedPaths();
 			return;
 		}
 	}
@@ -1259,6 +1280,7 @@ void CBaseFileSystem::AddMapPackFile( const char *pPath, const char *pPathID, Se
 			m_ZipFiles.AddToTail( pf );
 
 			SetSearchPathIsTrustedSource( sp );
+			InvalidateResolvedPaths();
 		}
 		else
 		{
@@ -1452,6 +1474,7 @@ void CBaseFileSystem::AddSearchPathInternal( const char *pPath, const char *path
 			}
 			else
 			{
+				InvalidateResolvedPaths();
 				m_SearchPaths.Remove(i); // remove it from its current position so we can add it back to the head
 				i--;
 				c--;
@@ -1523,6 +1546,8 @@ void CBaseFileSystem::AddSearchPathInternal( const char *pPath, const char *path
 	{
 		sp->m_bIsRemotePath = true;
 	}
+
+	InvalidateResolvedPaths();
 }
 
 //-----------------------------------------------------------------------------
@@ -1683,6 +1708,11 @@ bool CBaseFileSystem::RemoveSearchPath( const char *pPath, const char *pathID )
 		m_SearchPaths.Remove( i );
 		bret = true;
 	}
+
+	if ( bret )
+	{
+		InvalidateResolvedPaths();
+	}
 	return bret;
 }
 
@@ -1703,6 +1733,8 @@ void CBaseFileSystem::RemoveSearchPaths( const char *pathID )
 			m_SearchPaths.FastRemove(i);
 		}
 	}
+
+	InvalidateResolvedPaths();
 }
 
 
@@ -2122,6 +2154,7 @@ void CBaseFileSystem::RemoveAllSearchPaths( void )
 {
 	AUTO_LOCK( m_SearchPathsMutex );
 	m_SearchPaths.Purge();
+	InvalidateResolvedPaths();
 	//m_PackFileHandles.Purge();
 }
 
@@ -2374,6 +2407,120 @@ FileHandle_t CBaseFileSystem::FindFileInSearchPath( CFileOpenInfo &openInfo )
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Looks up where an earlier open of pFileName resolved to. When the
+//			result is RESOLVED_PATH_FOUND, searchPath is a copy of that search
+//			path holding its own reference to any pack. nSerial has to be passed
+//			back to AddResolvedPath when recording the result of a full search.
+//-----------------------------------------------------------------------------
+CBaseFileSystem::ResolvedPathResult_t CBaseFileSystem::FindResolvedPath( const char *pFileName, const CUtlSymbol &pathID, PathTypeFilter_t pathFilter, CSearchPath &searchPath, int &nSerial )
+{
+	AUTO_LOCK( m_SearchPathsMutex );
+
+	nSerial = m_nResolvedPathSerial;
+
+	UtlHashHandle_t h = m_ResolvedPathNames.Find( pFileName );
+	if ( h == m_ResolvedPathNames.InvalidHandle() )
+		return RESOLVED_PATH_UNKNOWN;
+
+	for ( int i = m_ResolvedPathNames[h]; i != -1; i = m_ResolvedPaths[i].m_iNext )
+	{
+		const ResolvedPath_t &resolved = m_ResolvedPaths[i];
+		if ( !( resolved.m_PathID == pathID ) || resolved.m_nFilter != pathFilter )
+			continue;
+
+		if ( resolved.m_iSearchPath == -1 )
+			return RESOLVED_PATH_MISSING;
+
+		if ( !m_SearchPaths.IsValidIndex( resolved.m_iSearchPath ) || m_SearchPaths[resolved.m_iSearchPath].m_storeId != resolved.m_nStoreId )
+			return RESOLVED_PATH_UNKNOWN;
+
+		searchPath = m_SearchPaths[resolved.m_iSearchPath];
+		if ( searchPath.GetPackFile() )
+		{
+			searchPath.GetPackFile()->AddRef();
+		}
+		else if ( searchPath.GetPackedStore() )
+		{
+			searchPath.GetPackedStore()->AddRef();
+		}
+		return RESOLVED_PATH_FOUND;
+	}
+
+	return RESOLVED_PATH_UNKNOWN;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Remembers the outcome of walking the search paths for pFileName.
+//			iSearchPath is the iterator's index of the search path the file was
+//			found in and nStoreId that path's m_storeId, or -1 if no search path
+//			had it.
+//-----------------------------------------------------------------------------
+void CBaseFileSystem::AddResolvedPath( const char *pFileName, const CUtlSymbol &pathID, PathTypeFilter_t pathFilter, int iSearchPath, int nStoreId, int nSerial )
+{
+	AUTO_LOCK( m_SearchPathsMutex );
+
+	// The search paths changed since the caller started walking them
+	if ( nSerial != m_nResolvedPathSerial )
+		return;
+
+	// The index is into the iterator's copy, only trust it if it's still the same path here
+	if ( iSearchPath != -1 && ( !m_SearchPaths.IsValidIndex( iSearchPath ) || m_SearchPaths[iSearchPath].m_storeId != nStoreId ) )
+		return;
+
+	// Don't let a long session of unique names grow this forever
+	if ( m_ResolvedPaths.Count() >= 65536 )
+	{
+		InvalidateResolvedPaths();
+	}
+
+	UtlHashHandle_t h = m_ResolvedPathNames.Insert( pFileName, -1 );
+
+	// Newer entries go in front, so they shadow anything stale for the same path ID
+	int i = m_ResolvedPaths.AddToTail();
+	ResolvedPath_t &resolved = m_ResolvedPaths[i];
+	resolved.m_PathID = pathID;
+	resolved.m_nFilter = pathFilter;
+	resolved.m_iSearchPath = iSearchPath;
+	resolved.m_nStoreId = ( iSearchPath != -1 ) ? nStoreId : 0;
+	resolved.m_iNext = m_ResolvedPathNames[h];
+	m_ResolvedPathNames[h] = i;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Forgets everything about one relative name, used when it's written
+//-----------------------------------------------------------------------------
+void CBaseFileSystem::RemoveResolvedPath( const char *pFileName )
+{
+	char szFixedName[MAX_PATH];
+	FixUpPath( pFileName, szFixedName, sizeof( szFixedName ) );
+
+	AUTO_LOCK( m_SearchPathsMutex );
+
+	if ( V_IsAbsolutePath( szFixedName ) )
+	{
+		// No telling which relative names this was reachable as
+		InvalidateResolvedPaths();
+		return;
+	}
+
+	// The entries stay in m_ResolvedPaths until the next invalidate
+	m_ResolvedPathNames.Remove( szFixedName );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Needs to be called whenever m_SearchPaths or the path ID filtering changes
+//-----------------------------------------------------------------------------
+void CBaseFileSystem::InvalidateResolvedPaths()
+{
+	AUTO_LOCK( m_SearchPathsMutex );
+
+	m_ResolvedPathNames.RemoveAll();
+	m_ResolvedPaths.RemoveAll();
+	m_nResolvedPathSerial++;
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -2519,6 +2666,55 @@ FileHandle_t CBaseFileSystem::OpenForRead( const char *pFileNameT, const char *p
 		}
 	}
 
+	// See if an earlier open of this name already walked the search paths.
+	// ("//pathid/" names get their path ID from the iterator, leave those alone)
+	CUtlSymbol pathIDSymbol = pathID ? g_PathIDTable.AddString( pathID ) : CUtlSymbol( UTL_INVAL_SYMBOL );
+	bool bUseResolvedPaths = fs_resolvecache.GetBool() && !( pFileName[0] == '/' && pFileName[1] == '/' );
+	int nResolvedPathSerial = 0;
+	CSearchPath resolvedSearchPath;
+	if ( bUseResolvedPaths )
+	{
+		ResolvedPathResult_t result = FindResolvedPath( pFileName, pathIDSymbol, pathFilter, resolvedSearchPath, nResolvedPathSerial );
+		if ( result == RESOLVED_PATH_MISSING )
+		{
+			m_Stats.nResolvedPathMissing++;
+			LogFileOpen( "[Failed]", pFileName, "" );
+			return ( FileHandle_t )0;
+		}
+
+		if ( result == RESOLVED_PATH_FOUND )
+		{
+			openInfo.m_pSearchPath = &resolvedSearchPath;
+			FileHandle_t filehandle = FindFileInSearchPath( openInfo );
+			if ( filehandle && ( resolvedSearchPath.m_bIsTrustedForPureServer || openInfo.m_ePureFileClass != ePureServerFileClass_AnyTrusted ) )
+			{
+				m_Stats.nResolvedPathHits++;
+				openInfo.HandleFileCRCTracking( openInfo.m_pFileName );
+				return filehandle;
+			}
+
+			// Gone from there, or not good enough for the pure server anymore. Do the full search.
+			if ( filehandle )
+			{
+				Close( filehandle );
+				openInfo.m_pFileHandle = NULL;
+				if ( ppszResolvedFilename && *ppszResolvedFilename )
+				{
+					free( *ppszResolvedFilename );
+					*ppszResolvedFilename = NULL;
+				}
+			}
+			m_Stats.nResolvedPathStale++;
+		}
+		else
+		{
+			m_Stats.nResolvedPathMisses++;
+		}
+	}
+
+	// Results that depended on the pure server whitelist skipping a path aren't remembered
+	bool bSkippedForPureServer = false;
+
 	CSearchPathsIterator iter( this, &pFileName, pathID, pathFilter );
 	for ( openInfo.m_pSearchPath = iter.GetFirst(); openInfo.m_pSearchPath != NULL; openInfo.m_pSearchPath = iter.GetNext() )
 	{
@@ -2529,6 +2725,8 @@ FileHandle_t CBaseFileSystem::OpenForRead( const char *pFileNameT, const char *p
 			// then we should make a note of this fact, and keep searching
 			if ( !openInfo.m_pSearchPath->m_bIsTrustedForPureServer && openInfo.m_ePureFileClass == ePureServerFileClass_AnyTrusted )
 			{
+				bSkippedForPureServer = true;
+
 				#ifdef PURE_SERVER_DEBUG_SPEW
 					Msg( "Ignoring %s from %s for pure server operation\n", openInfo.m_pFileName, openInfo.m_pSearchPath->GetDebugString() );
 				#endif
@@ -2544,12 +2742,22 @@ FileHandle_t CBaseFileSystem::OpenForRead( const char *pFileNameT, const char *p
 				continue;
 			}
 
+			if ( bUseResolvedPaths && !bSkippedForPureServer )
+			{
+				AddResolvedPath( pFileName, pathIDSymbol, pathFilter, iter.GetCurrentIndex(), openInfo.m_pSearchPath->m_storeId, nResolvedPathSerial );
+			}
+
 			// 
 			openInfo.HandleFileCRCTracking( openInfo.m_pFileName );
 			return filehandle;
 		}
 	}
 
+	if ( bUseResolvedPaths && !bSkippedForPureServer )
+	{
+		AddResolvedPath( pFileName, pathIDSymbol, pathFilter, -1, 0, nResolvedPathSerial );
+	}
+
 	LogFileOpen( "[Failed]", pFileName, "" );
 	return ( FileHandle_t )0;
 }
@@ -2589,6 +2797,9 @@ FileHandle_t CBaseFileSystem::OpenForWrite( const char *pFileName, const char *p
 		return ( FileHandle_t )0;
 	}
 
+	// The file may not have existed before, or now exists in an earlier search path
+	RemoveResolvedPath( pFileName );
+
 	CFileHandle *fh = new CFileHandle( this );
 	fh->m_nLength = size;
 	fh->m_type = FT_NORMAL;
@@ -3608,6 +3819,7 @@ void CBaseFileSystem::RegisterFileWhitelist( IPureServerWhitelist *pWhiteList, I
 	{
 		SetSearchPathIsTrustedSource( &m_SearchPaths[i] );
 	}
+	InvalidateResolvedPaths();
 
 	// See if we need to reload any files
 	if ( pFilesToReload )
@@ -4663,6 +4875,8 @@ void CBaseFileSystem::RemoveFile( char const* pRelativePath, const char *pathID
 	{
 		Warning( FILESYSTEM_WARNING, "Unable to remove %s!\n", szScratchFileName );
 	}
+
+	RemoveResolvedPath( pRelativePath );
 }
 
 
@@ -4724,6 +4938,8 @@ bool CBaseFileSystem::RenameFile( char const *pOldPath, char const *pNewPath, co
 		return false;
 	}
 
+	RemoveResolvedPath( pOldPath );
+	RemoveResolvedPath( pNewPath );
 	return true;
 }
 
@@ -5185,6 +5401,7 @@ CBaseFileSystem::CPathIDInfo* CBaseFileSystem::FindOrAddPathIDInfo( const CUtlSy
 void CBaseFileSystem::MarkPathIDByRequestOnly( const char *pPathID, bool bRequestOnly )
 {
 	FindOrAddPathIDInfo( g_PathIDTable.AddString( pPathID ), bRequestOnly );
+	InvalidateResolvedPaths();
 }
 
 #if defined( TRACK_BLOCKING_IO )
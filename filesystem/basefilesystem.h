@@ -469,6 +469,9 @@ public:
 	// Unregister a CMemoryFileBacking; must balance with RegisterMemoryFile.
 	virtual void UnregisterMemoryFile( CMemoryFileBacking *pFile );
 
+	// Forgets where relative opens resolved to, see OpenForRead
+	void InvalidateResolvedPaths();
+
 	//------------------------------------
 	// Synchronous path for file operations
 	//------------------------------------
@@ -623,6 +626,11 @@ public:
 		CSearchPath *GetFirst();
 		CSearchPath *GetNext();
 
+		// Index of the current search path in the iterator's own copy of the search paths. It
+		// only matches CBaseFileSystem::m_SearchPaths while they're unchanged, which callers
+		// check with the path's m_storeId (see AddResolvedPath)
+		int GetCurrentIndex() const { return m_iCurrent; }
+
 	private:
 		CSearchPathsIterator( const  CSearchPathsIterator & );
 		void operator=(const CSearchPathsIterator &);
@@ -759,6 +767,33 @@ protected:
 	CThreadFastMutex m_MemoryFileMutex;
 	CUtlHashtable< const char*, CMemoryFileBacking* > m_MemoryFileHash;
 
+	// Where relative opens ended up, so opening the same name again goes
+	// straight to the right search path (or fails without touching the disk).
+	// Guarded by m_SearchPathsMutex, and thrown away whenever the search paths change.
+	struct ResolvedPath_t
+	{
+		CUtlSymbol	m_PathID;			// path ID the open asked for
+		int			m_nFilter;			// PathTypeFilter_t the open used
+		int			m_iSearchPath;		// index in m_SearchPaths, -1 if no search path has the file
+		int			m_nStoreId;			// m_storeId of that search path, catches stale indices
+		int			m_iNext;			// next entry for the same name, -1 for none
+	};
+
+	enum ResolvedPathResult_t
+	{
+		RESOLVED_PATH_UNKNOWN,
+		RESOLVED_PATH_MISSING,
+		RESOLVED_PATH_FOUND,
+	};
+
+	ResolvedPathResult_t FindResolvedPath( const char *pFileName, const CUtlSymbol &pathID, PathTypeFilter_t pathFilter, CSearchPath &searchPath, int &nSerial );
+	void AddResolvedPath( const char *pFileName, const CUtlSymbol &pathID, PathTypeFilter_t pathFilter, int iSearchPath, int nStoreId, int nSerial );
+	void RemoveResolvedPath( const char *pFileName );
+
+	CUtlHashtable< CUtlString, int > m_ResolvedPathNames;	// relative name -> first entry in m_ResolvedPaths
+	CUtlVector< ResolvedPath_t > m_ResolvedPaths;
+	int m_nResolvedPathSerial;								// bumped by InvalidateResolvedPaths
+
 
 	//CUtlRBTree< COpenedFile, int > m_OpenedFiles;
 	CThreadMutex m_OpenedFilesMutex;
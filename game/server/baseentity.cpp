@@ -613,6 +613,20 @@ CBaseEntity *CBaseEntity::GetFollowedEntity()
 void CBaseEntity::SetClassname( const char *className )
 {
 	m_iClassname = AllocPooledString( className );
+	gEntList.UpdateEntityIndex( this );
+}
+
+void CBaseEntity::SetName( string_t newName )
+{
+	m_iName = newName;
+	gEntList.UpdateEntityIndex( this );
+}
+
+void CBaseEntity::SetModelName( string_t name )
+{
+	m_ModelName = name;
+	DispatchUpdateTransmitState();
+	gEntList.UpdateEntityIndex( this );
 }
 
 void CBaseEntity::SetModelIndex( int index )
@@ -3224,6 +3238,9 @@ int CBaseEntity::Restore( IRestore &restore )
 		m_hGroundEntity->AddEntityToGroundList( this );
 	}
 
+	// Name, classname and model were restored behind the find indices' back
+	gEntList.UpdateEntityIndex( this );
+
 	return status;
 }
 
@@ -1964,11 +1964,6 @@ inline string_t CBaseEntity::GetEntityName()
 	return m_iName; 
 }
 
-inline void CBaseEntity::SetName( string_t newName )
-{
-	m_iName = newName;
-}
-
 
 inline bool CBaseEntity::NameMatches( const char *pszNameOrWildcard )
 {
@@ -2487,12 +2482,6 @@ inline CBaseEntity *CBaseEntity::GetBaseEntity()
 //-----------------------------------------------------------------------------
 // Model related methods
 //-----------------------------------------------------------------------------
-inline void CBaseEntity::SetModelName( string_t name )
-{
-	m_ModelName = name;
-	DispatchUpdateTransmitState();
-}
-
 inline string_t CBaseEntity::GetModelName( void ) const
 {
 	return m_ModelName;
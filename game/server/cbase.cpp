@@ -84,6 +84,7 @@ OUTPUTS:
 #include "tier1/strtools.h"
 #include "datacache/imdlcache.h"
 #include "env_debughistory.h"
+#include "tier1/functors.h"
 
 #include "tier0/vprof.h"
 
@@ -642,10 +643,11 @@ DEFINE_FIXEDSIZE_ALLOCATOR( EventQueuePrioritizedEvent_t, 128, CUtlMemoryPool::G
 
 CEventQueue g_EventQueue;
 
-CEventQueue::CEventQueue()
+CEventQueue::CEventQueue() : m_TargetIndex( DefLessFunc( int ) ), m_CallerIndex( DefLessFunc( int ) )
 {
-	m_Events.m_flFireTime = -FLT_MAX;
-	m_Events.m_pNext = NULL;
+	m_nNextSerialNumber = 0;
+	m_pFiringEvent = NULL;
+	m_bFiringEventRemoved = false;
 
 	Init();
 }
@@ -759,21 +761,43 @@ void CEventQueue::Init( void )
 void CEventQueue::Clear( void )
 {
 	// delete all the events in the queue
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-	
-	while ( pe != NULL )
+	for ( int i = 0; i < m_Heap.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
-		delete pe;
-		pe = next;
+		if ( m_Heap[i] == m_pFiringEvent )
+		{
+			// ServiceEvents still holds it, it gets deleted there
+			m_bFiringEventRemoved = true;
+			continue;
+		}
+		delete m_Heap[i];
 	}
 
-	m_Events.m_pNext = NULL;
+	m_Heap.RemoveAll();
+	m_TargetIndex.RemoveAll();
+	m_CallerIndex.RemoveAll();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Gets the queued events in the order they'll fire
+//-----------------------------------------------------------------------------
+static int __cdecl CompareEventFireOrder( EventQueuePrioritizedEvent_t * const *a, EventQueuePrioritizedEvent_t * const *b )
+{
+	if ( (*a)->m_flFireTime != (*b)->m_flFireTime )
+		return ( (*a)->m_flFireTime < (*b)->m_flFireTime ) ? -1 : 1;
+
+	return (int)( (*a)->m_nSerialNumber - (*b)->m_nSerialNumber );
+}
+
+void CEventQueue::GetSortedEvents( CUtlVector< EventQueuePrioritizedEvent_t * > &events )
+{
+	events.CopyArray( m_Heap.Base(), m_Heap.Count() );
+	events.Sort( CompareEventFireOrder );
 }
 
 void CEventQueue::Dump( void )
 {
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	CUtlVector< EventQueuePrioritizedEvent_t * > events;
+	GetSortedEvents( events );
 
 	Msg("Dumping event queue. Current time is: %.2f\n",
 #ifdef TF_DLL
@@ -783,9 +807,9 @@ void CEventQueue::Dump( void )
 #endif
 		);
 
-	while ( pe != NULL )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *pe = events[i];
 
 		Msg("   (%.2f) Target: '%s', Input: '%s', Parameter '%s'. Activator: '%s', Caller '%s'.  \n", 
 			pe->m_flFireTime, 
@@ -794,8 +818,6 @@ void CEventQueue::Dump( void )
 			pe->m_VariantValue.String(),
 			pe->m_pActivator ? pe->m_pActivator->GetDebugName() : "None", 
 			pe->m_pCaller ? pe->m_pCaller->GetDebugName() : "None"  );
-
-		pe = next;
 	}
 
 	Msg("Finished dump.\n");
@@ -807,6 +829,14 @@ void CEventQueue::Dump( void )
 //-----------------------------------------------------------------------------
 void CEventQueue::AddEvent( const char *target, const char *targetInput, variant_t Value, float fireDelay, CBaseEntity *pActivator, CBaseEntity *pCaller, int outputID )
 {
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		// Event allocation and queue order aren't thread safe, queue it up once the workers are done
+		typedef void (CEventQueue::*AddEventFn_t)( const char *, const char *, variant_t, float, CBaseEntity *, CBaseEntity *, int );
+		UTIL_DeferSimulateSideEffect( CreateFunctor( this, (AddEventFn_t)&CEventQueue::AddEvent, target, targetInput, Value, fireDelay, pActivator, pCaller, outputID ) );
+		return;
+	}
+
 	// build the new event
 	EventQueuePrioritizedEvent_t *newEvent = new EventQueuePrioritizedEvent_t;
 #ifdef TF_DLL
@@ -830,6 +860,14 @@ void CEventQueue::AddEvent( const char *target, const char *targetInput, variant
 //-----------------------------------------------------------------------------
 void CEventQueue::AddEvent( CBaseEntity *target, const char *targetInput, variant_t Value, float fireDelay, CBaseEntity *pActivator, CBaseEntity *pCaller, int outputID )
 {
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		// Event allocation and queue order aren't thread safe, queue it up once the workers are done
+		typedef void (CEventQueue::*AddEventFn_t)( CBaseEntity *, const char *, variant_t, float, CBaseEntity *, CBaseEntity *, int );
+		UTIL_DeferSimulateSideEffect( CreateFunctor( this, (AddEventFn_t)&CEventQueue::AddEvent, target, targetInput, Value, fireDelay, pActivator, pCaller, outputID ) );
+		return;
+	}
+
 	// build the new event
 	EventQueuePrioritizedEvent_t *newEvent = new EventQueuePrioritizedEvent_t;
 #ifdef TF_DLL
@@ -857,41 +895,219 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *action, float fireD
 
 
 //-----------------------------------------------------------------------------
-// Purpose: private function, adds an event into the list
-// Input  : *newEvent - the (already built) event to add
+// Purpose: Links an event into one of the per-entity lists
 //-----------------------------------------------------------------------------
-void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
+typedef EventQueuePrioritizedEvent_t *EventQueuePrioritizedEvent_t::*EventLink_t;
+
+static void LinkEventToIndex( CUtlMap< int, EventQueuePrioritizedEvent_t * > &index, int key, EventQueuePrioritizedEvent_t *pe, EventLink_t pNext, EventLink_t pPrev )
 {
-	// loop through the actions looking for a place to insert
-	EventQueuePrioritizedEvent_t *pe;
-	for ( pe = &m_Events; pe->m_pNext != NULL; pe = pe->m_pNext )
+	pe->*pPrev = NULL;
+
+	unsigned short i = index.Find( key );
+	if ( i == index.InvalidIndex() )
 	{
-		if ( pe->m_pNext->m_flFireTime > newEvent->m_flFireTime )
-		{
+		pe->*pNext = NULL;
+		index.Insert( key, pe );
+		return;
+	}
+
+	EventQueuePrioritizedEvent_t *pHead = index[i];
+	pe->*pNext = pHead;
+	pHead->*pPrev = pe;
+	index[i] = pe;
+}
+
+static void UnlinkEventFromIndex( CUtlMap< int, EventQueuePrioritizedEvent_t * > &index, int key, EventQueuePrioritizedEvent_t *pe, EventLink_t pNext, EventLink_t pPrev )
+{
+	if ( pe->*pNext )
+	{
+		(pe->*pNext)->*pPrev = pe->*pPrev;
+	}
+
+	if ( pe->*pPrev )
+	{
+		(pe->*pPrev)->*pNext = pe->*pNext;
+		return;
+	}
+
+	// it was the head
+	unsigned short i = index.Find( key );
+	Assert( i != index.InvalidIndex() && index[i] == pe );
+	if ( pe->*pNext )
+	{
+		index[i] = pe->*pNext;
+	}
+	else
+	{
+		index.RemoveAt( i );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: heap order, earlier fire time first and ties in the order they were added
+//-----------------------------------------------------------------------------
+bool CEventQueue::FiresBefore( const EventQueuePrioritizedEvent_t *a, const EventQueuePrioritizedEvent_t *b )
+{
+	if ( a->m_flFireTime != b->m_flFireTime )
+		return a->m_flFireTime < b->m_flFireTime;
+
+	// serial numbers may wrap
+	return (int)( a->m_nSerialNumber - b->m_nSerialNumber ) < 0;
+}
+
+void CEventQueue::HeapSetAt( int i, EventQueuePrioritizedEvent_t *pe )
+{
+	m_Heap[i] = pe;
+	pe->m_iHeapIndex = i;
+}
+
+void CEventQueue::HeapSiftUp( int i )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[i];
+	while ( i > 0 )
+	{
+		int parent = ( i - 1 ) >> 1;
+		if ( !FiresBefore( pe, m_Heap[parent] ) )
+			break;
+
+		HeapSetAt( i, m_Heap[parent] );
+		i = parent;
+	}
+	HeapSetAt( i, pe );
+}
+
+void CEventQueue::HeapSiftDown( int i )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[i];
+	int count = m_Heap.Count();
+	while ( 1 )
+	{
+		int child = ( i << 1 ) + 1;
+		if ( child >= count )
 			break;
+
+		if ( child + 1 < count && FiresBefore( m_Heap[child + 1], m_Heap[child] ) )
+		{
+			child++;
 		}
+
+		if ( !FiresBefore( m_Heap[child], pe ) )
+			break;
+
+		HeapSetAt( i, m_Heap[child] );
+		i = child;
 	}
+	HeapSetAt( i, pe );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: private function, adds an event into the queue
+// Input  : *newEvent - the (already built) event to add
+//-----------------------------------------------------------------------------
+void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
+{
+	newEvent->m_nSerialNumber = m_nNextSerialNumber++;
+
+	HeapSetAt( m_Heap.AddToTail(), newEvent );
+	HeapSiftUp( newEvent->m_iHeapIndex );
 
-	Assert( pe );
+	if ( newEvent->m_pEntTarget.IsValid() )
+	{
+		LinkEventToIndex( m_TargetIndex, newEvent->m_pEntTarget.ToInt(), newEvent, &EventQueuePrioritizedEvent_t::m_pNextForTarget, &EventQueuePrioritizedEvent_t::m_pPrevForTarget );
+	}
 
-	// insert
-	newEvent->m_pNext = pe->m_pNext;
-	newEvent->m_pPrev = pe;
-	pe->m_pNext = newEvent;
-	if ( newEvent->m_pNext )
+	if ( newEvent->m_pCaller.IsValid() )
 	{
-		newEvent->m_pNext->m_pPrev = newEvent;
+		LinkEventToIndex( m_CallerIndex, newEvent->m_pCaller.ToInt(), newEvent, &EventQueuePrioritizedEvent_t::m_pNextForCaller, &EventQueuePrioritizedEvent_t::m_pPrevForCaller );
 	}
 }
 
 void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
 {
-	Assert( pe->m_pPrev );
-	pe->m_pPrev->m_pNext = pe->m_pNext;
-	if ( pe->m_pNext )
+	int i = pe->m_iHeapIndex;
+	Assert( m_Heap[i] == pe );
+
+	EventQueuePrioritizedEvent_t *pLast = m_Heap.Tail();
+	m_Heap.RemoveMultipleFromTail( 1 );
+	if ( pLast != pe )
+	{
+		HeapSetAt( i, pLast );
+		HeapSiftUp( i );
+		HeapSiftDown( pLast->m_iHeapIndex );
+	}
+
+	// handles keep their value after the entity is gone, so these are the keys it was added with
+	if ( pe->m_pEntTarget.IsValid() )
+	{
+		UnlinkEventFromIndex( m_TargetIndex, pe->m_pEntTarget.ToInt(), pe, &EventQueuePrioritizedEvent_t::m_pNextForTarget, &EventQueuePrioritizedEvent_t::m_pPrevForTarget );
+	}
+
+	if ( pe->m_pCaller.IsValid() )
+	{
+		UnlinkEventFromIndex( m_CallerIndex, pe->m_pCaller.ToInt(), pe, &EventQueuePrioritizedEvent_t::m_pNextForCaller, &EventQueuePrioritizedEvent_t::m_pPrevForCaller );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Removes and frees an event. The one being fired is freed by ServiceEvents.
+//-----------------------------------------------------------------------------
+void CEventQueue::DeleteEvent( EventQueuePrioritizedEvent_t *pe )
+{
+	RemoveEvent( pe );
+
+	if ( pe == m_pFiringEvent )
+	{
+		m_bFiringEventRemoved = true;
+		return;
+	}
+
+	delete pe;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Checks the heap and the per-entity lists agree
+//-----------------------------------------------------------------------------
+void CEventQueue::ValidateQueue( void )
+{
+	int nTargetLinked = 0;
+	int nCallerLinked = 0;
+
+	for ( int i = 0; i < m_Heap.Count(); i++ )
+	{
+		EventQueuePrioritizedEvent_t *pe = m_Heap[i];
+		Assert( pe->m_iHeapIndex == i );
+		Assert( i == 0 || !FiresBefore( pe, m_Heap[( i - 1 ) >> 1] ) );
+
+		if ( pe->m_pEntTarget.IsValid() )
+		{
+			nTargetLinked++;
+		}
+
+		if ( pe->m_pCaller.IsValid() )
+		{
+			nCallerLinked++;
+		}
+	}
+
+	FOR_EACH_MAP_FAST( m_TargetIndex, i )
+	{
+		for ( EventQueuePrioritizedEvent_t *pe = m_TargetIndex[i]; pe; pe = pe->m_pNextForTarget )
+		{
+			Assert( pe->m_pEntTarget.ToInt() == m_TargetIndex.Key( i ) );
+			nTargetLinked--;
+		}
+	}
+
+	FOR_EACH_MAP_FAST( m_CallerIndex, i )
 	{
-		pe->m_pNext->m_pPrev = pe->m_pPrev;
+		for ( EventQueuePrioritizedEvent_t *pe = m_CallerIndex[i]; pe; pe = pe->m_pNextForCaller )
+		{
+			Assert( pe->m_pCaller.ToInt() == m_CallerIndex.Key( i ) );
+			nCallerLinked--;
+		}
 	}
+
+	Assert( nTargetLinked == 0 && nCallerLinked == 0 );
 }
 
 
@@ -905,16 +1121,19 @@ void CEventQueue::ServiceEvents( void )
 		return;
 	}
 
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-
 #ifdef TF_DLL
-	while ( pe != NULL && pe->m_flFireTime <= engine->GetServerTime() )
+	while ( m_Heap.Count() && m_Heap[0]->m_flFireTime <= engine->GetServerTime() )
 #else
-	while ( pe != NULL && pe->m_flFireTime <= gpGlobals->curtime )
+	while ( m_Heap.Count() && m_Heap[0]->m_flFireTime <= gpGlobals->curtime )
 #endif
 	{
 		MDLCACHE_CRITICAL_SECTION();
 
+		// stays queued while it fires, so HasEventPending still sees it
+		EventQueuePrioritizedEvent_t *pe = m_Heap[0];
+		m_pFiringEvent = pe;
+		m_bFiringEventRemoved = false;
+
 		bool targetFound = false;
 
 		// find the targets
@@ -978,8 +1197,12 @@ void CEventQueue::ServiceEvents( void )
 			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
 		}
 
-		// remove the event from the list (remembering that the queue may have been added to)
-		RemoveEvent( pe );
+		// remove the event from the queue, unless it was cancelled while firing
+		m_pFiringEvent = NULL;
+		if ( !m_bFiringEventRemoved )
+		{
+			RemoveEvent( pe );
+		}
 		delete pe;
 
 		//
@@ -992,9 +1215,6 @@ void CEventQueue::ServiceEvents( void )
 				break;
 			}
 		}
-
-		// restart the list (to catch any new items have probably been added to the queue)
-		pe = m_Events.m_pNext;	
 	}
 }
 
@@ -1022,30 +1242,18 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 	if (!pCaller)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	unsigned short i = m_CallerIndex.Find( pCaller->GetRefEHandle().ToInt() );
+	if ( i == m_CallerIndex.InvalidIndex() )
+		return;
 
+	// Every event in the list has this caller; delete them all from the queue.
+	EventQueuePrioritizedEvent_t *pCur = m_CallerIndex[i];
 	while (pCur != NULL)
 	{
-		bool bDelete = false;
-		if (pCur->m_pCaller == pCaller)
-		{
-			// Pointers match; make sure everything else matches.
-			if (!stricmp(STRING(pCur->m_pCaller->GetEntityName()), STRING(pCaller->GetEntityName())) &&
-				!stricmp(pCur->m_pCaller->GetClassname(), pCaller->GetClassname()))
-			{
-				// Found a matching event; delete it from the queue.
-				bDelete = true;
-			}
-		}
-
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextForCaller;
 
-		if (bDelete)
-		{
-			RemoveEvent( pCurSave );
-			delete pCurSave;
-		}
+		DeleteEvent( pCurSave );
 	}
 }
 
@@ -1060,27 +1268,20 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 	if (!pTarget)
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	unsigned short i = m_TargetIndex.Find( pTarget->GetRefEHandle().ToInt() );
+	if ( i == m_TargetIndex.InvalidIndex() )
+		return;
 
+	EventQueuePrioritizedEvent_t *pCur = m_TargetIndex[i];
 	while (pCur != NULL)
 	{
-		bool bDelete = false;
-		if (pCur->m_pEntTarget == pTarget)
-		{
-			if ( !Q_strncmp( STRING(pCur->m_iTargetInput), sInputName, strlen(sInputName) ) )
-			{
-				// Found a matching event; delete it from the queue.
-				bDelete = true;
-			}
-		}
-
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextForTarget;
 
-		if (bDelete)
+		if ( !Q_strncmp( STRING(pCurSave->m_iTargetInput), sInputName, strlen(sInputName) ) )
 		{
-			RemoveEvent( pCurSave );
-			delete pCurSave;
+			// Found a matching event; delete it from the queue.
+			DeleteEvent( pCurSave );
 		}
 	}
 }
@@ -1095,20 +1296,17 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 	if (!pTarget)
 		return false;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
-
-	while (pCur != NULL)
-	{
-		if (pCur->m_pEntTarget == pTarget)
-		{
-			if ( !sInputName )
-				return true;
+	unsigned short i = m_TargetIndex.Find( pTarget->GetRefEHandle().ToInt() );
+	if ( i == m_TargetIndex.InvalidIndex() )
+		return false;
 
-			if ( !Q_strncmp( STRING(pCur->m_iTargetInput), sInputName, strlen(sInputName) ) )
-				return true;
-		}
+	if ( !sInputName )
+		return true;
 
-		pCur = pCur->m_pNext;
+	for ( EventQueuePrioritizedEvent_t *pCur = m_TargetIndex[i]; pCur != NULL; pCur = pCur->m_pNextForTarget )
+	{
+		if ( !Q_strncmp( STRING(pCur->m_iTargetInput), sInputName, strlen(sInputName) ) )
+			return true;
 	}
 
 	return false;
@@ -1143,29 +1341,31 @@ BEGIN_SIMPLE_DATADESC( EventQueuePrioritizedEvent_t )
 	DEFINE_FIELD( m_iOutputID, FIELD_INTEGER ),
 	DEFINE_CUSTOM_FIELD( m_VariantValue, variantFuncs ),
 
-//	DEFINE_FIELD( m_pNext, FIELD_??? ),
-//	DEFINE_FIELD( m_pPrev, FIELD_??? ),
+//	DEFINE_FIELD( m_nSerialNumber, FIELD_INTEGER ),	// restored events are re-added in fire order
+//	DEFINE_FIELD( m_iHeapIndex, FIELD_INTEGER ),
+//	DEFINE_FIELD( m_pNextForTarget, FIELD_??? ),
+//	DEFINE_FIELD( m_pPrevForTarget, FIELD_??? ),
+//	DEFINE_FIELD( m_pNextForCaller, FIELD_??? ),
+//	DEFINE_FIELD( m_pPrevForCaller, FIELD_??? ),
 END_DATADESC()
 
 
 int CEventQueue::Save( ISave &save )
 {
-	// count the number of items in the queue
-	EventQueuePrioritizedEvent_t *pe;
+	// save in fire order, restoring re-adds them in the same order so ties still fire the same way
+	CUtlVector< EventQueuePrioritizedEvent_t * > events;
+	GetSortedEvents( events );
 
-	m_iListCount = 0;
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
-	{
-		m_iListCount++;
-	}
+	m_iListCount = events.Count();
 
 	// save that value out to disk, so we know how many to restore
 	if ( !save.WriteFields( "EventQueue", this, NULL, m_DataMap.dataDesc, m_DataMap.dataNumFields ) )
 		return 0;
 	
 	// cycle through all the events, saving them all
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
+		EventQueuePrioritizedEvent_t *pe = events[i];
 		if ( !save.WriteFields( "PEvent", pe, NULL, pe->m_DataMap.dataDesc, pe->m_DataMap.dataNumFields ) )
 			return 0;
 	}
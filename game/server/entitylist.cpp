@@ -17,6 +17,7 @@
 #include "ai_initutils.h"
 #include "globalstate.h"
 #include "datacache/imdlcache.h"
+#include "tier1/functors.h"
 
 #ifdef HL2_DLL
 #include "npc_playercompanion.h"
@@ -277,6 +278,14 @@ int SimThink_ListCopy( CBaseEntity *pList[], int listMax )
 
 void SimThink_EntityChanged( CBaseEntity *pEntity )
 {
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		// The list is shared by every worker, update it from the main thread once they're done.
+		// It reads the entity's think state then, which is what it would have ended up with anyway.
+		UTIL_DeferSimulateSideEffect( CreateFunctor( &SimThink_EntityChanged, pEntity ) );
+		return;
+	}
+
 	g_SimThinkManager.EntityChanged( pEntity );
 }
 
@@ -290,10 +299,20 @@ CBaseEntityClassList::~CBaseEntityClassList()
 {
 }
 
-CGlobalEntityList::CGlobalEntityList()
+CGlobalEntityList::CGlobalEntityList() : m_EntityIndexKeys( 0, 256, true )
 {
 	m_iHighestEnt = m_iNumEnts = m_iNumEdicts = 0;
 	m_bClearingEntities = false;
+	m_nEntityAddOrder = 0;
+
+	for ( int i = 0; i < NUM_ENT_ENTRIES; i++ )
+	{
+		for ( int j = 0; j < ENTINDEX_COUNT; j++ )
+		{
+			m_EntityIndex[i].m_Links[j].m_pszValue = NULL;
+			m_EntityIndex[i].m_Links[j].m_Key = UTL_INVAL_SYMBOL;
+		}
+	}
 }
 
 
@@ -382,6 +401,16 @@ void CGlobalEntityList::Clear( void )
 	m_iHighestEnt = 0;
 	m_iNumEnts = 0;
 
+	// every bucket is empty now, drop the keys gathered over the level
+	if ( FirstHandle() == InvalidHandle() )
+	{
+		for ( int i = 0; i < ENTINDEX_COUNT; i++ )
+		{
+			m_EntityIndexBuckets[i].Purge();
+		}
+		m_EntityIndexKeys.RemoveAll();
+	}
+
 	m_bClearingEntities = false;
 }
 
@@ -474,6 +503,142 @@ bool CGlobalEntityList::IsEntityPtr( void *pTest )
 	return false; 
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Adds an entity slot to a find index bucket, keeping the bucket in
+//			entity list order.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::LinkEntityIndex( int nIndex, int nSlot, UtlSymId_t key )
+{
+	EntityIndexLink_t &link = m_EntityIndex[nSlot].m_Links[nIndex];
+	link.m_Key = key;
+	link.m_nNext = link.m_nPrev = -1;
+
+	if ( key == UTL_INVAL_SYMBOL )
+		return;
+
+	CUtlVector< EntityIndexBucket_t > &buckets = m_EntityIndexBuckets[nIndex];
+	while ( buckets.Count() <= key )
+	{
+		EntityIndexBucket_t &newBucket = buckets[ buckets.AddToTail() ];
+		newBucket.m_nHead = newBucket.m_nTail = -1;
+	}
+	EntityIndexBucket_t &bucket = buckets[key];
+
+	// Usually this is the newest entity, so walk back from the tail
+	unsigned int nAddOrder = m_EntityIndex[nSlot].m_nAddOrder;
+	int nPrev = bucket.m_nTail;
+	while ( nPrev != -1 && (int)( m_EntityIndex[nPrev].m_nAddOrder - nAddOrder ) > 0 )
+	{
+		nPrev = m_EntityIndex[nPrev].m_Links[nIndex].m_nPrev;
+	}
+	int nNext = ( nPrev != -1 ) ? m_EntityIndex[nPrev].m_Links[nIndex].m_nNext : bucket.m_nHead;
+
+	link.m_nPrev = nPrev;
+	link.m_nNext = nNext;
+
+	if ( nPrev != -1 )
+		m_EntityIndex[nPrev].m_Links[nIndex].m_nNext = nSlot;
+	else
+		bucket.m_nHead = nSlot;
+
+	if ( nNext != -1 )
+		m_EntityIndex[nNext].m_Links[nIndex].m_nPrev = nSlot;
+	else
+		bucket.m_nTail = nSlot;
+}
+
+void CGlobalEntityList::UnlinkEntityIndex( int nIndex, int nSlot )
+{
+	EntityIndexLink_t &link = m_EntityIndex[nSlot].m_Links[nIndex];
+	if ( link.m_Key != UTL_INVAL_SYMBOL )
+	{
+		EntityIndexBucket_t &bucket = m_EntityIndexBuckets[nIndex][link.m_Key];
+
+		if ( link.m_nPrev != -1 )
+			m_EntityIndex[link.m_nPrev].m_Links[nIndex].m_nNext = link.m_nNext;
+		else
+			bucket.m_nHead = link.m_nNext;
+
+		if ( link.m_nNext != -1 )
+			m_EntityIndex[link.m_nNext].m_Links[nIndex].m_nPrev = link.m_nPrev;
+		else
+			bucket.m_nTail = link.m_nPrev;
+	}
+
+	link.m_pszValue = NULL;
+	link.m_Key = UTL_INVAL_SYMBOL;
+	link.m_nNext = link.m_nPrev = -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Moves an entity to the right find index buckets after its classname,
+//			name or model changed.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::UpdateEntityIndex( CBaseEntity *pEntity )
+{
+	// Not in the list yet, OnAddEntity will pick it up
+	const CBaseHandle &handle = pEntity->GetRefEHandle();
+	if ( !handle.IsValid() || LookupEntity( handle ) != pEntity )
+		return;
+
+	int nSlot = handle.GetEntryIndex();
+
+	string_t values[ENTINDEX_COUNT];
+	values[ENTINDEX_CLASSNAME] = pEntity->m_iClassname;
+	values[ENTINDEX_NAME] = pEntity->GetEntityName();
+	values[ENTINDEX_MODEL] = pEntity->GetModelName();
+
+	for ( int i = 0; i < ENTINDEX_COUNT; i++ )
+	{
+		EntityIndexLink_t &link = m_EntityIndex[nSlot].m_Links[i];
+
+		// pooled strings, same pointer means same key
+		const char *pszValue = STRING( values[i] );
+		if ( pszValue == link.m_pszValue )
+			continue;
+
+		UtlSymId_t key = ( pszValue && pszValue[0] ) ? (UtlSymId_t)m_EntityIndexKeys.AddString( pszValue ) : UTL_INVAL_SYMBOL;
+		if ( key != link.m_Key )
+		{
+			UnlinkEntityIndex( i, nSlot );
+			LinkEntityIndex( i, nSlot, key );
+		}
+		link.m_pszValue = pszValue;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the next entity after pStartEntity in a find index bucket
+//-----------------------------------------------------------------------------
+CBaseEntity *CGlobalEntityList::NextIndexedEntity( int nIndex, CBaseEntity *pStartEntity, const char *pszKey )
+{
+	UtlSymId_t key = m_EntityIndexKeys.Find( pszKey );
+	if ( key == UTL_INVAL_SYMBOL || key >= m_EntityIndexBuckets[nIndex].Count() )
+		return NULL;
+
+	int nSlot = m_EntityIndexBuckets[nIndex][key].m_nHead;
+	if ( pStartEntity )
+	{
+		int nStartSlot = pStartEntity->GetRefEHandle().GetEntryIndex();
+		const EntityIndexLink_t &startLink = m_EntityIndex[nStartSlot].m_Links[nIndex];
+		if ( startLink.m_Key == key )
+		{
+			nSlot = startLink.m_nNext;
+		}
+		else
+		{
+			// The start entity isn't a match, skip everything added before it
+			unsigned int nStartOrder = m_EntityIndex[nStartSlot].m_nAddOrder;
+			while ( nSlot != -1 && (int)( m_EntityIndex[nSlot].m_nAddOrder - nStartOrder ) <= 0 )
+			{
+				nSlot = m_EntityIndex[nSlot].m_Links[nIndex].m_nNext;
+			}
+		}
+	}
+
+	return ( nSlot != -1 ) ? (CBaseEntity *)GetEntInfoPtrByIndex( nSlot )->m_pEntity : NULL;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Iterates the entities with a given classname.
 // Input  : pStartEntity - Last entity found, NULL to start a new iteration.
@@ -481,6 +646,10 @@ bool CGlobalEntityList::IsEntityPtr( void *pTest )
 //-----------------------------------------------------------------------------
 CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity, const char *szName )
 {
+	// Wildcards still need the full walk
+	if ( szName && szName[0] && !Q_strstr( szName, "*" ) )
+		return NextIndexedEntity( ENTINDEX_CLASSNAME, pStartEntity, szName );
+
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -590,6 +759,21 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 
 		return NULL;
 	}
+
+	// Wildcards still need the full walk
+	if ( !Q_strstr( szName, "*" ) )
+	{
+		CBaseEntity *ent = pStartEntity;
+		while ( ( ent = NextIndexedEntity( ENTINDEX_NAME, ent, szName ) ) != NULL )
+		{
+			if ( pFilter && !pFilter->ShouldFindEntity(ent) )
+				continue;
+
+			return ent;
+		}
+
+		return NULL;
+	}
 	
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -624,6 +808,18 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 //-----------------------------------------------------------------------------
 CBaseEntity *CGlobalEntityList::FindEntityByModel( CBaseEntity *pStartEntity, const char *szModelName )
 {
+	if ( szModelName && szModelName[0] )
+	{
+		CBaseEntity *ent = pStartEntity;
+		while ( ( ent = NextIndexedEntity( ENTINDEX_MODEL, ent, szModelName ) ) != NULL )
+		{
+			if ( ent->edict() )
+				return ent;
+		}
+
+		return NULL;
+	}
+
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -1092,6 +1288,10 @@ void CGlobalEntityList::OnAddEntity( IHandleEntity *pEnt, CBaseHandle handle )
 	CBaseEntity *pBaseEnt = static_cast<IServerUnknown*>(pEnt)->GetBaseEntity();
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts++;
+
+	// entity list order is add order, the find indices sort by it
+	m_EntityIndex[handle.GetEntryIndex()].m_nAddOrder = m_nEntityAddOrder++;
+	UpdateEntityIndex( pBaseEnt );
 	
 	// NOTE: Must be a CBaseEntity on server
 	Assert( pBaseEnt );
@@ -1125,6 +1325,11 @@ void CGlobalEntityList::OnRemoveEntity( IHandleEntity *pEnt, CBaseHandle handle
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts--;
 
+	for ( int i = 0; i < ENTINDEX_COUNT; i++ )
+	{
+		UnlinkEntityIndex( i, handle.GetEntryIndex() );
+	}
+
 	m_iNumEnts--;
 }
 
@@ -14,6 +14,7 @@
 #endif
 
 #include "baseentity.h"
+#include "utlsymbol.h"
 
 class IEntityListener;
 
@@ -81,6 +82,47 @@ private:
 	bool m_bClearingEntities;
 	CUtlVector<IEntityListener *>	m_entityListeners;
 
+	// Entities bucketed by classname, targetname and model so the finds only visit
+	// matches. Buckets are kept in entity list order, which is the order entities
+	// were added in, so results come back in the same order as a full walk.
+	enum
+	{
+		ENTINDEX_CLASSNAME = 0,
+		ENTINDEX_NAME,
+		ENTINDEX_MODEL,
+
+		ENTINDEX_COUNT
+	};
+
+	struct EntityIndexLink_t
+	{
+		const char	*m_pszValue;	// pooled string the key was made from
+		UtlSymId_t	m_Key;		// bucket, UTL_INVAL_SYMBOL if not in one
+		int			m_nNext;	// entity slots, -1 terminated
+		int			m_nPrev;
+	};
+
+	struct EntityIndexEntry_t
+	{
+		unsigned int		m_nAddOrder;
+		EntityIndexLink_t	m_Links[ENTINDEX_COUNT];
+	};
+
+	struct EntityIndexBucket_t
+	{
+		int		m_nHead;
+		int		m_nTail;
+	};
+
+	void LinkEntityIndex( int nIndex, int nSlot, UtlSymId_t key );
+	void UnlinkEntityIndex( int nIndex, int nSlot );
+	CBaseEntity *NextIndexedEntity( int nIndex, CBaseEntity *pStartEntity, const char *pszKey );
+
+	EntityIndexEntry_t		m_EntityIndex[NUM_ENT_ENTRIES];
+	CUtlVector< EntityIndexBucket_t >	m_EntityIndexBuckets[ENTINDEX_COUNT];
+	CUtlSymbolTable			m_EntityIndexKeys;	// case insensitive, like entity name matching
+	unsigned int			m_nEntityAddOrder;
+
 public:
 	IServerNetworkable* GetServerNetworkable( CBaseHandle hEnt ) const;
 	CBaseNetworkable* GetBaseNetworkable( CBaseHandle hEnt ) const;
@@ -108,6 +150,9 @@ public:
 
 	void ReportEntityFlagsChanged( CBaseEntity *pEntity, unsigned int flagsOld, unsigned int flagsNow );
 
+	// the entity's classname, name or model may have changed, update the find indices
+	void UpdateEntityIndex( CBaseEntity *pEntity );
+
 	// entity is about to be removed, notify the listeners
 	void NotifyCreateEntity( CBaseEntity *pEnt );
 	void NotifySpawn( CBaseEntity *pEnt );
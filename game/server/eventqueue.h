@@ -6,6 +6,11 @@
 //
 //			The queue is serviced once per server frame.
 //
+//			Events live in a binary heap ordered by fire time, ties fire in the
+//			order they were added. Events with a direct target or a caller are
+//			also linked into per-entity lists so cancelling and querying them
+//			doesn't have to look at the whole queue.
+//
 //=============================================================================//
 
 #ifndef EVENTQUEUE_H
@@ -15,6 +20,7 @@
 #endif
 
 #include "mempool.h"
+#include "utlmap.h"
 
 struct EventQueuePrioritizedEvent_t
 {
@@ -28,8 +34,14 @@ struct EventQueuePrioritizedEvent_t
 
 	variant_t m_VariantValue;	// variable-type parameter
 
-	EventQueuePrioritizedEvent_t *m_pNext;
-	EventQueuePrioritizedEvent_t *m_pPrev;
+	unsigned int m_nSerialNumber;	// breaks fire time ties, in the order events were added
+	int m_iHeapIndex;
+
+	// other events with the same m_pEntTarget / m_pCaller
+	EventQueuePrioritizedEvent_t *m_pNextForTarget;
+	EventQueuePrioritizedEvent_t *m_pPrevForTarget;
+	EventQueuePrioritizedEvent_t *m_pNextForCaller;
+	EventQueuePrioritizedEvent_t *m_pPrevForCaller;
 
 	DECLARE_SIMPLE_DATADESC();
 
@@ -68,11 +80,26 @@ public:
 
 private:
 
+	typedef CUtlMap< int, EventQueuePrioritizedEvent_t * > EventIndex_t;
+
 	void AddEvent( EventQueuePrioritizedEvent_t *event );
 	void RemoveEvent( EventQueuePrioritizedEvent_t *pe );
+	void DeleteEvent( EventQueuePrioritizedEvent_t *pe );
+	void GetSortedEvents( CUtlVector< EventQueuePrioritizedEvent_t * > &events );
+
+	// heap
+	static bool FiresBefore( const EventQueuePrioritizedEvent_t *a, const EventQueuePrioritizedEvent_t *b );
+	void HeapSetAt( int i, EventQueuePrioritizedEvent_t *pe );
+	void HeapSiftUp( int i );
+	void HeapSiftDown( int i );
 
 	DECLARE_SIMPLE_DATADESC();
-	EventQueuePrioritizedEvent_t m_Events;
+	CUtlVector< EventQueuePrioritizedEvent_t * > m_Heap;
+	EventIndex_t m_TargetIndex;		// first event for each m_pEntTarget handle
+	EventIndex_t m_CallerIndex;		// first event for each m_pCaller handle
+	unsigned int m_nNextSerialNumber;
+	EventQueuePrioritizedEvent_t *m_pFiringEvent;	// event ServiceEvents is dispatching
+	bool m_bFiringEventRemoved;		// it was cancelled while it fired
 	int m_iListCount;
 };
 
@@ -28,14 +28,21 @@ public:
 		m_bInGodMode( false ),
 		m_bInNoClip( false )
 	{
-		m_vecSaveOrigin.Init();
+		for ( int i = 0; i < MAX_PLAYERS; i++ )
+		{
+			m_vecSaveOrigin[i].Init();
+		}
 	}
 
 	void SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *pHelper, CMoveData *move );
 	void FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *move );
 
+protected:
+	CMoveData *CreateMoveData( void ) { return new CHLMoveData; }
+
 private:
-	Vector m_vecSaveOrigin;
+	// Per player, RunCommandsInParallel sets up every player's move before finishing any
+	Vector m_vecSaveOrigin[MAX_PLAYERS];
 	bool m_bWasInVehicle;
 	bool m_bVehicleFlipped;
 	bool m_bInGodMode;
@@ -81,6 +88,7 @@ void CHLPlayerMove::SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 
 	if ( gpGlobals->frametime != 0 )
 	{
+		Vector &vecSaveOrigin = m_vecSaveOrigin[ player->entindex() - 1 ];
 		IServerVehicle *pVehicle = player->GetVehicle();
 
 		if ( pVehicle )
@@ -90,12 +98,12 @@ void CHLPlayerMove::SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 			if ( !m_bWasInVehicle )
 			{
 				m_bWasInVehicle = true;
-				m_vecSaveOrigin.Init();
+				vecSaveOrigin.Init();
 			}
 		}
 		else
 		{
-			m_vecSaveOrigin = player->GetAbsOrigin();
+			vecSaveOrigin = player->GetAbsOrigin();
 			if ( m_bWasInVehicle )
 			{
 				m_bWasInVehicle = false;
@@ -111,6 +119,7 @@ void CHLPlayerMove::FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *
 	BaseClass::FinishMove( player, ucmd, move );
 	if ( gpGlobals->frametime != 0 )
 	{		
+		Vector &vecSaveOrigin = m_vecSaveOrigin[ player->entindex() - 1 ];
 		float distance = 0.0f;
 		IServerVehicle *pVehicle = player->GetVehicle();
 		if ( pVehicle )
@@ -121,10 +130,10 @@ void CHLPlayerMove::FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *
 			{
 				Vector newPos;
 				obj->GetPosition( &newPos, NULL );
-				distance = VectorLength( newPos - m_vecSaveOrigin );
-				if ( m_vecSaveOrigin == vec3_origin || distance > 100.0f )
+				distance = VectorLength( newPos - vecSaveOrigin );
+				if ( vecSaveOrigin == vec3_origin || distance > 100.0f )
 					distance = 0.0f;
-				m_vecSaveOrigin = newPos;
+				vecSaveOrigin = newPos;
 			}
 			
 			CPropVehicleDriveable *driveable = dynamic_cast< CPropVehicleDriveable * >( player->GetVehicleEntity() );
@@ -149,7 +158,7 @@ void CHLPlayerMove::FinishMove( CBasePlayer *player, CUserCmd *ucmd, CMoveData *
 		else
 		{
 			m_bVehicleFlipped = false;
-			distance = VectorLength( player->GetAbsOrigin() - m_vecSaveOrigin );
+			distance = VectorLength( player->GetAbsOrigin() - vecSaveOrigin );
 		}
 		if ( distance > 0 )
 		{
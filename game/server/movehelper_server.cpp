@@ -13,6 +13,7 @@
 #include "movehelper_server.h"
 #include "shake.h"				// For screen fade constants
 #include "engine/IEngineSound.h"
+#include "tier1/functors.h"
 
 //=============================================================================
 // HPE_BEGIN
@@ -41,7 +42,7 @@ extern IPhysicsCollision *physcollision;
 class CMoveHelperServer : public IMoveHelperServer
 {
 public:
-	CMoveHelperServer( void );
+	CMoveHelperServer( bool bSingleton = true );
 	virtual ~CMoveHelperServer();
 
 	// Methods associated with a particular entity
@@ -70,6 +71,9 @@ public:
 	virtual bool IsWorldEntity( const CBaseHandle &handle );
 
 private:
+	void			DeferredPlayerSetAnimation( PLAYER_ANIM eAnim );
+
+	bool			m_bSingleton;
 	CBasePlayer*	m_pHostPlayer;
 
 	// results, tallied on client and server, but only used by server to run SV_Impact.
@@ -97,6 +101,11 @@ IMoveHelperServer* MoveHelperServer()
 	return &s_MoveHelperServer;
 }
 
+IMoveHelperServer* CreateMoveHelperServer()
+{
+	return new CMoveHelperServer( false );
+}
+
 
 //-----------------------------------------------------------------------------
 // Converts the entity handle into a edict_t
@@ -112,15 +121,22 @@ static inline edict_t* GetEdict( EntityHandle_t handle )
 // Constructor
 //-----------------------------------------------------------------------------
 
-CMoveHelperServer::CMoveHelperServer( void ) : m_TouchList( 0, 128 )
+CMoveHelperServer::CMoveHelperServer( bool bSingleton ) : m_TouchList( 0, 128 )
 {
 	m_pHostPlayer = 0;
-	SetSingleton( this );
+	m_bSingleton = bSingleton;
+	if ( m_bSingleton )
+	{
+		SetSingleton( this );
+	}
 }
 
 CMoveHelperServer::~CMoveHelperServer( void )
 {
-	SetSingleton( 0 );
+	if ( m_bSingleton )
+	{
+		SetSingleton( 0 );
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -269,6 +285,13 @@ void CMoveHelperServer::ProcessImpacts( void )
 //-----------------------------------------------------------------------------
 void CMoveHelperServer::StartSound( const Vector& origin, const char *soundname )
 {
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		typedef void (CMoveHelperServer::*StartSoundFn_t)( const Vector&, const char * );
+		UTIL_DeferSimulateSideEffect( CreateFunctor( this, (StartSoundFn_t)&CMoveHelperServer::StartSound, origin, soundname ) );
+		return;
+	}
+
 	//MDB - Changing this to send to PAS, as the overloaded function below has done.
 	//Also removed the UsePredictionRules, client does not yet play the equivalent sound
 
@@ -284,6 +307,14 @@ void CMoveHelperServer::StartSound( const Vector& origin, const char *soundname
 void CMoveHelperServer::StartSound( const Vector& origin, int channel, char const* sample, 
 						float volume, soundlevel_t soundlevel, int fFlags, int pitch )
 {
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		// UsePredictionRules needs the host the main thread suppresses events for
+		typedef void (CMoveHelperServer::*StartSoundFn_t)( const Vector&, int, char const*, float, soundlevel_t, int, int );
+		UTIL_DeferSimulateSideEffect( CreateFunctor( this, (StartSoundFn_t)&CMoveHelperServer::StartSound, origin, channel, sample, volume, soundlevel, fFlags, pitch ) );
+		return;
+	}
+
 
 	CRecipientFilter filter;
 	filter.AddRecipientsByPAS( origin );
@@ -359,6 +390,14 @@ void CMoveHelperServer::Con_NPrintf( int idx, char const* pFormat, ...)
 //-----------------------------------------------------------------------------
 bool CMoveHelperServer::PlayerFallingDamage( void )
 {
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		// TakeDamage runs game rules, outputs and maybe death. Take it on the main thread and
+		// say the player lived for now, the landing animation checks again when it's played.
+		UTIL_DeferSimulateSideEffect( CreateFunctor( this, &CMoveHelperServer::PlayerFallingDamage ) );
+		return true;
+	}
+
 	float flFallDamage = g_pGameRules->FlPlayerFallDamage( m_pHostPlayer );	
 	if ( flFallDamage > 0 )
 	{
@@ -407,6 +446,24 @@ bool CMoveHelperServer::PlayerFallingDamage( void )
 //-----------------------------------------------------------------------------
 void CMoveHelperServer::PlayerSetAnimation( PLAYER_ANIM eAnim )
 {
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		UTIL_DeferSimulateSideEffect( CreateFunctor( this, &CMoveHelperServer::DeferredPlayerSetAnimation, eAnim ) );
+		return;
+	}
+
+	m_pHostPlayer->SetAnimation( eAnim );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A PlayerSetAnimation from a worker thread. Deferred fall damage runs
+//  first and may have killed the player the movement code thought survived.
+//-----------------------------------------------------------------------------
+void CMoveHelperServer::DeferredPlayerSetAnimation( PLAYER_ANIM eAnim )
+{
+	if ( m_pHostPlayer->m_iHealth <= 0 )
+		return;
+
 	m_pHostPlayer->SetAnimation( eAnim );
 }
 
@@ -39,5 +39,9 @@ public:
 
 IMoveHelperServer* MoveHelperServer();
 
+// Extra helpers for player movement running on worker threads, owned by the caller.
+// They don't replace the MoveHelper() singleton.
+IMoveHelperServer* CreateMoveHelperServer();
+
 
 #endif // MOVEHELPER_SERVER_H
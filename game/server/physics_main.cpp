@@ -33,6 +33,8 @@
 #include "vphysicsupdateai.h"
 #include "tier0/vcrmode.h"
 #include "pushentity.h"
+#include "player_command.h"
+#include "tier1/functors.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -2013,6 +2015,36 @@ void Physics_SimulateEntity( CBaseEntity *pEntity )
 		pEntity->PhysicsRunThink();
 	}
 }
+//-----------------------------------------------------------------------------
+// Worker thread side effects
+//
+// Code running game logic on a worker thread queues side effects that need a
+// fixed order or touch shared state (removes, entity I/O, sounds, think list
+// changes). The main thread replays them in a fixed order once the workers are
+// done, so the result doesn't depend on how the work was scheduled.
+//-----------------------------------------------------------------------------
+ConVar sv_parallel_usercmds( "sv_parallel_usercmds", "0", 0, "Run player movement on worker threads for players whose game allows it. Players simulate before other entities." );
+
+// Side effect queue of the work the current thread is doing, NULL outside of one
+static CTHREADLOCALPTR( CUtlVector< CFunctor * > ) s_pDeferredSideEffects;
+
+bool UTIL_IsSimulatingInParallel()
+{
+	return (CUtlVector< CFunctor * > *)s_pDeferredSideEffects != NULL;
+}
+
+void UTIL_DeferSimulateSideEffect( CFunctor *pFunctor )
+{
+	CUtlVector< CFunctor * > *pDeferred = s_pDeferredSideEffects;
+	Assert( pDeferred );
+	pDeferred->AddToTail( pFunctor );
+}
+
+void UTIL_SetSimulateSideEffectQueue( CUtlVector< CFunctor * > *pQueue )
+{
+	s_pDeferredSideEffects = pQueue;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Runs the main physics simulation loop against all entities ( except players )
 //-----------------------------------------------------------------------------
@@ -2054,6 +2086,12 @@ void Physics_RunThinkFunctions( bool simulating )
 		// Do we really need UTIL_RemoveImmediate()?
 		int count = SimThink_ListCopy( list, listMax );
 
+		if ( sv_parallel_usercmds.GetBool() && gpGlobals->maxClients > 1 )
+		{
+			// Players run here are already simulated this tick, the list skips them
+			PlayerMove()->RunCommandsInParallel( starttime );
+		}
+
 		//DevMsg(1, "Count: %d\n", count );
 		for ( int i = 0; i < count; i++ )
 		{
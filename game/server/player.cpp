@@ -635,6 +635,11 @@ CBasePlayer::CBasePlayer( )
 
 	m_flLastUserCommandTime = 0.f;
 	m_flMovementTimeForUserCmdProcessingRemaining = 0.0f;
+
+	m_nSimulationCommands = 0;
+	m_flSimulationVPhysicsArrivalTime = 0.0f;
+	m_flSimulationSaveTime = 0.0f;
+	m_flSimulationSaveFrameTime = 0.0f;
 }
 
 CBasePlayer::~CBasePlayer( )
@@ -3196,6 +3201,41 @@ void CBasePlayer::PhysicsSimulate( void )
 {
 	VPROF_BUDGET( "CBasePlayer::PhysicsSimulate", VPROF_BUDGETGROUP_PLAYER );
 
+	if ( !PhysicsSimulateBegin() )
+		return;
+
+	// Now run the commands
+	if ( m_nSimulationCommands > 0 )
+	{
+		MoveHelperServer()->SetHost( this );
+
+		// Suppress predicted events, etc.
+		if ( IsPredictingWeapons() )
+		{
+			IPredictionSystem::SuppressHostEvents( this );
+		}
+
+		for ( int i = 0; i < m_nSimulationCommands; ++i )
+		{
+			PlayerRunCommand( &m_SimulationCommands[ i ], MoveHelperServer() );
+			PhysicsSimulateCommandDone();
+		}
+
+		// Always reset after running commands
+		IPredictionSystem::SuppressHostEvents( NULL );
+
+		MoveHelperServer()->SetHost( NULL );
+	}
+
+	PhysicsSimulateEnd();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Picks the usercmds to run this tick
+// Output : false if the player is done simulating for this tick
+//-----------------------------------------------------------------------------
+bool CBasePlayer::PhysicsSimulateBegin( void )
+{
 	// If we've got a moveparent, we must simulate that first.
 	CBaseEntity *pMoveParent = GetMoveParent();
 	if (pMoveParent)
@@ -3206,7 +3246,7 @@ void CBasePlayer::PhysicsSimulate( void )
 	// Make sure not to simulate this guy twice per frame
 	if ( m_nSimulationTick == gpGlobals->tickcount )
 	{
-		return;
+		return false;
 	}
 	
 	m_nSimulationTick = gpGlobals->tickcount;
@@ -3227,18 +3267,19 @@ void CBasePlayer::PhysicsSimulate( void )
 		Assert ( GetCommandContextCount() == 0 );
 		RunNullCommand();
 		RemoveAllCommandContexts();
-		return;
+		return false;
 	}
 
 	// Store off true server timestamps
-	float savetime		= gpGlobals->curtime;
-	float saveframetime = gpGlobals->frametime;
+	m_flSimulationSaveTime		= gpGlobals->curtime;
+	m_flSimulationSaveFrameTime = gpGlobals->frametime;
 
 	int command_context_count = GetCommandContextCount();
 	
 
 	// Build a list of all available commands
-	CUtlVector< CUserCmd >	vecAvailCommands;
+	CUtlVector< CUserCmd > &vecAvailCommands = m_SimulationCommands;
+	vecAvailCommands.RemoveAll();
 
 	// Contexts go from oldest to newest
 	for ( int context_number = 0; context_number < command_context_count; context_number++ )
@@ -3315,7 +3356,7 @@ void CBasePlayer::PhysicsSimulate( void )
 		RemoveAllCommandContexts();
 	}
 
-	float vphysicsArrivalTime = TICK_INTERVAL;
+	m_flSimulationVPhysicsArrivalTime = TICK_INTERVAL;
 
 #ifdef _DEBUG
 	if ( sv_player_net_suppress_usercommands.GetBool() )
@@ -3340,38 +3381,37 @@ void CBasePlayer::PhysicsSimulate( void )
 		m_flMovementTimeForUserCmdProcessingRemaining = FLT_MAX;
 	}
 
-	// Now run the commands
+	m_nSimulationCommands = commandsToRun;
 	if ( commandsToRun > 0 )
 	{
-		m_flLastUserCommandTime = savetime;
-
-		MoveHelperServer()->SetHost( this );
-
-		// Suppress predicted events, etc.
-		if ( IsPredictingWeapons() )
-		{
-			IPredictionSystem::SuppressHostEvents( this );
-		}
-
-		for ( int i = 0; i < commandsToRun; ++i )
-		{
-			PlayerRunCommand( &vecAvailCommands[ i ], MoveHelperServer() );
-
-			// Update our vphysics object.
-			if ( m_pPhysicsController )
-			{
-				VPROF( "CBasePlayer::PhysicsSimulate-UpdateVPhysicsPosition" );
-				// If simulating at 2 * TICK_INTERVAL, add an extra TICK_INTERVAL to position arrival computation
-				UpdateVPhysicsPosition( m_vNewVPhysicsPosition, m_vNewVPhysicsVelocity, vphysicsArrivalTime );
-				vphysicsArrivalTime += TICK_INTERVAL;
-			}
-		}
+		m_flLastUserCommandTime = m_flSimulationSaveTime;
+	}
 
-		// Always reset after running commands
-		IPredictionSystem::SuppressHostEvents( NULL );
+	return true;
+}
 
-		MoveHelperServer()->SetHost( NULL );
+//-----------------------------------------------------------------------------
+// Purpose: Called after each command PhysicsSimulateBegin picked has run
+//-----------------------------------------------------------------------------
+void CBasePlayer::PhysicsSimulateCommandDone( void )
+{
+	// Update our vphysics object.
+	if ( m_pPhysicsController )
+	{
+		VPROF( "CBasePlayer::PhysicsSimulate-UpdateVPhysicsPosition" );
+		// If simulating at 2 * TICK_INTERVAL, add an extra TICK_INTERVAL to position arrival computation
+		UpdateVPhysicsPosition( m_vNewVPhysicsPosition, m_vNewVPhysicsVelocity, m_flSimulationVPhysicsArrivalTime );
+		m_flSimulationVPhysicsArrivalTime += TICK_INTERVAL;
+	}
+}
 
+//-----------------------------------------------------------------------------
+// Purpose: Records where the commands left the player and restores the server clock
+//-----------------------------------------------------------------------------
+void CBasePlayer::PhysicsSimulateEnd( void )
+{
+	if ( m_nSimulationCommands > 0 )
+	{
 		// Copy in final origin from simulation
 		CPlayerSimInfo *pi = NULL;
 		if ( m_vecPlayerSimInfo.Count() > 0 )
@@ -3380,15 +3420,15 @@ void CBasePlayer::PhysicsSimulate( void )
 			pi->m_flTime = Plat_FloatTime();
 			pi->m_vecAbsOrigin = GetAbsOrigin();
 			pi->m_flGameSimulationTime = gpGlobals->curtime;
-			pi->m_nNumCmds = commandsToRun;
+			pi->m_nNumCmds = m_nSimulationCommands;
 		}
 	}
 
 	// Restore the true server clock
 	// FIXME:  Should this occur after simulation of children so
 	//  that they are in the timespace of the player?
-	gpGlobals->curtime		= savetime;
-	gpGlobals->frametime	= saveframetime;	
+	gpGlobals->curtime		= m_flSimulationSaveTime;
+	gpGlobals->frametime	= m_flSimulationSaveFrameTime;	
 
 // 	// Kick the player if they haven't sent a user command in awhile in order to prevent clients
 // 	// from using packet-level manipulation to mess with gamestate.  Not sending usercommands seems
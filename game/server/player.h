@@ -312,6 +312,16 @@ public:
 	// Physics simulation (player executes it's usercmd's here)
 	virtual void			PhysicsSimulate( void );
 
+	// PhysicsSimulate split up so CPlayerMove::RunCommandsInParallel can interleave players.
+	// Begin returns false when there's nothing more to do this tick. Otherwise each of the
+	// GetSimulationCommandCount() commands is run and followed by PhysicsSimulateCommandDone(),
+	// then PhysicsSimulateEnd() restores the server clock.
+	bool					PhysicsSimulateBegin( void );
+	int						GetSimulationCommandCount( void ) const { return m_nSimulationCommands; }
+	CUserCmd				*GetSimulationCommand( int i ) { return &m_SimulationCommands[i]; }
+	void					PhysicsSimulateCommandDone( void );
+	void					PhysicsSimulateEnd( void );
+
 	// Forces processing of usercmds (e.g., even if game is paused, etc.)
 	void					ForceSimulation();
 
@@ -818,6 +828,13 @@ private:
 	int					DetermineSimulationTicks( void );
 	void				AdjustPlayerTimeBase( int simulation_ticks );
 
+	// Commands picked by PhysicsSimulateBegin for this tick
+	CUtlVector< CUserCmd >	m_SimulationCommands;
+	int					m_nSimulationCommands;
+	float				m_flSimulationVPhysicsArrivalTime;
+	float				m_flSimulationSaveTime;
+	float				m_flSimulationSaveFrameTime;
+
 public:
 	
 
@@ -13,7 +13,13 @@
 #include "player_command.h"
 #include "movehelper_server.h"
 #include "iservervehicle.h"
+#include "ipredictionsystem.h"
+#include "gamemovement.h"
+#include "collisionproperty.h"
+#include "datacache/imdlcache.h"
 #include "tier0/vprof.h"
+#include "tier1/functors.h"
+#include "vstdlib/jobthread.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -24,11 +30,35 @@ extern ConVar sv_noclipduringpause;
 
 ConVar sv_maxusrcmdprocessticks_warning( "sv_maxusrcmdprocessticks_warning", "-1", FCVAR_NONE, "Print a warning when user commands get dropped due to insufficient usrcmd ticks allocated, number of seconds to throttle, negative disabled" );
 
+//-----------------------------------------------------------------------------
+// Purpose: Everything one player's movement touches while it runs on a worker
+//  thread. Slots are indexed by player and allocated the first time a player
+//  runs in parallel.
+//-----------------------------------------------------------------------------
+struct PlayerMoveSlot_t
+{
+	CBasePlayer			*m_pPlayer;
+	CUserCmd			*m_pCommand;		// Staged command, waiting for its movement
+	CMoveData			*m_pMoveData;
+	CGameMovement		*m_pMovement;
+	IMoveHelperServer	*m_pMoveHelper;
+
+	// The player's clock between commands, players run ahead of the server by their tickbase
+	float				m_flCurtime;
+	float				m_flFrametime;
+
+	// Side effects of the movement, run on the main thread before FinishMove
+	CUtlVector< CFunctor * > m_Deferred;
+};
+
+static PlayerMoveSlot_t s_PlayerMoveSlots[MAX_PLAYERS];
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
 CPlayerMove::CPlayerMove( void )
 {
+	m_pStagingSlot = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -312,6 +342,40 @@ void CommentarySystem_PePlayerRunCommand( CBasePlayer *player, CUserCmd *ucmd );
 // Output : void CPlayerMove::RunCommand
 //-----------------------------------------------------------------------------
 void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper )
+{
+	IServerVehicle *pVehicle;
+	if ( !StartRunCommand( player, ucmd, moveHelper, &pVehicle ) )
+		return;
+
+	if ( m_pStagingSlot && m_pStagingSlot->m_pPlayer == player && !pVehicle &&
+		 m_pStagingSlot->m_pMovement->CanProcessMovementInParallel( player, g_pMoveData ) )
+	{
+		// RunCommandsInParallel does the movement and finishes the command
+		m_pStagingSlot->m_pCommand = ucmd;
+		return;
+	}
+
+	// Let the game do the movement.
+	if ( !pVehicle )
+	{
+		VPROF( "g_pGameMovement->ProcessMovement()" );
+		Assert( g_pGameMovement );
+		g_pGameMovement->ProcessMovement( player, g_pMoveData );
+	}
+	else
+	{
+		VPROF( "pVehicle->ProcessMovement()" );
+		pVehicle->ProcessMovement( player, g_pMoveData );
+	}
+
+	FinishRunCommand( player, ucmd, moveHelper );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: First half of RunCommand, everything before the movement
+// Output : false if the command was dropped
+//-----------------------------------------------------------------------------
+bool CPlayerMove::StartRunCommand( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper, IServerVehicle **ppVehicle )
 {
 	const float playerCurTime = player->m_nTickBase * TICK_INTERVAL; 
 	const float playerFrameTime = player->m_bGamePaused ? 0 : TICK_INTERVAL;
@@ -330,7 +394,7 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 				Warning( "sv_maxusrcmdprocessticks_warning at server tick %u: Ignored client %s usrcmd (%.6f < %.6f)!\n", gpGlobals->tickcount, player->GetPlayerName(), flTimeAllowedForProcessing, playerFrameTime );
 			}
 		}
-		return; // Don't process this command
+		return false; // Don't process this command
 	}
 
 	StartCommand( player, ucmd );
@@ -386,6 +450,7 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 	}
 
 	IServerVehicle *pVehicle = player->GetVehicle();
+	*ppVehicle = pVehicle;
 
 	// Latch in impulse.
 	if ( ucmd->impulse )
@@ -426,19 +491,14 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 	// Setup input.
 	SetupMove( player, ucmd, moveHelper, g_pMoveData );
 
-	// Let the game do the movement.
-	if ( !pVehicle )
-	{
-		VPROF( "g_pGameMovement->ProcessMovement()" );
-		Assert( g_pGameMovement );
-		g_pGameMovement->ProcessMovement( player, g_pMoveData );
-	}
-	else
-	{
-		VPROF( "pVehicle->ProcessMovement()" );
-		pVehicle->ProcessMovement( player, g_pMoveData );
-	}
-			
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Second half of RunCommand, everything after the movement
+//-----------------------------------------------------------------------------
+void CPlayerMove::FinishRunCommand( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper )
+{
 	// Copy output
 	FinishMove( player, ucmd, g_pMoveData );
 
@@ -459,3 +519,287 @@ void CPlayerMove::RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper
 		player->m_nTickBase++;
 	}
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: Lazily creates the worker movement state for one player
+//-----------------------------------------------------------------------------
+PlayerMoveSlot_t *CPlayerMove::GetMoveSlot( int nSlot )
+{
+	PlayerMoveSlot_t *pSlot = &s_PlayerMoveSlots[nSlot];
+	if ( pSlot->m_pMovement )
+		return pSlot;
+
+	CGameMovement *pMovement = static_cast< CGameMovement * >( g_pGameMovement )->CreateWorkerInstance();
+	if ( !pMovement )
+		return NULL;
+
+	CMoveData *pMoveData = CreateMoveData();
+	if ( !pMoveData )
+	{
+		delete pMovement;
+		return NULL;
+	}
+
+	pSlot->m_pMoveHelper = CreateMoveHelperServer();
+	pSlot->m_pMoveData = pMoveData;
+	pSlot->m_pMovement = pMovement;
+	pSlot->m_pMovement->SetMoveHelper( pSlot->m_pMoveHelper );
+	return pSlot;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Traces compute abs positions, velocities and surrounding bounds on
+//  demand. Settle them for everyone up front so the workers only read.
+//-----------------------------------------------------------------------------
+static void PlayerMove_ResolveLazyState( void )
+{
+	VPROF( "PlayerMove_ResolveLazyState" );
+
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		if ( pEntity->IsEFlagSet( EFL_DIRTY_ABSTRANSFORM ) )
+		{
+			pEntity->CalcAbsolutePosition();
+		}
+
+		if ( pEntity->IsEFlagSet( EFL_DIRTY_ABSVELOCITY ) )
+		{
+			pEntity->GetAbsVelocity();
+		}
+
+		if ( pEntity->IsEFlagSet( EFL_DIRTY_SURROUNDING_COLLISION_BOUNDS ) )
+		{
+			Vector vecMins, vecMaxs;
+			pEntity->CollisionProp()->WorldSpaceSurroundingBounds( &vecMins, &vecMaxs );
+		}
+	}
+
+	UpdateDirtySpatialPartitionEntities();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Worker thread body, the movement for one staged command
+//-----------------------------------------------------------------------------
+static void PlayerMove_ProcessMovement( PlayerMoveSlot_t *&pSlot )
+{
+	UTIL_SetSimulateSideEffectQueue( &pSlot->m_Deferred );
+
+	pSlot->m_pMovement->StartTrackPredictionErrors( pSlot->m_pPlayer );
+	pSlot->m_pMovement->ProcessMovement( pSlot->m_pPlayer, pSlot->m_pMoveData );
+
+	UTIL_SetSimulateSideEffectQueue( NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Runs the movement of the staged commands. The workers share
+//  gpGlobals, so players run in batches with the same tickbase and see the
+//  curtime RunCommand would have given them.
+//-----------------------------------------------------------------------------
+void CPlayerMove::ProcessPendingMovement( PlayerMoveSlot_t **pPending, int nPending )
+{
+	// Staged commands are never paused or lagged, they all run one tick
+	gpGlobals->frametime = TICK_INTERVAL;
+
+	bool bDone[MAX_PLAYERS] = { false };
+	for ( int i = 0; i < nPending; i++ )
+	{
+		if ( bDone[i] )
+			continue;
+
+		int nTickBase = pPending[i]->m_pPlayer->m_nTickBase;
+
+		PlayerMoveSlot_t *pBatch[MAX_PLAYERS];
+		int nBatch = 0;
+		for ( int j = i; j < nPending; j++ )
+		{
+			if ( !bDone[j] && pPending[j]->m_pPlayer->m_nTickBase == nTickBase )
+			{
+				bDone[j] = true;
+				pBatch[nBatch++] = pPending[j];
+			}
+		}
+
+		gpGlobals->curtime = nTickBase * TICK_INTERVAL;
+
+		if ( nBatch == 1 )
+		{
+			PlayerMove_ProcessMovement( pBatch[0] );
+		}
+		else
+		{
+			// Partition moves made by the workers wait for EndParallelQueries. That's
+			// fine here: a worker's movement lives in its CMoveData until FinishMove,
+			// and the only element it can move early is its own player, which its
+			// trace filter skips. Everyone else is seen where the wave started.
+			partition->BeginParallelQueries();
+			ParallelProcess( "CPlayerMove::RunCommandsInParallel", pBatch, nBatch, &PlayerMove_ProcessMovement );
+			partition->EndParallelQueries();
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Switch the globals over to a player between two of its commands
+//-----------------------------------------------------------------------------
+static void PlayerMove_EnterSlot( PlayerMoveSlot_t *pSlot )
+{
+	gpGlobals->curtime = pSlot->m_flCurtime;
+	gpGlobals->frametime = pSlot->m_flFrametime;
+
+	// Suppress predicted events, etc.
+	if ( pSlot->m_pPlayer->IsPredictingWeapons() )
+	{
+		IPredictionSystem::SuppressHostEvents( pSlot->m_pPlayer );
+	}
+}
+
+static void PlayerMove_LeaveSlot( PlayerMoveSlot_t *pSlot )
+{
+	pSlot->m_flCurtime = gpGlobals->curtime;
+	pSlot->m_flFrametime = gpGlobals->frametime;
+
+	IPredictionSystem::SuppressHostEvents( NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Simulates every player for this tick. Players run their commands in
+//  waves, the Nth command of every player per wave. Everything up to SetupMove
+//  and from FinishMove on runs on the main thread in player order as before,
+//  the movement in between runs on worker threads for the players whose game
+//  movement says it can. Other players are seen where they were at the start
+//  of the wave.
+// Input  : starttime - server time the players simulate from
+//-----------------------------------------------------------------------------
+void CPlayerMove::RunCommandsInParallel( float starttime )
+{
+	VPROF( "CPlayerMove::RunCommandsInParallel" );
+
+	// Game movement has no worker instances, the players simulate one by one
+	if ( !GetMoveSlot( 0 ) )
+		return;
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	CMoveData *pMainMoveData = g_pMoveData;
+	IMoveHelperServer *pMainMoveHelper = MoveHelperServer();
+
+	PlayerMoveSlot_t *pSlots[MAX_PLAYERS];
+	int nSlots = 0;
+	int nWaves = 0;
+
+	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+	{
+		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
+		if ( !pPlayer )
+			continue;
+
+		PlayerMoveSlot_t *pSlot = GetMoveSlot( i - 1 );
+		if ( !pSlot )
+			continue;
+
+		gpGlobals->curtime = starttime;
+		if ( !pPlayer->PhysicsSimulateBegin() )
+			continue;
+
+		pSlot->m_pPlayer = pPlayer;
+		pSlot->m_pCommand = NULL;
+		pSlot->m_flCurtime = gpGlobals->curtime;
+		pSlot->m_flFrametime = gpGlobals->frametime;
+		pSlots[nSlots++] = pSlot;
+
+		nWaves = MAX( nWaves, pPlayer->GetSimulationCommandCount() );
+	}
+
+	for ( int nWave = 0; nWave < nWaves; nWave++ )
+	{
+		PlayerMoveSlot_t *pPending[MAX_PLAYERS];
+		int nPending = 0;
+
+		// Everything before the movement, RunCommand stages the command if it can move in parallel
+		for ( int i = 0; i < nSlots; i++ )
+		{
+			PlayerMoveSlot_t *pSlot = pSlots[i];
+			CBasePlayer *pPlayer = pSlot->m_pPlayer;
+			if ( nWave >= pPlayer->GetSimulationCommandCount() )
+				continue;
+
+			PlayerMove_EnterSlot( pSlot );
+			pMainMoveHelper->SetHost( pPlayer );
+			g_pMoveData = pSlot->m_pMoveData;
+			m_pStagingSlot = pSlot;
+
+			pPlayer->PlayerRunCommand( pPlayer->GetSimulationCommand( nWave ), pMainMoveHelper );
+
+			m_pStagingSlot = NULL;
+			g_pMoveData = pMainMoveData;
+
+			if ( pSlot->m_pCommand )
+			{
+				pPending[nPending++] = pSlot;
+			}
+			else
+			{
+				pPlayer->PhysicsSimulateCommandDone();
+			}
+
+			pMainMoveHelper->SetHost( NULL );
+			PlayerMove_LeaveSlot( pSlot );
+		}
+
+		if ( !nPending )
+			continue;
+
+		PlayerMove_ResolveLazyState();
+
+		for ( int i = 0; i < nPending; i++ )
+		{
+			// Dirty every networked field now so the workers never touch the shared change list
+			pPending[i]->m_pPlayer->NetworkStateChanged();
+			pPending[i]->m_pMoveHelper->SetHost( pPending[i]->m_pPlayer );
+		}
+
+		ProcessPendingMovement( pPending, nPending );
+
+		// Everything after the movement, in player order
+		for ( int i = 0; i < nPending; i++ )
+		{
+			PlayerMoveSlot_t *pSlot = pPending[i];
+			CBasePlayer *pPlayer = pSlot->m_pPlayer;
+
+			PlayerMove_EnterSlot( pSlot );
+
+			// Other players ran their commands since this one started
+			CBaseEntity::SetPredictionRandomSeed( pSlot->m_pCommand );
+			CBaseEntity::SetPredictionPlayer( pPlayer );
+
+			g_pMoveData = pSlot->m_pMoveData;
+
+			for ( int j = 0; j < pSlot->m_Deferred.Count(); j++ )
+			{
+				(*pSlot->m_Deferred[j])();
+				pSlot->m_Deferred[j]->Release();
+			}
+			pSlot->m_Deferred.RemoveAll();
+
+			FinishRunCommand( pPlayer, pSlot->m_pCommand, pSlot->m_pMoveHelper );
+
+			g_pMoveData = pMainMoveData;
+			pSlot->m_pMoveHelper->SetHost( NULL );
+			pSlot->m_pCommand = NULL;
+
+			pPlayer->PhysicsSimulateCommandDone();
+			PlayerMove_LeaveSlot( pSlot );
+		}
+	}
+
+	for ( int i = 0; i < nSlots; i++ )
+	{
+		gpGlobals->curtime = pSlots[i]->m_flCurtime;
+		gpGlobals->frametime = pSlots[i]->m_flFrametime;
+
+		pSlots[i]->m_pPlayer->PhysicsSimulateEnd();
+		pSlots[i]->m_pPlayer = NULL;
+	}
+
+	gpGlobals->curtime = starttime;
+}
@@ -17,6 +17,8 @@
 class IMoveHelper;
 class CMoveData;
 class CBasePlayer;
+class IServerVehicle;
+struct PlayerMoveSlot_t;
 
 //-----------------------------------------------------------------------------
 // Purpose: Server side player movement
@@ -34,7 +36,14 @@ public:
 	// Run a movement command from the player
 	void			RunCommand ( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper );
 
+	// Simulate all players for this tick (sv_parallel_usercmds), with ProcessMovement on
+	// worker threads for players the game movement allows it for
+	void			RunCommandsInParallel( float starttime );
+
 protected:
+	// Move data for one player, for games that support RunCommandsInParallel
+	virtual CMoveData *CreateMoveData( void ) { return NULL; }
+
 	// Prepare for running movement
 	virtual void	SetupMove( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *pHelper, CMoveData *move );
 
@@ -52,6 +61,20 @@ protected:
 	void			RunPreThink( CBasePlayer *player );
 	void			RunThink (CBasePlayer *ent, double frametime );
 	void			RunPostThink( CBasePlayer *player );
+
+private:
+	// RunCommand up to SetupMove and from FinishMove on
+	bool			StartRunCommand( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper, IServerVehicle **ppVehicle );
+	void			FinishRunCommand( CBasePlayer *player, CUserCmd *ucmd, IMoveHelper *moveHelper );
+
+	// Per player movement state for RunCommandsInParallel, NULL if the game doesn't support it
+	PlayerMoveSlot_t *GetMoveSlot( int nSlot );
+
+	// Movement of the commands RunCommand staged, on worker threads
+	void			ProcessPendingMovement( PlayerMoveSlot_t **pPending, int nPending );
+
+	// Player RunCommandsInParallel is running a command for, RunCommand stops before the movement
+	PlayerMoveSlot_t	*m_pStagingSlot;
 };
 
 
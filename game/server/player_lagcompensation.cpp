@@ -10,7 +10,6 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utllinkedlist.h"
 #include "BaseAnimatingOverlay.h"
 #include "tier0/vprof.h"
 
@@ -114,6 +113,111 @@ public:
 	float					m_masterCycle;
 };
 
+//-----------------------------------------------------------------------------
+// Purpose: Fixed size history ring for one player. The fields walked by every
+//  backtrack (time, flags, origin) live in their own arrays, the bounds and
+//  animation state are only read for the two records that get interpolated.
+//-----------------------------------------------------------------------------
+struct LagRecordDetail
+{
+	QAngle					m_vecAngles;
+	Vector					m_vecMinsPreScaled;
+	Vector					m_vecMaxsPreScaled;
+
+	LayerRecord				m_layerRecords[MAX_LAYER_RECORDS];
+	int						m_masterSequence;
+	float					m_masterCycle;
+};
+
+class CLagTrack
+{
+public:
+	CLagTrack() : m_nHead( 0 ), m_nCount( 0 ), m_nMask( -1 ) {}
+
+	// Sizes the ring, a power of two, and drops all records
+	void	SetSize( int nSize )
+	{
+		Assert( nSize > 0 && ( nSize & ( nSize - 1 ) ) == 0 );
+		m_flSimulationTime.SetCount( nSize );
+		m_fFlags.SetCount( nSize );
+		m_vecOrigin.SetCount( nSize );
+		m_Detail.SetCount( nSize );
+		m_nMask = nSize - 1;
+		m_nHead = 0;
+		m_nCount = 0;
+	}
+	int		Size() const				{ return m_nMask + 1; }
+
+	void	RemoveAll()					{ m_nCount = 0; }
+	void	RemoveTail()				{ Assert( m_nCount > 0 ); --m_nCount; }
+	int		Count() const				{ return m_nCount; }
+
+	// Slot of a record by age, 0 is the newest
+	int		Slot( int nAge ) const		{ Assert( nAge < m_nCount ); return ( m_nHead - nAge ) & m_nMask; }
+
+	// Claims the slot for a new head record, dropping the oldest one when full
+	int		AddToHead()
+	{
+		m_nHead = ( m_nHead + 1 ) & m_nMask;
+		if ( m_nCount <= m_nMask )
+			++m_nCount;
+		return m_nHead;
+	}
+
+	CUtlVector< float >				m_flSimulationTime;
+	CUtlVector< int >				m_fFlags;
+	CUtlVector< Vector >			m_vecOrigin;
+	CUtlVector< LagRecordDetail >	m_Detail;
+
+private:
+	int						m_nHead;
+	int						m_nCount;
+	int						m_nMask;
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Ring size that holds the longest allowed sv_maxunlag at the current
+//  tick rate, plus the record just outside the window that backtracking
+//  interpolates from.
+//-----------------------------------------------------------------------------
+static int LagTrack_SizeForTickRate()
+{
+	float flMaxUnlag = 1.0f;
+	sv_maxunlag.GetMax( flMaxUnlag );
+
+	int nRecords = TIME_TO_TICKS( flMaxUnlag ) + 2;
+	int nSize = (int)SmallestPowerOfTwoGreaterOrEqual( nRecords );
+
+	// Records inside the unlag window must never be overwritten
+	Assert( ( nSize - 1 ) * TICK_INTERVAL >= flMaxUnlag );
+	return nSize;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Interpolated state of every player at one target tick. History only
+//  changes once per frame, so all shooters aiming at the same tick share it.
+//-----------------------------------------------------------------------------
+#define LAG_REWIND_CACHE_SIZE	16
+
+struct LagRewindState
+{
+	int						m_nRecord;		// Slot at or before the target time, -1 if track was lost
+	int						m_nPrevRecord;	// Newer slot to interpolate towards, -1 if none
+	float					m_flFrac;
+
+	Vector					m_vecOrigin;
+	QAngle					m_vecAngles;
+	Vector					m_vecMinsPreScaled;
+	Vector					m_vecMaxsPreScaled;
+};
+
+struct LagRewind
+{
+	int						m_nTargetTick;
+	float					m_flTargetTime;
+	LagRewindState			m_State[MAX_PLAYERS];
+};
+
 
 //
 // Try to take the player from his current origin to vWantedPos.
@@ -170,7 +274,7 @@ static void RestorePlayerTo( CBasePlayer *pPlayer, const Vector &vWantedPos )
 class CLagCompensationManager : public CAutoGameSystemPerFrame, public ILagCompensationManager
 {
 public:
-	CLagCompensationManager( char const *name ) : CAutoGameSystemPerFrame( name ), m_flTeleportDistanceSqr( 64 *64 )
+	CLagCompensationManager( char const *name ) : CAutoGameSystemPerFrame( name ), m_nRewinds( 0 ), m_flTeleportDistanceSqr( 64 *64 )
 	{
 	}
 
@@ -195,16 +299,24 @@ public:
 	void			FinishLagCompensation( CBasePlayer *player );
 
 private:
-	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
+	void			BacktrackPlayer( CBasePlayer *player, const LagRewind &rewind );
+
+	const LagRewind	&GetRewind( int nTargetTick );
+	void			ComputeRewind( LagRewind &rewind );
 
 	void ClearHistory()
 	{
 		for ( int i=0; i<MAX_PLAYERS; i++ )
-			m_PlayerTrack[i].Purge();
+			m_PlayerTrack[i].RemoveAll();
+		m_nRewinds = 0;
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a ring of lag records for each player
+	CLagTrack				m_PlayerTrack[ MAX_PLAYERS ];
+
+	// Rewound states computed since the history was last updated
+	LagRewind				m_Rewinds[ LAG_REWIND_CACHE_SIZE ];
+	int						m_nRewinds;
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -240,12 +352,20 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	// remove all records before that time:
 	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
 
+	// Tick rate only changes between maps, this resizes on the first frame of one
+	int nTrackSize = LagTrack_SizeForTickRate();
+
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		CLagTrack *track = &m_PlayerTrack[i-1];
+
+		if ( track->Size() != nTrackSize )
+		{
+			track->SetSize( nTrackSize );
+		}
 
 		if ( !pPlayer )
 		{
@@ -257,47 +377,40 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
-
 		// remove tail records that are too old
-		intp tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
+		while ( track->Count() > 0 )
 		{
-			LagRecord &tail = track->Element( tailIndex );
-
 			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
+			if ( track->m_flSimulationTime[ track->Slot( track->Count() - 1 ) ] >= flDeadtime )
 				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+
+			// remove tail
+			track->RemoveTail();
 		}
 
 		// check if head has same simulation time
 		if ( track->Count() > 0 )
 		{
-			LagRecord &head = track->Element( track->Head() );
-
 			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
+			if ( track->m_flSimulationTime[ track->Slot( 0 ) ] >= pPlayer->GetSimulationTime() )
 				continue; // don't add new entry for same or older time
 		}
 
 		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+		int slot = track->AddToHead();
+		LagRecordDetail &record = track->m_Detail[slot];
 
-		record.m_fFlags = 0;
+		track->m_fFlags[slot] = 0;
 		if ( pPlayer->IsAlive() )
 		{
-			record.m_fFlags |= LC_ALIVE;
+			track->m_fFlags[slot] |= LC_ALIVE;
 		}
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMinsPreScaled	= pPlayer->CollisionProp()->OBBMinsPreScaled();
-		record.m_vecMaxsPreScaled	= pPlayer->CollisionProp()->OBBMaxsPreScaled();
+		track->m_flSimulationTime[slot]	= pPlayer->GetSimulationTime();
+		track->m_vecOrigin[slot]		= pPlayer->GetLocalOrigin();
+		record.m_vecAngles				= pPlayer->GetLocalAngles();
+		record.m_vecMinsPreScaled		= pPlayer->CollisionProp()->OBBMinsPreScaled();
+		record.m_vecMaxsPreScaled		= pPlayer->CollisionProp()->OBBMaxsPreScaled();
 
 		int layerCount = pPlayer->GetNumAnimOverlays();
 		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
@@ -315,6 +428,9 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 		record.m_masterCycle = pPlayer->GetCycle();
 	}
 
+	// History changed, anything rewound so far is stale
+	m_nRewinds = 0;
+
 	//Clear the current player.
 	m_pCurrentPlayer = NULL;
 }
@@ -384,7 +500,9 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		// DevMsg("StartLagCompensation: delta too big (%.3f)\n", deltaTime );
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
-	
+
+	const LagRewind &rewind = GetRewind( targettick );
+
 	// Iterate all active players
 	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
@@ -407,110 +525,157 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 			continue;
 
 		// Move other player back in time
-		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
+		BacktrackPlayer( pPlayer, rewind );
 	}
 }
 
-void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTargetTime )
+//-----------------------------------------------------------------------------
+// Purpose: Returns the state of every tracked player at the target tick,
+//  computing it on the first request since the history was updated
+//-----------------------------------------------------------------------------
+const LagRewind &CLagCompensationManager::GetRewind( int nTargetTick )
 {
-	Vector org;
-	Vector minsPreScaled;
-	Vector maxsPreScaled;
-	QAngle ang;
-
-	VPROF_BUDGET( "BacktrackPlayer", "CLagCompensationManager" );
-	int pl_index = pPlayer->entindex() - 1;
+	for ( int i = 0; i < MIN( m_nRewinds, LAG_REWIND_CACHE_SIZE ); i++ )
+	{
+		if ( m_Rewinds[i].m_nTargetTick == nTargetTick )
+			return m_Rewinds[i];
+	}
 
-	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	// Once full, recycle entries in the order they were made
+	LagRewind &rewind = m_Rewinds[ m_nRewinds % LAG_REWIND_CACHE_SIZE ];
+	++m_nRewinds;
 
-	// check if we have at leat one entry
-	if ( track->Count() <= 0 )
-		return;
+	rewind.m_nTargetTick = nTargetTick;
+	rewind.m_flTargetTime = TICKS_TO_TIME( nTargetTick );
+	ComputeRewind( rewind );
+	return rewind;
+}
 
-    intp curr = track->Head();
+//-----------------------------------------------------------------------------
+// Purpose: One sweep over the history of all players. Only the newest record
+//  is checked against the player's live origin, that check is left to
+//  BacktrackPlayer since the live origin moves between shooters.
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::ComputeRewind( LagRewind &rewind )
+{
+	VPROF_BUDGET( "ComputeRewind", "CLagCompensationManager" );
 
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
+	const float flTargetTime = rewind.m_flTargetTime;
 
-	Vector prevOrg = pPlayer->GetLocalOrigin();
-	
-	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	for ( int i = 0; i < gpGlobals->maxClients; i++ )
 	{
-		// remember last record
-		prevRecord = record;
+		const CLagTrack &track = m_PlayerTrack[i];
+		LagRewindState &state = rewind.m_State[i];
 
-		// get next record
-		record = &track->Element( curr );
+		state.m_nRecord = -1;
+		state.m_nPrevRecord = -1;
+		state.m_flFrac = 0.0f;
 
-		if ( !(record->m_fFlags & LC_ALIVE) )
-		{
-			// player most be alive, lost track
-			return;
-		}
+		int nCount = track.Count();
+		if ( nCount <= 0 )
+			continue;
 
-		Vector delta = record->m_vecOrigin - prevOrg;
-		if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
+		// Walk back to the first record at or before the target time, any
+		// dead record or teleport on the way means we lost track
+		int nAge = 0;
+		int slot = track.Slot( 0 );
+		int prevSlot = -1;
+		bool bLost = false;
+		for ( ;; )
 		{
-			// lost track, too much difference
-			return; 
+			if ( !( track.m_fFlags[slot] & LC_ALIVE ) )
+			{
+				bLost = true;
+				break;
+			}
+
+			if ( prevSlot != -1 )
+			{
+				Vector delta = track.m_vecOrigin[slot] - track.m_vecOrigin[prevSlot];
+				if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
+				{
+					bLost = true;
+					break;
+				}
+			}
+
+			if ( track.m_flSimulationTime[slot] <= flTargetTime || ++nAge >= nCount )
+				break;
+
+			prevSlot = slot;
+			slot = track.Slot( nAge );
 		}
 
-		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
-			break; // hurra, stop
+		if ( bLost )
+			continue;
+
+		state.m_nRecord = slot;
+		state.m_nPrevRecord = prevSlot;
 
-		prevOrg = record->m_vecOrigin;
+		const LagRecordDetail &record = track.m_Detail[slot];
+		if ( prevSlot != -1 &&
+			 ( track.m_flSimulationTime[slot] < flTargetTime ) &&
+			 ( track.m_flSimulationTime[slot] < track.m_flSimulationTime[prevSlot] ) )
+		{
+			// we didn't find the exact time but have a valid previous record
+			// so interpolate between these two records;
+			const LagRecordDetail &prevRecord = track.m_Detail[prevSlot];
 
-		// go one step back
-		curr = track->Next( curr );
-	}
+			Assert( flTargetTime < track.m_flSimulationTime[prevSlot] );
 
-	Assert( record );
+			// calc fraction between both records
+			float frac = ( flTargetTime - track.m_flSimulationTime[slot] ) /
+				( track.m_flSimulationTime[prevSlot] - track.m_flSimulationTime[slot] );
 
-	if ( !record )
-	{
-		if ( sv_unlag_debug.GetBool() )
+			Assert( frac > 0 && frac < 1 ); // should never extrapolate
+
+			state.m_flFrac				= frac;
+			state.m_vecOrigin			= Lerp( frac, track.m_vecOrigin[slot], track.m_vecOrigin[prevSlot] );
+			state.m_vecAngles			= Lerp( frac, record.m_vecAngles, prevRecord.m_vecAngles );
+			state.m_vecMinsPreScaled	= Lerp( frac, record.m_vecMinsPreScaled, prevRecord.m_vecMinsPreScaled );
+			state.m_vecMaxsPreScaled	= Lerp( frac, record.m_vecMaxsPreScaled, prevRecord.m_vecMaxsPreScaled );
+		}
+		else
 		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
+			// we found the exact record or no other record to interpolate with
+			// just copy these values since they are the best we have
+			state.m_vecOrigin			= track.m_vecOrigin[slot];
+			state.m_vecAngles			= record.m_vecAngles;
+			state.m_vecMinsPreScaled	= record.m_vecMinsPreScaled;
+			state.m_vecMaxsPreScaled	= record.m_vecMaxsPreScaled;
 		}
-
-		return; // that should never happen
 	}
+}
 
-	float frac = 0.0f;
-	if ( prevRecord && 
-		 (record->m_flSimulationTime < flTargetTime) &&
-		 (record->m_flSimulationTime < prevRecord->m_flSimulationTime) )
-	{
-		// we didn't find the exact time but have a valid previous record
-		// so interpolate between these two records;
-
-		Assert( prevRecord->m_flSimulationTime > record->m_flSimulationTime );
-		Assert( flTargetTime < prevRecord->m_flSimulationTime );
+void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, const LagRewind &rewind )
+{
+	VPROF_BUDGET( "BacktrackPlayer", "CLagCompensationManager" );
+	int pl_index = pPlayer->entindex() - 1;
 
-		// calc fraction between both records
-		frac = ( flTargetTime - record->m_flSimulationTime ) / 
-			( prevRecord->m_flSimulationTime - record->m_flSimulationTime );
+	const CLagTrack *track = &m_PlayerTrack[ pl_index ];
+	const LagRewindState &state = rewind.m_State[ pl_index ];
 
-		Assert( frac > 0 && frac < 1 ); // should never extrapolate
+	// no history, or lost track of the player along the way
+	if ( state.m_nRecord == -1 )
+		return;
 
-		ang				= Lerp( frac, record->m_vecAngles, prevRecord->m_vecAngles );
-		org				= Lerp( frac, record->m_vecOrigin, prevRecord->m_vecOrigin );
-		minsPreScaled	= Lerp( frac, record->m_vecMinsPreScaled, prevRecord->m_vecMinsPreScaled );
-		maxsPreScaled	= Lerp( frac, record->m_vecMaxsPreScaled, prevRecord->m_vecMaxsPreScaled );
-	}
-	else
+	// newest record against where the player is right now
+	Vector delta = track->m_vecOrigin[ track->Slot( 0 ) ] - pPlayer->GetLocalOrigin();
+	if ( delta.Length2DSqr() > m_flTeleportDistanceSqr )
 	{
-		// we found the exact record or no other record to interpolate with
-		// just copy these values since they are the best we have
-		org				= record->m_vecOrigin;
-		ang				= record->m_vecAngles;
-		minsPreScaled	= record->m_vecMinsPreScaled;
-		maxsPreScaled	= record->m_vecMaxsPreScaled;
+		// lost track, too much difference
+		return; 
 	}
 
+	const LagRecordDetail *record = &track->m_Detail[ state.m_nRecord ];
+	const LagRecordDetail *prevRecord = ( state.m_nPrevRecord != -1 ) ? &track->m_Detail[ state.m_nPrevRecord ] : NULL;
+
+	float frac = state.m_flFrac;
+	Vector org = state.m_vecOrigin;
+	QAngle ang = state.m_vecAngles;
+	Vector minsPreScaled = state.m_vecMinsPreScaled;
+	Vector maxsPreScaled = state.m_vecMaxsPreScaled;
+
 	// See if this is still a valid position for us to teleport to
 	if ( sv_unlag_fixstuck.GetBool() )
 	{
@@ -538,7 +703,7 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 					// Temp turn this flag on
 					m_RestorePlayer.Set( pl_index );
 
-					BacktrackPlayer( pHitPlayer, flTargetTime );
+					BacktrackPlayer( pHitPlayer, rewind );
 
 					// Remove the temp flag
 					m_RestorePlayer.Clear( pl_index );
@@ -669,8 +834,8 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 			bool interpolated = false;
 			if( (frac > 0.0f)  &&  interpolationAllowed )
 			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
+				const LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
+				const LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
 				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
 					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
 					)
@@ -710,7 +875,7 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	if ( sv_lagflushbonecache.GetBool() )
 		pPlayer->InvalidateBoneCache();
 
-	/*char text[256]; Q_snprintf( text, sizeof(text), "time %.2f", flTargetTime );
+	/*char text[256]; Q_snprintf( text, sizeof(text), "time %.2f", rewind.m_flTargetTime );
 	pPlayer->DrawServerHitboxes( 10 );
 	NDebugOverlay::Text( org, text, false, 10 );
 	NDebugOverlay::EntityBounds( pPlayer, 255, 0, 0, 32, 10 ); */
@@ -36,6 +36,7 @@
 #include "datacache/imdlcache.h"
 #include "util.h"
 #include "cdll_int.h"
+#include "tier1/functors.h"
 
 #ifdef PORTAL
 #include "PortalSimulation.h"
@@ -449,6 +450,9 @@ realcheck:
 
 bool g_bDisableEhandleAccess = false;
 bool g_bReceivedChainedUpdateOnRemove = false;
+
+static void UTIL_FinishRemove( IServerNetworkable *oldObj );
+
 //-----------------------------------------------------------------------------
 // Purpose: Sets the entity up for deletion.  Entity will not actually be deleted
 //			until the next frame, so there can be no pointer errors.
@@ -476,6 +480,21 @@ void UTIL_Remove( IServerNetworkable *oldObj )
 	// mark it for deletion	
 	pProp->MarkForDeletion( );
 
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		// UpdateOnRemove fires outputs and touches other entities, run it once the workers are done
+		UTIL_DeferSimulateSideEffect( CreateFunctor( &UTIL_FinishRemove, oldObj ) );
+		return;
+	}
+
+	UTIL_FinishRemove( oldObj );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Second half of UTIL_Remove, after the object is marked for deletion
+//-----------------------------------------------------------------------------
+static void UTIL_FinishRemove( IServerNetworkable *oldObj )
+{
 	CBaseEntity *pBaseEnt = oldObj->GetBaseEntity();
 	if ( pBaseEnt )
 	{
@@ -1894,6 +1913,9 @@ int DispatchSpawn( CBaseEntity *pEntity )
 			MemAlloc_PushAllocDbgInfo( pszClassname, __LINE__ );
 		}
 #endif
+		// classname and model may have come in as keyvalues, which don't go through the setters
+		gEntList.UpdateEntityIndex( pEntity );
+
 		bool bAsyncAnims = mdlcache->SetAsyncLoad( MDLCACHE_ANIMBLOCK, false );
 		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
 		if (!pAnimating)
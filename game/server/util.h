@@ -303,6 +303,15 @@ inline int UTIL_EntitiesInSphere( CBaseEntity **pList, int listMax, const Vector
 void UTIL_Remove( IServerNetworkable *oldObj );
 void UTIL_Remove( CBaseEntity *oldObj );
 
+// UTIL_SetSimulateSideEffectQueue points a worker thread at a queue, and back at NULL
+// when it's done. While it has one, UTIL_IsSimulatingInParallel is true and side effects
+// that have to happen in a fixed order are handed to UTIL_DeferSimulateSideEffect. The
+// main thread runs them after all the workers finish, which releases the functor.
+class CFunctor;
+bool UTIL_IsSimulatingInParallel();
+void UTIL_DeferSimulateSideEffect( CFunctor *pFunctor );
+void UTIL_SetSimulateSideEffectQueue( CUtlVector< CFunctor * > *pQueue );
+
 // deletes an entity, without any delay.  Only use this when sure no pointers rely on this entity.
 void UTIL_DisableRemoveImmediate();
 void UTIL_EnableRemoveImmediate();
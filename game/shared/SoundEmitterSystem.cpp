@@ -15,6 +15,7 @@
 #include "tier0/vprof.h"
 #include "checksum_crc.h"
 #include "tier0/icommandline.h"
+#include "tier1/functors.h"
 
 #if defined( TF_CLIENT_DLL ) || defined( TF_DLL )
 #include "tf_shareddefs.h"
@@ -54,6 +55,7 @@ static bool g_bPermitDirectSoundPrecache = false;
 #if !defined( CLIENT_DLL )
 
 void ClearModelSoundsCache();
+static void DeferEmitSound( IRecipientFilter& filter, int entindex, const EmitSound_t & ep );
 
 #endif // !CLIENT_DLL
 
@@ -557,6 +559,14 @@ public:
 	{
 		VPROF( "CSoundEmitterSystem::EmitSound (calls engine)" );
 
+#if !defined( CLIENT_DLL )
+		if ( UTIL_IsSimulatingInParallel() )
+		{
+			DeferEmitSound( filter, entindex, ep );
+			return;
+		}
+#endif
+
 #ifdef STAGING_ONLY
 		if ( sv_snd_filter.GetString()[ 0 ] && !V_stristr( ep.m_pSoundName, sv_snd_filter.GetString() ))
 		{
@@ -977,6 +987,89 @@ public:
 
 static CSoundEmitterSystem g_SoundEmitterSystem( "CSoundEmitterSystem" );
 
+#if !defined( CLIENT_DLL )
+//-----------------------------------------------------------------------------
+// Purpose: An EmitSound made on a worker thread. Holds copies of
+//  everything the caller pointed at and plays it on the main thread later.
+//-----------------------------------------------------------------------------
+class CDeferredEmitSound : public CFunctorBase
+{
+public:
+	CDeferredEmitSound( IRecipientFilter& filter, int entindex, const EmitSound_t & ep )
+	{
+		CBitVec< ABSOLUTE_PLAYER_LIMIT > players;
+		players.ClearAll();
+		for ( int i = 0; i < filter.GetRecipientCount(); i++ )
+		{
+			int iPlayer = filter.GetRecipientIndex( i );
+			if ( iPlayer >= 1 && iPlayer <= ABSOLUTE_PLAYER_LIMIT )
+			{
+				players.Set( iPlayer - 1 );
+			}
+		}
+		m_Filter.AddPlayersFromBitMask( players );
+		if ( filter.IsReliable() )
+		{
+			m_Filter.MakeReliable();
+		}
+		if ( filter.IsInitMessage() )
+		{
+			m_Filter.MakeInitMessage();
+		}
+
+		m_nEntIndex = entindex;
+
+		m_Params.m_nChannel = ep.m_nChannel;
+		m_Params.m_flVolume = ep.m_flVolume;
+		m_Params.m_SoundLevel = ep.m_SoundLevel;
+		m_Params.m_nFlags = ep.m_nFlags;
+		m_Params.m_nPitch = ep.m_nPitch;
+		m_Params.m_nSpecialDSP = ep.m_nSpecialDSP;
+		m_Params.m_flSoundTime = ep.m_flSoundTime;
+		m_Params.m_bEmitCloseCaption = ep.m_bEmitCloseCaption;
+		m_Params.m_bWarnOnMissingCloseCaption = ep.m_bWarnOnMissingCloseCaption;
+		m_Params.m_bWarnOnDirectWaveReference = ep.m_bWarnOnDirectWaveReference;
+		m_Params.m_nSpeakerEntity = ep.m_nSpeakerEntity;
+		m_Params.m_hSoundScriptHandle = ep.m_hSoundScriptHandle;
+
+		if ( ep.m_pSoundName )
+		{
+			Q_strncpy( m_szSoundName, ep.m_pSoundName, sizeof( m_szSoundName ) );
+			m_Params.m_pSoundName = m_szSoundName;
+		}
+
+		if ( ep.m_pOrigin )
+		{
+			m_vecOrigin = *ep.m_pOrigin;
+			m_Params.m_pOrigin = &m_vecOrigin;
+		}
+
+		// Callers read the duration right after EmitSound returns
+		if ( ep.m_pflSoundDuration )
+		{
+			*ep.m_pflSoundDuration = ep.m_pSoundName ? CBaseEntity::GetSoundDuration( ep.m_pSoundName, NULL ) : 0.0f;
+		}
+	}
+
+	virtual void operator()()
+	{
+		g_SoundEmitterSystem.EmitSound( m_Filter, m_nEntIndex, m_Params );
+	}
+
+private:
+	CRecipientFilter	m_Filter;
+	int					m_nEntIndex;
+	EmitSound_t			m_Params;
+	char				m_szSoundName[MAX_PATH];
+	Vector				m_vecOrigin;
+};
+
+static void DeferEmitSound( IRecipientFilter& filter, int entindex, const EmitSound_t & ep )
+{
+	UTIL_DeferSimulateSideEffect( new CDeferredEmitSound( filter, entindex, ep ) );
+}
+#endif // !CLIENT_DLL
+
 IGameSystem *SoundEmitterSystem()
 {
 	return &g_SoundEmitterSystem;
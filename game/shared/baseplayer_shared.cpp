@@ -32,6 +32,7 @@
 	#include "doors.h"
 	#include "ai_basenpc.h"
 	#include "env_zoom.h"
+	#include "tier1/functors.h"
 
 	extern int TrainSpeed(int iSpeed, int iMax);
 	
@@ -659,6 +660,14 @@ void CBasePlayer::UpdateStepSound( surfacedata_t *psurface, const Vector &vecOri
 	PlayStepSound( feet, psurface, fvol, false );
 }
 
+#if !defined( CLIENT_DLL )
+static void DeferredPlayStepSound( CBasePlayer *pPlayer, const Vector &vecOrigin, surfacedata_t *psurface, float fvol, bool force )
+{
+	Vector vecStepOrigin = vecOrigin;
+	pPlayer->PlayStepSound( vecStepOrigin, psurface, fvol, force );
+}
+#endif
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : step - 
@@ -674,6 +683,13 @@ void CBasePlayer::PlayStepSound( Vector &vecOrigin, surfacedata_t *psurface, flo
 	// during prediction play footstep sounds only once
 	if ( prediction->InPrediction() && !prediction->IsFirstTimePredicted() )
 		return;
+#else
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		// Movement running on a worker, the PAS/PVS filter and the step cache need the main thread
+		UTIL_DeferSimulateSideEffect( CreateFunctor( &DeferredPlayStepSound, this, vecOrigin, psurface, fvol, force ) );
+		return;
+	}
 #endif
 
 	if ( !psurface )
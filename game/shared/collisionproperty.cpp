@@ -73,7 +73,7 @@ public:
 
 
 private:
-	int m_nReadLockCount[MAX_THREADS_SUPPORTED];
+	int m_nReadLockCount[MAX_THREAD_IDS];
 
 	CTSListWithFreeList<CBaseHandle> m_DirtyEntities;
 	CThreadSpinRWLock	 m_partitionMutex;
@@ -14,6 +14,7 @@
 #include "decals.h"
 #include "coordsize.h"
 #include "rumble_shared.h"
+#include "tier1/functors.h"
 
 #if defined(HL2_DLL) || defined(HL2_CLIENT_DLL)
 	#include "hl_movedata.h"
@@ -624,6 +625,10 @@ CGameMovement::CGameMovement( void )
 
 	mv					= NULL;
 
+#ifdef GAME_DLL
+	m_pMoveHelper		= NULL;
+#endif
+
 	memset( m_flStuckCheckTime, 0, sizeof(m_flStuckCheckTime) );
 }
 
@@ -1138,7 +1143,12 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 
 	//!!HACK HACK: Adrian - slow down all player movement by this factor.
 	//!!Blame Yahn for this one.
-	gpGlobals->frametime *= pPlayer->GetLaggedMovementValue();
+	// Leave gpGlobals alone unless it's needed, movement can run on several threads at once.
+	bool bLaggedMovement = ( pPlayer->GetLaggedMovementValue() != 1.0f );
+	if ( bLaggedMovement )
+	{
+		gpGlobals->frametime *= pPlayer->GetLaggedMovementValue();
+	}
 
 	ResetGetPointContentsCache();
 
@@ -1168,11 +1178,36 @@ void CGameMovement::ProcessMovement( CBasePlayer *pPlayer, CMoveData *pMove )
 	// CheckV( player->CurrentCommandNumber(), "EndPos", mv->GetAbsOrigin() );
 
 	//This is probably not needed, but just in case.
-	gpGlobals->frametime = flStoreFrametime;
+	if ( bLaggedMovement )
+	{
+		gpGlobals->frametime = flStoreFrametime;
+	}
 
 // 	player = NULL;
 }
 
+#ifdef GAME_DLL
+//-----------------------------------------------------------------------------
+// Purpose: Can ProcessMovement run for this player on a worker thread, using an
+//  instance from CreateWorkerInstance? Games add their own rules on top.
+//-----------------------------------------------------------------------------
+bool CGameMovement::CanProcessMovementInParallel( CBasePlayer *pPlayer, CMoveData *pMove )
+{
+	// Ladders change the move type, observers follow other entities
+	if ( pPlayer->GetMoveType() != MOVETYPE_WALK && pPlayer->GetMoveType() != MOVETYPE_NOCLIP )
+		return false;
+
+	if ( pPlayer->IsObserver() || pPlayer->IsInAVehicle() )
+		return false;
+
+	// Workers all run with the same gpGlobals->frametime, so no lagged movement or pause
+	if ( pPlayer->GetLaggedMovementValue() != 1.0f || gpGlobals->frametime != TICK_INTERVAL )
+		return false;
+
+	return true;
+}
+#endif
+
 void CGameMovement::StartTrackPredictionErrors( CBasePlayer *pPlayer )
 {
 	player = pPlayer;
@@ -2135,7 +2170,14 @@ void CGameMovement::FullWalkMove( )
 	{
 		PlaySwimSound();
 #if !defined( CLIENT_DLL )
-		player->Splash();
+		if ( UTIL_IsSimulatingInParallel() )
+		{
+			UTIL_DeferSimulateSideEffect( CreateFunctor( player, &CBasePlayer::Splash ) );
+		}
+		else
+		{
+			player->Splash();
+		}
 #endif
 	}
 }
@@ -3986,7 +4028,16 @@ void CGameMovement::PlayerRoughLandingEffects( float fvol )
 		}
 
 #if !defined( CLIENT_DLL )
-		player->RumbleEffect( ( fvol > 0.85f ) ? ( RUMBLE_FALL_LONG ) : ( RUMBLE_FALL_SHORT ), 0, RUMBLE_FLAGS_NONE );
+		unsigned char rumble = ( fvol > 0.85f ) ? ( RUMBLE_FALL_LONG ) : ( RUMBLE_FALL_SHORT );
+		if ( UTIL_IsSimulatingInParallel() )
+		{
+			// Sends a user message
+			UTIL_DeferSimulateSideEffect( CreateFunctor( player, &CBasePlayer::RumbleEffect, rumble, (unsigned char)0, (unsigned char)RUMBLE_FLAGS_NONE ) );
+		}
+		else
+		{
+			player->RumbleEffect( rumble, 0, RUMBLE_FLAGS_NONE );
+		}
 #endif
 	}
 }
@@ -13,6 +13,7 @@
 #endif
 
 #include "igamemovement.h"
+#include "imovehelper.h"
 #include "cmodel.h"
 #include "tier0/vprof.h"
 
@@ -64,7 +65,27 @@ public:
 	virtual unsigned int PlayerSolidMask( bool brushOnly = false );	///< returns the solid mask for the given player, so bots can have a more-restrictive set
 	CBasePlayer		*player;
 	CMoveData *GetMoveData() { return mv; }
+
+#ifdef GAME_DLL
+	// For running player movement on worker threads (sv_parallel_usercmds). Games that support
+	// it return a new instance here, which the server uses for one player slot at a time.
+	virtual CGameMovement *CreateWorkerInstance() { return NULL; }
+
+	// Called on the main thread after SetupMove. Anything the movement would do to other
+	// entities or shared state right away has to be ruled out here.
+	virtual bool	CanProcessMovementInParallel( CBasePlayer *pPlayer, CMoveData *pMove );
+
+	// Worker instances collect touches and sounds in their own helper
+	void			SetMoveHelper( IMoveHelper *pMoveHelper ) { m_pMoveHelper = pMoveHelper; }
+#endif
+
 protected:
+#ifdef GAME_DLL
+	IMoveHelper		*MoveHelper() const { return m_pMoveHelper ? m_pMoveHelper : ::MoveHelper(); }
+
+	IMoveHelper		*m_pMoveHelper;
+#endif
+
 	// Input/Output for this movement
 	CMoveData		*mv;
 	
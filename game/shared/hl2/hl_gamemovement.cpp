@@ -8,6 +8,7 @@
 #include "in_buttons.h"
 #include "utlrbtree.h"
 #include "hl2_shareddefs.h"
+#include "movevars_shared.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -1143,6 +1144,60 @@ bool CHL2GameMovement::CanAccelerate()
 }
 
 
+#if defined( GAME_DLL ) && !defined( PORTAL )
+//-----------------------------------------------------------------------------
+// Purpose: 
+//-----------------------------------------------------------------------------
+CGameMovement *CHL2GameMovement::CreateWorkerInstance()
+{
+	return new CHL2GameMovement;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Getting on, off or moving along a ladder reserves spots, creates and
+//  removes entities and changes the move type, so keep anyone who might reach
+//  a ladder this tick on the main thread.
+//-----------------------------------------------------------------------------
+bool CHL2GameMovement::CanProcessMovementInParallel( CBasePlayer *pPlayer, CMoveData *pMove )
+{
+	if ( !BaseClass::CanProcessMovementInParallel( pPlayer, pMove ) )
+		return false;
+
+	CHL2_Player *pHLPlayer = static_cast< CHL2_Player * >( pPlayer );
+	if ( pHLPlayer->m_HL2Local.m_hLadder.Get() || pHLPlayer->GetLadderMove()->m_bForceLadderMove )
+		return false;
+
+	if ( pPlayer->GetMoveType() == MOVETYPE_NOCLIP )
+		return true;
+
+	// Findladder looks 64 units out from wherever the move ends up
+	float flReach = 64.0f + 2.0f * sv_maxvelocity.GetFloat() * TICK_INTERVAL;
+	float flReachSqr = flReach * flReach;
+
+	int c = CFuncLadder::GetLadderCount();
+	for ( int i = 0 ; i < c; i++ )
+	{
+		CFuncLadder *ladder = CFuncLadder::GetLadder( i );
+		if ( !ladder->IsEnabled() )
+			continue;
+
+		Vector topPosition;
+		Vector bottomPosition;
+
+		ladder->GetTopPosition( topPosition );
+		ladder->GetBottomPosition( bottomPosition );
+
+		Vector closest;
+		CalcClosestPointOnLineSegment( pMove->GetAbsOrigin(), bottomPosition, topPosition, closest, NULL );
+
+		if ( ( closest - pMove->GetAbsOrigin() ).LengthSqr() <= flReachSqr )
+			return false;
+	}
+
+	return true;
+}
+#endif
+
 #ifndef PORTAL	// Portal inherits from this but needs to declare it's own global interface
 	// Expose our interface.
 	static CHL2GameMovement g_GameMovement;
@@ -44,6 +44,11 @@ public:
 	virtual void	SetGroundEntity( trace_t *pm );
 	virtual bool CanAccelerate( void );
 
+#if defined( GAME_DLL ) && !defined( PORTAL )
+	virtual CGameMovement *CreateWorkerInstance();
+	virtual bool	CanProcessMovementInParallel( CBasePlayer *pPlayer, CMoveData *pMove );
+#endif
+
 private:
 
 	// See if we are pressing use near a ladder "mount" point and if so, latch us onto the ladder
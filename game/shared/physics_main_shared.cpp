@@ -18,6 +18,7 @@
 #include "igamesystem.h"
 #include "utlmultilist.h"
 #include "tier1/callqueue.h"
+#include "tier1/functors.h"
 
 #ifdef PORTAL
 	#include "portal_util_shared.h"
@@ -2122,17 +2123,18 @@ bool CBaseEntity::PhysicsRunSpecificThink( int nContextIndex, BASEPTR thinkFunc
 	return ( !IsMarkedForDeletion() );
 }
 
-void CBaseEntity::SetGroundEntity( CBaseEntity *ground )
+//-----------------------------------------------------------------------------
+// Purpose: Second half of SetGroundEntity, moves pEntity from the ground list of
+//  its old ground to the new one
+//-----------------------------------------------------------------------------
+static void UpdateGroundLinks( CBaseEntity *pEntity, CBaseEntity *oldGround, CBaseEntity *ground )
 {
-	if ( m_hGroundEntity.Get() == ground )
-		return;
-
 #ifdef GAME_DLL
 	// this can happen in-between updates to the held object controller (physcannon, +USE)
 	// so trap it here and release held objects when they become player ground
-	if ( ground && IsPlayer() && ground->GetMoveType()== MOVETYPE_VPHYSICS )
+	if ( ground && pEntity->IsPlayer() && ground->GetMoveType()== MOVETYPE_VPHYSICS )
 	{
-		CBasePlayer *pPlayer = ToBasePlayer(this);
+		CBasePlayer *pPlayer = ToBasePlayer(pEntity);
 		IPhysicsObject *pPhysGround = ground->VPhysicsGetObject();
 		if ( pPhysGround && pPlayer )
 		{
@@ -2144,38 +2146,64 @@ void CBaseEntity::SetGroundEntity( CBaseEntity *ground )
 	}
 #endif
 
-	CBaseEntity *oldGround = m_hGroundEntity;
-	m_hGroundEntity = ground;
-
 	// Just starting to touch
 	if ( !oldGround && ground )
 	{
-		ground->AddEntityToGroundList( this );
+		ground->AddEntityToGroundList( pEntity );
 	}
 	// Just stopping touching
 	else if ( oldGround && !ground )
 	{
-		PhysicsNotifyOtherOfGroundRemoval( this, oldGround );
+		CBaseEntity::PhysicsNotifyOtherOfGroundRemoval( pEntity, oldGround );
 	}
 	// Changing out to new ground entity
 	else
 	{
-		PhysicsNotifyOtherOfGroundRemoval( this, oldGround );
-		ground->AddEntityToGroundList( this );
+		CBaseEntity::PhysicsNotifyOtherOfGroundRemoval( pEntity, oldGround );
+		ground->AddEntityToGroundList( pEntity );
 	}
 
 	// HACK/PARANOID:  This is redundant with the code above, but in case we get out of sync groundlist entries ever, 
 	//  this will force the appropriate flags
-	if ( ground )
+	if ( pEntity->GetGroundEntity() )
 	{
-		AddFlag( FL_ONGROUND );
+		pEntity->AddFlag( FL_ONGROUND );
 	}
 	else
 	{
-		RemoveFlag( FL_ONGROUND );
+		pEntity->RemoveFlag( FL_ONGROUND );
 	}
 }
 
+void CBaseEntity::SetGroundEntity( CBaseEntity *ground )
+{
+	if ( m_hGroundEntity.Get() == ground )
+		return;
+
+	CBaseEntity *oldGround = m_hGroundEntity;
+	m_hGroundEntity = ground;
+
+#ifdef GAME_DLL
+	if ( UTIL_IsSimulatingInParallel() )
+	{
+		// The ground lists belong to the ground entities, relink from the main thread. Movement
+		// reads FL_ONGROUND back right away, so that one can't wait.
+		if ( ground )
+		{
+			AddFlag( FL_ONGROUND );
+		}
+		else
+		{
+			RemoveFlag( FL_ONGROUND );
+		}
+		UTIL_DeferSimulateSideEffect( CreateFunctor( &UpdateGroundLinks, this, oldGround, ground ) );
+		return;
+	}
+#endif
+
+	UpdateGroundLinks( this, oldGround, ground );
+}
+
 CBaseEntity *CBaseEntity::GetGroundEntity( void )
 {
 	return m_hGroundEntity;
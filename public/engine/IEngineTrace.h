@@ -185,6 +185,10 @@ public:
 
 	// Walks bsp to find the leaf containing the specified point
 	virtual int GetLeafContainingPoint( const Vector &ptTest ) = 0;
+
+	// TraceRay for a batch of rays with the same mask and filter. Rays close together share one
+	// entity query and the filter is asked about each entity once for the whole batch.
+	virtual void	TraceRays( const Ray_t *pRays, int nRays, unsigned int fMask, ITraceFilter *pTraceFilter, trace_t *pTraces ) = 0;
 };
 
 
@@ -286,6 +286,12 @@ struct FileSystemStatistics
 						nBytesRead,
 						nBytesWritten,
 						nSeeks;
+
+	// Relative opens and the resolved path cache
+	CInterlockedUInt	nResolvedPathHits,			// opened straight from the remembered search path
+						nResolvedPathMissing,		// remembered as not being in any search path
+						nResolvedPathMisses,		// had to walk the search paths
+						nResolvedPathStale;			// remembered search path didn't have the file anymore
 };
 
 //-----------------------------------------------------------------------------
@@ -211,6 +211,14 @@ public:
 	virtual void ReportStats( const char *pFileName ) = 0;
 
 	virtual void InstallQueryCallback( IPartitionQueryCallback *pCallback ) = 0;
+
+	// Brackets a phase where many threads query the partition at once. Element moves made
+	// inside it are queued and applied in one batch when the outermost End is called, so
+	// queries see every element where it was when the phase began, even one moved by the
+	// thread doing the query. Only run work in a phase that doesn't need to see its own
+	// moves. Main thread only.
+	virtual void BeginParallelQueries() = 0;
+	virtual void EndParallelQueries() = 0;
 };
 
 #endif
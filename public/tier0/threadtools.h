@@ -166,6 +166,10 @@ extern bool gbCheckNotMultithreaded;
 #define MAX_THREADS_SUPPORTED 32
 #endif
 
+// Upper bound (exclusive) on g_nThreadID. Every thread created through ThreadCreate/CThread gets an id,
+// so per-thread tables indexed by g_nThreadID must be sized by this, not MAX_THREADS_SUPPORTED
+#define MAX_THREAD_IDS 128
+
 
 
 //-----------------------------------------------------------------------------
@@ -224,6 +228,13 @@ typedef uintp (*ThreadedLoadLibraryFunc_t)(void *pParam);
 PLATFORM_INTERFACE void SetThreadedLoadLibraryFunc( ThreadedLoadLibraryFunc_t func );
 PLATFORM_INTERFACE ThreadedLoadLibraryFunc_t GetThreadedLoadLibraryFunc();
 
+// Called on every thread tier0 started (CThread, CreateSimpleThread) just before it
+// exits, so modules can free what they keep per thread. A module must remove its
+// function before it unloads.
+typedef void (*ThreadExitFunc_t)();
+PLATFORM_INTERFACE void ThreadAddExitFunc( ThreadExitFunc_t pfnExit );
+PLATFORM_INTERFACE void ThreadRemoveExitFunc( ThreadExitFunc_t pfnExit );
+
 #if defined( PLATFORM_WINDOWS_PC32 )
 DLL_IMPORT unsigned long STDCALL GetCurrentThreadId();
 #define ThreadGetCurrentId GetCurrentThreadId
@@ -782,7 +782,6 @@ BITBUF_INLINE unsigned int bf_read::ReadUBitLong( int numbits ) RESTRICT
 	int iLastBit = m_iCurBit + numbits - 1;
 	unsigned int iWordOffset1 = m_iCurBit >> 5;
 	unsigned int iWordOffset2 = iLastBit >> 5;
-	m_iCurBit += numbits;
 	
 #if __i386__
 	unsigned int bitmask = (2 << (numbits-1)) - 1;
@@ -791,6 +790,19 @@ BITBUF_INLINE unsigned int bf_read::ReadUBitLong( int numbits ) RESTRICT
 	unsigned int bitmask = g_ExtraMasks[numbits];
 #endif
 
+#if VALVE_LITTLE_ENDIAN
+	// Fast path: one qword load covers any value up to 32 bits
+	if ( (int)( (iWordOffset1 + 2) * sizeof(uint32) ) <= m_nDataBytes )
+	{
+		uint64 qword;
+		memcpy( &qword, m_pData + iWordOffset1 * sizeof(uint32), sizeof(qword) );
+		m_iCurBit += numbits;
+		return (unsigned int)( qword >> iStartBit ) & bitmask;
+	}
+#endif
+
+	m_iCurBit += numbits;
+
 	unsigned int dw1 = LoadLittleDWord( (uint32* RESTRICT)m_pData, iWordOffset1 ) >> iStartBit;
 	unsigned int dw2 = LoadLittleDWord( (uint32* RESTRICT)m_pData, iWordOffset2 ) << (32 - iStartBit);
 
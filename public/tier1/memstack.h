@@ -202,6 +202,184 @@ private:
 	int m_nAllocated;
 };
 
+//-----------------------------------------------------------------------------
+// Frame arenas: per-thread linear allocators that are thrown away wholesale at
+// a frame boundary. Memory handed out for a scope stays valid until the next
+// FrameArenaEndFrame() of that scope, there is no per-allocation free.
+//
+// Each thread lazily gets its own arena per scope and only the owning thread
+// ever resets it (on its first allocation after the boundary), so allocation
+// needs no locking. Arenas live in tier1, so each module that links it has its
+// own set. A thread's arenas are freed when it exits through tier0's thread
+// exit path. FrameArenaAlloc returns NULL when the thread's arena is full;
+// callers must fall back to the heap.
+//-----------------------------------------------------------------------------
+enum FrameArenaScope_t
+{
+	FRAME_ARENA_SERVER_TICK = 0,	// reset at the start of each server tick
+
+	FRAME_ARENA_SCOPE_COUNT
+};
+
+void *FrameArenaAlloc( FrameArenaScope_t scope, unsigned nBytes );
+void FrameArenaEndFrame( FrameArenaScope_t scope );
+unsigned FrameArenaGeneration( FrameArenaScope_t scope );
+
+// Number of arenas this module has, across all threads and scopes
+int FrameArenaCount();
+
+//-----------------------------------------------------------------------------
+// The CUtlMemoryFrameArena class:
+// A dynamic memory class for per-frame temporaries. Storage comes out of the
+// current thread's frame arena and is never freed individually; if the arena
+// runs dry the memory moves to the heap. The container must not outlive the
+// frame it was filled in.
+//-----------------------------------------------------------------------------
+template< typename T, FrameArenaScope_t SCOPE, typename I = int >
+class CUtlMemoryFrameArena
+{
+public:
+	// constructor, destructor
+	CUtlMemoryFrameArena( int nGrowSize = 0, int nInitSize = 0 ) : m_pMemory( NULL ), m_nAllocated( 0 ), m_bHeap( false )
+	{
+		if ( nInitSize )
+		{
+			Grow( nInitSize );
+		}
+	}
+	CUtlMemoryFrameArena( T* pMemory, int numElements )		{ Assert( 0 ); }
+	~CUtlMemoryFrameArena()									{ Purge(); }
+
+	// Can we use this index?
+	bool IsIdxValid( I i ) const							{ return (i >= 0) && (i < m_nAllocated); }
+
+	// Specify the invalid ('null') index that we'll only return on failure
+	static const I INVALID_INDEX = ( I )-1; // For use with COMPILE_TIME_ASSERT
+	static I InvalidIndex() { return INVALID_INDEX; }
+
+	class Iterator_t
+	{
+		Iterator_t( I i ) : index( i ) {}
+		I index;
+		friend class CUtlMemoryFrameArena<T, SCOPE, I>;
+	public:
+		bool operator==( const Iterator_t it ) const		{ return index == it.index; }
+		bool operator!=( const Iterator_t it ) const		{ return index != it.index; }
+	};
+	Iterator_t First() const								{ return Iterator_t( m_nAllocated ? 0 : InvalidIndex() ); }
+	Iterator_t Next( const Iterator_t &it ) const			{ return Iterator_t( it.index < m_nAllocated ? it.index + 1 : InvalidIndex() ); }
+	I GetIndex( const Iterator_t &it ) const				{ return it.index; }
+	bool IsIdxAfter( I i, const Iterator_t &it ) const		{ return i > it.index; }
+	bool IsValidIterator( const Iterator_t &it ) const		{ return it.index >= 0 && it.index < m_nAllocated; }
+	Iterator_t InvalidIterator() const						{ return Iterator_t( InvalidIndex() ); }
+
+	// Gets the base address
+	T* Base()												{ return m_pMemory; }
+	const T* Base() const									{ return m_pMemory; }
+
+	// element access
+	T& operator[]( I i )									{ Assert( IsIdxValid(i) ); return m_pMemory[i];	}
+	const T& operator[]( I i ) const						{ Assert( IsIdxValid(i) ); return m_pMemory[i];	}
+	T& Element( I i )										{ Assert( IsIdxValid(i) ); return m_pMemory[i];	}
+	const T& Element( I i ) const							{ Assert( IsIdxValid(i) ); return m_pMemory[i];	}
+
+	// Attaches the buffer to external memory....
+	void SetExternalBuffer( T* pMemory, int numElements )	{ Assert( 0 ); }
+
+	// Size
+	int NumAllocated() const								{ return m_nAllocated; }
+	int Count() const										{ return m_nAllocated; }
+
+	// Grows the memory, so that at least allocated + num elements are allocated
+	void Grow( int num = 1 )
+	{
+		Assert( num > 0 );
+		int nNewAllocated = MAX( m_nAllocated * 2, m_nAllocated + num );
+		if ( nNewAllocated < 16 )
+		{
+			nNewAllocated = 16;
+		}
+		ReAlloc( nNewAllocated );
+	}
+
+	// Makes sure we've got at least this much memory
+	void EnsureCapacity( int num )							{ if ( m_nAllocated < num ) ReAlloc( num ); }
+
+	// Memory deallocation; arena memory simply goes away with the frame
+	void Purge()
+	{
+		if ( m_bHeap )
+		{
+			free( m_pMemory );
+		}
+		m_pMemory = NULL;
+		m_nAllocated = 0;
+		m_bHeap = false;
+	}
+	void Purge( int numElements )							{ Assert( numElements <= m_nAllocated ); }
+
+	// is the memory externally allocated?
+	bool IsExternallyAllocated() const						{ return false; }
+
+	// Did we run out of arena space?
+	bool IsOnHeap() const									{ return m_bHeap; }
+
+	// Set the size by which the memory grows
+	void SetGrowSize( int size )							{}
+
+	// Swapped by hand, V_swap would drag mathlib into every user of this header
+	void Swap( CUtlMemoryFrameArena<T, SCOPE, I> &mem )
+	{
+		T *pMemory = m_pMemory;
+		m_pMemory = mem.m_pMemory;
+		mem.m_pMemory = pMemory;
+
+		int nAllocated = m_nAllocated;
+		m_nAllocated = mem.m_nAllocated;
+		mem.m_nAllocated = nAllocated;
+
+		bool bHeap = m_bHeap;
+		m_bHeap = mem.m_bHeap;
+		mem.m_bHeap = bHeap;
+	}
+
+private:
+	void ReAlloc( int nAllocated )
+	{
+		T *pNew = NULL;
+		if ( !m_bHeap )
+		{
+			pNew = (T *)FrameArenaAlloc( SCOPE, nAllocated * sizeof(T) );
+		}
+		if ( pNew )
+		{
+			if ( m_nAllocated )
+			{
+				memcpy( (void *)pNew, m_pMemory, m_nAllocated * sizeof(T) );
+			}
+		}
+		else if ( m_bHeap )
+		{
+			pNew = (T *)realloc( m_pMemory, nAllocated * sizeof(T) );
+		}
+		else
+		{
+			pNew = (T *)malloc( nAllocated * sizeof(T) );
+			if ( m_nAllocated )
+			{
+				memcpy( (void *)pNew, m_pMemory, m_nAllocated * sizeof(T) );
+			}
+			m_bHeap = true;
+		}
+		m_pMemory = pNew;
+		m_nAllocated = nAllocated;
+	}
+
+	T *m_pMemory;
+	int m_nAllocated;
+	bool m_bHeap;
+};
+
 //-----------------------------------------------------------------------------
 
 #endif // MEMSTACK_H
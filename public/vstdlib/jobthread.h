@@ -425,6 +425,7 @@ JOB_INTERFACE void DestroyThreadPool( IThreadPool *pPool );
 //-------------------------------------
 
 JOB_INTERFACE void RunThreadPoolTests();
+JOB_INTERFACE void RunThreadPoolScalingBenchmark();
 
 //-----------------------------------------------------------------------------
 
@@ -993,22 +994,36 @@ public:
 		{
 			m_lIndex = lBegin;
 			m_lLimit = lBegin + nItems;
-			int i = g_pThreadPool->NumIdleThreads();
+			int nJobs = g_pThreadPool->NumIdleThreads();
 
-			if ( nMaxParallel < i)
+			if ( nMaxParallel < nJobs )
 			{
-				i = nMaxParallel;
+				nJobs = nMaxParallel;
 			}
 
+			CJob **jobs = (CJob **)stackalloc( MAX( nJobs, 1 ) * sizeof(CJob **) );
+			int i = nJobs;
+
 			while( i-- )
 			{
 				++m_nActive;
-				ThreadExecute( this, &CParallelLoopProcessor<ITEM_PROCESSOR_TYPE>::DoExecute )->Release();
+				jobs[i] = ThreadExecute( this, &CParallelLoopProcessor<ITEM_PROCESSOR_TYPE>::DoExecute );
 			}
 
 			++m_nActive;
 			DoExecute();
 
+			// All items are claimed now. Helpers that never got a thread (say we're
+			// nested in a job and every worker is busy) are dropped, not waited on.
+			for ( i = 0; i < nJobs; i++ )
+			{
+				if ( jobs[i]->Abort() == JOB_STATUS_ABORTED )
+				{
+					--m_nActive;
+				}
+				jobs[i]->Release();
+			}
+
 			while ( m_nActive )
 			{
 				ThreadPause();
@@ -1095,12 +1110,15 @@ protected:
 			i = nMaxParallel;
 		}
 
+		CJob **jobs = (CJob **)stackalloc( MAX( i, 1 ) * sizeof(CJob **) );
+		int nJobs = 0;
+
 		while( i -- > 0 )
 		{
 			if (  threadOverride == -1 || i == threadOverride - 1 )
 			{
 				++ m_nActive;
-				ThreadExecute( this, &ThisParallelProcessorBase_t::DoExecute )->Release();
+				jobs[nJobs++] = ThreadExecute( this, &ThisParallelProcessorBase_t::DoExecute );
 			}
 		}
 
@@ -1108,6 +1126,20 @@ protected:
 		{
 			++ m_nActive;
 			DoExecute();
+
+			// Same as CParallelLoopProcessor, don't wait on helpers that never started
+			for ( i = 0; i < nJobs; i++ )
+			{
+				if ( jobs[i]->Abort() == JOB_STATUS_ABORTED )
+				{
+					-- m_nActive;
+				}
+			}
+		}
+
+		for ( i = 0; i < nJobs; i++ )
+		{
+			jobs[i]->Release();
 		}
 
 		while ( m_nActive )
@@ -1140,7 +1172,231 @@ private:
 	const char *				m_szDescription;
 };
 
+//-----------------------------------------------------------------------------
+// Task graphs: jobs that run once the tasks they depend on have finished.
+//
+// Add the tasks and their dependencies, then Launch(). Tasks with nothing to
+// wait on are queued right away, and each finished task queues the ones it
+// unblocks. Wait() runs the graph's own ready tasks on the calling thread while
+// it waits, so a job may build and wait on a graph without tying up the pool.
+//
+//	CTaskGraph graph;
+//	CGraphTask *pPack = graph.AddTask( "Pack", this, &CFoo::PackEntities );
+//	CGraphTask *pWrite = graph.AddTask( "Write", this, &CFoo::WriteDeltas );
+//	graph.AddDependency( pWrite, pPack );
+//	graph.Launch();
+//	...
+//	graph.Wait();
+//-----------------------------------------------------------------------------
+
+class CTaskGraph;
+
+class CGraphTask : public CJob
+{
+public:
+	CGraphTask( CTaskGraph *pGraph, CFunctor *pFunctor, JobPriority_t priority )
+	  : CJob( priority ),
+		m_pGraph( pGraph ),
+		m_pFunctor( pFunctor ),
+		m_nPrerequisites( 1 ) // held by the graph until Launch()
+	{
+		SetFlags( JF_QUEUE );
+	}
+
+private:
+	friend class CTaskGraph;
+
+	virtual JobStatus_t DoExecute();
+	virtual JobStatus_t DoAbort( bool bDiscard );
+
+	CTaskGraph *				m_pGraph;
+	CRefPtr<CFunctor>			m_pFunctor;
+	CInterlockedInt				m_nPrerequisites;
+	CUtlVector<CGraphTask *>	m_Continuations;
+};
+
+class CTaskGraph
+{
+public:
+	CTaskGraph( IThreadPool *pPool = NULL )
+	  : m_pPool( pPool ),
+		m_nUnfinished( 0 ),
+		m_bLaunched( false )
+	{
+	}
+
+	~CTaskGraph()
+	{
+		Reset();
+	}
+
+	//-----------------------------------------------------
+	// Building, only before Launch(). The graph takes over the functor's reference.
+	//-----------------------------------------------------
+	CGraphTask *AddTask( CFunctor *pFunctor, const char *pszDescription = NULL, JobPriority_t priority = JP_NORMAL )
+	{
+		Assert( !m_bLaunched );
+		CGraphTask *pTask = new CGraphTask( this, pFunctor, priority );
+		pTask->SetDescription( pszDescription );
+		m_Tasks.AddToTail( pTask );
+		++m_nUnfinished;
+		return pTask;
+	}
+
+	CGraphTask *AddTask( const char *pszDescription, void (*pfnTask)(), JobPriority_t priority = JP_NORMAL )
+	{
+		return AddTask( CreateFunctor( pfnTask ), pszDescription, priority );
+	}
+
+	template <typename OBJECT_TYPE, typename FUNCTION_CLASS>
+	CGraphTask *AddTask( const char *pszDescription, OBJECT_TYPE *pObject, void (FUNCTION_CLASS::*pfnTask)(), JobPriority_t priority = JP_NORMAL )
+	{
+		return AddTask( CreateFunctor( pObject, pfnTask ), pszDescription, priority );
+	}
+
+	// pTask won't start until pPrerequisite has finished
+	void AddDependency( CGraphTask *pTask, CGraphTask *pPrerequisite )
+	{
+		Assert( !m_bLaunched && pTask->m_pGraph == this && pPrerequisite->m_pGraph == this && pTask != pPrerequisite );
+		pPrerequisite->m_Continuations.AddToTail( pTask );
+		++pTask->m_nPrerequisites;
+	}
+
+	//-----------------------------------------------------
+	// Running
+	//-----------------------------------------------------
+	void Launch()
+	{
+		Assert( !m_bLaunched );
+		if ( !m_pPool )
+		{
+			m_pPool = g_pThreadPool;
+		}
+
+		m_bLaunched = true;
+		if ( !m_Tasks.Count() )
+		{
+			m_FinishedEvent.Set();
+			return;
+		}
+
+		for ( int i = 0; i < m_Tasks.Count(); i++ )
+		{
+			ReleasePrerequisite( m_Tasks[i] );
+		}
+	}
+
+	// Goes by the event, not the count: the last task still touches the graph
+	// after its decrement, to set the event
+	bool IsFinished() const
+	{
+		return ( m_bLaunched && m_FinishedEvent.Wait( 0 ) );
+	}
+
+	// Help while waiting: run whatever ready tasks of ours nobody has picked up yet
+	void Wait()
+	{
+		Assert( m_bLaunched );
+		while ( !m_FinishedEvent.Wait( 0 ) )
+		{
+			if ( !ExecuteReadyTask() )
+			{
+				m_FinishedEvent.Wait( 1 );
+			}
+		}
+	}
+
+	// Waits, then drops the tasks so the graph can be built again (e.g. next frame)
+	void Reset()
+	{
+		if ( m_bLaunched )
+		{
+			Wait();
+		}
+
+		for ( int i = 0; i < m_Tasks.Count(); i++ )
+		{
+			m_Tasks[i]->m_pGraph = NULL;
+			m_Tasks[i]->Release();
+		}
+		m_Tasks.RemoveAll();
+		m_nUnfinished = 0;
+		m_FinishedEvent.Reset();
+		m_bLaunched = false;
+	}
+
+private:
+	friend class CGraphTask;
+
+	void ReleasePrerequisite( CGraphTask *pTask )
+	{
+		if ( --pTask->m_nPrerequisites == 0 )
+		{
+			if ( m_pPool && m_pPool->NumThreads() )
+			{
+				m_pPool->AddJob( pTask );
+			}
+			else
+			{
+				// No workers, Wait() runs it. Avoids recursing down long chains.
+				pTask->SlamStatus( JOB_STATUS_PENDING );
+			}
+		}
+	}
+
+	void OnTaskDone( CGraphTask *pTask )
+	{
+		for ( int i = 0; i < pTask->m_Continuations.Count(); i++ )
+		{
+			ReleasePrerequisite( pTask->m_Continuations[i] );
+		}
+
+		// Only the task whose decrement reaches zero sets the event. That has to be
+		// our last touch of the graph, Wait() returns on it and the owner may
+		// destroy us right after
+		if ( --m_nUnfinished == 0 )
+		{
+			m_FinishedEvent.Set();
+		}
+	}
+
+	bool ExecuteReadyTask()
+	{
+		for ( int i = 0; i < m_Tasks.Count(); i++ )
+		{
+			CGraphTask *pTask = m_Tasks[i];
+			if ( pTask->GetStatus() == JOB_STATUS_PENDING && pTask->m_nPrerequisites == 0 )
+			{
+				if ( pTask->TryExecute() == JOB_OK )
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	IThreadPool *				m_pPool;
+	CUtlVector<CGraphTask *>	m_Tasks;
+	CInterlockedInt				m_nUnfinished;
+	mutable CThreadManualEvent	m_FinishedEvent;
+	bool						m_bLaunched;
+};
+
+inline JobStatus_t CGraphTask::DoExecute()
+{
+	(*m_pFunctor)();
+	m_pGraph->OnTaskDone( this );
+	return JOB_OK;
+}
 
+// An aborted task (pool stopped, AbortAll) still lets its continuations go,
+// otherwise waiters on the graph would never return
+inline JobStatus_t CGraphTask::DoAbort( bool bDiscard )
+{
+	m_pGraph->OnTaskDone( this );
+	return JOB_STATUS_ABORTED;
+}
 
 
 //-----------------------------------------------------------------------------
@@ -87,6 +87,7 @@ static CDialogInitInfo g_Info;
 
 #if defined(_WIN32) && !defined(STATIC_TIER0)
 extern "C" BOOL APIENTRY MemDbgDllMain( HMODULE hDll, DWORD dwReason, PVOID pvReserved );
+extern void MemStdThreadDetach();
 
 BOOL WINAPI DllMain(
   HINSTANCE hinstDLL,  // handle to the DLL module
@@ -98,6 +99,10 @@ BOOL WINAPI DllMain(
 #ifdef DEBUG
 	MemDbgDllMain( hinstDLL, fdwReason, lpvReserved );
 #endif
+	if ( fdwReason == DLL_THREAD_DETACH )
+	{
+		MemStdThreadDetach();
+	}
 	return true;
 }
 #endif
@@ -35,4 +35,8 @@ size_t CalcHeapUsed();
 // platforms (Xbox 360, PS3, 32-bit Windows, etc.)
 void ReserveBottomMemory();
 
+// Call as a thread exits to hand its small block heap cache back to the pools.
+// Safe to call more than once, the thread gets no new cache afterwards.
+void MemStdThreadDetach();
+
 #endif // MEM_HELPERS_H
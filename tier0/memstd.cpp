@@ -579,6 +579,7 @@ void CSmallBlockPool::Init( unsigned nBlockSize, byte *pBase, unsigned initialCo
 		DebuggerBreak();
 
 	m_nBlockSize = nBlockSize;
+	m_nMagazineSize = Clamp( (int)( SBH_MAGAZINE_BYTES / nBlockSize ), MIN_SBH_MAGAZINE, MAX_SBH_MAGAZINE );
 	m_pCommitLimit = m_pNextAlloc = m_pBase = pBase;
 	m_pAllocLimit = m_pBase + MAX_POOL_REGION;
 
@@ -623,27 +624,42 @@ void *CSmallBlockPool::Alloc()
 					pResult = pNextAlloc;
 						break;
 					}
+				m_nContention++;
 				}
 						else
 						{
-				AUTO_LOCK( m_CommitMutex );
+				// Taken once and released on every path below, counting a wait as contention
+				if ( !m_CommitMutex.TryLock() )
+				{
+					m_nContention++;
+					m_CommitMutex.Lock();
+				}
+				bool bOutOfMemory = false;
 				if ( pCommitLimit == m_pCommitLimit )
-							{
+				{
 					if ( pCommitLimit + COMMIT_SIZE <= m_pAllocLimit )
-								{
-						if ( !VirtualAlloc( pCommitLimit, COMMIT_SIZE, VA_COMMIT_FLAGS, PAGE_READWRITE ) )
-								{
-							Assert( 0 );
-							return NULL;
-							}
-
-						m_pCommitLimit = pCommitLimit + COMMIT_SIZE;
+					{
+						if ( VirtualAlloc( pCommitLimit, COMMIT_SIZE, VA_COMMIT_FLAGS, PAGE_READWRITE ) )
+						{
+							m_pCommitLimit = pCommitLimit + COMMIT_SIZE;
 						}
 						else
 						{
-							return NULL;
+							Assert( 0 );
+							bOutOfMemory = true;
 						}
 					}
+					else
+					{
+						bOutOfMemory = true;
+					}
+				}
+				m_CommitMutex.Unlock();
+
+				if ( bOutOfMemory )
+				{
+					return NULL;
+				}
 					}
 				}
 			}
@@ -657,10 +673,31 @@ void CSmallBlockPool::Free( void *p )
 	m_FreeList.Push( p );
 }
 
+// Returns a partial magazine (e.g. from an exiting thread's cache) to the free list
+void CSmallBlockPool::FreeChain( void *p )
+{
+	while ( p )
+	{
+		void *pNext = ((void **)p)[1];
+		Free( p );
+		p = pNext;
+	}
+}
+
+// Breaks the magazines back up so Compact() can see their blocks
+void CSmallBlockPool::ReturnMagazines()
+{
+	void *pMagazine;
+	while ( ( pMagazine = m_Magazines.Pop() ) != NULL )
+	{
+		FreeChain( pMagazine );
+	}
+}
+
 // Count the free blocks.  
 int CSmallBlockPool::CountFreeBlocks()
 {
-	return m_FreeList.Count();
+	return m_FreeList.Count() + m_Magazines.Count() * m_nMagazineSize;
 }
 
 // Size of committed memory managed by this heap:
@@ -687,6 +724,7 @@ int CSmallBlockPool::CountAllocatedBlocks()
 int CSmallBlockPool::Compact()
 {
 	int nBytesFreed = 0;
+	ReturnMagazines();
 	if ( m_FreeList.Count() )
 {
 	int i;
@@ -751,6 +789,197 @@ int CSmallBlockPool::Compact()
 }
 
 
+//-----------------------------------------------------------------------------
+// Per-thread magazine cache. Each pool gets a loaded magazine that allocs and
+// frees work on, plus one full spare. Only whole magazines move between a thread
+// and its pool, so most small allocations touch no shared cache lines. A block
+// freed on another thread simply joins that thread's cache, and imbalances
+// (one thread allocating, another freeing) even out through the pool's magazines.
+//-----------------------------------------------------------------------------
+#ifndef NO_SBH_THREAD_CACHE
+#define UsingSBHThreadCache() true
+#else
+#define UsingSBHThreadCache() false
+#endif
+
+struct SmallBlockThreadCache_t
+{
+	struct Bin_t
+	{
+		void *	m_pLoaded;			// chained through the blocks' second pointer
+		int		m_nLoaded;
+		void *	m_pSpare;			// full magazine, or NULL
+	};
+
+	Bin_t		m_Bins[NUM_POOLS];
+
+	// Stats, only written by the owning thread
+	unsigned	m_nHits[NUM_POOLS];
+	unsigned	m_nMisses[NUM_POOLS];
+	unsigned	m_nReturns[NUM_POOLS];
+
+	SmallBlockThreadCache_t *m_pNext;
+};
+
+// Left in a thread's cache pointer once ReleaseThreadCache ran, so late frees and
+// allocs on the exiting thread go straight to the pools instead of leaking a new cache
+#define SBH_THREAD_CACHE_RELEASED	( (SmallBlockThreadCache_t *)(intp)-1 )
+
+inline void *&NextInMagazine( void *p )
+{
+	// The first pointer is the free list link once a magazine goes back to the pool
+	return ((void **)p)[1];
+}
+
+SmallBlockThreadCache_t *CSmallBlockHeap::GetThreadCache()
+{
+	SmallBlockThreadCache_t *pCache = m_pThreadCache;
+	if ( pCache == SBH_THREAD_CACHE_RELEASED )
+	{
+		return NULL;
+	}
+
+	if ( !pCache && UsingSBHThreadCache() )
+	{
+		pCache = (SmallBlockThreadCache_t *)malloc( sizeof(SmallBlockThreadCache_t) ); // can't use new because will reenter
+		if ( pCache )
+		{
+			memset( pCache, 0, sizeof(SmallBlockThreadCache_t) );
+			m_pThreadCache = pCache;
+
+			AUTO_LOCK( m_ThreadCacheMutex );
+			pCache->m_pNext = m_pThreadCaches;
+			m_pThreadCaches = pCache;
+		}
+	}
+	return pCache;
+}
+
+void *CSmallBlockHeap::PoolAlloc( CSmallBlockPool *pPool )
+{
+	SmallBlockThreadCache_t *pCache = GetThreadCache();
+	if ( !pCache )
+	{
+		return pPool->Alloc();
+	}
+
+	int iPool = pPool - m_Pools;
+	SmallBlockThreadCache_t::Bin_t &bin = pCache->m_Bins[iPool];
+	if ( !bin.m_nLoaded )
+	{
+		if ( bin.m_pSpare )
+		{
+			pCache->m_nHits[iPool]++;
+			bin.m_pLoaded = bin.m_pSpare;
+			bin.m_nLoaded = pPool->GetMagazineSize();
+			bin.m_pSpare = NULL;
+		}
+		else
+		{
+			pCache->m_nMisses[iPool]++;
+
+			void *pMagazine = pPool->PopMagazine();
+			if ( pMagazine )
+			{
+				bin.m_pLoaded = pMagazine;
+				bin.m_nLoaded = pPool->GetMagazineSize();
+			}
+			else
+			{
+				// Nothing to swap in, fill a magazine from the pool in one go
+				int nMagazine = pPool->GetMagazineSize();
+				while ( bin.m_nLoaded < nMagazine )
+				{
+					void *p = pPool->Alloc();
+					if ( !p )
+					{
+						break;
+					}
+					NextInMagazine( p ) = bin.m_pLoaded;
+					bin.m_pLoaded = p;
+					bin.m_nLoaded++;
+				}
+
+				if ( !bin.m_nLoaded )
+				{
+					return NULL;
+				}
+			}
+		}
+	}
+	else
+	{
+		pCache->m_nHits[iPool]++;
+	}
+
+	void *p = bin.m_pLoaded;
+	bin.m_pLoaded = NextInMagazine( p );
+	bin.m_nLoaded--;
+	return p;
+}
+
+void CSmallBlockHeap::PoolFree( CSmallBlockPool *pPool, void *p )
+{
+	SmallBlockThreadCache_t *pCache = GetThreadCache();
+	if ( !pCache )
+	{
+		pPool->Free( p );
+		return;
+	}
+
+	int iPool = pPool - m_Pools;
+	SmallBlockThreadCache_t::Bin_t &bin = pCache->m_Bins[iPool];
+	if ( bin.m_nLoaded == pPool->GetMagazineSize() )
+	{
+		if ( bin.m_pSpare )
+		{
+			pPool->PushMagazine( bin.m_pSpare );
+			pCache->m_nReturns[iPool]++;
+		}
+		bin.m_pSpare = bin.m_pLoaded;
+		bin.m_pLoaded = NULL;
+		bin.m_nLoaded = 0;
+	}
+
+	NextInMagazine( p ) = bin.m_pLoaded;
+	bin.m_pLoaded = p;
+	bin.m_nLoaded++;
+}
+
+// Gives the calling thread's cached blocks back to the pools, called as threads
+// exit. The thread doesn't get a new cache afterwards.
+void CSmallBlockHeap::ReleaseThreadCache()
+{
+	SmallBlockThreadCache_t *pCache = m_pThreadCache;
+	m_pThreadCache = SBH_THREAD_CACHE_RELEASED;
+	if ( !pCache || pCache == SBH_THREAD_CACHE_RELEASED )
+	{
+		return;
+	}
+
+	for ( int i = 0; i < NUM_POOLS; i++ )
+	{
+		SmallBlockThreadCache_t::Bin_t &bin = pCache->m_Bins[i];
+		if ( bin.m_pSpare )
+		{
+			m_Pools[i].PushMagazine( bin.m_pSpare );
+		}
+		m_Pools[i].FreeChain( bin.m_pLoaded );
+	}
+
+	{
+		AUTO_LOCK( m_ThreadCacheMutex );
+		SmallBlockThreadCache_t **ppCache = &m_pThreadCaches;
+		while ( *ppCache != pCache )
+		{
+			ppCache = &(*ppCache)->m_pNext;
+		}
+		*ppCache = pCache->m_pNext;
+	}
+
+	free( pCache );
+}
+
 //-----------------------------------------------------------------------------
 //
 //-----------------------------------------------------------------------------
@@ -761,6 +990,8 @@ CSmallBlockHeap::CSmallBlockHeap()
 	// Make sure that we return 64-bit addresses in 64-bit builds.
 	ReserveBottomMemory();
 
+	m_pThreadCaches = NULL;
+
 	if ( !UsingSBH() )
 	{
 		return;
@@ -927,7 +1158,7 @@ void *CSmallBlockHeap::Alloc( size_t nBytes )
 	Assert( ShouldUse( nBytes ) );
 	CSmallBlockPool *pPool = FindPool( nBytes );
 	
-	void *p = pPool->Alloc();
+	void *p = PoolAlloc( pPool );
 	if ( p )
 	{
 		return p;
@@ -935,7 +1166,7 @@ void *CSmallBlockHeap::Alloc( size_t nBytes )
 
 	if ( s_StdMemAlloc.CallAllocFailHandler( nBytes ) >= nBytes )
 	{
-		p = pPool->Alloc();
+		p = PoolAlloc( pPool );
 		if ( p )
 		{
 	return p;
@@ -969,13 +1200,13 @@ void *CSmallBlockHeap::Realloc( void *p, size_t nBytes )
 
 	if ( pNewPool )
 	{
-		pNewBlock = pNewPool->Alloc();
+		pNewBlock = PoolAlloc( pNewPool );
 
 	if ( !pNewBlock )
 	{
 			if ( s_StdMemAlloc.CallAllocFailHandler( nBytes ) >= nBytes )
 			{
-				pNewBlock = pNewPool->Alloc();
+				pNewBlock = PoolAlloc( pNewPool );
 			}
 		}
 	}
@@ -995,7 +1226,7 @@ void *CSmallBlockHeap::Realloc( void *p, size_t nBytes )
 		memcpy( pNewBlock, p, nBytesCopy );
 	} 
 
-	pOldPool->Free( p );
+	PoolFree( pOldPool, p );
 
 	return pNewBlock;
 }
@@ -1003,7 +1234,7 @@ void *CSmallBlockHeap::Realloc( void *p, size_t nBytes )
 void CSmallBlockHeap::Free( void *p )
 	{
 	CSmallBlockPool *pPool = FindPool( p );
-		pPool->Free( p );
+		PoolFree( pPool, p );
 	}
 
 size_t CSmallBlockHeap::GetSize( void *p )
@@ -1014,6 +1245,28 @@ size_t CSmallBlockHeap::GetSize( void *p )
 
 void CSmallBlockHeap::DumpStats( FILE *pFile )
 {
+	// Thread cache totals. Reads other threads' counters unlocked, good enough for stats.
+	// Blocks sitting in a thread's cache are free, the pool counts them as allocated.
+	uint64 nHits[NUM_POOLS] = { 0 };
+	uint64 nMisses[NUM_POOLS] = { 0 };
+	uint64 nReturns[NUM_POOLS] = { 0 };
+	int nCached[NUM_POOLS] = { 0 };
+	int nThreads = 0;
+	{
+		AUTO_LOCK( m_ThreadCacheMutex );
+		for ( SmallBlockThreadCache_t *pCache = m_pThreadCaches; pCache; pCache = pCache->m_pNext )
+		{
+			for ( int i = 0; i < NUM_POOLS; i++ )
+			{
+				nHits[i] += pCache->m_nHits[i];
+				nMisses[i] += pCache->m_nMisses[i];
+				nReturns[i] += pCache->m_nReturns[i];
+				nCached[i] += pCache->m_Bins[i].m_nLoaded + ( pCache->m_Bins[i].m_pSpare ? m_Pools[i].GetMagazineSize() : 0 );
+			}
+			nThreads++;
+		}
+	}
+
 	bool bSpew = true;
 
 	if ( pFile )
@@ -1024,14 +1277,39 @@ void CSmallBlockHeap::DumpStats( FILE *pFile )
 			fprintf( pFile, "Pool %i: Size: %llu Allocated: %i Free: %i Committed: %i CommittedSize: %i\n", 
 				i, 
 				(uint64)m_Pools[i].GetBlockSize(), 
-				m_Pools[i].CountAllocatedBlocks(), 
-				m_Pools[i].CountFreeBlocks(),
+				m_Pools[i].CountAllocatedBlocks() - nCached[i], 
+				m_Pools[i].CountFreeBlocks() + nCached[i],
 				m_Pools[i].CountCommittedBlocks(), 
 				m_Pools[i].GetCommittedSize() );
 		}
 		bSpew = false;
 	}
 
+	for ( int i = 0; i < NUM_POOLS; i++ )
+	{
+		uint64 nTotal = nHits[i] + nMisses[i];
+		float flHitRate = ( nTotal ) ? 100.0f * (float)nHits[i] / (float)nTotal : 0.0f;
+		if ( pFile )
+		{
+			fprintf( pFile, "Pool %i cache: Hits: %llu Misses: %llu HitRate: %.1f Returns: %llu Cached: %i Magazines: %i Contention: %i\n",
+				i, nHits[i], nMisses[i], flHitRate, nReturns[i], nCached[i], m_Pools[i].CountMagazines(), m_Pools[i].GetContentionCount() );
+		}
+		else
+		{
+			Msg( "Pool %i cache: hits:%llu misses:%llu (%.1f%% hit) returns:%llu cached:%i magazines:%i contention:%i\n",
+				i, nHits[i], nMisses[i], flHitRate, nReturns[i], nCached[i], m_Pools[i].CountMagazines(), m_Pools[i].GetContentionCount() );
+		}
+	}
+
+	if ( pFile )
+	{
+		fprintf( pFile, "Thread caches: %i\n", nThreads );
+	}
+	else
+	{
+		Msg( "Thread caches: %i\n", nThreads );
+	}
+
 	if ( bSpew )
 	{
 		unsigned bytesCommitted = 0;
@@ -1039,10 +1317,10 @@ void CSmallBlockHeap::DumpStats( FILE *pFile )
 
 		for ( int i = 0; i < NUM_POOLS; i++ )
 		{
-			Msg( "Pool %i: (size: %llu) blocks: allocated:%i free:%i committed:%i (committed size:%u kb)\n",i, (uint64)m_Pools[i].GetBlockSize(),m_Pools[i].CountAllocatedBlocks(), m_Pools[i].CountFreeBlocks(),m_Pools[i].CountCommittedBlocks(), m_Pools[i].GetCommittedSize() / 1024);
+			Msg( "Pool %i: (size: %llu) blocks: allocated:%i free:%i committed:%i (committed size:%u kb)\n",i, (uint64)m_Pools[i].GetBlockSize(),m_Pools[i].CountAllocatedBlocks() - nCached[i], m_Pools[i].CountFreeBlocks() + nCached[i],m_Pools[i].CountCommittedBlocks(), m_Pools[i].GetCommittedSize() / 1024);
 
 			bytesCommitted += m_Pools[i].GetCommittedSize();
-			bytesAllocated += ( m_Pools[i].CountAllocatedBlocks() * m_Pools[i].GetBlockSize() );
+			bytesAllocated += ( ( m_Pools[i].CountAllocatedBlocks() - nCached[i] ) * m_Pools[i].GetBlockSize() );
 		}
 
 		Msg( "Totals: Committed:%u kb Allocated:%u kb\n", bytesCommitted / 1024, bytesAllocated / 1024 );
@@ -1902,3 +2180,10 @@ void ReserveBottomMemory()
 }
 
 #endif // STEAM
+
+void MemStdThreadDetach()
+{
+#if !defined( STEAM ) && !defined( NO_MALLOC_OVERRIDE ) && !defined( _DEBUG ) && !defined( USE_MEM_DEBUG ) && defined( MEM_SBH_ENABLED )
+	s_StdMemAlloc.m_SmallBlockHeap.ReleaseThreadCache();
+#endif
+}
@@ -73,6 +73,12 @@
 #define MEM_SBH_ENABLED 1
 #endif
 
+// Per-thread magazine caches in front of the small block pools
+// #define NO_SBH_THREAD_CACHE	1
+#define SBH_MAGAZINE_BYTES		(4*1024)
+#define MIN_SBH_MAGAZINE		4
+#define MAX_SBH_MAGAZINE		64
+
 class ALIGN16 CSmallBlockPool
 {
 public:
@@ -87,7 +93,18 @@ public:
 	int CountAllocatedBlocks();
 	int Compact();
 
+	// Full magazines handed back by thread caches. A magazine is a chain of
+	// GetMagazineSize() blocks linked through their second pointer.
+	int GetMagazineSize()			{ return m_nMagazineSize; }
+	void *PopMagazine()				{ return m_Magazines.Pop(); }
+	void PushMagazine( void *p )	{ m_Magazines.Push( p ); }
+	int CountMagazines()			{ return m_Magazines.Count(); }
+	void FreeChain( void *p );
+
+	int GetContentionCount()		{ return m_nContention; }
+
 private:
+	void ReturnMagazines();
 
 	typedef TSLNodeBase_t FreeBlock_t;
 	class CFreeList : public CTSListBase
@@ -97,8 +114,10 @@ private:
 	};
 
 	CFreeList		m_FreeList;
+	CFreeList		m_Magazines;
 
 	unsigned		m_nBlockSize;
+	int				m_nMagazineSize;
 
 	CInterlockedPtr<byte> m_pNextAlloc;
 	byte *			m_pCommitLimit;
@@ -106,8 +125,12 @@ private:
 	byte *			m_pBase;
 
 	CThreadFastMutex m_CommitMutex;
+	CInterlockedInt	m_nContention;		// Lost bump pointer races and commit lock waits
 } ALIGN16_POST;
 
+struct SmallBlockThreadCache_t;
+
+
 
 class ALIGN16 CSmallBlockHeap
 {
@@ -121,15 +144,24 @@ public:
 	size_t GetSize( void *p );
 	void DumpStats( FILE *pFile = NULL );
 	int Compact();
+	void ReleaseThreadCache();
 
 private:
 	CSmallBlockPool *FindPool( size_t nBytes );
 	CSmallBlockPool *FindPool( void *p );
 
+	void *PoolAlloc( CSmallBlockPool *pPool );
+	void PoolFree( CSmallBlockPool *pPool, void *p );
+	SmallBlockThreadCache_t *GetThreadCache();
+
 	CSmallBlockPool *m_PoolLookup[MAX_SBH_BLOCK >> 2];
 	CSmallBlockPool m_Pools[NUM_POOLS];
 	byte *m_pBase;
 	byte *m_pLimit;
+
+	CTHREADLOCALPTR( SmallBlockThreadCache_t ) m_pThreadCache;
+	SmallBlockThreadCache_t *m_pThreadCaches;	// Every live cache, for stats
+	CThreadFastMutex m_ThreadCacheMutex;
 } ALIGN16_POST;
 
 #ifdef USE_PHYSICAL_SMALL_BLOCK_HEAP
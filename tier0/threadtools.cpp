@@ -90,8 +90,6 @@ ASSERT_INVARIANT(TT_INFINITE == INFINITE);
 // thread creation counter.
 // this is used to provide a unique threadid for each running thread in g_nThreadID ( a thread local variable ).
 
-const int MAX_THREAD_IDS = 128;
-
 static volatile bool s_bThreadIDAllocated[MAX_THREAD_IDS];
 
 #if defined(_PS3)
@@ -118,8 +116,63 @@ PLATFORM_INTERFACE void AllocateThreadID( void )
 	Error( "Out of thread ids. Decrease the number of threads or increase MAX_THREAD_IDS\n" );
 }
 
+extern void MemStdThreadDetach();
+
+#define MAX_THREAD_EXIT_FUNCS 16
+
+static CThreadFastMutex s_ThreadExitFuncMutex;
+static ThreadExitFunc_t s_ThreadExitFuncs[MAX_THREAD_EXIT_FUNCS];
+static int s_nThreadExitFuncs;
+
+PLATFORM_INTERFACE void ThreadAddExitFunc( ThreadExitFunc_t pfnExit )
+{
+	AUTO_LOCK( s_ThreadExitFuncMutex );
+	for ( int i = 0; i < s_nThreadExitFuncs; i++ )
+	{
+		if ( s_ThreadExitFuncs[i] == pfnExit )
+			return;
+	}
+	if ( s_nThreadExitFuncs == MAX_THREAD_EXIT_FUNCS )
+	{
+		Error( "Out of thread exit functions. Increase MAX_THREAD_EXIT_FUNCS\n" );
+	}
+	s_ThreadExitFuncs[s_nThreadExitFuncs++] = pfnExit;
+}
+
+PLATFORM_INTERFACE void ThreadRemoveExitFunc( ThreadExitFunc_t pfnExit )
+{
+	AUTO_LOCK( s_ThreadExitFuncMutex );
+	for ( int i = 0; i < s_nThreadExitFuncs; i++ )
+	{
+		if ( s_ThreadExitFuncs[i] == pfnExit )
+		{
+			s_ThreadExitFuncs[i] = s_ThreadExitFuncs[--s_nThreadExitFuncs];
+			return;
+		}
+	}
+}
+
+// Every thread tier0 starts (CThread, CreateSimpleThread) ends here, so this is
+// also where it gives back its small block heap cache and where modules free
+// their per-thread data. On Win32 DLL builds DllMain's DLL_THREAD_DETACH covers
+// the heap cache of threads tier0 didn't start.
 PLATFORM_INTERFACE void FreeThreadID( void )
 {
+	// Called without the lock held, exit functions may free memory or take locks of their own
+	ThreadExitFunc_t exitFuncs[MAX_THREAD_EXIT_FUNCS];
+	int nExitFuncs;
+	{
+		AUTO_LOCK( s_ThreadExitFuncMutex );
+		nExitFuncs = s_nThreadExitFuncs;
+		memcpy( exitFuncs, s_ThreadExitFuncs, nExitFuncs * sizeof( ThreadExitFunc_t ) );
+	}
+	for ( int i = 0; i < nExitFuncs; i++ )
+	{
+		(*exitFuncs[i])();
+	}
+
+	MemStdThreadDetach();
+
 	AUTO_LOCK( s_ThreadIDMutex );
 	int nThread = g_nThreadID;
 	if ( nThread )
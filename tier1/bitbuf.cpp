@@ -485,34 +485,31 @@ bool bf_write::WriteBits(const void *pInData, int nBits)
 	// X360TBD: Can't write dwords in WriteBits because they'll get swapped
 	if ( IsPC() && nBitsLeft >= 32 )
 	{
+		// Shift whole input dwords through a 64-bit accumulator so every output
+		// dword is stored exactly once instead of being masked in twice.
 		uint32 iBitsRight = (m_iCurBit & 31);
-        uint32 iBitsLeft = 32 - iBitsRight;
-        uint32 bitMaskLeft = g_BitWriteMasks[iBitsRight][32];
-        uint32 bitMaskRight = g_BitWriteMasks[0][iBitsRight];
+		uint32 *pData = &m_pData[m_iCurBit>>5];
+		uint64 accum = *pData & g_ExtraMasks[iBitsRight];
 
-        uint32 *pData = &m_pData[m_iCurBit>>5];
-
-		// Read dwords.
-		while(nBitsLeft >= 32)
+		while ( nBitsLeft >= 32 )
 		{
-            uint32 curData = *(uint32*)pOut;
+			uint32 curData;
+			memcpy( &curData, pOut, sizeof(curData) );
 			pOut += sizeof(uint32);
 
-			*pData &= bitMaskLeft;
-			*pData |= curData << iBitsRight;
-
-			pData++; 
-
-			if ( iBitsLeft < 32 )
-			{
-				curData >>= iBitsLeft;
-				*pData &= bitMaskRight;
-				*pData |= curData;
-			}
+			accum |= (uint64)curData << iBitsRight;
+			*pData++ = (uint32)accum;
+			accum >>= 32;
 
 			nBitsLeft -= 32;
 			m_iCurBit += 32;
 		}
+
+		// flush the bits left over from the last dword, keeping what follows them
+		if ( iBitsRight )
+		{
+			*pData = ( *pData & ~g_ExtraMasks[iBitsRight] ) | (uint32)accum;
+		}
 	}
 
 
@@ -536,7 +533,20 @@ bool bf_write::WriteBits(const void *pInData, int nBits)
 
 bool bf_write::WriteBitsFromBuffer( bf_read *pIn, int nBits )
 {
-	// This could be optimized a little by
+	// Both sides byte aligned, copy whole bytes at once
+	if ( IsPC() && nBits >= 32 && (m_iCurBit & 7) == 0 && (pIn->m_iCurBit & 7) == 0 &&
+		 m_iCurBit + nBits <= m_nDataBits && pIn->m_iCurBit + nBits <= pIn->m_nDataBits )
+	{
+		int numbytes = nBits >> 3;
+		Q_memcpy( (char*)m_pData + (m_iCurBit>>3), pIn->m_pData + (pIn->m_iCurBit>>3), numbytes );
+		m_iCurBit += numbytes << 3;
+		pIn->m_iCurBit += numbytes << 3;
+		nBits -= numbytes << 3;
+
+		if ( nBits == 0 )
+			return !IsOverflowed() && !pIn->IsOverflowed();
+	}
+
 	while ( nBits > 32 )
 	{
 		WriteUBitLong( pIn->ReadUBitLong( 32 ), 32 );
@@ -625,30 +635,36 @@ void bf_write::WriteBitCoord (const float f)
 	int		intval = (int)abs(f);
 	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
 
+	// Pack the flags, sign, integer and fraction in stream order and write them
+	// with one call. Same bits as writing each field on its own.
 
 	// Send the bit flags that indicate whether we have an integer part and/or a fraction part.
-	WriteOneBit( intval );
-	WriteOneBit( fractval );
+	unsigned int bits = ( intval ? 1 : 0 ) | ( fractval ? 2 : 0 );
+	int numbits = 2;
 
 	if ( intval || fractval )
 	{
 		// Send the sign bit
-		WriteOneBit( signbit );
+		bits |= signbit << 2;
+		numbits = 3;
 
 		// Send the integer if we have one.
 		if ( intval )
 		{
 			// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
-			intval--;
-			WriteUBitLong( (unsigned int)intval, COORD_INTEGER_BITS );
+			bits |= ( (unsigned int)(intval - 1) & ((1 << COORD_INTEGER_BITS) - 1) ) << numbits;
+			numbits += COORD_INTEGER_BITS;
 		}
 		
 		// Send the fraction if we have one
 		if ( fractval )
 		{
-			WriteUBitLong( (unsigned int)fractval, COORD_FRACTIONAL_BITS );
+			bits |= (unsigned int)fractval << numbits;
+			numbits += COORD_FRACTIONAL_BITS;
 		}
 	}
+
+	WriteUBitLong( bits, numbits );
 }
 
 void bf_write::WriteBitVec3Coord( const Vector& fa )
@@ -659,9 +675,8 @@ void bf_write::WriteBitVec3Coord( const Vector& fa )
 	yflag = (fa[1] >= COORD_RESOLUTION) || (fa[1] <= -COORD_RESOLUTION);
 	zflag = (fa[2] >= COORD_RESOLUTION) || (fa[2] <= -COORD_RESOLUTION);
 
-	WriteOneBit( xflag );
-	WriteOneBit( yflag );
-	WriteOneBit( zflag );
+	// all three flags in one write
+	WriteUBitLong( xflag | (yflag << 1) | (zflag << 2), 3 );
 
 	if ( xflag )
 		WriteBitCoord( fa[0] );
@@ -682,11 +697,8 @@ void bf_write::WriteBitNormal( float f )
 	if (fractval > NORMAL_DENOMINATOR)
 		fractval = NORMAL_DENOMINATOR;
 
-	// Send the sign bit
-	WriteOneBit( signbit );
-
-	// Send the fractional component
-	WriteUBitLong( fractval, NORMAL_FRACTIONAL_BITS );
+	// Send the sign bit followed by the fractional component
+	WriteUBitLong( signbit | (fractval << 1), 1 + NORMAL_FRACTIONAL_BITS );
 }
 
 void bf_write::WriteBitVec3Normal( const Vector& fa )
@@ -892,6 +904,16 @@ void bf_read::ReadBits(void *pOutData, int nBits)
 		nBitsLeft -= 8;
 	}
 
+	// byte aligned and fully inside the buffer, copy whole bytes at once
+	if ( IsPC() && nBitsLeft >= 32 && (m_iCurBit & 7) == 0 && nBitsLeft <= GetNumBitsLeft() )
+	{
+		int numbytes = nBitsLeft >> 3;
+		Q_memcpy( pOut, m_pData + (m_iCurBit>>3), numbytes );
+		pOut += numbytes;
+		nBitsLeft -= numbytes << 3;
+		m_iCurBit += numbytes << 3;
+	}
+
 	// X360TBD: Can't read dwords in ReadBits because they'll get swapped
 	if ( IsPC() )
 	{
@@ -1090,26 +1112,37 @@ float bf_read::ReadBitCoord (void)
 
 
 	// Read the required integer and fraction flags
-	intval = ReadOneBit();
-	fractval = ReadOneBit();
+	unsigned int flags = ReadUBitLong( 2 );
+	intval = flags & 1;
+	fractval = flags & 2;
 
 	// If we got either parse them, otherwise it's a zero.
-	if ( intval || fractval )
+	if ( flags )
 	{
-		// Read the sign bit
-		signbit = ReadOneBit();
+		// Read the sign bit, integer and fraction with one call
+		static const int numbits_table[3] =
+		{
+			1 + COORD_INTEGER_BITS,
+			1 + COORD_FRACTIONAL_BITS,
+			1 + COORD_INTEGER_BITS + COORD_FRACTIONAL_BITS
+		};
+		unsigned int bits = ReadUBitLong( numbits_table[ flags-1 ] );
+
+		signbit = bits & 1;
+		bits >>= 1;
 
 		// If there's an integer, read it in
 		if ( intval )
 		{
 			// Adjust the integers from [0..MAX_COORD_VALUE-1] to [1..MAX_COORD_VALUE]
-			intval = ReadUBitLong( COORD_INTEGER_BITS ) + 1;
+			intval = ( bits & ((1 << COORD_INTEGER_BITS) - 1) ) + 1;
+			bits >>= COORD_INTEGER_BITS;
 		}
 
 		// If there's a fraction, read it in
 		if ( fractval )
 		{
-			fractval = ReadUBitLong( COORD_FRACTIONAL_BITS );
+			fractval = bits;
 		}
 
 		// Calculate the correct floating point value
@@ -1276,9 +1309,10 @@ void bf_read::ReadBitVec3Coord( Vector& fa )
 	// the corresponding component will not be read and will be stack garbage.
 	fa.Init( 0, 0, 0 );
 
-	xflag = ReadOneBit();
-	yflag = ReadOneBit(); 
-	zflag = ReadOneBit();
+	unsigned int flags = ReadUBitLong( 3 );
+	xflag = flags & 1;
+	yflag = flags & 2;
+	zflag = flags & 4;
 
 	if ( xflag )
 		fa[0] = ReadBitCoord();
@@ -1290,11 +1324,10 @@ void bf_read::ReadBitVec3Coord( Vector& fa )
 
 float bf_read::ReadBitNormal (void)
 {
-	// Read the sign bit
-	int	signbit = ReadOneBit();
-
-	// Read the fractional part
-	unsigned int fractval = ReadUBitLong( NORMAL_FRACTIONAL_BITS );
+	// Read the sign bit and the fractional part
+	unsigned int bits = ReadUBitLong( 1 + NORMAL_FRACTIONAL_BITS );
+	int	signbit = bits & 1;
+	unsigned int fractval = bits >> 1;
 
 	// Calculate the correct floating point value
 	float value = (float)fractval * NORMAL_RESOLUTION;
@@ -15,6 +15,7 @@
 #endif
 
 #include "tier0/dbg.h"
+#include "tier0/threadtools.h"
 #include "memstack.h"
 #include "utlmap.h"
 #include "tier0/memdbgon.h"
@@ -295,3 +296,107 @@ void CMemoryStack::PrintContents()
 }
 
 //-----------------------------------------------------------------------------
+
+#define FRAME_ARENA_MAX_SIZE	( 2 * 1024 * 1024 )
+#define FRAME_ARENA_COMMIT_SIZE	( 64 * 1024 )
+
+struct FrameArena_t
+{
+	CMemoryStack	stack;
+	unsigned		nGeneration;
+};
+
+static volatile int32 s_FrameArenaGeneration[FRAME_ARENA_SCOPE_COUNT];
+static CTHREADLOCALPTR( FrameArena_t ) s_pFrameArenas[FRAME_ARENA_SCOPE_COUNT];
+static CInterlockedInt s_nFrameArenas;
+static CInterlockedInt s_bFrameArenaExitFuncAdded;
+
+// Frees the arenas of a thread that is exiting
+static void FrameArenaThreadExit()
+{
+	for ( int i = 0; i < FRAME_ARENA_SCOPE_COUNT; i++ )
+	{
+		FrameArena_t *pArena = s_pFrameArenas[i];
+		if ( pArena )
+		{
+			s_pFrameArenas[i] = NULL;
+			delete pArena;
+			--s_nFrameArenas;
+		}
+	}
+}
+
+// The exit function lives in this module, so it has to go before the module does
+class CFrameArenaExitFuncRemover
+{
+public:
+	~CFrameArenaExitFuncRemover()
+	{
+		if ( s_bFrameArenaExitFuncAdded )
+		{
+			ThreadRemoveExitFunc( &FrameArenaThreadExit );
+		}
+	}
+};
+static CFrameArenaExitFuncRemover s_FrameArenaExitFuncRemover;
+
+//-------------------------------------
+
+void *FrameArenaAlloc( FrameArenaScope_t scope, unsigned nBytes )
+{
+	Assert( scope >= 0 && scope < FRAME_ARENA_SCOPE_COUNT );
+
+	FrameArena_t *pArena = s_pFrameArenas[scope];
+	unsigned nGeneration = (unsigned)s_FrameArenaGeneration[scope];
+	if ( !pArena )
+	{
+		pArena = new FrameArena_t;
+		if ( !pArena->stack.Init( FRAME_ARENA_MAX_SIZE, FRAME_ARENA_COMMIT_SIZE ) )
+		{
+			delete pArena;
+			return NULL;
+		}
+		pArena->nGeneration = nGeneration;
+		s_pFrameArenas[scope] = pArena;
+		++s_nFrameArenas;
+
+		if ( s_bFrameArenaExitFuncAdded.AssignIf( 0, 1 ) )
+		{
+			ThreadAddExitFunc( &FrameArenaThreadExit );
+		}
+	}
+	else if ( pArena->nGeneration != nGeneration )
+	{
+		// First allocation on this thread since the frame boundary, so nothing
+		// handed out from here can still be in use
+		pArena->stack.FreeAll( false );
+		pArena->nGeneration = nGeneration;
+	}
+
+	return pArena->stack.Alloc( nBytes );
+}
+
+//-------------------------------------
+
+void FrameArenaEndFrame( FrameArenaScope_t scope )
+{
+	Assert( scope >= 0 && scope < FRAME_ARENA_SCOPE_COUNT );
+	ThreadInterlockedIncrement( &s_FrameArenaGeneration[scope] );
+}
+
+//-------------------------------------
+
+unsigned FrameArenaGeneration( FrameArenaScope_t scope )
+{
+	Assert( scope >= 0 && scope < FRAME_ARENA_SCOPE_COUNT );
+	return (unsigned)s_FrameArenaGeneration[scope];
+}
+
+//-------------------------------------
+
+int FrameArenaCount()
+{
+	return s_nFrameArenas;
+}
+
+//-----------------------------------------------------------------------------
@@ -0,0 +1,139 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit tests for picking the entity updates that go out in a snapshot
+//			that overflows the client's bandwidth.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier0/dbg.h"
+#include "unitlib/unitlib.h"
+#include "sv_snapshotpriority.h"
+
+DEFINE_TESTSUITE( SnapshotPriorityTestSuite )
+
+static void SetUpdate( EntityUpdatePriority_t &update, int nEntity, int nBits, float flPriority )
+{
+	update.nEntity = nEntity;
+	update.nBits = nBits;
+	update.flPriority = flPriority;
+}
+
+static void RelevanceTests()
+{
+	Shipping_Assert( SV_EntityUpdateRelevance( 0.0f, 1000.0f ) == 1.0f );
+	Shipping_Assert( SV_EntityUpdateRelevance( 1000.0f, 1000.0f ) == 0.5f );
+	Shipping_Assert( SV_EntityUpdateRelevance( 100.0f, 1000.0f ) > SV_EntityUpdateRelevance( 200.0f, 1000.0f ) );
+}
+
+static void OverflowOrderTests()
+{
+	CEntityStaleness staleness;
+	CBitVec<MAX_EDICTS> deferFlags;
+
+	// Five 100 bit updates and room for two, handed over far to near
+	EntityUpdatePriority_t updates[5];
+	SetUpdate( updates[0], 20, 100, SV_EntityUpdateRelevance( 4000.0f, 1000.0f ) );
+	SetUpdate( updates[1], 21, 100, SV_EntityUpdateRelevance( 3000.0f, 1000.0f ) );
+	SetUpdate( updates[2], 22, 100, SV_EntityUpdateRelevance( 2000.0f, 1000.0f ) );
+	SetUpdate( updates[3], 23, 100, SV_EntityUpdateRelevance( 1000.0f, 1000.0f ) );
+	SetUpdate( updates[4], 24, 100, SV_EntityUpdateRelevance( 0.0f, 1000.0f ) );
+
+	staleness.BeginSnapshot();
+	staleness.Save();
+	SV_PrioritizeEntityUpdates( updates, 5, 250, staleness.Base(), deferFlags );
+
+	// Best first, the two nearest go out
+	Shipping_Assert( updates[0].nEntity == 24 && updates[1].nEntity == 23 && updates[4].nEntity == 20 );
+	Shipping_Assert( !deferFlags.IsBitSet( 24 ) && !deferFlags.IsBitSet( 23 ) );
+	Shipping_Assert( deferFlags.IsBitSet( 22 ) && deferFlags.IsBitSet( 21 ) && deferFlags.IsBitSet( 20 ) );
+	Shipping_Assert( staleness[24] == 0 && staleness[23] == 0 );
+	Shipping_Assert( staleness[22] == 1 && staleness[21] == 1 && staleness[20] == 1 );
+
+	// Equal priorities go out lowest entity first, whatever order they came in
+	SetUpdate( updates[0], 33, 100, 0.5f );
+	SetUpdate( updates[1], 31, 100, 0.5f );
+	SetUpdate( updates[2], 32, 100, 0.5f );
+	SV_PrioritizeEntityUpdates( updates, 3, 250, staleness.Base(), deferFlags );
+	Shipping_Assert( updates[0].nEntity == 31 && updates[1].nEntity == 32 && updates[2].nEntity == 33 );
+	Shipping_Assert( deferFlags.IsBitSet( 33 ) && !deferFlags.IsBitSet( 31 ) && !deferFlags.IsBitSet( 32 ) );
+
+	// An update too big for what's left doesn't stop smaller ones behind it
+	SetUpdate( updates[0], 40, 100, 1.0f );
+	SetUpdate( updates[1], 41, 200, 0.9f );
+	SetUpdate( updates[2], 42, 100, 0.1f );
+	SV_PrioritizeEntityUpdates( updates, 3, 250, staleness.Base(), deferFlags );
+	Shipping_Assert( !deferFlags.IsBitSet( 40 ) && deferFlags.IsBitSet( 41 ) && !deferFlags.IsBitSet( 42 ) );
+}
+
+static void StalenessTests()
+{
+	CEntityStaleness staleness;
+	CBitVec<MAX_EDICTS> deferFlags;
+
+	// A far entity that loses to a near one gets boosted until it wins
+	int nSnapshot;
+	for ( nSnapshot = 0; nSnapshot < 10; nSnapshot++ )
+	{
+		EntityUpdatePriority_t updates[2];
+		SetUpdate( updates[0], 50, 100, SV_EntityUpdateRelevance( 0.0f, 1000.0f ) );
+		SetUpdate( updates[1], 51, 100, SV_EntityUpdateRelevance( 3000.0f, 1000.0f ) );
+
+		staleness.BeginSnapshot();
+		staleness.Save();
+		SV_PrioritizeEntityUpdates( updates, 2, 150, staleness.Base(), deferFlags );
+		if ( !deferFlags.IsBitSet( 51 ) )
+			break;
+
+		Shipping_Assert( staleness[51] == nSnapshot + 1 );
+	}
+
+	// 0.25 * ( 1 + 3 ) ties with 1.0 and the lower index wins, so it takes one more
+	Shipping_Assert( nSnapshot == 4 );
+	Shipping_Assert( staleness[51] == 0 && staleness[50] == 1 );
+}
+
+static void RevertTests()
+{
+	CEntityStaleness staleness;
+	CBitVec<MAX_EDICTS> deferFlags;
+
+	staleness.Base()[3] = 2;
+	staleness.Base()[7] = 5;
+
+	EntityUpdatePriority_t updates[4];
+	SetUpdate( updates[0], 7, 100, 6.0f );
+	SetUpdate( updates[1], 3, 100, 3.0f );
+	SetUpdate( updates[2], 9, 100, 1.0f );
+	SetUpdate( updates[3], 12, 100, 0.5f );
+
+	staleness.BeginSnapshot();
+	staleness.Save();
+	SV_FillEntityUpdateBudget( updates, 4, 250, staleness.Base(), deferFlags );
+	Shipping_Assert( staleness[7] == 0 && staleness[3] == 0 && staleness[9] == 1 && staleness[12] == 1 );
+
+	// The overflowed snapshot is rewritten, which must see the counts it started from
+	staleness.Revert();
+	Shipping_Assert( staleness[3] == 2 && staleness[7] == 5 && staleness[9] == 0 && staleness[12] == 0 );
+
+	CBitVec<MAX_EDICTS> rewriteFlags;
+	staleness.Save();
+	SV_FillEntityUpdateBudget( updates, 4, 250, staleness.Base(), rewriteFlags );
+	Shipping_Assert( staleness[7] == 0 && staleness[3] == 0 && staleness[9] == 1 && staleness[12] == 1 );
+	Shipping_Assert( rewriteFlags == deferFlags );
+
+	// A snapshot that never aged anything has nothing to put back
+	staleness.BeginSnapshot();
+	staleness.Revert();
+	Shipping_Assert( staleness[9] == 1 && staleness[12] == 1 );
+}
+
+DEFINE_TESTCASE( SnapshotPriorityTest, SnapshotPriorityTestSuite )
+{
+	Msg( "Running snapshot priority tests\n" );
+
+	RelevanceTests();
+	OverflowOrderTests();
+	StalenessTests();
+	RevertTests();
+}
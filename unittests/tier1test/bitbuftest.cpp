@@ -0,0 +1,650 @@
+//========= Copyright Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Unit tests and throughput comparison for the bf_write / bf_read
+//			fast paths against the original dword based bit I/O.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "unitlib/unitlib.h"
+#include "tier1/bitbuf.h"
+#include "coordsize.h"
+#include "mathlib/vector.h"
+
+DEFINE_TESTSUITE( BitBufTestSuite )
+
+//-----------------------------------------------------------------------------
+// The pre-change bf_write / bf_read code paths, copied unchanged, kept here as
+// the reference for the wire format and as the baseline for the throughput
+// numbers. Only the error handler plumbing is left out.
+//-----------------------------------------------------------------------------
+extern uint32 g_LittleBits[32];
+extern uint32 g_BitWriteMasks[32][33];
+extern uint32 g_ExtraMasks[33];
+
+class CRefBitWriter
+{
+public:
+	CRefBitWriter( uint32 *pData, int nBytes ) : m_pData( pData ), m_nDataBits( nBytes << 3 ), m_iCurBit( 0 ), m_bOverflow( false ) {}
+
+	void WriteUBitLong( unsigned int curData, int numbits )
+	{
+		// the tests lead in with zero bit writes, which the original never saw
+		if ( numbits == 0 )
+			return;
+
+		if ( m_nDataBits - m_iCurBit < numbits )
+		{
+			m_iCurBit = m_nDataBits;
+			m_bOverflow = true;
+			return;
+		}
+
+		int iCurBitMasked = m_iCurBit & 31;
+		int iDWord = m_iCurBit >> 5;
+		m_iCurBit += numbits;
+
+		uint32 * RESTRICT pOut = &m_pData[iDWord];
+
+		// Rotate data into dword alignment
+		curData = (curData << iCurBitMasked) | (curData >> (32 - iCurBitMasked));
+
+		// Calculate bitmasks for first and second word
+		unsigned int temp = 1 << (numbits-1);
+		unsigned int mask1 = (temp*2-1) << iCurBitMasked;
+		unsigned int mask2 = (temp-1) >> (31 - iCurBitMasked);
+
+		// Only look beyond current word if necessary (avoid access violation)
+		int i = mask2 & 1;
+		uint32 dword1 = LoadLittleDWord( pOut, 0 );
+		uint32 dword2 = LoadLittleDWord( pOut, i );
+
+		// Drop bits into place
+		dword1 ^= ( mask1 & ( curData ^ dword1 ) );
+		dword2 ^= ( mask2 & ( curData ^ dword2 ) );
+
+		// Note reversed order of writes so that dword1 wins if mask2 == 0 && i == 0
+		StoreLittleDWord( pOut, i, dword2 );
+		StoreLittleDWord( pOut, 0, dword1 );
+	}
+
+	void WriteOneBit( int nValue )
+	{
+		if ( m_iCurBit >= m_nDataBits )
+		{
+			m_bOverflow = true;
+			return;
+		}
+
+		if ( nValue )
+			m_pData[m_iCurBit >> 5] |= g_LittleBits[m_iCurBit & 31];
+		else
+			m_pData[m_iCurBit >> 5] &= ~g_LittleBits[m_iCurBit & 31];
+
+		++m_iCurBit;
+	}
+
+	bool WriteBits( const void *pInData, int nBits )
+	{
+		unsigned char *pOut = (unsigned char*)pInData;
+		int nBitsLeft = nBits;
+
+		// Bounds checking..
+		if ( (m_iCurBit+nBits) > m_nDataBits )
+		{
+			m_bOverflow = true;
+			return false;
+		}
+
+		// Align output to dword boundary
+		while (((uintp)pOut & 3) != 0 && nBitsLeft >= 8)
+		{
+			WriteUBitLong( *pOut, 8 );
+			++pOut;
+			nBitsLeft -= 8;
+		}
+
+		if ( IsPC() && (nBitsLeft >= 32) && (m_iCurBit & 7) == 0 )
+		{
+			// current bit is byte aligned, do block copy
+			int numbytes = nBitsLeft >> 3;
+			int numbits = numbytes << 3;
+
+			Q_memcpy( (char*)m_pData+(m_iCurBit>>3), pOut, numbytes );
+			pOut += numbytes;
+			nBitsLeft -= numbits;
+			m_iCurBit += numbits;
+		}
+
+		if ( IsPC() && nBitsLeft >= 32 )
+		{
+			uint32 iBitsRight = (m_iCurBit & 31);
+			uint32 iBitsLeft = 32 - iBitsRight;
+			uint32 bitMaskLeft = g_BitWriteMasks[iBitsRight][32];
+			uint32 bitMaskRight = g_BitWriteMasks[0][iBitsRight];
+
+			uint32 *pData = &m_pData[m_iCurBit>>5];
+
+			// Read dwords.
+			while(nBitsLeft >= 32)
+			{
+				uint32 curData = *(uint32*)pOut;
+				pOut += sizeof(uint32);
+
+				*pData &= bitMaskLeft;
+				*pData |= curData << iBitsRight;
+
+				pData++;
+
+				if ( iBitsLeft < 32 )
+				{
+					curData >>= iBitsLeft;
+					*pData &= bitMaskRight;
+					*pData |= curData;
+				}
+
+				nBitsLeft -= 32;
+				m_iCurBit += 32;
+			}
+		}
+
+		// write remaining bytes
+		while ( nBitsLeft >= 8 )
+		{
+			WriteUBitLong( *pOut, 8 );
+			++pOut;
+			nBitsLeft -= 8;
+		}
+
+		// write remaining bits
+		if ( nBitsLeft )
+		{
+			WriteUBitLong( *pOut, nBitsLeft );
+		}
+
+		return !m_bOverflow;
+	}
+
+	void WriteBitCoord( const float f )
+	{
+		int		signbit = (f <= -COORD_RESOLUTION);
+		int		intval = (int)abs(f);
+		int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
+
+		// Send the bit flags that indicate whether we have an integer part and/or a fraction part.
+		WriteOneBit( intval );
+		WriteOneBit( fractval );
+
+		if ( intval || fractval )
+		{
+			// Send the sign bit
+			WriteOneBit( signbit );
+
+			// Send the integer if we have one.
+			if ( intval )
+			{
+				// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
+				intval--;
+				WriteUBitLong( (unsigned int)intval, COORD_INTEGER_BITS );
+			}
+
+			// Send the fraction if we have one
+			if ( fractval )
+			{
+				WriteUBitLong( (unsigned int)fractval, COORD_FRACTIONAL_BITS );
+			}
+		}
+	}
+
+	void WriteBitVec3Coord( const Vector& fa )
+	{
+		int		xflag, yflag, zflag;
+
+		xflag = (fa[0] >= COORD_RESOLUTION) || (fa[0] <= -COORD_RESOLUTION);
+		yflag = (fa[1] >= COORD_RESOLUTION) || (fa[1] <= -COORD_RESOLUTION);
+		zflag = (fa[2] >= COORD_RESOLUTION) || (fa[2] <= -COORD_RESOLUTION);
+
+		WriteOneBit( xflag );
+		WriteOneBit( yflag );
+		WriteOneBit( zflag );
+
+		if ( xflag )
+			WriteBitCoord( fa[0] );
+		if ( yflag )
+			WriteBitCoord( fa[1] );
+		if ( zflag )
+			WriteBitCoord( fa[2] );
+	}
+
+	void WriteBitNormal( float f )
+	{
+		int	signbit = (f <= -NORMAL_RESOLUTION);
+
+		// NOTE: Since +/-1 are valid values for a normal, I'm going to encode that as all ones
+		unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+
+		// clamp..
+		if (fractval > NORMAL_DENOMINATOR)
+			fractval = NORMAL_DENOMINATOR;
+
+		// Send the sign bit
+		WriteOneBit( signbit );
+
+		// Send the fractional component
+		WriteUBitLong( fractval, NORMAL_FRACTIONAL_BITS );
+	}
+
+	int GetNumBitsWritten() const { return m_iCurBit; }
+
+private:
+	uint32	*m_pData;
+	int		m_nDataBits;
+	int		m_iCurBit;
+	bool	m_bOverflow;
+};
+
+class CRefBitReader
+{
+public:
+	CRefBitReader( const uint32 *pData, int nBytes ) : m_pData( pData ), m_nDataBits( nBytes << 3 ), m_iCurBit( 0 ) {}
+
+	unsigned int ReadUBitLong( int numbits )
+	{
+		if ( m_nDataBits - m_iCurBit < numbits )
+		{
+			m_iCurBit = m_nDataBits;
+			return 0;
+		}
+
+		unsigned int iStartBit = m_iCurBit & 31u;
+		int iLastBit = m_iCurBit + numbits - 1;
+		unsigned int iWordOffset1 = m_iCurBit >> 5;
+		unsigned int iWordOffset2 = iLastBit >> 5;
+		m_iCurBit += numbits;
+
+		unsigned int bitmask = g_ExtraMasks[numbits];
+
+		unsigned int dw1 = LoadLittleDWord( (uint32* RESTRICT)m_pData, iWordOffset1 ) >> iStartBit;
+		unsigned int dw2 = LoadLittleDWord( (uint32* RESTRICT)m_pData, iWordOffset2 ) << (32 - iStartBit);
+
+		return (dw1 | dw2) & bitmask;
+	}
+
+private:
+	const uint32	*m_pData;
+	int				m_nDataBits;
+	int				m_iCurBit;
+};
+
+//-----------------------------------------------------------------------------
+// Deterministic value stream so runs are repeatable
+//-----------------------------------------------------------------------------
+class CBitBufTestRandom
+{
+public:
+	CBitBufTestRandom( uint32 nSeed ) : m_nState( nSeed ) {}
+
+	uint32 Next()
+	{
+		m_nState = m_nState * 1664525u + 1013904223u;
+		return m_nState;
+	}
+
+	// 1..32 bits, weighted toward the small fields typical for sendprops
+	int NextNumBits()
+	{
+		uint32 n = Next() >> 24;
+		return ( n < 192 ) ? (int)( 1 + ( n % 16 ) ) : (int)( 1 + ( n % 32 ) );
+	}
+
+private:
+	uint32 m_nState;
+};
+
+enum
+{
+	BITBUF_TEST_BYTES = 64 * 1024,
+	BITBUF_TEST_VALUES = 16 * 1024,
+};
+
+static uint32 s_NewData[BITBUF_TEST_BYTES / 4];
+static uint32 s_RefData[BITBUF_TEST_BYTES / 4];
+static uint32 s_Values[BITBUF_TEST_VALUES];
+static int s_NumBits[BITBUF_TEST_VALUES];
+static float s_Coords[BITBUF_TEST_VALUES];
+
+static void FillTestValues()
+{
+	CBitBufTestRandom random( 0x5EED );
+	for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+	{
+		s_NumBits[i] = random.NextNumBits();
+		s_Values[i] = random.Next() & ( s_NumBits[i] == 32 ? ~0u : ( (1u << s_NumBits[i]) - 1 ) );
+
+		// mix of zero, integral and fractional coords over the full range
+		int nCoord = (int)( random.Next() % ( 2 * MAX_COORD_INTEGER ) ) - MAX_COORD_INTEGER;
+		float flFraction = ( random.Next() & 3 ) ? ( random.Next() % COORD_DENOMINATOR ) * COORD_RESOLUTION : 0.0f;
+		s_Coords[i] = ( random.Next() & 7 ) ? nCoord + flFraction : 0.0f;
+	}
+}
+
+static void ClearTestBuffers()
+{
+	memset( s_NewData, 0xCD, sizeof( s_NewData ) );
+	memset( s_RefData, 0xCD, sizeof( s_RefData ) );
+}
+
+//-----------------------------------------------------------------------------
+// Wire format must match the reference bit for bit
+//-----------------------------------------------------------------------------
+static void UBitLongTests()
+{
+	ClearTestBuffers();
+
+	bf_write buf( "UBitLongTests", s_NewData, sizeof( s_NewData ) );
+	CRefBitWriter ref( s_RefData, sizeof( s_RefData ) );
+
+	for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+	{
+		buf.WriteUBitLong( s_Values[i], s_NumBits[i] );
+		ref.WriteUBitLong( s_Values[i], s_NumBits[i] );
+	}
+
+	Shipping_Assert( !buf.IsOverflowed() );
+	Shipping_Assert( buf.GetNumBitsWritten() == ref.GetNumBitsWritten() );
+	Shipping_Assert( memcmp( s_NewData, s_RefData, sizeof( s_NewData ) ) == 0 );
+
+	bf_read read( "UBitLongTests", s_NewData, buf.GetNumBytesWritten(), buf.GetNumBitsWritten() );
+	CRefBitReader refRead( s_RefData, sizeof( s_RefData ) );
+	for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+	{
+		unsigned int nValue = read.ReadUBitLong( s_NumBits[i] );
+		Shipping_Assert( nValue == s_Values[i] );
+		Shipping_Assert( nValue == refRead.ReadUBitLong( s_NumBits[i] ) );
+	}
+	Shipping_Assert( !read.IsOverflowed() );
+	Shipping_Assert( read.GetNumBitsLeft() == 0 );
+}
+
+static void BitCoordTests()
+{
+	ClearTestBuffers();
+
+	bf_write buf( "BitCoordTests", s_NewData, sizeof( s_NewData ) );
+	CRefBitWriter ref( s_RefData, sizeof( s_RefData ) );
+
+	for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+	{
+		buf.WriteBitCoord( s_Coords[i] );
+		ref.WriteBitCoord( s_Coords[i] );
+	}
+
+	Shipping_Assert( buf.GetNumBitsWritten() == ref.GetNumBitsWritten() );
+	Shipping_Assert( memcmp( s_NewData, s_RefData, sizeof( s_NewData ) ) == 0 );
+
+	bf_read read( "BitCoordTests", s_NewData, buf.GetNumBytesWritten(), buf.GetNumBitsWritten() );
+	for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+	{
+		float flCoord = read.ReadBitCoord();
+		Shipping_Assert( fabs( flCoord - s_Coords[i] ) <= COORD_RESOLUTION );
+	}
+	Shipping_Assert( read.GetNumBitsLeft() == 0 );
+
+	// vectors and normals pack their flags and fields the same way
+	ClearTestBuffers();
+
+	bf_write vecBuf( "BitCoordTests", s_NewData, sizeof( s_NewData ) );
+	CRefBitWriter vecRef( s_RefData, sizeof( s_RefData ) );
+
+	for ( int i = 0; i + 2 < BITBUF_TEST_VALUES; i += 3 )
+	{
+		Vector vec( s_Coords[i], s_Coords[i+1], s_Coords[i+2] );
+		vecBuf.WriteBitVec3Coord( vec );
+		vecRef.WriteBitVec3Coord( vec );
+
+		float flNormal = s_Coords[i] / MAX_COORD_INTEGER;
+		vecBuf.WriteBitNormal( flNormal );
+		vecRef.WriteBitNormal( flNormal );
+	}
+
+	Shipping_Assert( vecBuf.GetNumBitsWritten() == vecRef.GetNumBitsWritten() );
+	Shipping_Assert( memcmp( s_NewData, s_RefData, sizeof( s_NewData ) ) == 0 );
+
+	bf_read vecRead( "BitCoordTests", s_NewData, vecBuf.GetNumBytesWritten(), vecBuf.GetNumBitsWritten() );
+	for ( int i = 0; i + 2 < BITBUF_TEST_VALUES; i += 3 )
+	{
+		Vector vec;
+		vecRead.ReadBitVec3Coord( vec );
+		Shipping_Assert( fabs( vec.x - s_Coords[i] ) <= COORD_RESOLUTION );
+		Shipping_Assert( fabs( vec.y - s_Coords[i+1] ) <= COORD_RESOLUTION );
+		Shipping_Assert( fabs( vec.z - s_Coords[i+2] ) <= COORD_RESOLUTION );
+
+		float flNormal = vecRead.ReadBitNormal();
+		Shipping_Assert( fabs( flNormal - s_Coords[i] / MAX_COORD_INTEGER ) <= 2.0f * NORMAL_RESOLUTION );
+	}
+	Shipping_Assert( vecRead.GetNumBitsLeft() == 0 );
+}
+
+static void BulkBitsTests()
+{
+	unsigned char source[1024];
+	unsigned char dest[1024 + 4];
+	for ( int i = 0; i < (int)sizeof( source ); ++i )
+	{
+		source[i] = (unsigned char)( i * 37 + 11 );
+	}
+
+	// every destination bit offset, every source misalignment, lengths around the dword paths
+	for ( int nStartBit = 0; nStartBit < 64; ++nStartBit )
+	{
+		for ( int nSourceOffset = 0; nSourceOffset < 4; ++nSourceOffset )
+		{
+			const int nBits = 8 * 300 + nStartBit * 3 + nSourceOffset;
+
+			ClearTestBuffers();
+
+			bf_write buf( "BulkBitsTests", s_NewData, sizeof( s_NewData ) );
+			CRefBitWriter ref( s_RefData, sizeof( s_RefData ) );
+
+			buf.WriteUBitLong( 0x2AAAAAAA >> ( 31 - ( nStartBit & 31 ) ), nStartBit & 31 );
+			ref.WriteUBitLong( 0x2AAAAAAA >> ( 31 - ( nStartBit & 31 ) ), nStartBit & 31 );
+			if ( nStartBit >= 32 )
+			{
+				buf.WriteUBitLong( 0x12345678, 32 );
+				ref.WriteUBitLong( 0x12345678, 32 );
+			}
+
+			buf.WriteBits( source + nSourceOffset, nBits );
+			ref.WriteBits( source + nSourceOffset, nBits );
+
+			// trailing value makes sure the bits after the copy were left intact
+			buf.WriteUBitLong( 0x5, 3 );
+			ref.WriteUBitLong( 0x5, 3 );
+
+			Shipping_Assert( buf.GetNumBitsWritten() == ref.GetNumBitsWritten() );
+			Shipping_Assert( memcmp( s_NewData, s_RefData, sizeof( s_NewData ) ) == 0 );
+
+			// read back through the bulk path and the buffer to buffer copy
+			bf_read read( "BulkBitsTests", s_NewData, sizeof( s_NewData ), buf.GetNumBitsWritten() );
+			read.Seek( nStartBit );
+
+			memset( dest, 0, sizeof( dest ) );
+			read.ReadBits( dest + nSourceOffset, nBits );
+			Shipping_Assert( memcmp( dest + nSourceOffset, source + nSourceOffset, nBits >> 3 ) == 0 );
+			Shipping_Assert( read.ReadUBitLong( 3 ) == 0x5 );
+
+			uint32 copy[512];
+			bf_write copyBuf( "BulkBitsTests", copy, sizeof( copy ) );
+			copyBuf.WriteUBitLong( 0, nStartBit & 7 );
+			read.Seek( nStartBit );
+			copyBuf.WriteBitsFromBuffer( &read, nBits + 3 );
+
+			bf_read copyRead( "BulkBitsTests", copy, sizeof( copy ), copyBuf.GetNumBitsWritten() );
+			copyRead.Seek( nStartBit & 7 );
+			memset( dest, 0, sizeof( dest ) );
+			copyRead.ReadBits( dest, nBits );
+			Shipping_Assert( memcmp( dest, source + nSourceOffset, nBits >> 3 ) == 0 );
+			Shipping_Assert( copyRead.ReadUBitLong( 3 ) == 0x5 );
+		}
+	}
+}
+
+static void OverflowTests()
+{
+	uint32 data[4];
+	memset( data, 0, sizeof( data ) );
+	bf_write buf( "OverflowTests", data, sizeof( data ) );
+	buf.SetAssertOnOverflow( false );
+
+	for ( int i = 0; i < 3; ++i )
+	{
+		buf.WriteUBitLong( 0xFFFFFFFF, 32 );
+	}
+	buf.WriteUBitLong( 0x7FFFFFFF, 31 );
+	Shipping_Assert( !buf.IsOverflowed() );
+
+	// last dword takes the slow path, one more bit than fits must overflow
+	buf.WriteUBitLong( 0x3, 2 );
+	Shipping_Assert( buf.IsOverflowed() );
+
+	bf_read read( "OverflowTests", data, sizeof( data ) );
+	read.SetAssertOnOverflow( false );
+	read.Seek( 120 );
+	Shipping_Assert( read.ReadUBitLong( 8 ) == 0x7F );
+	Shipping_Assert( read.ReadUBitLong( 8 ) == 0 );
+	Shipping_Assert( read.IsOverflowed() );
+}
+
+//-----------------------------------------------------------------------------
+// Throughput of the reworked paths against the reference
+//-----------------------------------------------------------------------------
+#define BITBUF_BENCH_PASSES 200
+
+static void ReportThroughput( const char *pName, double flNewTime, double flRefTime, int nBits )
+{
+	double flMBits = (double)nBits * BITBUF_BENCH_PASSES / ( 1024.0 * 1024.0 );
+	Msg( "  %-16s new %8.1f Mbit/s   old %8.1f Mbit/s   (%.2fx)\n", pName,
+		flNewTime > 0.0 ? flMBits / flNewTime : 0.0,
+		flRefTime > 0.0 ? flMBits / flRefTime : 0.0,
+		flNewTime > 0.0 ? flRefTime / flNewTime : 0.0 );
+}
+
+static void ThroughputBenchmark()
+{
+	int nBits = 0;
+	double flStart, flNewTime, flRefTime;
+
+	// WriteUBitLong
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < BITBUF_BENCH_PASSES; ++nPass )
+	{
+		bf_write buf( s_NewData, sizeof( s_NewData ) );
+		for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+		{
+			buf.WriteUBitLong( s_Values[i], s_NumBits[i] );
+		}
+		nBits = buf.GetNumBitsWritten();
+	}
+	flNewTime = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < BITBUF_BENCH_PASSES; ++nPass )
+	{
+		CRefBitWriter ref( s_RefData, sizeof( s_RefData ) );
+		for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+		{
+			ref.WriteUBitLong( s_Values[i], s_NumBits[i] );
+		}
+	}
+	flRefTime = Plat_FloatTime() - flStart;
+	ReportThroughput( "WriteUBitLong", flNewTime, flRefTime, nBits );
+
+	// ReadUBitLong
+	uint32 nCheck = 0;
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < BITBUF_BENCH_PASSES; ++nPass )
+	{
+		bf_read read( s_NewData, sizeof( s_NewData ), nBits );
+		for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+		{
+			nCheck += read.ReadUBitLong( s_NumBits[i] );
+		}
+	}
+	flNewTime = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < BITBUF_BENCH_PASSES; ++nPass )
+	{
+		CRefBitReader read( s_RefData, sizeof( s_RefData ) );
+		for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+		{
+			nCheck -= read.ReadUBitLong( s_NumBits[i] );
+		}
+	}
+	flRefTime = Plat_FloatTime() - flStart;
+	Shipping_Assert( nCheck == 0 );
+	ReportThroughput( "ReadUBitLong", flNewTime, flRefTime, nBits );
+
+	// WriteBitCoord
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < BITBUF_BENCH_PASSES; ++nPass )
+	{
+		bf_write buf( s_NewData, sizeof( s_NewData ) );
+		for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+		{
+			buf.WriteBitCoord( s_Coords[i] );
+		}
+		nBits = buf.GetNumBitsWritten();
+	}
+	flNewTime = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < BITBUF_BENCH_PASSES; ++nPass )
+	{
+		CRefBitWriter ref( s_RefData, sizeof( s_RefData ) );
+		for ( int i = 0; i < BITBUF_TEST_VALUES; ++i )
+		{
+			ref.WriteBitCoord( s_Coords[i] );
+		}
+	}
+	flRefTime = Plat_FloatTime() - flStart;
+	ReportThroughput( "WriteBitCoord", flNewTime, flRefTime, nBits );
+
+	// WriteBits at an unaligned offset, like copying cached entity deltas
+	const int nCopyBits = ( sizeof( s_Values ) << 3 ) - 64;
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < BITBUF_BENCH_PASSES; ++nPass )
+	{
+		bf_write buf( s_NewData, sizeof( s_NewData ) );
+		buf.WriteUBitLong( 0, 13 );
+		buf.WriteBits( s_Values, nCopyBits );
+	}
+	flNewTime = Plat_FloatTime() - flStart;
+
+	flStart = Plat_FloatTime();
+	for ( int nPass = 0; nPass < BITBUF_BENCH_PASSES; ++nPass )
+	{
+		CRefBitWriter ref( s_RefData, sizeof( s_RefData ) );
+		ref.WriteUBitLong( 0, 13 );
+		ref.WriteBits( s_Values, nCopyBits );
+	}
+	flRefTime = Plat_FloatTime() - flStart;
+	ReportThroughput( "WriteBits", flNewTime, flRefTime, nCopyBits );
+}
+
+DEFINE_TESTCASE( BitBufTest, BitBufTestSuite )
+{
+	Msg( "Running bf_write/bf_read tests\n" );
+
+	FillTestValues();
+
+	UBitLongTests();
+	BitCoordTests();
+	BulkBitsTests();
+	OverflowTests();
+
+	Msg( "bf_write/bf_read throughput (%d passes):\n", BITBUF_BENCH_PASSES );
+	ThroughputBenchmark();
+}
@@ -0,0 +1,144 @@
+#include "tier0/dbg.h"
+#include "tier0/threadtools.h"
+#include "unitlib/unitlib.h"
+#include "tier1/utlvector.h"
+#include "tier1/memstack.h"
+
+DEFINE_TESTSUITE( FrameArenaTestSuite )
+
+typedef CUtlMemoryFrameArena< int, FRAME_ARENA_SERVER_TICK > CTestArenaMemory;
+typedef CUtlVector< int, CTestArenaMemory > CTestArenaVector;
+
+// Takes everything the arena has left, 64K at a time
+static int FillFrameArena()
+{
+	// A full arena asserts on some platforms before it returns NULL
+	bool bAssertsDisabled = AreAllAssertsDisabled();
+	SetAllAssertsDisabled( true );
+
+	int nBlocks = 0;
+	while ( FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, 64 * 1024 ) )
+	{
+		nBlocks++;
+	}
+	while ( FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, 16 ) )
+	{
+	}
+
+	SetAllAssertsDisabled( bAssertsDisabled );
+	return nBlocks;
+}
+
+static void ResetTests()
+{
+	FrameArenaEndFrame( FRAME_ARENA_SERVER_TICK );
+	unsigned nGeneration = FrameArenaGeneration( FRAME_ARENA_SERVER_TICK );
+
+	void *p1 = FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, 64 );
+	void *p2 = FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, 64 );
+	Shipping_Assert( p1 && p2 && p1 != p2 );
+
+	// The boundary only bumps the generation, the next alloc rewinds
+	FrameArenaEndFrame( FRAME_ARENA_SERVER_TICK );
+	Shipping_Assert( FrameArenaGeneration( FRAME_ARENA_SERVER_TICK ) == nGeneration + 1 );
+	void *p3 = FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, 64 );
+	Shipping_Assert( p3 == p1 );
+
+	// A full arena is usable again after the next boundary
+	Shipping_Assert( FillFrameArena() > 0 );
+	Shipping_Assert( !FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, 64 ) );
+	FrameArenaEndFrame( FRAME_ARENA_SERVER_TICK );
+	Shipping_Assert( FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, 64 ) == p1 );
+}
+
+static void OverflowTests()
+{
+	FrameArenaEndFrame( FRAME_ARENA_SERVER_TICK );
+
+	CTestArenaVector vec;
+	for ( int i = 0; i < 1000; i++ )
+	{
+		vec.AddToTail( i );
+	}
+
+	// Once the arena runs dry the vector keeps growing on the heap, contents intact
+	FillFrameArena();
+	for ( int i = 1000; i < 5000; i++ )
+	{
+		vec.AddToTail( i );
+	}
+	Shipping_Assert( vec.Count() == 5000 );
+	for ( int i = 0; i < vec.Count(); i++ )
+	{
+		Shipping_Assert( vec[i] == i );
+	}
+
+	// And heap memory is freed like any other
+	vec.Purge();
+	Shipping_Assert( vec.Count() == 0 );
+
+	CTestArenaMemory mem;
+	mem.EnsureCapacity( 16 );
+	Shipping_Assert( mem.IsOnHeap() && mem.NumAllocated() == 16 );
+}
+
+static void SwapTests()
+{
+	FrameArenaEndFrame( FRAME_ARENA_SERVER_TICK );
+
+	CTestArenaMemory arenaMem( 0, 16 );
+	Shipping_Assert( !arenaMem.IsOnHeap() );
+	arenaMem[0] = 1;
+
+	FillFrameArena();
+	CTestArenaMemory heapMem( 0, 32 );
+	Shipping_Assert( heapMem.IsOnHeap() );
+	heapMem[0] = 2;
+
+	int *pArena = arenaMem.Base();
+	int *pHeap = heapMem.Base();
+	arenaMem.Swap( heapMem );
+	Shipping_Assert( arenaMem.Base() == pHeap && arenaMem.IsOnHeap() && arenaMem.NumAllocated() == 32 && arenaMem[0] == 2 );
+	Shipping_Assert( heapMem.Base() == pArena && !heapMem.IsOnHeap() && heapMem.NumAllocated() == 16 && heapMem[0] == 1 );
+
+	// Vectors swap through their memory
+	CTestArenaVector a, b;
+	a.AddToTail( 10 );
+	b.AddToTail( 20 );
+	b.AddToTail( 30 );
+	a.Swap( b );
+	Shipping_Assert( a.Count() == 2 && a[0] == 20 && a[1] == 30 );
+	Shipping_Assert( b.Count() == 1 && b[0] == 10 );
+
+	FrameArenaEndFrame( FRAME_ARENA_SERVER_TICK );
+}
+
+static unsigned FrameArenaThread( void *pParam )
+{
+	*(void **)pParam = FrameArenaAlloc( FRAME_ARENA_SERVER_TICK, 64 );
+	return 0;
+}
+
+static void ThreadExitTests()
+{
+	int nArenas = FrameArenaCount();
+
+	// The thread gets its own arena and gives it back on the way out
+	void *pThreadAlloc = NULL;
+	ThreadHandle_t hThread = CreateSimpleThread( FrameArenaThread, &pThreadAlloc );
+	ThreadJoin( hThread );
+	ReleaseThreadHandle( hThread );
+
+	Shipping_Assert( pThreadAlloc != NULL );
+	Shipping_Assert( FrameArenaCount() == nArenas );
+}
+
+DEFINE_TESTCASE( FrameArenaTest, FrameArenaTestSuite )
+{
+	Msg( "Running frame arena tests\n" );
+
+	ResetTests();
+	OverflowTests();
+	SwapTests();
+	ThreadExitTests();
+}
@@ -149,6 +149,17 @@ public:
 		return m_JobAvailableEvent;
 	}
 
+	// For waiters that also look at other sources of work and may have set the event themselves
+	void ResetEventIfEmpty()
+	{
+		m_mutex.Lock();
+		if ( !m_nItems )
+		{
+			m_JobAvailableEvent.Reset();
+		}
+		m_mutex.Unlock();
+	}
+
 	void Flush()
 	{
 		// Only safe to call when system is suspended
@@ -176,6 +187,108 @@ private:
 
 } ALIGN16_POST;
 
+//-----------------------------------------------------------------------------
+// Lock free work stealing deque (Chase-Lev), one per worker and priority.
+// Only the owning worker may Push or Pop, and it works on the newest job;
+// any thread may Steal, which takes the oldest.
+//-----------------------------------------------------------------------------
+
+class ALIGN16 CJobDeque
+{
+public:
+	enum
+	{
+		CAPACITY = 1024,		// must be a power of 2
+	};
+
+	CJobDeque() :
+		m_iTop( 0 ),
+		m_iBottom( 0 )
+	{
+	}
+
+	int Count()
+	{
+		int nItems = m_iBottom - m_iTop;
+		return ( nItems > 0 ) ? nItems : 0;
+	}
+
+	// Owner only. Returns false if full, the caller should queue the job elsewhere
+	bool Push( CJob *pJob )
+	{
+		int32 iBottom = m_iBottom;
+		if ( iBottom - m_iTop >= CAPACITY )
+		{
+			return false;
+		}
+
+		pJob->AddRef();
+		m_pJobs[iBottom & ( CAPACITY - 1 )] = pJob;
+		ThreadMemoryBarrier();
+		m_iBottom = iBottom + 1;
+		return true;
+	}
+
+	// Owner only
+	bool Pop( CJob **ppJob )
+	{
+		int32 iBottom = m_iBottom - 1;
+
+		// Full fence, thieves must see the claim on the bottom slot before we read the top
+		ThreadInterlockedExchange( &m_iBottom, iBottom );
+
+		int32 iTop = m_iTop;
+		if ( iTop > iBottom )
+		{
+			m_iBottom = iTop;
+			return false;
+		}
+
+		CJob *pJob = m_pJobs[iBottom & ( CAPACITY - 1 )];
+		if ( iTop == iBottom )
+		{
+			// Last one, race any thief for it
+			bool bWon = ThreadInterlockedAssignIf( &m_iTop, iTop + 1, iTop );
+			m_iBottom = iTop + 1;
+			if ( !bWon )
+			{
+				return false;
+			}
+		}
+
+		*ppJob = pJob;
+		return true;
+	}
+
+	// Any thread
+	bool Steal( CJob **ppJob )
+	{
+		for (;;)
+		{
+			int32 iTop = m_iTop;
+			ThreadMemoryBarrier();
+			int32 iBottom = m_iBottom;
+			if ( iTop >= iBottom )
+			{
+				return false;
+			}
+
+			CJob *pJob = m_pJobs[iTop & ( CAPACITY - 1 )];
+			if ( ThreadInterlockedAssignIf( &m_iTop, iTop + 1, iTop ) )
+			{
+				*ppJob = pJob;
+				return true;
+			}
+		}
+	}
+
+private:
+	volatile int32		m_iTop;
+	volatile int32		m_iBottom;
+	CJob *				m_pJobs[CAPACITY];
+
+} ALIGN16_POST;
+
 //-----------------------------------------------------------------------------
 //
 // CThreadPool
@@ -264,6 +377,13 @@ private:
 	CJob *PeekJob();
 	CJob *GetDummyJob();
 
+	//-----------------------------------------------------
+	// Work stealing. iThief is the stealing worker, or -1
+	//-----------------------------------------------------
+	bool PushLocalJob( CJob *pJob );
+	bool StealJob( CJob **ppJob, JobPriority_t priority, int iThief, uint32 *pSeed );
+	int DrainLocalJobs( JobPriority_t priority, CUtlVector<CJob *> *pJobs );
+
 	//-----------------------------------------------------
 	// Thread functions
 	//-----------------------------------------------------
@@ -274,6 +394,8 @@ private:
 
 	CJobQueue				m_SharedQueue;
 	CInterlockedInt			m_nIdleThreads;
+	CInterlockedInt			m_nStealable;		// Jobs sitting in worker deques
+	CInterlockedInt			m_nStealThreads;	// Workers fully started, the ones thieves may look at
 	CUtlVector<CJobThread *> m_Threads;
 	CUtlVector<CThreadEvent *>		m_IdleEvents;
 
@@ -330,13 +452,16 @@ public:
 
 //-----------------------------------------------------------------------------
 
+static CTHREADLOCALPTR( CJobThread ) s_pCurrentJobThread;
+
 class CJobThread : public CWorkerThread
 {
 public:
 	CJobThread( CThreadPool *pOwner, int iThread ) : 
 		m_SharedQueue( pOwner->m_SharedQueue ),
 		m_pOwner( pOwner ),
-		m_iThread( iThread )
+		m_iThread( iThread ),
+		m_nStealSeed( 2463534242u + iThread * 0x9E3779B9u )
 	{
 	}
 
@@ -350,6 +475,16 @@ public:
 		return m_DirectQueue;
 	}
 
+	CJobDeque &AccessLocalDeque( JobPriority_t priority )
+	{
+		return m_LocalDeques[priority];
+	}
+
+	CThreadPool *GetOwner()
+	{
+		return m_pOwner;
+	}
+
 private:
 	unsigned Wait()
 	{
@@ -401,6 +536,38 @@ private:
 		return waitResult;
 	}
 
+	//-----------------------------------------------------
+	// Targeted jobs first. Then, per priority, our own newest job, the shared
+	// queue, and finally the oldest job of a random peer.
+	//-----------------------------------------------------
+	bool GetJob( CJob **ppJob )
+	{
+		if ( m_DirectQueue.Pop( ppJob ) )
+		{
+			return true;
+		}
+
+		for ( int iPriority = JP_HIGH; iPriority >= JP_LOW; --iPriority )
+		{
+			if ( m_LocalDeques[iPriority].Pop( ppJob ) )
+			{
+				m_pOwner->m_nStealable--;
+				return true;
+			}
+
+			if ( m_SharedQueue.Count( (JobPriority_t)iPriority ) && m_SharedQueue.Pop( ppJob ) )
+			{
+				return true;
+			}
+
+			if ( m_pOwner->StealJob( ppJob, (JobPriority_t)iPriority, m_iThread, &m_nStealSeed ) )
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
 	int Run()
 	{
 
@@ -411,6 +578,8 @@ private:
 
 		tmZone( TELEMETRY_LEVEL0, TMZF_NONE, "%s", __FUNCTION__ );
 
+		s_pCurrentJobThread = this;
+
 		m_pOwner->m_nIdleThreads++;
 		m_IdleEvent.Set();
 		while (!bExit && ( ( waitResult = Wait() ) != WAIT_FAILED ) )
@@ -459,13 +628,16 @@ private:
 				bool bTookJob = false;
 				do
 				{
-					if ( !m_DirectQueue.Pop( &pJob) )
+					if ( !GetJob( &pJob ) )
 					{
-						if ( !m_SharedQueue.Pop( &pJob ) )
+						// Nothing to process, return to wait state. Peers' deques share the
+						// shared queue's event, so only clear it if there's really nothing left.
+						m_SharedQueue.ResetEventIfEmpty();
+						if ( m_pOwner->m_nStealable > 0 )
 						{
-							// Nothing to process, return to wait state
-							break;
+							m_SharedQueue.GetEventHandle().Set();
 						}
+						break;
 					}
 					if ( !bTookJob )
 					{
@@ -486,6 +658,7 @@ private:
 		}
 		m_pOwner->m_nIdleThreads--;
 		m_IdleEvent.Reset();
+		s_pCurrentJobThread = NULL;
 		return 0;
 	}
 
@@ -494,6 +667,8 @@ private:
 	CThreadPool *		m_pOwner;
 	CThreadManualEvent	m_IdleEvent;
 	int					m_iThread;
+	CJobDeque			m_LocalDeques[JP_HIGH + 1];
+	uint32				m_nStealSeed;
 };
 
 //-----------------------------------------------------------------------------
@@ -509,6 +684,8 @@ IThreadPool *g_pThreadPool = &g_ThreadPool;
 
 CThreadPool::CThreadPool() :
 	m_nIdleThreads( 0 ),
+	m_nStealable( 0 ),
+	m_nStealThreads( 0 ),
 	m_nJobs( 0 ),
 	m_nSuspend( 0 )
 {
@@ -614,11 +791,13 @@ int CThreadPool::YieldWait( CThreadEvent **pEvents, int nEvents, bool bWaitAll,
 
 	int result;
 	CJob *pJob;
+	uint32 nStealSeed = ThreadGetCurrentId() | 1;
 	// Always wait for zero milliseconds initially, to let us process jobs on this thread.
 	timeout = 0;
 	while ( ( result = CThreadEvent::WaitForMultiple( nEvents, pEvents, bWaitAll, timeout ) ) == TW_TIMEOUT )
 	{
-		if ( !m_bExecOnThreadPoolThreadsOnly && m_SharedQueue.Pop( &pJob ) )
+		if ( !m_bExecOnThreadPoolThreadsOnly && ( m_SharedQueue.Pop( &pJob ) || StealJob( &pJob, JP_HIGH, -1, &nStealSeed ) ||
+			StealJob( &pJob, JP_NORMAL, -1, &nStealSeed ) || StealJob( &pJob, JP_LOW, -1, &nStealSeed ) ) )
 		{
 			ServiceJobAndRelease( pJob );
 			m_nJobs--;
@@ -725,6 +904,11 @@ void CThreadPool::InsertJobInQueue( CJob *pJob )
 		int iThread = pJob->GetServiceThread();
 		if ( iThread == -1 || !m_Threads.IsValidIndex( iThread ) )
 		{
+			// Jobs queued by our own workers stay with them, idle peers steal them
+			if ( PushLocalJob( pJob ) )
+			{
+				return;
+			}
 			pQueue = &m_SharedQueue;
 		}
 		else
@@ -825,6 +1009,32 @@ int CThreadPool::ExecuteToPriority( JobPriority_t iToPriority, JobFilter_t pfnFi
 
 		}
 
+		// Workers are suspended, so their deques can be emptied from here
+		CUtlVector<CJob *> localJobs;
+		DrainLocalJobs( (JobPriority_t)iCurPriority, &localJobs );
+		for ( i = 0; i < localJobs.Count(); i++ )
+		{
+			pJob = localJobs[i];
+			if ( pfnFilter && !(*pfnFilter)( pJob ) )
+			{
+				if ( pJob->CanExecute() )
+				{
+					jobsToPutBack.EnsureCapacity( nJobsTotal );
+					jobsToPutBack.AddToTail( pJob );
+				}
+				else
+				{
+					m_nJobs--;
+					pJob->Release(); // see above
+				}
+				continue;
+			}
+
+			ServiceJobAndRelease( pJob );
+			m_nJobs--;
+			nExecuted++;
+		}
+
 		while ( m_SharedQueue.Count( (JobPriority_t)iCurPriority ) )
 		{
 			m_SharedQueue.Pop( &pJob );
@@ -889,6 +1099,18 @@ int CThreadPool::AbortAll()
 
 	}
 
+	CUtlVector<CJob *> localJobs;
+	for ( int iPriority = JP_HIGH; iPriority >= JP_LOW; --iPriority )
+	{
+		DrainLocalJobs( (JobPriority_t)iPriority, &localJobs );
+	}
+	for ( int i = 0; i < localJobs.Count(); i++ )
+	{
+		localJobs[i]->Abort();
+		localJobs[i]->Release();
+		iAborted++;
+	}
+
 	m_nJobs = 0;
 
 	ResumeExecution();
@@ -996,6 +1218,7 @@ bool CThreadPool::Start( const ThreadPoolStartParams_t &startParams, const char
 #ifdef WIN32
 		ThreadSetPriority( (ThreadHandle_t)m_Threads[iThread]->GetThreadHandle(), priority );
 #endif
+		m_nStealThreads++;
 	}
 
 	Distribute( bDistribute, startParams.bUseAffinityTable ? (int *)startParams.iAffinityTable : NULL );
@@ -1105,6 +1328,22 @@ bool CThreadPool::Stop( int timeout )
 		{
 			ThreadSleep( 0 );
 		}
+	}
+
+	CUtlVector<CJob *> localJobs;
+	for ( int iPriority = JP_HIGH; iPriority >= JP_LOW; --iPriority )
+	{
+		DrainLocalJobs( (JobPriority_t)iPriority, &localJobs );
+	}
+	for ( int i = 0; i < localJobs.Count(); i++ )
+	{
+		localJobs[i]->Abort();
+		localJobs[i]->Release();
+	}
+
+	m_nStealThreads = 0;
+	for ( int i = 0; i < m_Threads.Count(); ++i )
+	{
 		delete m_Threads[i];
 	}
 
@@ -1117,6 +1356,90 @@ bool CThreadPool::Stop( int timeout )
 	return true;
 }
 
+//---------------------------------------------------------
+// Queues a job on the deque of the worker that's adding it
+//---------------------------------------------------------
+
+bool CThreadPool::PushLocalJob( CJob *pJob )
+{
+	CJobThread *pThread = s_pCurrentJobThread;
+	if ( !pThread || pThread->GetOwner() != this )
+	{
+		return false;
+	}
+
+	if ( !pThread->AccessLocalDeque( pJob->GetPriority() ).Push( pJob ) )
+	{
+		return false;
+	}
+
+	m_nStealable++;
+	if ( m_nIdleThreads > 0 )
+	{
+		// Idle workers sleep on the shared queue's event
+		m_SharedQueue.GetEventHandle().Set();
+	}
+	return true;
+}
+
+//---------------------------------------------------------
+// Takes the oldest job of the given priority from a random worker
+//---------------------------------------------------------
+
+bool CThreadPool::StealJob( CJob **ppJob, JobPriority_t priority, int iThief, uint32 *pSeed )
+{
+	int nThreads = m_nStealThreads;
+	if ( m_nStealable <= 0 || nThreads == 0 )
+	{
+		return false;
+	}
+
+	// xorshift32
+	uint32 nSeed = *pSeed;
+	nSeed ^= nSeed << 13;
+	nSeed ^= nSeed >> 17;
+	nSeed ^= nSeed << 5;
+	*pSeed = nSeed;
+
+	int iVictim = nSeed % nThreads;
+	for ( int i = 0; i < nThreads; i++ )
+	{
+		if ( iVictim != iThief && m_Threads[iVictim]->AccessLocalDeque( priority ).Steal( ppJob ) )
+		{
+			m_nStealable--;
+			return true;
+		}
+
+		if ( ++iVictim == nThreads )
+		{
+			iVictim = 0;
+		}
+	}
+	return false;
+}
+
+//---------------------------------------------------------
+// Empties every worker deque of one priority, only safe while the workers
+// can't touch them (suspended or stopped)
+//---------------------------------------------------------
+
+int CThreadPool::DrainLocalJobs( JobPriority_t priority, CUtlVector<CJob *> *pJobs )
+{
+	int nDrained = 0;
+	CJob *pJob;
+	for ( int i = 0; i < m_nStealThreads; i++ )
+	{
+		CJobDeque &deque = m_Threads[i]->AccessLocalDeque( priority );
+		while ( deque.Steal( &pJob ) )
+		{
+			m_nStealable--;
+			pJobs->AddToTail( pJob );
+			nDrained++;
+		}
+	}
+	return nDrained;
+}
+
 //---------------------------------------------------------
 
 CJob *CThreadPool::GetDummyJob()
@@ -1356,6 +1679,200 @@ void TestForcedExecute()
 	Msg( "TestForcedExecute DONE\n" );
 }
 
+//-----------------------------------------------------------------------------
+// Task graph: a diamond (A -> B, C -> D) whose middle tasks nest ParallelProcess
+//-----------------------------------------------------------------------------
+
+CInterlockedInt g_nTaskStep;
+int g_TaskSteps[4];
+int g_NestedItems[2][512];
+
+void NestedItem( int &item )
+{
+	item++;
+}
+
+void TaskA() { g_TaskSteps[0] = g_nTaskStep++; }
+void TaskB() { g_TaskSteps[1] = g_nTaskStep++; ParallelProcess( "TaskB", g_pTestThreadPool, g_NestedItems[0], ARRAYSIZE( g_NestedItems[0] ), &NestedItem ); }
+void TaskC() { g_TaskSteps[2] = g_nTaskStep++; ParallelProcess( "TaskC", g_pTestThreadPool, g_NestedItems[1], ARRAYSIZE( g_NestedItems[1] ), &NestedItem ); }
+void TaskD() { g_TaskSteps[3] = g_nTaskStep++; }
+
+void TestTaskGraph()
+{
+	Msg( "TestTaskGraph\n" );
+	for ( int nThreads = 0; nThreads <= 4; nThreads++ )
+	{
+		if ( nThreads )
+		{
+			ThreadPoolStartParams_t params;
+			params.nThreads = nThreads;
+			params.fDistribute = TRS_TRUE;
+			g_pTestThreadPool->Start( params, "Tst" );
+		}
+
+		CTaskGraph graph( g_pTestThreadPool );
+		memset( g_NestedItems, 0, sizeof( g_NestedItems ) );
+		for ( int iPass = 0; iPass < 100; iPass++ )
+		{
+			g_nTaskStep = 0;
+
+			CGraphTask *pA = graph.AddTask( "A", &TaskA );
+			CGraphTask *pB = graph.AddTask( "B", &TaskB );
+			CGraphTask *pC = graph.AddTask( "C", &TaskC );
+			CGraphTask *pD = graph.AddTask( "D", &TaskD );
+			graph.AddDependency( pB, pA );
+			graph.AddDependency( pC, pA );
+			graph.AddDependency( pD, pB );
+			graph.AddDependency( pD, pC );
+			graph.Launch();
+			graph.Wait();
+
+			if ( g_TaskSteps[0] != 0 || g_TaskSteps[3] != 3 || g_TaskSteps[1] + g_TaskSteps[2] != 3 )
+			{
+				Msg( "Task graph test failed, bad order with %d threads!\n", nThreads );
+				DebuggerBreakIfDebugging();
+			}
+			graph.Reset();
+		}
+
+		for ( int i = 0; i < (int)ARRAYSIZE( g_NestedItems[0] ); i++ )
+		{
+			if ( g_NestedItems[0][i] != 100 || g_NestedItems[1][i] != 100 )
+			{
+				Msg( "Task graph test failed, nested items not processed with %d threads!\n", nThreads );
+				DebuggerBreakIfDebugging();
+				break;
+			}
+		}
+
+		if ( nThreads )
+		{
+			g_pTestThreadPool->Stop();
+		}
+	}
+	Msg( "TestTaskGraph DONE\n" );
+}
+
+//-----------------------------------------------------------------------------
+// Scaling: jobs/sec as threads are added, with the leaf jobs queued either by
+// the main thread (shared queue) or fanned out by workers (worker deques)
+//-----------------------------------------------------------------------------
+
+CInterlockedInt g_nLeavesDone;
+int g_nLeavesTotal;
+CThreadEvent g_leavesDone;
+
+class CLeafJob : public CJob
+{
+public:
+	virtual JobStatus_t DoExecute()
+	{
+		float flSum = 0;
+		for ( int i = 0; i < m_nWork; i++ )
+		{
+			flSum += sqrt( (float)( i + 1 ) );
+		}
+		m_flResult = flSum;
+		if ( ++g_nLeavesDone == g_nLeavesTotal )
+		{
+			g_leavesDone.Set();
+		}
+		return 0;
+	}
+
+	int m_nWork;
+	volatile float m_flResult;
+};
+
+class CFanOutJob : public CJob
+{
+public:
+	virtual JobStatus_t DoExecute()
+	{
+		for ( int i = 0; i < m_nLeaves; i++ )
+		{
+			CLeafJob *pLeaf = new CLeafJob;
+			pLeaf->SetFlags( JF_QUEUE );
+			pLeaf->m_nWork = m_nWork;
+			g_pTestThreadPool->AddJob( pLeaf );
+			pLeaf->Release();
+		}
+		return 0;
+	}
+
+	int m_nLeaves;
+	int m_nWork;
+};
+
+float MeasureJobsPerSecond( int nThreads, bool bFanOut, int nWork )
+{
+	const int nFanOuts = 64;
+	const int nLeavesPerFanOut = 256;
+
+	ThreadPoolStartParams_t params;
+	params.nThreads = nThreads;
+	params.fDistribute = TRS_TRUE;
+	g_pTestThreadPool->Start( params, "Tst" );
+
+	g_nLeavesDone = 0;
+	g_nLeavesTotal = nFanOuts * nLeavesPerFanOut;
+	g_leavesDone.Reset();
+
+	CFastTimer timer;
+	timer.Start();
+	for ( int i = 0; i < nFanOuts; i++ )
+	{
+		if ( bFanOut )
+		{
+			CFanOutJob *pJob = new CFanOutJob;
+			pJob->SetFlags( JF_QUEUE );
+			pJob->m_nLeaves = nLeavesPerFanOut;
+			pJob->m_nWork = nWork;
+			g_pTestThreadPool->AddJob( pJob );
+			pJob->Release();
+		}
+		else
+		{
+			CFanOutJob fanOut;
+			fanOut.m_nLeaves = nLeavesPerFanOut;
+			fanOut.m_nWork = nWork;
+			fanOut.DoExecute();
+		}
+	}
+	g_leavesDone.Wait();
+	timer.End();
+
+	g_pTestThreadPool->Stop();
+
+	return (float)g_nLeavesTotal / timer.GetDuration().GetSeconds();
+}
+
+void TestScaling()
+{
+	int nMaxThreads = MIN( GetCPUInformation()->m_nLogicalProcessors, 16 );
+	static const int s_Work[] = { 16, 256, 4096 };
+
+	for ( int iWork = 0; iWork < (int)ARRAYSIZE( s_Work ); iWork++ )
+	{
+		Msg( "ThreadPoolTest: Scaling, %d units of work per job\n", s_Work[iWork] );
+		float flBase[2] = { 0, 0 };
+		for ( int nThreads = 1; nThreads <= nMaxThreads; nThreads = ( nThreads < 4 ) ? nThreads + 1 : nThreads * 2 )
+		{
+			float flRates[2];
+			for ( int bFanOut = 0; bFanOut < 2; bFanOut++ )
+			{
+				flRates[bFanOut] = MeasureJobsPerSecond( nThreads, ( bFanOut != 0 ), s_Work[iWork] );
+				if ( nThreads == 1 )
+				{
+					flBase[bFanOut] = flRates[bFanOut];
+				}
+			}
+			Msg( "ThreadPoolTest:     %2d threads -- shared %10.0f jobs/s (%.2fx), fan out %10.0f jobs/s (%.2fx)\n",
+				nThreads, flRates[0], flRates[0] / flBase[0], flRates[1], flRates[1] / flBase[1] );
+		}
+	}
+}
+
 } // namespace ThreadPoolTest
 
 void RunThreadPoolTests()
@@ -1438,4 +1955,12 @@ void RunThreadPoolTests()
 #endif
 
 	ThreadPoolTest::TestForcedExecute();
+	ThreadPoolTest::TestTaskGraph();
+}
+
+void RunThreadPoolScalingBenchmark()
+{
+	CThreadPool pool;
+	ThreadPoolTest::g_pTestThreadPool = &pool;
+	ThreadPoolTest::TestScaling();
 }